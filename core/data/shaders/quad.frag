@@ -6,8 +6,12 @@ in vec2 vUv;
 
 uniform sampler2D uTexture;
 
+// How much of the tile's texture is covered by the canvas (less than 1 at the
+// right and bottom edges).
+uniform vec2 uUvScale;
+
 void main()
 {
     // Note that gl loads textures upside down, so we flip the y coordinate.
-    outColor = texture(uTexture, vec2(vUv.x, 1.0-vUv.y));
+    outColor = texture(uTexture, vec2(vUv.x, 1.0-vUv.y) * uUvScale);
 }
@@ -5,8 +5,11 @@ in vec2 uv;
 
 out vec2 vUv;
 
+// The corners of the tile being drawn, in clip space (left, bottom, right, top).
+uniform vec4 uRect;
+
 void main()
 {
     vUv = uv;
-    gl_Position = vec4(position, 0.0, 1.0);
+    gl_Position = vec4(mix(uRect.xy, uRect.zw, position*0.5 + 0.5), 0.0, 1.0);
 }
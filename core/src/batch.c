@@ -0,0 +1,259 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "batch.h"
+
+#include "batch_scheduler.h"
+#include "filter_stream.h"
+#include "image_io.h"
+#include "recipe.h"
+
+#include <errno.h>  // errno, EEXIST
+#include <getopt.h>  // getopt_long
+#include <stdio.h>  // printf
+#include <stdlib.h>  // strtol, malloc, qsort, free
+#include <string.h>  // memset, strcmp
+#include <sys/stat.h>  // mkdir
+#include <unistd.h>  // sysconf
+
+
+
+//
+// HELPER methods
+//
+
+/* Prints how to use batch mode. */
+void batch_print_usage() {
+    printf("usage: tinypaint --batch (-r RECIPE | -f FILE) (-o OUTPUT | -d DIR) [options] INPUT...\n"
+        "\n"
+        "Applies a recipe of filters to every INPUT and writes the results, without\n"
+        "opening a window. A recipe is a list of filters separated by commas, each\n"
+        "followed by any of its params, e.g. \"gaussian:radius=8,sharpen:radius=2\".\n"
+        "\n"
+        "  -r, --recipe RECIPE      the filters to apply\n"
+        "  -f, --recipe-file FILE   read the recipe from FILE (one filter per line is fine)\n"
+        "  -o, --output PATH        where to write the result, for a single INPUT\n"
+        "  -d, --output-dir DIR     write each result into DIR, under the name of its INPUT\n"
+        "  -e, --format EXT         write png, tpaint, qoi, pam, ppm or bmp, whatever\n"
+        "                           the output names say\n"
+        "  -c, --compression N      png and .tpaint compression, 0 (none) to 9 (smallest)\n"
+        "      --fast               fast compression, same as -c %d\n"
+        "      --depth 8|16         bits per channel of png outputs\n"
+        "  -s, --stream             stream each image through in strips of rows instead\n"
+        "                           of loading it whole, for images larger than memory\n"
+        "      --strip N            rows per strip when streaming (default %d)\n"
+        "  -j, --jobs N             how many images to work on at once (default: one per\n"
+        "                           core, and any cores left over filter each image)\n"
+        "  -m, --memory MB          the most memory the images in flight may take up\n"
+        "                           (default: half of it). Images that would not fit\n"
+        "                           on their own are streamed\n"
+        "  -q, --quiet              only print errors\n"
+        "  -h, --help               print this and the filters a recipe can use\n",
+        IMAGE_COMPRESSION_FAST, FILTER_STREAM_STRIP_ROWS);
+}
+
+/* Prints how long each stage took, and how many images a second went through. */
+void batch_print_stats(BatchStats *stats, size_t memoryBudget) {
+    static const char *stageNames[NUM_BATCH_STAGES] = {"decode", "filter", "encode"};
+
+    // how busy each stage's threads were, out of the whole run
+    double available = stats->elapsed * stats->numJobs;
+    for (int stage = 0; stage < NUM_BATCH_STAGES; stage++) {
+        double seconds = stats->stageSeconds[stage];
+        printf("%s: %.2f s, %.3f s per image, %.0f%% busy\n", stageNames[stage], seconds,
+            stats->numInputs > 0 ? seconds / stats->numInputs : 0.0,
+            available > 0.0 ? 100.0 * seconds / available : 0.0);
+    }
+
+    printf("%d of %d images written in %.2f s (%.2f images/s), %d at a time with %d filter thread%s each\n",
+        stats->numWritten, stats->numInputs, stats->elapsed,
+        stats->elapsed > 0.0 ? stats->numWritten / stats->elapsed : 0.0,
+        stats->numJobs, stats->threadsPerJob, stats->threadsPerJob == 1 ? "" : "s");
+    printf("peak memory reserved %.1f of %.1f MB", stats->peakBytes / 1048576.0, memoryBudget / 1048576.0);
+    if (stats->numStreamed > 0) {
+        printf(", %d image%s streamed", stats->numStreamed, stats->numStreamed == 1 ? "" : "s");
+    }
+    printf("\n");
+}
+
+/* An input, and where its result is written. */
+typedef struct batchoutput {
+    const char *input;
+    char *output;
+} BatchOutput;
+
+/* Orders batchoutputs by where they are written. */
+int batch_compare_outputs(const void *a, const void *b) {
+    return strcmp(((const BatchOutput *)a)->output, ((const BatchOutput *)b)->output);
+}
+
+/* Returns false (and prints which) if two of the inputs would have their
+results written to the same path, as "-d" does with inputs of the same name
+from different directories (or the same input given twice). */
+int batch_check_outputs(BatchOptions *options, char **inputs, int numInputs) {
+    BatchOutput *outputs = malloc(sizeof(BatchOutput) * numInputs);
+    for (int i = 0; i < numInputs; i++) {
+        outputs[i].input = inputs[i];
+        outputs[i].output = batch_output_path(options, inputs[i]);
+    }
+
+    // sorted, any that collide are next to each other
+    qsort(outputs, numInputs, sizeof(BatchOutput), batch_compare_outputs);
+    int ok = 1;
+    for (int i = 1; i < numInputs; i++) {
+        if (strcmp(outputs[i - 1].output, outputs[i].output) == 0) {
+            printf("error: %s and %s would both be written to %s\n",
+                outputs[i - 1].input, outputs[i].input, outputs[i].output);
+            ok = 0;
+        }
+    }
+
+    for (int i = 0; i < numInputs; i++) {
+        free(outputs[i].output);
+    }
+    free(outputs);
+    return ok;
+}
+
+/* Parses a whole number from 'text' into 'value'. Returns false (and prints
+why) if it is not one, or is not from 'min' to 'max'. */
+int batch_parse_int(const char *text, const char *option, int min, int max, int *value) {
+    char *end;
+    long parsed = strtol(text, &end, 10);
+    if (*text == '\0' || *end != '\0' || parsed < min || parsed > max) {
+        printf("error: %s must be a whole number from %d to %d\n", option, min, max);
+        return 0;
+    }
+    *value = parsed;
+    return 1;
+}
+
+
+
+//
+// BATCH methods
+//
+
+int batch_main(int argc, char *argv[]) {
+    static const struct option longOptions[] = {
+        {"recipe", required_argument, NULL, 'r'},
+        {"recipe-file", required_argument, NULL, 'f'},
+        {"output", required_argument, NULL, 'o'},
+        {"output-dir", required_argument, NULL, 'd'},
+        {"format", required_argument, NULL, 'e'},
+        {"compression", required_argument, NULL, 'c'},
+        {"fast", no_argument, NULL, 'F'},
+        {"depth", required_argument, NULL, 'D'},
+        {"stream", no_argument, NULL, 's'},
+        {"strip", required_argument, NULL, 'S'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"memory", required_argument, NULL, 'm'},
+        {"quiet", no_argument, NULL, 'q'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    BatchOptions options;
+    memset(&options, 0, sizeof(options));
+    options.compressionLevel = IMAGE_COMPRESSION_DEFAULT;
+    options.bitDepth = IMAGE_DEPTH_8;
+
+    const char *recipeText = NULL;
+    const char *recipeFile = NULL;
+    int memoryMB = 0;
+    int option;
+    while ((option = getopt_long(argc, argv, "r:f:o:d:e:c:sj:m:qh", longOptions, NULL)) != -1) {
+        int ok = 1;
+        switch (option) {
+            case 'r': recipeText = optarg; break;
+            case 'f': recipeFile = optarg; break;
+            case 'o': options.output = optarg; break;
+            case 'd': options.outputDir = optarg; break;
+            case 'e': options.format = optarg[0] == '.' ? optarg + 1 : optarg; break;
+            case 'c': ok = batch_parse_int(optarg, "--compression", 0, 9, &options.compressionLevel); break;
+            case 'F': options.compressionLevel = IMAGE_COMPRESSION_FAST; break;
+            case 'D':
+                ok = batch_parse_int(optarg, "--depth", IMAGE_DEPTH_8, IMAGE_DEPTH_16, &options.bitDepth);
+                if (ok && options.bitDepth != IMAGE_DEPTH_8 && options.bitDepth != IMAGE_DEPTH_16) {
+                    printf("error: --depth must be 8 or 16\n");
+                    ok = 0;
+                }
+                break;
+            case 's': options.stream = 1; break;
+            case 'S': ok = batch_parse_int(optarg, "--strip", 1, 1 << 16, &options.stripRows); break;
+            case 'j': ok = batch_parse_int(optarg, "--jobs", 1, 1024, &options.numJobs); break;
+            case 'm': ok = batch_parse_int(optarg, "--memory", 1, 1 << 30, &memoryMB); break;
+            case 'q': options.quiet = 1; break;
+            case 'h':
+                batch_print_usage();
+                printf("\nfilters, with their params' defaults and ranges:\n");
+                recipe_print_help();
+                return 0;
+            default: ok = 0; break;
+        }
+        if (!ok) {
+            return 2;
+        }
+    }
+
+    // check the command line makes sense before touching any files
+    int numInputs = argc - optind;
+    const char *problem = NULL;
+    if ((recipeText == NULL) == (recipeFile == NULL)) {
+        problem = "give a recipe with either -r or -f";
+    }
+    else if ((options.output == NULL) == (options.outputDir == NULL)) {
+        problem = "give either -o or -d for where to write the results";
+    }
+    else if (numInputs == 0) {
+        problem = "no input images";
+    }
+    else if (options.output != NULL && numInputs > 1) {
+        problem = "-o can only be used with a single input, use -d for more";
+    }
+    else if (options.output != NULL && options.format != NULL) {
+        problem = "-e can only be used with -d, -o takes the format from its name";
+    }
+    if (problem != NULL) {
+        printf("error: %s (see --help)\n", problem);
+        return 2;
+    }
+    if (options.format != NULL) {
+        char probe[32];
+        snprintf(probe, sizeof(probe), "x.%s", options.format);
+        if (image_io_format_from_extension(probe) == IMAGE_FORMAT_UNKNOWN) {
+            printf("error: unknown format '%s'\n", options.format);
+            return 2;
+        }
+    }
+    if (!batch_check_outputs(&options, argv + optind, numInputs)) {
+        return 2;
+    }
+
+    int parsed = recipeText != NULL ? recipe_parse(recipeText, &options.recipe) : recipe_load(recipeFile, &options.recipe);
+    if (!parsed) {
+        return 2;
+    }
+    if (options.outputDir != NULL && mkdir(options.outputDir, 0777) != 0 && errno != EEXIST) {
+        printf("error: could not create %s\n", options.outputDir);
+        recipe_destroy(&options.recipe);
+        return 1;
+    }
+
+    // half of the memory there is, unless told otherwise
+    options.memoryBudget = (size_t)memoryMB << 20;
+    if (options.memoryBudget == 0) {
+        options.memoryBudget = (size_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE) / 2;
+    }
+
+    BatchStats stats;
+    int ok = batch_scheduler_run(&options, argv + optind, numInputs, &stats);
+    if (!options.quiet) {
+        batch_print_stats(&stats, options.memoryBudget);
+    }
+    recipe_destroy(&options.recipe);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,22 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef BATCH_H_
+#define BATCH_H_
+
+/* The first argument that puts tinypaint into batch mode instead of opening a window. */
+#define BATCH_FLAG "--batch"
+
+/* Runs "tinypaint --batch ...", which applies a recipe of filters (see
+recipe.h) to every input image and writes the results, then exits. 'argv'
+starts at BATCH_FLAG. Only the filter engine and the image codecs are used:
+gtk, the display and GL are never initialized, so it runs on machines
+without any. Returns the exit status: 0 if every image was written, 1 if any
+failed, 2 if the command line itself was wrong (including two inputs whose
+results would be written to the same path). */
+int batch_main(int argc, char *argv[]);
+
+#endif  // BATCH_H_
@@ -0,0 +1,444 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "batch_scheduler.h"
+
+#include "filter_stream.h"
+#include "image_io.h"
+#include "pixel_buffer.h"
+#include "png_io.h"
+
+#include <pthread.h>  // pthread
+#include <stdatomic.h>  // atomic_int
+#include <stdio.h>  // printf
+#include <stdlib.h>  // malloc, calloc, free
+#include <string.h>  // strdup, strrchr, strlen, strcat
+#include <time.h>  // clock_gettime
+#include <unistd.h>  // sysconf
+
+/* How many files may be in flight per job at once: one being decoded, one
+filtered and one encoded. */
+#define FILES_IN_FLIGHT_PER_JOB 3
+
+
+
+//
+// HELPER methods
+//
+
+/* One file of the batch, on its way through the stages. */
+typedef struct batchjob {
+    const char *input;
+    char *output;
+    int width;
+    int height;
+
+    // interlaced pngs are decoded whole first, however they are filtered
+    int interlaced;
+
+    // whether it is streamed through in strips (in the filter stage, which
+    // then does all of its work), and how much of the budget it holds
+    int streamed;
+    size_t reservedBytes;
+
+    PixelBuffer buffer;
+    int ok;
+    double seconds[NUM_BATCH_STAGES];
+} BatchJob;
+
+/* A first in, first out queue of jobs from one stage to the next. It has room
+for every job, so pushing never waits. */
+typedef struct batchqueue {
+    BatchJob **jobs;
+    int head;
+    int tail;
+
+    // how many threads of the stage before are still pushing jobs
+    int numProducers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} BatchQueue;
+
+/* The memory budget, and how much of it the files in flight have reserved. */
+typedef struct batchbudget {
+    size_t limit;
+    size_t used;
+    size_t peak;
+
+    // how many files are in flight, and how many may be at once
+    int numFiles;
+    int maxFiles;
+
+    pthread_mutex_t lock;
+    pthread_cond_t released;
+} BatchBudget;
+
+/* Everything the stage threads share. */
+typedef struct batchrun {
+    BatchOptions *options;
+    BatchJob *jobs;
+    int numFiles;
+    atomic_int nextFile;
+
+    BatchQueue filterQueue;
+    BatchQueue encodeQueue;
+    BatchBudget budget;
+} BatchRun;
+
+double batch_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+char* batch_output_path(BatchOptions *options, const char *input) {
+    if (options->output != NULL) {
+        return strdup(options->output);
+    }
+
+    const char *name = strrchr(input, '/');
+    name = name != NULL ? name + 1 : input;
+
+    // the name of the input, with the extension swapped if another format was asked for
+    size_t nameLength = strlen(name);
+    const char *dot = strrchr(name, '.');
+    if (options->format != NULL && dot != NULL && dot != name) {
+        nameLength = dot - name;
+    }
+
+    size_t length = strlen(options->outputDir) + 1 + nameLength + 1
+        + (options->format != NULL ? strlen(options->format) + 1 : 0);
+    char *path = malloc(length);
+    sprintf(path, "%s/%.*s", options->outputDir, (int)nameLength, name);
+    if (options->format != NULL) {
+        strcat(path, ".");
+        strcat(path, options->format);
+    }
+    return path;
+}
+
+/* Returns true if 'filepath' is an interlaced png. */
+int batch_is_interlaced_png(const char *filepath) {
+    if (image_io_detect_format(filepath) != IMAGE_FORMAT_PNG) {
+        return 0;
+    }
+    PngReader reader;
+    int interlaced = png_reader_open(&reader, filepath) && reader.interlaced;
+    png_reader_close(&reader);
+    return interlaced;
+}
+
+/* Returns the most memory 'job' takes up on its way through the stages when
+it is loaded whole. */
+size_t batch_estimate_bytes(BatchOptions *options, BatchJob *job) {
+    size_t pixels = (size_t)job->width * job->height;
+    size_t pixelBytes = sizeof(Color) + 4 * sizeof(float);
+
+    // the pixelbuffer, and the copy of it the convolution filters make
+    size_t bytes = pixels * pixelBytes;
+    for (int i = 0; i < options->recipe.numSteps; i++) {
+        if (filter_is_convolution(options->recipe.steps[i].type)) {
+            bytes += pixels * pixelBytes;
+            break;
+        }
+    }
+
+    // interlaced pngs are decoded whole first, at up to 16 bits per sample
+    if (job->interlaced) {
+        bytes += pixels * 8;
+    }
+
+    // and the png encoder holds every filtered sample, then every compressed one
+    ImageFormat format = image_io_format_from_extension(job->output);
+    if (format == IMAGE_FORMAT_PNG || format == IMAGE_FORMAT_UNKNOWN) {
+        bytes += 2 * pixels * 4 * (options->bitDepth / 8);
+    }
+    return bytes;
+}
+
+/* Reads the size of 'job' from its header and decides how it will be done.
+Returns false (and prints why) if it could not be read. */
+int batch_plan_job(BatchRun *run, BatchJob *job) {
+    BatchOptions *options = run->options;
+    if (!image_io_read_size(job->input, &job->width, &job->height)) {
+        printf("error: could not process %s\n", job->input);
+        return 0;
+    }
+
+    job->interlaced = batch_is_interlaced_png(job->input);
+
+    // streaming gives exactly the same pixels as loading the image whole
+    // (stream_test checks it), so it can be picked for any image too large.
+    // .tpaint can't be written a row at a time, so it is never streamed, and
+    // if it does not fit in the budget it waits to be done on its own
+    size_t wholeBytes = batch_estimate_bytes(options, job);
+    int canStream = image_io_format_from_extension(job->output) != IMAGE_FORMAT_TPAINT;
+    job->streamed = canStream && (options->stream || wholeBytes > run->budget.limit);
+    if (job->streamed) {
+        job->reservedBytes = filter_stream_estimate_bytes(job->width,
+            options->recipe.steps, options->recipe.numSteps, options->stripRows);
+
+        // an interlaced png is still decoded whole before its first row is handed on
+        if (job->interlaced) {
+            job->reservedBytes += (size_t)job->width * job->height * 8;
+        }
+    }
+    else {
+        job->reservedBytes = wholeBytes;
+    }
+    return 1;
+}
+
+
+
+//
+// QUEUE methods
+//
+
+void batch_queue_init(BatchQueue *self, int capacity, int numProducers) {
+    self->jobs = malloc(sizeof(BatchJob *) * capacity);
+    self->head = 0;
+    self->tail = 0;
+    self->numProducers = numProducers;
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_cond_init(&self->changed, NULL);
+}
+
+void batch_queue_push(BatchQueue *self, BatchJob *job) {
+    pthread_mutex_lock(&self->lock);
+    self->jobs[self->tail++] = job;
+    pthread_cond_signal(&self->changed);
+    pthread_mutex_unlock(&self->lock);
+}
+
+/* Called by each thread of the stage before once it has pushed its last job. */
+void batch_queue_producer_done(BatchQueue *self) {
+    pthread_mutex_lock(&self->lock);
+    self->numProducers--;
+    pthread_cond_broadcast(&self->changed);
+    pthread_mutex_unlock(&self->lock);
+}
+
+/* Waits for the next job, or returns NULL once there will be no more. */
+BatchJob* batch_queue_pop(BatchQueue *self) {
+    pthread_mutex_lock(&self->lock);
+    while (self->head == self->tail && self->numProducers > 0) {
+        pthread_cond_wait(&self->changed, &self->lock);
+    }
+    BatchJob *job = self->head < self->tail ? self->jobs[self->head++] : NULL;
+    pthread_mutex_unlock(&self->lock);
+    return job;
+}
+
+void batch_queue_destroy(BatchQueue *self) {
+    free(self->jobs);
+    pthread_mutex_destroy(&self->lock);
+    pthread_cond_destroy(&self->changed);
+}
+
+
+
+//
+// BUDGET methods
+//
+
+/* Waits until 'bytes' more fit in the budget (or nothing else is in flight,
+for a file too large to ever fit), then reserves them. */
+void batch_budget_reserve(BatchBudget *self, size_t bytes) {
+    pthread_mutex_lock(&self->lock);
+    while (self->numFiles > 0 && (self->used + bytes > self->limit || self->numFiles >= self->maxFiles)) {
+        pthread_cond_wait(&self->released, &self->lock);
+    }
+    self->used += bytes;
+    self->numFiles++;
+    self->peak = self->used > self->peak ? self->used : self->peak;
+    pthread_mutex_unlock(&self->lock);
+}
+
+void batch_budget_release(BatchBudget *self, size_t bytes) {
+    pthread_mutex_lock(&self->lock);
+    self->used -= bytes;
+    self->numFiles--;
+    pthread_cond_broadcast(&self->released);
+    pthread_mutex_unlock(&self->lock);
+}
+
+
+
+//
+// STAGE methods
+//
+
+/* Reports how 'job' went, and gives back its share of the budget. */
+void batch_finish_job(BatchRun *run, BatchJob *job) {
+    if (!job->ok) {
+        printf("error: could not process %s\n", job->input);
+    }
+    else if (!run->options->quiet && job->streamed) {
+        printf("%s -> %s (%d x %d, streamed in %.2f s)\n", job->input, job->output,
+            job->width, job->height, job->seconds[BATCH_FILTER]);
+    }
+    else if (!run->options->quiet) {
+        printf("%s -> %s (%d x %d, decode %.2f s, filter %.2f s, encode %.2f s)\n", job->input, job->output,
+            job->width, job->height, job->seconds[BATCH_DECODE], job->seconds[BATCH_FILTER], job->seconds[BATCH_ENCODE]);
+    }
+    batch_budget_release(&run->budget, job->reservedBytes);
+}
+
+/* Takes the next file not yet started, reserves what it needs from the
+budget, decodes it and hands it to the filter stage, until there are none
+left. Streamed files are handed on without being decoded. */
+void* batch_decode_worker(void *data) {
+    BatchRun *run = (BatchRun *)data;
+
+    int i;
+    while ((i = atomic_fetch_add(&run->nextFile, 1)) < run->numFiles) {
+        BatchJob *job = &run->jobs[i];
+        double start = batch_now();
+        if (!batch_plan_job(run, job)) {
+            continue;
+        }
+        double planned = batch_now() - start;
+
+        // time spent waiting for memory is not time spent decoding
+        batch_budget_reserve(&run->budget, job->reservedBytes);
+        start = batch_now();
+        job->ok = job->streamed || image_io_load(job->input, &job->buffer);
+        job->seconds[BATCH_DECODE] = planned + batch_now() - start;
+
+        if (!job->ok) {
+            batch_finish_job(run, job);
+            continue;
+        }
+        batch_queue_push(&run->filterQueue, job);
+    }
+
+    batch_queue_producer_done(&run->filterQueue);
+    return NULL;
+}
+
+/* Applies the recipe to each decoded file (or streams it through, start to
+finish) and hands it to the encode stage. */
+void* batch_filter_worker(void *data) {
+    BatchRun *run = (BatchRun *)data;
+    BatchOptions *options = run->options;
+
+    BatchJob *job;
+    while ((job = batch_queue_pop(&run->filterQueue)) != NULL) {
+        double start = batch_now();
+        if (job->streamed) {
+            job->ok = filter_stream_file(job->input, job->output, options->recipe.steps, options->recipe.numSteps,
+                options->stripRows, options->compressionLevel, options->bitDepth);
+        }
+        else {
+            recipe_apply_to_pixelbuffer(&options->recipe, &job->buffer);
+        }
+        job->seconds[BATCH_FILTER] = batch_now() - start;
+        batch_queue_push(&run->encodeQueue, job);
+    }
+
+    batch_queue_producer_done(&run->encodeQueue);
+    return NULL;
+}
+
+/* Saves each filtered file and frees its pixelbuffer. */
+void* batch_encode_worker(void *data) {
+    BatchRun *run = (BatchRun *)data;
+    BatchOptions *options = run->options;
+
+    BatchJob *job;
+    while ((job = batch_queue_pop(&run->encodeQueue)) != NULL) {
+        if (!job->streamed) {
+            double start = batch_now();
+            job->ok = image_io_save(&job->buffer, job->output, options->compressionLevel, options->bitDepth, NULL);
+            pixelbuffer_destroy(&job->buffer);
+            job->seconds[BATCH_ENCODE] = batch_now() - start;
+        }
+        batch_finish_job(run, job);
+    }
+    return NULL;
+}
+
+
+
+//
+// SCHEDULER methods
+//
+
+int batch_scheduler_run(BatchOptions *options, char **inputs, int numInputs, BatchStats *stats) {
+    memset(stats, 0, sizeof(BatchStats));
+    stats->numInputs = numInputs;
+    if (numInputs == 0) {
+        return 1;
+    }
+    double start = batch_now();
+
+    // several files at once first, since that scales better than splitting
+    // each one up, then whatever cores are left over for each file's filters
+    int numCores = sysconf(_SC_NPROCESSORS_ONLN);
+    numCores = numCores > 0 ? numCores : 1;
+    int numJobs = options->numJobs > 0 ? options->numJobs : numCores;
+    numJobs = numJobs < numInputs ? numJobs : numInputs;
+    int threadsPerJob = numCores / numJobs > 0 ? numCores / numJobs : 1;
+    int previousThreads = filter_get_num_threads();
+    filter_set_num_threads(threadsPerJob);
+
+    BatchRun run;
+    run.options = options;
+    run.numFiles = numInputs;
+    run.jobs = calloc(numInputs, sizeof(BatchJob));
+    for (int i = 0; i < numInputs; i++) {
+        run.jobs[i].input = inputs[i];
+        run.jobs[i].output = batch_output_path(options, inputs[i]);
+    }
+    atomic_init(&run.nextFile, 0);
+    batch_queue_init(&run.filterQueue, numInputs, numJobs);
+    batch_queue_init(&run.encodeQueue, numInputs, numJobs);
+
+    run.budget.limit = options->memoryBudget;
+    run.budget.used = 0;
+    run.budget.peak = 0;
+    run.budget.numFiles = 0;
+    run.budget.maxFiles = FILES_IN_FLIGHT_PER_JOB * numJobs;
+    pthread_mutex_init(&run.budget.lock, NULL);
+    pthread_cond_init(&run.budget.released, NULL);
+
+    // every stage gets a thread per job, and the calling thread just waits
+    void* (*workers[NUM_BATCH_STAGES])(void *) = {batch_decode_worker, batch_filter_worker, batch_encode_worker};
+    pthread_t *tids = malloc(sizeof(pthread_t) * NUM_BATCH_STAGES * numJobs);
+    for (int stage = 0; stage < NUM_BATCH_STAGES; stage++) {
+        for (int i = 0; i < numJobs; i++) {
+            pthread_create(&tids[stage * numJobs + i], NULL, workers[stage], (void *)(&run));
+        }
+    }
+    for (int i = 0; i < NUM_BATCH_STAGES * numJobs; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    free(tids);
+
+    for (int i = 0; i < numInputs; i++) {
+        BatchJob *job = &run.jobs[i];
+        stats->numWritten += job->ok;
+        stats->numStreamed += job->ok && job->streamed;
+        for (int stage = 0; stage < NUM_BATCH_STAGES; stage++) {
+            stats->stageSeconds[stage] += job->seconds[stage];
+        }
+        free(job->output);
+    }
+    stats->numJobs = numJobs;
+    stats->threadsPerJob = threadsPerJob;
+    stats->peakBytes = run.budget.peak;
+    stats->elapsed = batch_now() - start;
+
+    free(run.jobs);
+    batch_queue_destroy(&run.filterQueue);
+    batch_queue_destroy(&run.encodeQueue);
+    pthread_mutex_destroy(&run.budget.lock);
+    pthread_cond_destroy(&run.budget.released);
+    filter_set_num_threads(previousThreads);
+    return stats->numWritten == numInputs;
+}
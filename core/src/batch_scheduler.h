@@ -0,0 +1,87 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef BATCH_SCHEDULER_H_
+#define BATCH_SCHEDULER_H_
+
+#include "recipe.h"  // Recipe
+
+#include <stddef.h>  // size_t
+
+/* What to do with every file of a batch. */
+typedef struct batchoptions {
+    Recipe recipe;
+
+    // where the results go: 'output' for a single file, or into 'outputDir'
+    // under each input's name, with its extension swapped for 'format' (if not NULL)
+    const char *output;
+    const char *outputDir;
+    const char *format;
+
+    int compressionLevel;
+    int bitDepth;
+
+    // whether every file is streamed through in strips (see filter_stream.h)
+    // rather than only those too large for the memory budget
+    int stream;
+    int stripRows;
+    int quiet;
+
+    // how many files are worked on at once, or 0 to choose from the number of
+    // cores and files. The cores left over go to the filters of each file.
+    int numJobs;
+
+    // the most memory the files in flight may take up between them
+    size_t memoryBudget;
+} BatchOptions;
+
+/* The stages every file goes through, each on its own threads. */
+typedef enum batchstage {
+    BATCH_DECODE,
+    BATCH_FILTER,
+    BATCH_ENCODE,
+    NUM_BATCH_STAGES
+} BatchStage;
+
+/* What a batch did and how long it took. */
+typedef struct batchstats {
+    int numInputs;
+    int numWritten;
+    int numStreamed;
+
+    // how many files were worked on at once, and how many threads each one's filters had
+    int numJobs;
+    int threadsPerJob;
+
+    // the time each stage spent working, summed over every file, and the time
+    // the whole batch took
+    double stageSeconds[NUM_BATCH_STAGES];
+    double elapsed;
+
+    // the most memory the files in flight had reserved at once
+    size_t peakBytes;
+} BatchStats;
+
+/* Returns the time in seconds, from an arbitrary point. */
+double batch_now();
+
+/* Returns (in a new string) where the result for 'input' is written. */
+char* batch_output_path(BatchOptions *options, const char *input);
+
+/* Applies the recipe to every input and writes the results, several files at
+a time. Each file is decoded, filtered and encoded by a separate stage, so the
+next file is decoded while one is filtered and the one before is encoded.
+
+Before a file is decoded, the memory it will need (its pixelbuffer, the copy
+the convolution filters make of it, and its encoder's buffers) is worked out
+from its header and reserved from options->memoryBudget, and it waits until
+that much is free. Files that would not fit in the budget on their own are
+streamed through in strips instead. Prints a line for every file unless
+options->quiet, and an error for every file that fails. Returns true if
+every file was written. */
+int batch_scheduler_run(BatchOptions *options, char **inputs, int numInputs, BatchStats *stats);
+
+#endif  // BATCH_SCHEDULER_H_
@@ -0,0 +1,376 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "bmp_io.h"
+
+#include "render_buffer.h"  // convert_floats_to_unorm8
+
+#include <stdint.h>  // uint32_t, uint64_t
+#include <stdlib.h>  // malloc, calloc, free
+#include <string.h>  // memcpy, memset, strdup
+
+/* The sizes of the file header and of the info header .bmps are written with. */
+#define BMP_FILE_HEADER_SIZE 14
+#define BMP_V4_HEADER_SIZE 108
+
+/* The only info header bmp_load() does not read is the 12 byte one from OS/2. */
+#define BMP_MIN_INFO_HEADER_SIZE 40
+
+/* How the pixels are stored. Everything else is some kind of compression. */
+#define BMP_RGB 0
+#define BMP_BITFIELDS 3
+#define BMP_ALPHABITFIELDS 6
+
+/* The color space written .bmps are tagged with ('sRGB'). */
+#define BMP_SRGB 0x73524742
+
+
+
+//
+// HELPER methods
+//
+
+/* Where one channel sits within a 16 or 32-bit pixel. */
+typedef struct bmpchannel {
+    uint32_t mask;
+    int shift;
+    uint32_t max;
+} BmpChannel;
+
+/* Reads 2 or 4 little endian bytes from 'src'. */
+uint32_t bmp_io_get_uint16(const unsigned char *src) {
+    return src[0] | (src[1] << 8);
+}
+
+uint32_t bmp_io_get_uint32(const unsigned char *src) {
+    return src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+/* Stores 'value' as 2 or 4 little endian bytes at 'dst'. */
+void bmp_io_put_uint16(unsigned char *dst, uint32_t value) {
+    dst[0] = value;
+    dst[1] = value >> 8;
+}
+
+void bmp_io_put_uint32(unsigned char *dst, uint32_t value) {
+    dst[0] = value;
+    dst[1] = value >> 8;
+    dst[2] = value >> 16;
+    dst[3] = value >> 24;
+}
+
+/* Returns the channel picked out of a pixel by 'mask'. */
+BmpChannel bmp_io_channel(uint32_t mask) {
+    BmpChannel tmp = {mask, 0, 0};
+    if (mask != 0) {
+        while (((mask >> tmp.shift) & 1) == 0) {
+            tmp.shift++;
+        }
+        tmp.max = mask >> tmp.shift;
+    }
+    return tmp;
+}
+
+/* Returns the channel of 'pixel' scaled to 0 - 255, or 'fallback' if there is
+no such channel. */
+unsigned char bmp_io_extract(BmpChannel channel, uint32_t pixel, unsigned char fallback) {
+    if (channel.max == 0) {
+        return fallback;
+    }
+    uint64_t value = (pixel & channel.mask) >> channel.shift;
+    return channel.max == 255 ? value : (value * 255 + channel.max / 2) / channel.max;
+}
+
+
+/* Fills in the file and info headers of a 32-bit .bmp, with its rows stored
+from the top down if 'topDown', otherwise from the bottom up. Returns false
+(and prints why) if the image is too large for a .bmp. */
+int bmp_io_fill_header(unsigned char *header, int width, int height, int topDown) {
+    // every size in the headers is 32 bits
+    uint64_t imageSize = 4 * (uint64_t)width * height;
+    uint64_t fileSize = BMP_FILE_HEADER_SIZE + BMP_V4_HEADER_SIZE + imageSize;
+    if (fileSize > UINT32_MAX) {
+        printf("error: the image is too large to save as a .bmp\n");
+        return 0;
+    }
+
+    memset(header, 0, BMP_FILE_HEADER_SIZE + BMP_V4_HEADER_SIZE);
+    header[0] = 'B';
+    header[1] = 'M';
+    bmp_io_put_uint32(header + 2, fileSize);
+    bmp_io_put_uint32(header + 10, BMP_FILE_HEADER_SIZE + BMP_V4_HEADER_SIZE);
+
+    // 32 bits per pixel, stored as blue, green, red, alpha, at 72 dpi. A
+    // negative height is how a top-down .bmp is marked.
+    unsigned char *info = header + BMP_FILE_HEADER_SIZE;
+    bmp_io_put_uint32(info + 0, BMP_V4_HEADER_SIZE);
+    bmp_io_put_uint32(info + 4, width);
+    bmp_io_put_uint32(info + 8, topDown ? (uint32_t)-height : (uint32_t)height);
+    bmp_io_put_uint16(info + 12, 1);
+    bmp_io_put_uint16(info + 14, 32);
+    bmp_io_put_uint32(info + 16, BMP_BITFIELDS);
+    bmp_io_put_uint32(info + 20, imageSize);
+    bmp_io_put_uint32(info + 24, 2835);
+    bmp_io_put_uint32(info + 28, 2835);
+    bmp_io_put_uint32(info + 40, 0x00ff0000);
+    bmp_io_put_uint32(info + 44, 0x0000ff00);
+    bmp_io_put_uint32(info + 48, 0x000000ff);
+    bmp_io_put_uint32(info + 52, 0xff000000);
+    bmp_io_put_uint32(info + 56, BMP_SRGB);
+    return 1;
+}
+
+/* Converts a row of 'width' float rgba pixels to 8-bit bgra. */
+void bmp_io_convert_row(unsigned char *dst, const float *src, int width) {
+    convert_floats_to_unorm8(dst, src, 4 * width);
+    for (int x = 0; x < width; x++) {
+        unsigned char red = dst[4*x];
+        dst[4*x] = dst[4*x + 2];
+        dst[4*x + 2] = red;
+    }
+}
+
+
+//
+// BMP methods
+//
+
+int bmp_load_rows(const char *filepath, ImageRowSink *sink) {
+    MappedFile file;
+    if (!image_io_map_file(filepath, &file)) {
+        return 0;
+    }
+
+    const unsigned char *data = file.data;
+    size_t size = file.size;
+    const char *problem = NULL;
+
+    uint32_t pixelOffset = 0, headerSize = 0, compression = 0, numColors = 0;
+    int32_t width = 0, height = 0;
+    int bpp = 0;
+    if (size < BMP_FILE_HEADER_SIZE + BMP_MIN_INFO_HEADER_SIZE || data[0] != 'B' || data[1] != 'M') {
+        problem = "is not a valid .bmp file";
+    }
+    else {
+        pixelOffset = bmp_io_get_uint32(data + 10);
+        headerSize = bmp_io_get_uint32(data + 14);
+        width = bmp_io_get_uint32(data + 18);
+        height = bmp_io_get_uint32(data + 22);
+        bpp = bmp_io_get_uint16(data + 28);
+        compression = bmp_io_get_uint32(data + 30);
+        numColors = bmp_io_get_uint32(data + 46);
+
+        if (headerSize < BMP_MIN_INFO_HEADER_SIZE || headerSize > size - BMP_FILE_HEADER_SIZE) {
+            problem = "has an unsupported header";
+        }
+        else if (compression != BMP_RGB && compression != BMP_BITFIELDS && compression != BMP_ALPHABITFIELDS) {
+            problem = "is compressed, which is not supported";
+        }
+        else if (bpp != 1 && bpp != 4 && bpp != 8 && bpp != 16 && bpp != 24 && bpp != 32) {
+            problem = "has an unsupported bit depth";
+        }
+        else if (compression != BMP_RGB && bpp != 16 && bpp != 32) {
+            problem = "is not a valid .bmp file";
+        }
+        else if (width <= 0 || height == 0 || height == INT32_MIN) {
+            problem = "is not a valid .bmp file";
+        }
+    }
+
+    // a negative height means the rows are stored top to bottom
+    int topDown = height < 0;
+    height = topDown ? -height : height;
+    uint64_t stride = (((uint64_t)bpp * width + 31) / 32) * 4;
+    if (problem == NULL && (pixelOffset > size || stride * height > size - pixelOffset)) {
+        problem = "is truncated";
+    }
+
+    // the masks follow the 40 byte header, whether they are part of a larger header or not
+    BmpChannel channels[4];
+    if (problem == NULL && compression != BMP_RGB) {
+        int hasAlphaMask = headerSize >= 56 || compression == BMP_ALPHABITFIELDS;
+        if (BMP_FILE_HEADER_SIZE + 40 + (hasAlphaMask ? 16 : 12) > size) {
+            problem = "is truncated";
+        }
+        else {
+            for (int c = 0; c < 4; c++) {
+                channels[c] = bmp_io_channel(c < 3 || hasAlphaMask ? bmp_io_get_uint32(data + 54 + 4*c) : 0);
+            }
+        }
+    }
+    else if (problem == NULL) {
+        channels[0] = bmp_io_channel(bpp == 16 ? 0x7c00 : 0xff0000);
+        channels[1] = bmp_io_channel(bpp == 16 ? 0x03e0 : 0x00ff00);
+        channels[2] = bmp_io_channel(bpp == 16 ? 0x001f : 0x0000ff);
+        channels[3] = bmp_io_channel(0);
+    }
+
+    // palette entries are blue, green, red and one unused byte. Missing ones stay black.
+    unsigned char palette[256][4];
+    memset(palette, 0, sizeof(palette));
+    if (problem == NULL && bpp <= 8) {
+        uint32_t maxColors = 1u << bpp;
+        numColors = numColors == 0 || numColors > maxColors ? maxColors : numColors;
+        size_t paletteOffset = BMP_FILE_HEADER_SIZE + headerSize;
+        if (paletteOffset + 4 * (size_t)numColors > size) {
+            problem = "is truncated";
+        }
+        else {
+            memcpy(palette, data + paletteOffset, 4 * (size_t)numColors);
+        }
+    }
+
+    if (problem != NULL) {
+        printf("error: %s %s\n", filepath, problem);
+        image_io_unmap_file(&file);
+        return 0;
+    }
+
+    if (!sink->begin(sink->data, width, height)) {
+        image_io_unmap_file(&file);
+        return 0;
+    }
+
+    int ok = 1;
+    unsigned char *row = malloc(4 * (size_t)width);
+    for (int y = 0; y < height && ok; y++) {
+        const unsigned char *src = data + pixelOffset + stride * (topDown ? y : height - 1 - y);
+
+        for (int x = 0; x < width; x++) {
+            unsigned char *dst = row + 4*x;
+            if (bpp <= 8) {
+                int bit = x * bpp;
+                int index = (src[bit / 8] >> (8 - bpp - bit % 8)) & ((1 << bpp) - 1);
+                dst[0] = palette[index][2];
+                dst[1] = palette[index][1];
+                dst[2] = palette[index][0];
+                dst[3] = 255;
+            }
+            else if (bpp == 24) {
+                dst[0] = src[3*x + 2];
+                dst[1] = src[3*x + 1];
+                dst[2] = src[3*x + 0];
+                dst[3] = 255;
+            }
+            else {
+                uint32_t pixel = bpp == 16 ? bmp_io_get_uint16(src + 2*x) : bmp_io_get_uint32(src + 4*x);
+                dst[0] = bmp_io_extract(channels[0], pixel, 0);
+                dst[1] = bmp_io_extract(channels[1], pixel, 0);
+                dst[2] = bmp_io_extract(channels[2], pixel, 0);
+                dst[3] = bmp_io_extract(channels[3], pixel, 255);
+            }
+        }
+        ok = sink->row(sink->data, y, row, IMAGE_ROW_UNORM8);
+    }
+
+    free(row);
+    image_io_unmap_file(&file);
+    return ok;
+}
+
+int bmp_load(const char *filepath, PixelBuffer *out) {
+    ImageRowSink sink = image_io_pixelbuffer_sink(out);
+    return bmp_load_rows(filepath, &sink);
+}
+
+int bmp_save(PixelBuffer *source, const char *filepath, SaveProgress *progress) {
+    int width = source->width;
+    int height = source->height;
+    if (progress != NULL) {
+        atomic_store(&progress->total, height);
+    }
+
+    unsigned char header[BMP_FILE_HEADER_SIZE + BMP_V4_HEADER_SIZE];
+    if (!bmp_io_fill_header(header, width, height, 0)) {
+        return 0;
+    }
+
+    char *tmpPath;
+    FILE *file = image_io_open_temp(filepath, &tmpPath);
+    if (file == NULL) {
+        return 0;
+    }
+    fwrite(header, 1, sizeof(header), file);
+
+    // rows go from the bottom up, which every reader understands
+    unsigned char *row = malloc(4 * (size_t)width);
+    int ok = 1;
+    for (int y = height - 1; y >= 0 && ok; y--) {
+        bmp_io_convert_row(row, source->rgbadata + 4 * (size_t)y * width, width);
+        fwrite(row, 4, width, file);
+
+        save_progress_report(progress, 1);
+        ok = !save_progress_is_cancelled(progress);
+    }
+
+    free(row);
+    return image_io_close_temp(file, tmpPath, filepath, ok);
+}
+
+/* Everything a .bmp row writer needs between rows. */
+typedef struct bmpwriter {
+    FILE *file;
+    char *tmpPath;
+    char *filepath;
+    int width;
+    int height;
+    int rowsWritten;
+    unsigned char *row;
+} BmpWriter;
+
+/* Converts and writes the next row. */
+int bmp_writer_row(void *data, const float *rgba) {
+    BmpWriter *self = (BmpWriter *)data;
+    if (self->rowsWritten == self->height) {
+        printf("error: too many rows for %s\n", self->filepath);
+        return 0;
+    }
+    bmp_io_convert_row(self->row, rgba, self->width);
+    self->rowsWritten++;
+    return fwrite(self->row, 4, self->width, self->file) == (size_t)self->width;
+}
+
+/* Moves the file into place, if every row made it. */
+int bmp_writer_finish(void *data, int ok) {
+    BmpWriter *self = (BmpWriter *)data;
+    if (ok && self->rowsWritten != self->height) {
+        printf("error: only %d of %d rows were written to %s\n", self->rowsWritten, self->height, self->filepath);
+        ok = 0;
+    }
+
+    ok = image_io_close_temp(self->file, self->tmpPath, self->filepath, ok);
+    free(self->filepath);
+    free(self->row);
+    free(self);
+    return ok;
+}
+
+int bmp_open_writer(const char *filepath, int width, int height, ImageRowWriter *out) {
+    unsigned char header[BMP_FILE_HEADER_SIZE + BMP_V4_HEADER_SIZE];
+    if (!bmp_io_fill_header(header, width, height, 1)) {
+        return 0;
+    }
+
+    char *tmpPath;
+    FILE *file = image_io_open_temp(filepath, &tmpPath);
+    if (file == NULL) {
+        return 0;
+    }
+    fwrite(header, 1, sizeof(header), file);
+
+    BmpWriter *self = calloc(1, sizeof(BmpWriter));
+    self->file = file;
+    self->tmpPath = tmpPath;
+    self->filepath = strdup(filepath);
+    self->width = width;
+    self->height = height;
+    self->row = malloc(4 * (size_t)width);
+
+    out->row = bmp_writer_row;
+    out->finish = bmp_writer_finish;
+    out->data = self;
+    return 1;
+}
@@ -0,0 +1,37 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef BMP_IO_H_
+#define BMP_IO_H_
+
+#include "image_io.h"  // SaveProgress
+#include "pixel_buffer.h"  // PixelBuffer
+
+/* Decodes the uncompressed .bmp at 'filepath' into 'sink', one row at a time
+from the top, converting its pixels straight out of the memory mapped file
+(see image_io_load_rows()). 1, 4 and 8-bit palettes, 16 and 32-bit pixels with
+or without bitfields, and 24-bit pixels are all read, top-down or bottom-up.
+Run-length encoded .bmps are not. */
+int bmp_load_rows(const char *filepath, ImageRowSink *sink);
+
+/* Loads the .bmp at 'filepath' into a new pixelbuffer at 'out', with a white
+background. Returns false (and prints why, leaving 'out' alone) if it is not a
+readable .bmp. */
+int bmp_load(const char *filepath, PixelBuffer *out);
+
+/* Writes 'source' to 'filepath' as a 32-bit bottom-up .bmp, with a
+BITMAPV4HEADER so that readers keep its alpha. Only the float copy of the
+pixels (rgbadata) is read. 'progress' may be NULL. Returns false (and prints
+why) if the file could not be written, or if the save was cancelled, in which
+case the file is left as it was. */
+int bmp_save(PixelBuffer *source, const char *filepath, SaveProgress *progress);
+
+/* Starts writing a width x height 32-bit .bmp to 'filepath' one row at a time
+(see image_io_open_writer()). Since the rows arrive from the top, the .bmp is
+stored top-down (with a negative height), unlike bmp_save()'s. */
+int bmp_open_writer(const char *filepath, int width, int height, ImageRowWriter *out);
+
+#endif  // BMP_IO_H_
@@ -0,0 +1,339 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "canvas_program.h"
+
+#include <string.h>  // memcpy, strcmp
+
+/* How many share groups can hold the program at once. Each window without a
+shared context is its own group. */
+#define MAX_SHARED_PROGRAMS 64
+
+
+
+//
+// STATE
+//
+
+/* A program, and the context (or shared context) whose share group it lives in. */
+typedef struct sharedprogram {
+    GdkGLContext *group;
+    GLuint program;
+    int refs;
+} SharedProgram;
+
+/* The linked programs currently in use. Only touched from the gui thread. */
+static SharedProgram s_programs[MAX_SHARED_PROGRAMS];
+static int s_numPrograms = 0;
+
+/* The last program binary seen, and the renderer it is valid for. */
+static char *s_binaryKey = NULL;
+static GLenum s_binaryFormat = 0;
+static void *s_binary = NULL;
+static gsize s_binaryLength = 0;
+
+
+
+//
+// HELPER methods
+//
+
+/* Returns the contents of a shader in the gresource bundle, null terminated.
+Free with g_bytes_unref(). */
+GBytes* canvas_program_load_source(const char *path) {
+    GError *error = NULL;
+    GBytes *bytes = g_resources_lookup_data(path, G_RESOURCE_LOOKUP_FLAGS_NONE, &error);
+    if (bytes == NULL) {
+        printf("ERROR: could not load shader %s: %s\n", path, error->message);
+        g_error_free(error);
+    }
+    return bytes;
+}
+
+/* Returns the path of the program binary cache file. The name depends on the
+shader sources, so editing them never picks up a stale binary. */
+char* canvas_program_get_cache_path() {
+    GBytes *vert = canvas_program_load_source(CANVAS_VERTEX_SHADER_RESOURCE);
+    GBytes *frag = canvas_program_load_source(CANVAS_FRAGMENT_SHADER_RESOURCE);
+    if (vert == NULL || frag == NULL) {
+        if (vert != NULL) g_bytes_unref(vert);
+        if (frag != NULL) g_bytes_unref(frag);
+        return NULL;
+    }
+
+    GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA1);
+    gsize length;
+    const guchar *data = g_bytes_get_data(vert, &length);
+    g_checksum_update(checksum, data, length);
+    data = g_bytes_get_data(frag, &length);
+    g_checksum_update(checksum, data, length);
+
+    char *name = g_strdup_printf("canvas-%s.bin", g_checksum_get_string(checksum));
+    char *path = g_build_filename(g_get_user_cache_dir(), "tinypaint", name, NULL);
+
+    g_free(name);
+    g_checksum_free(checksum);
+    g_bytes_unref(vert);
+    g_bytes_unref(frag);
+    return path;
+}
+
+/* Returns a string identifying the driver of the current context. Binaries are
+only valid for the driver that produced them. */
+char* canvas_program_get_driver_key() {
+    return g_strdup_printf("%s|%s|%s", (const char *)glGetString(GL_VENDOR),
+        (const char *)glGetString(GL_RENDERER), (const char *)glGetString(GL_VERSION));
+}
+
+/* Replaces the in-memory binary. Takes ownership of 'key' and 'binary'. */
+void canvas_program_set_binary(char *key, GLenum format, void *binary, gsize length) {
+    g_free(s_binaryKey);
+    g_free(s_binary);
+    s_binaryKey = key;
+    s_binaryFormat = format;
+    s_binary = binary;
+    s_binaryLength = length;
+}
+
+/* Returns true if the current context can load and save program binaries. */
+int canvas_program_supports_binaries() {
+    GLint numFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    return numFormats > 0;
+}
+
+/* Tries to create the program from the in-memory binary. Returns 0 if there
+is none, it is for another driver, or the driver rejects it. */
+GLuint canvas_program_load_binary(const char *driverKey) {
+    if (s_binary == NULL || strcmp(s_binaryKey, driverKey) != 0) {
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, s_binaryFormat, s_binary, (GLsizei)s_binaryLength);
+
+    GLint status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+        // usually a driver update, so it just needs recompiling
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+/* Compiles the shader in 'shaderSource' and returns a GL handle to it, or -1
+(after printing the log) if it does not compile. */
+// Source:
+// http://schabby.de/shader-loading/
+int canvas_program_compile_shader(char* shaderSource, int shaderType) {
+	// handle will be non-zero if succefully created.
+	int handle = glCreateShader(shaderType);
+
+    // upload code to OpenGL and associate code with shader
+    const GLchar* shader_ptr = shaderSource;
+    glShaderSource(handle, 1, &shader_ptr, NULL);
+
+	// compile source code into binary
+	glCompileShader(handle);
+
+	// acquire compilation status
+	int shaderStatus = 0;
+    glGetShaderiv(handle, GL_COMPILE_STATUS, &shaderStatus);
+
+	// check whether compilation was successful
+	if(shaderStatus == GL_FALSE) {
+        char msg[512];
+        glGetShaderInfoLog(handle, 512, NULL, msg);
+        printf("%s\n", msg);
+        glDeleteShader(handle);
+        return -1;
+	}
+
+    printf("Compiled shader.\n");
+	return handle;
+}
+
+/* Compiles and links the program from the shader sources in the bundle.
+Returns 0 (after printing why) if either shader does not compile, or the
+program does not link. */
+GLuint canvas_program_compile() {
+    GBytes *vertBytes = canvas_program_load_source(CANVAS_VERTEX_SHADER_RESOURCE);
+    GBytes *fragBytes = canvas_program_load_source(CANVAS_FRAGMENT_SHADER_RESOURCE);
+    if (vertBytes == NULL || fragBytes == NULL) {
+        if (vertBytes != NULL) g_bytes_unref(vertBytes);
+        if (fragBytes != NULL) g_bytes_unref(fragBytes);
+        return 0;
+    }
+
+    // resources are always null terminated
+    int vertShader = canvas_program_compile_shader((char *)g_bytes_get_data(vertBytes, NULL), GL_VERTEX_SHADER);
+    int fragShader = canvas_program_compile_shader((char *)g_bytes_get_data(fragBytes, NULL), GL_FRAGMENT_SHADER);
+    g_bytes_unref(vertBytes);
+    g_bytes_unref(fragBytes);
+    if (vertShader == -1 || fragShader == -1) {
+        if (vertShader != -1) glDeleteShader(vertShader);
+        if (fragShader != -1) glDeleteShader(fragShader);
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertShader);
+    glAttachShader(program, fragShader);
+
+    // Specify the location of the output color.
+    glBindFragDataLocation(program, 0, "outColor");
+
+    // Ask for a binary to be kept, then link.
+    if (canvas_program_supports_binaries()) {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glLinkProgram(program);
+
+    // The shaders are not needed once linked.
+    glDetachShader(program, vertShader);
+    glDetachShader(program, fragShader);
+    glDeleteShader(vertShader);
+    glDeleteShader(fragShader);
+
+    GLint status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+        char msg[512];
+        glGetProgramInfoLog(program, 512, NULL, msg);
+        printf("error: could not link the canvas program: %s\n", msg);
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+/* Keeps the binary of a freshly linked program in memory and on disk. */
+void canvas_program_save_binary(GLuint program, char *driverKey) {
+    if (!canvas_program_supports_binaries()) {
+        g_free(driverKey);
+        return;
+    }
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        g_free(driverKey);
+        return;
+    }
+
+    GLenum format = 0;
+    void *binary = g_malloc(length);
+    glGetProgramBinary(program, length, NULL, &format, binary);
+    canvas_program_set_binary(driverKey, format, binary, length);
+
+    // on disk: the driver key (null terminated), the format, then the binary
+    char *path = canvas_program_get_cache_path();
+    if (path == NULL) {
+        return;
+    }
+
+    gsize keyLength = strlen(driverKey) + 1;
+    guint32 format32 = format;
+    gsize fileLength = keyLength + sizeof(format32) + length;
+    char *contents = g_malloc(fileLength);
+    memcpy(contents, driverKey, keyLength);
+    memcpy(contents + keyLength, &format32, sizeof(format32));
+    memcpy(contents + keyLength + sizeof(format32), binary, length);
+
+    // a failure here only costs a compile next time
+    char *dir = g_path_get_dirname(path);
+    g_mkdir_with_parents(dir, 0755);
+    g_file_set_contents(path, contents, fileLength, NULL);
+
+    g_free(dir);
+    g_free(contents);
+    g_free(path);
+}
+
+
+
+//
+// CANVAS PROGRAM methods
+//
+
+void canvas_program_preload() {
+    char *path = canvas_program_get_cache_path();
+    if (path == NULL) {
+        return;
+    }
+
+    char *contents = NULL;
+    gsize length = 0;
+    if (g_file_get_contents(path, &contents, &length, NULL)) {
+        // the key must be terminated inside the file, and be followed by a format
+        const char *end = memchr(contents, '\0', length);
+        gsize keyLength = end != NULL ? (gsize)(end - contents) + 1 : length;
+        if (end != NULL && keyLength + sizeof(guint32) < length) {
+            guint32 format32;
+            memcpy(&format32, contents + keyLength, sizeof(format32));
+            gsize binaryLength = length - keyLength - sizeof(format32);
+            canvas_program_set_binary(g_strdup(contents), format32,
+                g_memdup(contents + keyLength + sizeof(format32), binaryLength), binaryLength);
+        }
+        g_free(contents);
+    }
+
+    g_free(path);
+}
+
+GLuint canvas_program_acquire(GdkGLContext *context) {
+    // contexts created sharing another one can use its objects too
+    GdkGLContext *group = gdk_gl_context_get_shared_context(context);
+    group = group != NULL ? group : context;
+
+    for (int i = 0; i < s_numPrograms; i++) {
+        if (s_programs[i].group == group) {
+            s_programs[i].refs++;
+            return s_programs[i].program;
+        }
+    }
+
+    char *driverKey = canvas_program_get_driver_key();
+    GLuint program = canvas_program_load_binary(driverKey);
+    if (program != 0) {
+        g_free(driverKey);
+    }
+    else {
+        program = canvas_program_compile();
+        if (program == 0) {
+            // nothing to cache or share, so the next window tries again
+            g_free(driverKey);
+            return 0;
+        }
+        canvas_program_save_binary(program, driverKey);
+    }
+
+    if (s_numPrograms < MAX_SHARED_PROGRAMS) {
+        SharedProgram shared = {group, program, 1};
+        s_programs[s_numPrograms++] = shared;
+    }
+    return program;
+}
+
+void canvas_program_release(GdkGLContext *context, GLuint program) {
+    GdkGLContext *group = gdk_gl_context_get_shared_context(context);
+    group = group != NULL ? group : context;
+
+    for (int i = 0; i < s_numPrograms; i++) {
+        if (s_programs[i].group == group && s_programs[i].program == program) {
+            if (--s_programs[i].refs == 0) {
+                glDeleteProgram(program);
+                s_programs[i] = s_programs[--s_numPrograms];
+            }
+            return;
+        }
+    }
+
+    // it never made it into the table
+    glDeleteProgram(program);
+}
@@ -0,0 +1,43 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef CANVAS_PROGRAM_H_
+#define CANVAS_PROGRAM_H_
+
+#include <gtk/gtk.h>  // GdkGLContext
+
+// needed for the program binary prototypes
+#ifndef GL_GLEXT_PROTOTYPES
+#define GL_GLEXT_PROTOTYPES
+#endif
+
+#if defined(__APPLE__)
+#include <OpenGL/gl.h>
+#else
+#include <GL/gl.h>
+#endif
+
+/* Where the canvas shaders live in the gresource bundle. */
+#define CANVAS_VERTEX_SHADER_RESOURCE "/tinypaint/shaders/quad.vert"
+#define CANVAS_FRAGMENT_SHADER_RESOURCE "/tinypaint/shaders/quad.frag"
+
+/* Reads the program binary cached on disk by a previous run (if any) into
+memory, so the first window can skip compiling. Needs no GL context, so it can
+be called at startup. */
+void canvas_program_preload();
+
+/* Returns the linked canvas program for 'context', which must be current. If a
+context sharing objects with it already has one, that is reused. Otherwise it
+is loaded from the cached program binary where the driver supports that, and
+only compiled from source as a last resort. Returns 0 (after printing why) if
+the shaders do not compile or link. */
+GLuint canvas_program_acquire(GdkGLContext *context);
+
+/* Gives up a program returned by canvas_program_acquire(). It is deleted once
+no context sharing it uses it anymore. 'context' must be current. */
+void canvas_program_release(GdkGLContext *context, GLuint program);
+
+#endif  // CANVAS_PROGRAM_H_
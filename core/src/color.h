@@ -0,0 +1,20 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef COLOR_H_
+#define COLOR_H_
+
+/* An rgba color, each channel nominally from 0 to 1. It has the same fields
+as GdkRGBA, so the gui copies one into the other field by field, but nothing
+in the engine depends on Gdk for it. */
+typedef struct color {
+    double red;
+    double green;
+    double blue;
+    double alpha;
+} Color;
+
+#endif  // COLOR_H_
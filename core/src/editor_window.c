@@ -6,8 +6,17 @@
 
 #include "editor_window.h"
 
+#include "canvas_program.h"
+#include "frame_stats.h"
 #include "image_editor.h"
+#include "image_io.h"
+#include "mip_pyramid.h"
 #include "pixel_buffer.h"
+#include "render_buffer.h"
+#include "save_job.h"
+#include "stroke_engine.h"
+#include "thumbnail.h"
+#include "tile_display.h"
 #include "tools_window.h"
 #include "utilities.h"
 
@@ -22,13 +31,17 @@
 
 #include "gdk/gdkkeysyms.h"
 
+#include <math.h>  // floor, ceil, pow
+#include <stdatomic.h>  // atomic_int
+
 
 
 struct _EditorWindow {
     GtkWindow parent_instance;
 
-    // the editor
+    // the editor, and the engine that paints strokes into it off the gui thread
     ImageEditor m_editor;
+    StrokeEngine *m_engine;
 
     // instance properties
     ToolsWindow *m_tools_window;
@@ -36,20 +49,47 @@ struct _EditorWindow {
     // the canvas glarea
     GtkGLArea *m_canvasGLArea;
 
-    // the temporary buffer used to render the
-    // pixelbuffer to the screen via opengl
-    float *m_renderBuffer;
 
     // mouse tracking variables
-    int m_mousePosX;
-    int m_mousePosY;
-    int m_mousePosX_prev;
-    int m_mousePosY_prev;
+    double m_mousePosX;
+    double m_mousePosY;
     int m_mouseDown;
 
+    // stationary application, driven by the canvas' frame clock while the mouse is down
+    guint m_holdTickId;
+    double m_holdRate;
+    gint64 m_holdLastFrameTime;
+    double m_holdDabsOwed;
+
     // The VAO for the quad, and the shader to render it.
     GLuint m_vao;
     GLuint m_shader;
+
+    // Halved copies of the canvas for zooming out, the textures showing
+    // whichever level is in use, and where to put each one.
+    MipPyramid m_mips;
+    TileDisplay m_tiles;
+    GLint m_rectUniform;
+    GLint m_uvScaleUniform;
+
+    // Set while a refresh requested from the stroke engine's thread is waiting
+    // to reach the gui thread, so a burst of them only queues one.
+    atomic_int m_refreshQueued;
+
+    // How long renders take, if TINYPAINT_FRAME_STATS is set.
+    FrameStats m_frameStats;
+
+    // The canvas point shown at the top-left corner of the glarea, and how
+    // many screen pixels each canvas pixel takes up.
+    double m_viewX;
+    double m_viewY;
+    double m_zoom;
+
+    // saves still being written in the background (newest first), the timeout
+    // that keeps an eye on them, and the bar showing how far along they are
+    GList *m_saveJobs;
+    guint m_savePollId;
+    GtkProgressBar *m_saveProgressBar;
 };
 
 G_DEFINE_TYPE(EditorWindow, editor_window, GTK_TYPE_WINDOW);
@@ -91,31 +131,23 @@ void canvas_realize(EditorWindow *self, GdkGLContext *context) {
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
-    // Create the shader program.
-    self->m_shader = glCreateProgram();
-
-    // Load the shader source code.
-    int len;
-    char* vertSource = load_file("data/shaders/quad.vert", &len);
-    char* fragSource = load_file("data/shaders/quad.frag", &len);
-
-    // Compile the shaders.
-    int vertShader = compile_shader(vertSource, GL_VERTEX_SHADER);
-    int fragShader = compile_shader(fragSource, GL_FRAGMENT_SHADER);
-
-    // Free the loaded source code.
-    free(vertSource);
-    free(fragSource);
-
-    // Attach the compiled shaders to the program.
-    glAttachShader(self->m_shader, vertShader);
-    glAttachShader(self->m_shader, fragShader);
-
-    // Specify the location of the output color.
-    glBindFragDataLocation(self->m_shader, 0, "outColor");
-
-    // Link the shaders.
-    glLinkProgram(self->m_shader);
+    // Create the mip levels, and the tiles for each of them. The tiles get
+    // their textures as they come into view.
+    PixelBuffer *render = image_editor_get_current_pixelbuffer(&(self->m_editor));
+    self->m_mips = mip_pyramid_new(render->width, render->height);
+    self->m_tiles = tile_display_new(&self->m_mips);
+
+    // Get the shader program. It is shared with any window whose context shares
+    // objects with this one, and only compiled if no cached binary is usable.
+    self->m_shader = canvas_program_acquire(gtk_gl_area_get_context(self->m_canvasGLArea));
+    if (self->m_shader == 0) {
+        // the area shows the error in place of the canvas, and never renders
+        GError *error = g_error_new(GDK_GL_ERROR, GDK_GL_ERROR_COMPILATION_FAILED,
+            "could not build the canvas shaders");
+        gtk_gl_area_set_error(self->m_canvasGLArea, error);
+        g_error_free(error);
+        return;
+    }
 
     // Create a reference to the attributes.
     GLint posAttrib = glGetAttribLocation(self->m_shader, "position");
@@ -129,27 +161,107 @@ void canvas_realize(EditorWindow *self, GdkGLContext *context) {
     glVertexAttribPointer(posAttrib, 2, GL_FLOAT, GL_FALSE, 4*sizeof(float), 0);
     glVertexAttribPointer(uvAttrib, 2, GL_FLOAT, GL_FALSE, 4*sizeof(float), 2*sizeof(float));
 
-    // Create texture.
-    GLuint texture;
-    glGenTextures(1, &texture);
+    // Assign the texture unit to the shader, and find where each tile goes.
+    glUseProgram(self->m_shader);
+    glUniform1i(glGetUniformLocation(self->m_shader, "uTexture"), 0);
+    self->m_rectUniform = glGetUniformLocation(self->m_shader, "uRect");
+    self->m_uvScaleUniform = glGetUniformLocation(self->m_shader, "uUvScale");
+
+    // The tiles are uploaded in full when they first come into view, and the
+    // mip levels start out pending, so nothing from before now is needed.
+    stroke_engine_lock_for_read(self->m_engine);
+    image_editor_take_dirty_rect(&(self->m_editor));
+    stroke_engine_unlock(self->m_engine);
+}
 
-    // Bind texture.
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture);
+/* Frees the GL resources that canvas_realize() created and that need more than
+the context's own destruction to clean up. */
+void canvas_unrealize(EditorWindow *self, GdkGLContext *context) {
+    gtk_gl_area_make_current(self->m_canvasGLArea);
+    tile_display_destroy(&self->m_tiles);
+    mip_pyramid_destroy(&self->m_mips);
+    canvas_program_release(gtk_gl_area_get_context(self->m_canvasGLArea), self->m_shader);
+}
 
-    // Set the texture parameters.
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+/* Returns the part of the canvas currently visible in the glarea. */
+PixelRect canvas_get_view(EditorWindow *self) {
+    GtkWidget *area = GTK_WIDGET(self->m_canvasGLArea);
+    double width = gtk_widget_get_allocated_width(area) / self->m_zoom;
+    double height = gtk_widget_get_allocated_height(area) / self->m_zoom;
+    PixelRect view = {(int)floor(self->m_viewX), (int)floor(self->m_viewY),
+        (int)ceil(self->m_viewX + width), (int)ceil(self->m_viewY + height)};
+    return view;
+}
 
-    // Specify the texture format.
-    PixelBuffer *render = image_editor_get_current_pixelbuffer(&(self->m_editor));
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, render->width, render->height, 0, GL_RGBA, GL_FLOAT, self->m_renderBuffer);
+/* Returns the mip level to display at the current zoom: the smallest one that
+is still at least as detailed as the screen. */
+int canvas_get_level(EditorWindow *self) {
+    int level = 0;
+    while (level + 1 < self->m_mips.numLevels && self->m_zoom * (2 << level) <= 1.0) {
+        level++;
+    }
+    return level;
+}
 
-    // Assign the texture to the shader.
-    glUniform1i(glGetUniformLocation(self->m_shader, "uTexture"), 0);
+/* Moves the view so canvas point (x, y) is at the top-left of the glarea, as far
+as it can go without leaving the canvas. A canvas smaller than the glarea is
+centered instead. */
+void canvas_set_view(EditorWindow *self, double x, double y) {
+    PixelBuffer *current = image_editor_get_current_pixelbuffer(&(self->m_editor));
+    GtkWidget *area = GTK_WIDGET(self->m_canvasGLArea);
+    double width = gtk_widget_get_allocated_width(area) / self->m_zoom;
+    double height = gtk_widget_get_allocated_height(area) / self->m_zoom;
+
+    if (current->width <= width) {
+        self->m_viewX = (current->width - width) / 2.0;
+    }
+    else {
+        self->m_viewX = double_clamp(x, 0.0, current->width - width);
+    }
+
+    if (current->height <= height) {
+        self->m_viewY = (current->height - height) / 2.0;
+    }
+    else {
+        self->m_viewY = double_clamp(y, 0.0, current->height - height);
+    }
+
+    gtk_gl_area_queue_render(self->m_canvasGLArea);
+}
+
+/* Multiplies the zoom by 'factor', keeping the canvas point under glarea point
+(x, y) where it is. */
+void canvas_zoom_at(EditorWindow *self, double factor, double x, double y) {
+    double canvasX = self->m_viewX + x / self->m_zoom;
+    double canvasY = self->m_viewY + y / self->m_zoom;
+
+    self->m_zoom = double_clamp(self->m_zoom * factor, CANVAS_MIN_ZOOM, CANVAS_MAX_ZOOM);
+    canvas_set_view(self, canvasX - x / self->m_zoom, canvasY - y / self->m_zoom);
+}
+
+/* Multiplies the zoom by 'factor' around the middle of the glarea, or resets it
+to 1:1 if 'factor' is 0. */
+void canvas_zoom(EditorWindow *self, double factor) {
+    GtkWidget *area = GTK_WIDGET(self->m_canvasGLArea);
+    if (factor == 0.0) {
+        factor = 1.0 / self->m_zoom;
+    }
+    canvas_zoom_at(self, factor, gtk_widget_get_allocated_width(area) / 2.0,
+        gtk_widget_get_allocated_height(area) / 2.0);
+}
+
+/* Asks for a glarea as big as the canvas, up to the maximum view size. */
+void canvas_set_size_request(EditorWindow *self, int width, int height) {
+    width = width < CANVAS_MAX_VIEW_WIDTH ? width : CANVAS_MAX_VIEW_WIDTH;
+    height = height < CANVAS_MAX_VIEW_HEIGHT ? height : CANVAS_MAX_VIEW_HEIGHT;
+    gtk_widget_set_size_request(GTK_WIDGET(self->m_canvasGLArea), width, height);
 }
 
 /* Rerenders the gtkGLArea associated with this EditorWindow instance, based on its current pixelbuffer */
 void canvas_render(EditorWindow *self, GdkGLContext *context) {
+    gint64 renderStart = g_get_monotonic_time();
+    size_t uploadedBefore = self->m_tiles.stream.bytesUploaded;
+
     // Make the context of the canvas current.
     gdk_gl_context_make_current (context);
 
@@ -163,26 +275,143 @@ void canvas_render(EditorWindow *self, GdkGLContext *context) {
     // Use the specified vao which contains the quad vertices, created in canvas_realize().
     glBindVertexArray (self->m_vao);
 
-    // Update the texture to point to the current image editors pixelbuffer.
+    // Bring the mip level for this zoom up to date, then read what has changed
+    // in its tiles in view since the last render, straight into a pixel buffer
+    // if one is free. (the stroke engine may be painting into it at the same time)
+    PixelRect view = canvas_get_view(self);
+    int level = canvas_get_level(self);
+    stroke_engine_lock_for_read(self->m_engine);
     PixelBuffer *render = image_editor_get_current_pixelbuffer(&(self->m_editor));
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, render->width, render->height, GL_RGBA, GL_FLOAT, render->rgbadata);
+    PixelRect dirty = image_editor_take_dirty_rect(&(self->m_editor));
+    mip_pyramid_invalidate(&self->m_mips, dirty);
+    tile_display_invalidate(&self->m_tiles, dirty);
+    mip_pyramid_update(&self->m_mips, render, level);
+    tile_display_update(&self->m_tiles, &self->m_mips, render, level, view);
+    stroke_engine_unlock(self->m_engine);
+
+    // Then hand it to the gpu, which copies it into the textures in the
+    // background, and draw a quad for each tile in view.
+    GtkWidget *area = GTK_WIDGET(self->m_canvasGLArea);
+    if (!tile_display_draw(&self->m_tiles, self->m_viewX, self->m_viewY, self->m_zoom,
+        gtk_widget_get_allocated_width(area), gtk_widget_get_allocated_height(area),
+        self->m_rectUniform, self->m_uvScaleUniform)) {
+        // lost on the way, so try again next frame
+        gtk_gl_area_queue_render(self->m_canvasGLArea);
+    }
 
-    // Draw the fullscreen quad!
-    glDrawArrays(GL_TRIANGLES, 0, 6);
     glFlush ();
+
+    GdkFrameClock *clock = gtk_widget_get_frame_clock(GTK_WIDGET(self->m_canvasGLArea));
+    frame_stats_record(&self->m_frameStats, clock != NULL ? gdk_frame_clock_get_frame_time(clock) : renderStart,
+        g_get_monotonic_time() - renderStart, self->m_tiles.stream.bytesUploaded - uploadedBefore);
 }
 
-/* Refreshes this instance's GL canvas (basically triggers the "render" signal) */
+/* Refreshes this instance's GL canvas (basically triggers the "render" signal).
+However many times this is called between two frames, the canvas is only
+rendered once, at the next tick of the frame clock, and uploads the union of
+everything that changed in between. */
 void canvas_refresh(EditorWindow *self) {
     gtk_gl_area_queue_render(self->m_canvasGLArea);
 }
 
+/* Idle callback that refreshes the canvas on the gui thread, unless the window
+has been destroyed since it was queued. */
+int canvas_refresh_idle(EditorWindow *self) {
+    // anything painted from here on needs another refresh
+    atomic_store(&self->m_refreshQueued, 0);
+
+    if (self->m_engine != NULL) {
+        canvas_refresh(self);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+/* Called from the stroke engine's worker thread whenever it has painted. Only
+queues a refresh if one is not already on its way. */
+void canvas_on_painted(void *data) {
+    EditorWindow *self = (EditorWindow *)data;
+    if (atomic_exchange(&self->m_refreshQueued, 1) == 0) {
+        g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, (GSourceFunc)canvas_refresh_idle,
+            g_object_ref(self), g_object_unref);
+    }
+}
+
 
 
 //
 // FILE I/O methods
 //
 
+/* How often the progress of background saves is checked, in milliseconds. */
+#define SAVE_POLL_INTERVAL_MS 100
+
+/* Frees the saves that have finished, and shows the progress of the newest one
+still going. Runs every SAVE_POLL_INTERVAL_MS for as long as there are any. */
+gboolean file_save_poll(EditorWindow *self) {
+    GList *job = self->m_saveJobs;
+    while (job != NULL) {
+        GList *next = job->next;
+        if (save_job_is_finished(job->data)) {
+            save_job_finish(job->data);
+            self->m_saveJobs = g_list_delete_link(self->m_saveJobs, job);
+        }
+        job = next;
+    }
+
+    if (self->m_saveJobs == NULL) {
+        gtk_widget_hide(GTK_WIDGET(self->m_saveProgressBar));
+        self->m_savePollId = 0;
+        return G_SOURCE_REMOVE;
+    }
+
+    // superseded saves are on their way out, so only the newest one matters
+    SaveJob *newest = self->m_saveJobs->data;
+    gchar *basename = g_path_get_basename(newest->filepath);
+    gchar *text = g_strdup_printf("Saving %s...", basename);
+    gtk_progress_bar_set_text(self->m_saveProgressBar, text);
+    gtk_progress_bar_set_fraction(self->m_saveProgressBar, save_job_get_progress(newest));
+    gtk_widget_show(GTK_WIDGET(self->m_saveProgressBar));
+    g_free(text);
+    g_free(basename);
+    return G_SOURCE_CONTINUE;
+}
+
+/* Saves a snapshot of the current buffer to 'filepath' in the background. A
+save to the same file that is still running is cancelled, since this one
+would overwrite it anyway. */
+void file_save_in_background(EditorWindow *self, const char *filepath, int compressionLevel, int bitDepth) {
+    for (GList *job = self->m_saveJobs; job != NULL; job = job->next) {
+        if (strcmp(((SaveJob *)job->data)->filepath, filepath) == 0) {
+            save_job_cancel(job->data);
+        }
+    }
+
+    // the snapshot is taken with the editor locked, so it includes every stroke so far
+    stroke_engine_lock(self->m_engine);
+    SaveJob *job = save_job_start(image_editor_get_current_pixelbuffer(&(self->m_editor)), filepath, compressionLevel, bitDepth);
+    stroke_engine_unlock(self->m_engine);
+
+    self->m_saveJobs = g_list_prepend(self->m_saveJobs, job);
+    if (self->m_savePollId == 0) {
+        self->m_savePollId = g_timeout_add(SAVE_POLL_INTERVAL_MS, (GSourceFunc)file_save_poll, self);
+    }
+    file_save_poll(self);
+}
+
+/* Waits for every background save to finish writing. Used before the window
+goes away, so closing it never loses a save. */
+void file_save_wait(EditorWindow *self) {
+    if (self->m_savePollId != 0) {
+        g_source_remove(self->m_savePollId);
+        self->m_savePollId = 0;
+    }
+    for (GList *job = self->m_saveJobs; job != NULL; job = job->next) {
+        save_job_finish(job->data);
+    }
+    g_list_free(self->m_saveJobs);
+    self->m_saveJobs = NULL;
+}
+
 /* Opens a new EditorWindow under the current TinyPaintApp instance. */
 void file_new(EditorWindow *self) {
 	/* Emits the "new" signal to alert the TinyPaintApp parent that a
@@ -190,14 +419,100 @@ void file_new(EditorWindow *self) {
     g_signal_emit_by_name(self, "editor-new");
 }
 
+/* How often the open dialog checks whether its preview is ready, in milliseconds. */
+#define PREVIEW_POLL_INTERVAL_MS 50
+
+/* What the open dialog's preview needs between selections. */
+typedef struct openpreview {
+    GtkImage *image;
+    GtkLabel *label;
+    ThumbnailJob *job;
+    guint pollId;
+} OpenPreview;
+
+/* Stops making the thumbnail of the last selection, if it is still going. */
+void file_open_stop_preview(OpenPreview *preview) {
+    if (preview->job != NULL) {
+        // the gui never waits on a decode: the worker frees the job itself
+        thumbnail_job_abandon(preview->job);
+        preview->job = NULL;
+    }
+    if (preview->pollId != 0) {
+        g_source_remove(preview->pollId);
+        preview->pollId = 0;
+    }
+}
+
+/* Frees the pixels of a thumbnail shown in the preview, along with its pixbuf. */
+void file_open_free_pixels(guchar *pixels, gpointer data) {
+    free(pixels);
+}
+
+/* Shows the thumbnail once it is ready. Runs every PREVIEW_POLL_INTERVAL_MS
+until then. */
+gboolean file_open_preview_poll(OpenPreview *preview) {
+    if (preview->job == NULL) {
+        preview->pollId = 0;
+        return G_SOURCE_REMOVE;
+    }
+    if (!thumbnail_job_is_finished(preview->job)) {
+        return G_SOURCE_CONTINUE;
+    }
+
+    Thumbnail thumbnail;
+    if (thumbnail_job_finish(preview->job, &thumbnail)) {
+        // the pixbuf takes the pixels over, and frees them along with itself
+        GdkPixbuf *pixbuf = gdk_pixbuf_new_from_data(thumbnail.rgba, GDK_COLORSPACE_RGB, TRUE, 8,
+            thumbnail.width, thumbnail.height, 4 * thumbnail.width, file_open_free_pixels, NULL);
+        gtk_image_set_from_pixbuf(preview->image, pixbuf);
+        g_object_unref(pixbuf);
+    }
+    preview->job = NULL;
+    preview->pollId = 0;
+    return G_SOURCE_REMOVE;
+}
+
+/* Called whenever the selection in the open dialog changes. The size of the
+image is shown straight away (only its header is read), and its thumbnail is
+made in the background, so flicking through a folder of huge images never
+waits on one. */
+void file_open_update_preview(GtkFileChooser *chooser, OpenPreview *preview) {
+    file_open_stop_preview(preview);
+
+    int width, height;
+    gchar *filename = gtk_file_chooser_get_preview_filename(chooser);
+    if (filename == NULL || !g_file_test(filename, G_FILE_TEST_IS_REGULAR)
+        || !image_io_read_size(filename, &width, &height)) {
+        gtk_file_chooser_set_preview_widget_active(chooser, FALSE);
+        g_free(filename);
+        return;
+    }
+
+    gchar *text = g_strdup_printf("%d x %d", width, height);
+    gtk_label_set_text(preview->label, text);
+    g_free(text);
+    gtk_image_clear(preview->image);
+    gtk_file_chooser_set_preview_widget_active(chooser, TRUE);
+
+    preview->job = thumbnail_job_start(filename);
+    preview->pollId = g_timeout_add(PREVIEW_POLL_INTERVAL_MS, (GSourceFunc)file_open_preview_poll, preview);
+    g_free(filename);
+}
+
 /* Opens the file as a new EditorWindow under the current TinyPaintApp instance. */
 void file_open(EditorWindow *self) {
     // get a reference to the builder
     GtkBuilder *builder = gtk_builder_new_from_resource("/tinypaint/ui/io_dialogs.glade");
 
-    // get a reference to the openDialog from it
+    // get a reference to the openDialog (and its preview) from it
     GtkFileChooserDialog *openDialog =
         GTK_FILE_CHOOSER_DIALOG(gtk_builder_get_object(builder, "openDialog"));
+    OpenPreview preview;
+    preview.image = GTK_IMAGE(gtk_builder_get_object(builder, "previewImage"));
+    preview.label = GTK_LABEL(gtk_builder_get_object(builder, "previewLabel"));
+    preview.job = NULL;
+    preview.pollId = 0;
+    g_signal_connect(openDialog, "update-preview", G_CALLBACK(file_open_update_preview), &preview);
 
     if (gtk_dialog_run(GTK_DIALOG(openDialog)) == GTK_RESPONSE_OK) {
         // get file string
@@ -211,6 +526,10 @@ void file_open(EditorWindow *self) {
         g_free(filename);
     }
 
+    // the preview has to be stopped before the widgets it fills in go away
+    g_signal_handlers_disconnect_by_data(openDialog, &preview);
+    file_open_stop_preview(&preview);
+
     gtk_widget_destroy(GTK_WIDGET(openDialog));
 
     g_object_unref(builder);
@@ -221,8 +540,10 @@ void file_save(EditorWindow *self) {
     // get a reference to the builder
     GtkBuilder *builder = gtk_builder_new_from_resource("/tinypaint/ui/io_dialogs.glade");
 
-    // get an instance of saveDialog from it
+    // get an instance of saveDialog (and its compression and depth options) from it
     GtkFileChooserDialog *saveDialog = GTK_FILE_CHOOSER_DIALOG(gtk_builder_get_object(builder, "saveDialog"));
+    GtkComboBox *compressionCombo = GTK_COMBO_BOX(gtk_builder_get_object(builder, "compressionCombo"));
+    GtkComboBox *depthCombo = GTK_COMBO_BOX(gtk_builder_get_object(builder, "depthCombo"));
 
     // and run the save dialog
     if (gtk_dialog_run(GTK_DIALOG(saveDialog)) == GTK_RESPONSE_OK) {
@@ -232,16 +553,35 @@ void file_save(EditorWindow *self) {
         char filename_final[filenameLength+5];
         memset(filename_final, '\0', filenameLength+5);
 
-        // verify if filename is valid
-        if (string_ends_with(filename, ".png") == 0) {
+        // verify if filename is valid (i.e. has an extension we can save)
+        if (image_io_format_from_extension(filename) != IMAGE_FORMAT_UNKNOWN) {
             sprintf(filename_final, "%s", filename);
         }
         else {
             sprintf(filename_final, "%s.png", filename);
         }
 
-        // and save the image
-        image_editor_save_current_pixelbuffer(&(self->m_editor), filename_final);
+        // get the compression level
+        const gchar *compression = gtk_combo_box_get_active_id(compressionCombo);
+        int compressionLevel = IMAGE_COMPRESSION_DEFAULT;
+        if (g_strcmp0(compression, "none") == 0) {
+            compressionLevel = 0;
+        }
+        else if (g_strcmp0(compression, "fast") == 0) {
+            compressionLevel = IMAGE_COMPRESSION_FAST;
+        }
+        else if (g_strcmp0(compression, "smallest") == 0) {
+            compressionLevel = IMAGE_COMPRESSION_SMALLEST;
+        }
+
+        // get the bits per sample
+        int bitDepth = IMAGE_DEPTH_8;
+        if (g_strcmp0(gtk_combo_box_get_active_id(depthCombo), "16") == 0) {
+            bitDepth = IMAGE_DEPTH_16;
+        }
+
+        // and save the image, without holding up painting
+        file_save_in_background(self, filename_final, compressionLevel, bitDepth);
     }
 
     // destroy saveDialog widget
@@ -256,6 +596,28 @@ void file_save(EditorWindow *self) {
 
 
 
+//
+// EDIT methods
+//
+
+/* Undoes the last stroke or filter, once any stroke still being painted is done. */
+void edit_undo(EditorWindow *self) {
+    stroke_engine_lock(self->m_engine);
+    image_editor_undo(&(self->m_editor));
+    stroke_engine_unlock(self->m_engine);
+    canvas_refresh(self);
+}
+
+/* Redoes the last undone stroke or filter. */
+void edit_redo(EditorWindow *self) {
+    stroke_engine_lock(self->m_engine);
+    image_editor_redo(&(self->m_editor));
+    stroke_engine_unlock(self->m_engine);
+    canvas_refresh(self);
+}
+
+
+
 //
 // DEVICE I/O callbacks
 //
@@ -266,12 +628,10 @@ int device_keyPress(EditorWindow *self, GdkEventKey *event) {
     GdkModifierType modifiers  = gtk_accelerator_get_default_mod_mask ();
 
     if (gdk_keyval_to_upper(event->keyval) == GDK_KEY_Z  && (event->state & modifiers) == GDK_CONTROL_MASK) {
-        image_editor_undo(&(self->m_editor));
-        canvas_refresh(self);
+        edit_undo(self);
     }
     else if (gdk_keyval_to_upper(event->keyval) == GDK_KEY_Z  && (event->state & modifiers) == (GDK_CONTROL_MASK | GDK_SHIFT_MASK)) {
-        image_editor_redo(&(self->m_editor));
-        canvas_refresh(self);
+        edit_redo(self);
     }
     if (gdk_keyval_to_upper(event->keyval) == GDK_KEY_Q  && (event->state & modifiers) == GDK_CONTROL_MASK) {
         // will trigger the editor_window_quit method automatically.
@@ -286,60 +646,130 @@ int device_keyPress(EditorWindow *self, GdkEventKey *event) {
     if (gdk_keyval_to_upper(event->keyval) == GDK_KEY_S  && (event->state & modifiers) == GDK_CONTROL_MASK) {
         file_save(self);
     }
+    if ((event->keyval == GDK_KEY_plus || event->keyval == GDK_KEY_equal) && (event->state & GDK_CONTROL_MASK)) {
+        canvas_zoom(self, CANVAS_ZOOM_STEP);
+    }
+    if (event->keyval == GDK_KEY_minus && (event->state & modifiers) == GDK_CONTROL_MASK) {
+        canvas_zoom(self, 1.0 / CANVAS_ZOOM_STEP);
+    }
+    if (event->keyval == GDK_KEY_0 && (event->state & modifiers) == GDK_CONTROL_MASK) {
+        canvas_zoom(self, 0.0);
+    }
 
     /* return false, i.e. other signals can interupt this one
     (to enable multi-key combinations) */
     return 0;
 }
 
-/* Fires when the mouse is held down on the canvas */
-int device_mouseHold(EditorWindow *self) {
-    image_editor_stroke_hold(&(self->m_editor), self->m_mousePosX, self->m_mousePosY);
-    canvas_refresh(self);
-    return self->m_mouseDown;  // will uninstall itself when the mouse is lifted
+/* Fires once per frame while the mouse is held down on the canvas. Works out how
+many dabs are owed for the time since the last frame, so the amount applied
+depends only on how long the mouse was held and not on the frame rate. */
+int device_mouseHoldTick(GtkWidget *widget, GdkFrameClock *clock, EditorWindow *self) {
+    if (!self->m_mouseDown) {
+        self->m_holdTickId = 0;
+        return G_SOURCE_REMOVE;  // uninstalls itself when the mouse is lifted
+    }
+
+    gint64 now = gdk_frame_clock_get_frame_time(clock);
+    if (self->m_holdLastFrameTime != 0) {
+        double elapsed = (now - self->m_holdLastFrameTime) / 1000000.0;
+        self->m_holdDabsOwed += elapsed * self->m_holdRate;
+    }
+    self->m_holdLastFrameTime = now;
+
+    // hand every dab owed this frame to the stroke engine as a single batch
+    int numDabs = (int)self->m_holdDabsOwed;
+    if (numDabs > 0) {
+        self->m_holdDabsOwed -= numDabs;
+        stroke_engine_push_hold(self->m_engine, numDabs);
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+/* Fires when the scroll wheel is turned over the canvas, and pans it. Shift
+turns vertical scrolling into horizontal, and control zooms around the
+pointer instead. */
+int device_scroll(EditorWindow *self, GdkEventScroll *event) {
+    double dx = 0.0;
+    double dy = 0.0;
+
+    if (event->direction == GDK_SCROLL_SMOOTH) {
+        gdk_event_get_scroll_deltas((GdkEvent *)event, &dx, &dy);
+    }
+    else if (event->direction == GDK_SCROLL_UP) {
+        dy = -1.0;
+    }
+    else if (event->direction == GDK_SCROLL_DOWN) {
+        dy = 1.0;
+    }
+    else if (event->direction == GDK_SCROLL_LEFT) {
+        dx = -1.0;
+    }
+    else if (event->direction == GDK_SCROLL_RIGHT) {
+        dx = 1.0;
+    }
+
+    if (event->state & GDK_CONTROL_MASK) {
+        canvas_zoom_at(self, pow(CANVAS_ZOOM_STEP, -dy), event->x, event->y);
+        return TRUE;
+    }
+
+    if (event->state & GDK_SHIFT_MASK) {
+        double tmp = dx;
+        dx = dy;
+        dy = tmp;
+    }
+
+    // a notch moves the same distance on screen at any zoom
+    canvas_set_view(self, self->m_viewX + dx * CANVAS_SCROLL_STEP / self->m_zoom,
+        self->m_viewY + dy * CANVAS_SCROLL_STEP / self->m_zoom);
+    return TRUE;
 }
 
 /* Fires when the mouse is moved on the canvas */
 void device_mouseMove(EditorWindow *self, GdkEventMotion *event) {
     if (self->m_mouseDown) {
-        // update the mouse tracking parameters
-        self->m_mousePosX_prev = self->m_mousePosX;
-        self->m_mousePosY_prev = self->m_mousePosY;
-        self->m_mousePosX = event->x;
-        self->m_mousePosY = event->y;
+        // update the mouse tracking parameters (in canvas coordinates)
+        self->m_mousePosX = self->m_viewX + event->x / self->m_zoom;
+        self->m_mousePosY = self->m_viewY + event->y / self->m_zoom;
 
-        image_editor_stroke_move(&(self->m_editor), self->m_mousePosX, self->m_mousePosY, self->m_mousePosX_prev, self->m_mousePosY_prev);
-        canvas_refresh(self);
+        // the stroke engine paints it, and asks for a refresh when it is done
+        stroke_engine_push_move(self->m_engine, self->m_mousePosX, self->m_mousePosY);
     }
 }
 
 /* Fires when the mouse is clicked on the canvas */
 void device_mouseClick(EditorWindow *self, GdkEventMotion *event) {
-    // update the mouse tracking parameters
+    // update the mouse tracking parameters (in canvas coordinates)
     self->m_mouseDown = 1;
-    self->m_mousePosX = event->x;
-    self->m_mousePosY = event->y;
-    self->m_mousePosX_prev = self->m_mousePosX;
-    self->m_mousePosY_prev = self->m_mousePosY;
+    self->m_mousePosX = self->m_viewX + event->x / self->m_zoom;
+    self->m_mousePosY = self->m_viewY + event->y / self->m_zoom;
 
-    // install the mouseHold polling function
+    // install the per-frame stationary application
     if (self->m_editor.m_tool.applyWhenStationary) {
-        g_timeout_add(MOUSE_HOLD_POLL_RATE_MS, (void *)device_mouseHold, self);
+        self->m_holdRate = self->m_editor.m_tool.stationaryRate;
+        self->m_holdLastFrameTime = 0;
+        self->m_holdDabsOwed = 0.0;
+
+        // (it may still be installed if the mouse was lifted and pressed within one frame)
+        if (self->m_holdTickId == 0) {
+            self->m_holdTickId = gtk_widget_add_tick_callback(GTK_WIDGET(self->m_canvasGLArea),
+                (GtkTickCallback)device_mouseHoldTick, self, NULL);
+        }
     }
 
-    image_editor_stroke_start(&(self->m_editor), self->m_mousePosX, self->m_mousePosY);
-    canvas_refresh(self);
+    stroke_engine_push_start(self->m_engine, self->m_mousePosX, self->m_mousePosY);
 }
 
 /* Fires when the mouse is unclicked on the canvas */
 void device_mouseUnclick(EditorWindow *self, GdkEventMotion *event) {
-    // update the mouse tracking parameters
+    // update the mouse tracking parameters (in canvas coordinates)
     self->m_mouseDown = 0;
-    self->m_mousePosX = event->x;
-    self->m_mousePosY = event->y;
+    self->m_mousePosX = self->m_viewX + event->x / self->m_zoom;
+    self->m_mousePosY = self->m_viewY + event->y / self->m_zoom;
 
-    image_editor_stroke_end(&(self->m_editor), self->m_mousePosX, self->m_mousePosY);
-    canvas_refresh(self);
+    stroke_engine_push_end(self->m_engine, self->m_mousePosX, self->m_mousePosY);
 }
 
 
@@ -348,6 +778,20 @@ void device_mouseUnclick(EditorWindow *self, GdkEventMotion *event) {
 // FILTER methods
 //
 
+void filter_applyInvert(EditorWindow *self) {
+    stroke_engine_lock(self->m_engine);
+    image_editor_apply_invert_filter(&(self->m_editor));
+    stroke_engine_unlock(self->m_engine);
+    canvas_refresh(self);
+}
+
+void filter_applyEdgeDetect(EditorWindow *self) {
+    stroke_engine_lock(self->m_engine);
+    image_editor_apply_edge_detect_filter(&(self->m_editor));
+    stroke_engine_unlock(self->m_engine);
+    canvas_refresh(self);
+}
+
 void filter_applySaturation(EditorWindow *self) {
     // get a reference to the builder
     GtkBuilder *builder = gtk_builder_new_from_resource("/tinypaint/ui/filter_dialogs.glade");
@@ -358,7 +802,9 @@ void filter_applySaturation(EditorWindow *self) {
 
     // run the dialog
     if (gtk_dialog_run(saturationDialog) == GTK_RESPONSE_APPLY) {
+        stroke_engine_lock(self->m_engine);
         image_editor_apply_saturation_filter(&(self->m_editor), gtk_adjustment_get_value(saturationScale));
+        stroke_engine_unlock(self->m_engine);
         canvas_refresh(self);
     }
 
@@ -381,8 +827,10 @@ void filter_applyChannels(EditorWindow *self) {
 
     // run the dialog
     if (gtk_dialog_run(channelsDialog) == GTK_RESPONSE_APPLY) {
+        stroke_engine_lock(self->m_engine);
         image_editor_apply_channels_filter(&(self->m_editor), gtk_adjustment_get_value(rScale),
             gtk_adjustment_get_value(gScale), gtk_adjustment_get_value(bScale));
+        stroke_engine_unlock(self->m_engine);
             canvas_refresh(self);
     }
 
@@ -404,8 +852,10 @@ void filter_applyBrightnessContrast(EditorWindow *self) {
 
     // run the dialog
     if (gtk_dialog_run(brightnessContrastDialog) == GTK_RESPONSE_APPLY) {
+        stroke_engine_lock(self->m_engine);
         image_editor_apply_brightness_contrast_filter(&(self->m_editor),
             gtk_adjustment_get_value(brightnessScale), gtk_adjustment_get_value(contrastScale));
+        stroke_engine_unlock(self->m_engine);
             canvas_refresh(self);
     }
 
@@ -426,7 +876,9 @@ void filter_applyGaussianBlur(EditorWindow *self) {
 
     // run the dialog
     if (gtk_dialog_run(gaussianBlurDialog) == GTK_RESPONSE_APPLY) {
+        stroke_engine_lock(self->m_engine);
         image_editor_apply_gaussian_blur_filter(&(self->m_editor), (int)gtk_adjustment_get_value(gaussianBlurRadius));
+        stroke_engine_unlock(self->m_engine);
         canvas_refresh(self);
     }
 
@@ -448,9 +900,11 @@ void filter_applyMotionBlur(EditorWindow *self) {
 
     // run the dialog
     if (gtk_dialog_run(motionBlurDialog) == GTK_RESPONSE_APPLY) {
+        stroke_engine_lock(self->m_engine);
         image_editor_apply_motion_blur_filter(&(self->m_editor),
             (int)gtk_adjustment_get_value(motionBlurRadius),
             (int)gtk_adjustment_get_value(motionBlurAngle));
+        stroke_engine_unlock(self->m_engine);
             canvas_refresh(self);
     }
 
@@ -471,7 +925,9 @@ void filter_applySharpen(EditorWindow *self) {
 
     // run the dialog
     if (gtk_dialog_run(sharpenDialog) == GTK_RESPONSE_APPLY) {
+        stroke_engine_lock(self->m_engine);
         image_editor_apply_sharpen_filter(&(self->m_editor), (int)gtk_adjustment_get_value(sharpenRadius));
+        stroke_engine_unlock(self->m_engine);
         canvas_refresh(self);
     }
 
@@ -492,7 +948,9 @@ void filter_applyPosterize(EditorWindow *self) {
 
     // run the dialog
     if (gtk_dialog_run(posterizeDialog) == GTK_RESPONSE_APPLY) {
+        stroke_engine_lock(self->m_engine);
         image_editor_apply_posterize_filter(&(self->m_editor), (int)gtk_adjustment_get_value(posterizeBins));
+        stroke_engine_unlock(self->m_engine);
         canvas_refresh(self);
     }
 
@@ -513,7 +971,9 @@ void filter_applyThreshold(EditorWindow *self) {
 
     // run the dialog
     if (gtk_dialog_run(thresholdDialog) == GTK_RESPONSE_APPLY) {
+        stroke_engine_lock(self->m_engine);
         image_editor_apply_threshold_filter(&(self->m_editor), gtk_adjustment_get_value(thresholdCutoff));
+        stroke_engine_unlock(self->m_engine);
         canvas_refresh(self);
     }
 
@@ -534,12 +994,12 @@ void filter_applyThreshold(EditorWindow *self) {
 /* Prepares the editorWindow instance based on an input width, height, and color
 Should be called by the user exactly ONCE after getting a new instance of EditorWindow */
 void editor_window_canvas_init_from_parameters(EditorWindow *self, int width, int height, GdkRGBA backgroundColor) {
-    gtk_widget_set_size_request(GTK_WIDGET(self->m_canvasGLArea), width, height);
-
-    // initialize the renderBuffer to be the correct size
-    self->m_renderBuffer = malloc(sizeof(float) * 4 * width * height);
+    canvas_set_size_request(self, width, height);
 
-    image_editor_init_from_parameters(&(self->m_editor), width, height, backgroundColor);
+    Color color = {backgroundColor.red, backgroundColor.green, backgroundColor.blue, backgroundColor.alpha};
+    stroke_engine_lock(self->m_engine);
+    image_editor_init_from_parameters(&(self->m_editor), width, height, color);
+    stroke_engine_unlock(self->m_engine);
 
     // refresh the canvas to show the initial pixelbuffer
     canvas_refresh(self);
@@ -548,16 +1008,15 @@ void editor_window_canvas_init_from_parameters(EditorWindow *self, int width, in
 /* Prepares the editorWindow instance based on an input filepath
 Should be called by the user exactly ONCE after getting a new instance of EditorWindow */
 void editor_window_canvas_init_from_file(EditorWindow *self, const char *filepath) {
+    stroke_engine_lock(self->m_engine);
     image_editor_init_from_file(&(self->m_editor), filepath);
+    stroke_engine_unlock(self->m_engine);
 
     int width = image_editor_get_current_pixelbuffer(&(self->m_editor))->width;
     int height = image_editor_get_current_pixelbuffer(&(self->m_editor))->height;
 
     // set the size request
-    gtk_widget_set_size_request(GTK_WIDGET(self->m_canvasGLArea), width, height);
-
-    // initialize the renderBuffer to be the correct size
-    self->m_renderBuffer = malloc(sizeof(float) * 4 * width * height);
+    canvas_set_size_request(self, width, height);
 
     // refresh the canvas to show the initial pixelbuffer
     canvas_refresh(self);
@@ -578,8 +1037,10 @@ EditorWindow* editor_window_new () {
 /* Frees the dynamically allocated memory associated with this window,
 then destroys itself. */
 void editor_window_destroy(EditorWindow *self) {
+    file_save_wait(self);
+    stroke_engine_destroy(self->m_engine);
+    self->m_engine = NULL;
     image_editor_destroy(&(self->m_editor));
-    free(self->m_renderBuffer);
     gtk_widget_destroy(GTK_WIDGET(self));
 }
 
@@ -601,7 +1062,10 @@ void editor_window_quit(EditorWindow *self) {
         file_save(self);
     }
 
-    // destroy the editor
+    // let any saves finish writing, stop painting, then destroy the editor
+    file_save_wait(self);
+    stroke_engine_destroy(self->m_engine);
+    self->m_engine = NULL;
     image_editor_destroy(&(self->m_editor));
 
     // then finally destroy this instance
@@ -637,6 +1101,7 @@ static void editor_window_init (EditorWindow *self) {
     // EDITOR setup
     //
     self->m_editor = image_editor_new();
+    self->m_engine = stroke_engine_new(&(self->m_editor), canvas_on_painted, self);
 
 
 
@@ -694,13 +1159,11 @@ static void editor_window_init (EditorWindow *self) {
 
     // menu UNDO
     GtkMenuItem *undoButton = GTK_MENU_ITEM(gtk_builder_get_object(builder, "undoButton"));
-    g_signal_connect_swapped(undoButton, "activate", (GCallback)image_editor_undo, &(self->m_editor));
-    g_signal_connect_swapped(undoButton, "activate", (GCallback)canvas_refresh, self);
+    g_signal_connect_swapped(undoButton, "activate", (GCallback)edit_undo, self);
 
     // menu REDO
     GtkMenuItem *redoButton = GTK_MENU_ITEM(gtk_builder_get_object(builder, "redoButton"));
-    g_signal_connect_swapped(redoButton, "activate", (GCallback)image_editor_redo, &(self->m_editor));
-    g_signal_connect_swapped(redoButton, "activate", (GCallback)canvas_refresh, self);
+    g_signal_connect_swapped(redoButton, "activate", (GCallback)edit_redo, self);
 
     // menu SATURATION
     GtkMenuItem *saturationButton = GTK_MENU_ITEM(gtk_builder_get_object(builder, "saturationButton"));
@@ -716,8 +1179,7 @@ static void editor_window_init (EditorWindow *self) {
 
     // menu INVERT
     GtkMenuItem *invertButton = GTK_MENU_ITEM(gtk_builder_get_object(builder, "invertButton"));
-    g_signal_connect_swapped(invertButton, "activate", (GCallback)image_editor_apply_invert_filter, &(self->m_editor));
-    g_signal_connect_swapped(invertButton, "activate", (GCallback)canvas_refresh, self);
+    g_signal_connect_swapped(invertButton, "activate", (GCallback)filter_applyInvert, self);
 
     // menu GAUSSIAN_BLUR
     GtkMenuItem *gaussianBlurButton = GTK_MENU_ITEM(gtk_builder_get_object(builder, "gaussianBlurButton"));
@@ -733,8 +1195,7 @@ static void editor_window_init (EditorWindow *self) {
 
     // menu EDGE DETECT
     GtkMenuItem *edgeDetectButton = GTK_MENU_ITEM(gtk_builder_get_object(builder, "edgeDetectButton"));
-    g_signal_connect_swapped(edgeDetectButton, "activate", (GCallback)image_editor_apply_edge_detect_filter, &(self->m_editor));
-    g_signal_connect_swapped(edgeDetectButton, "activate", (GCallback)canvas_refresh, self);
+    g_signal_connect_swapped(edgeDetectButton, "activate", (GCallback)filter_applyEdgeDetect, self);
 
     // menu POSTERIZE
     GtkMenuItem *posterizeButton = GTK_MENU_ITEM(gtk_builder_get_object(builder, "posterizeButton"));
@@ -760,6 +1221,8 @@ static void editor_window_init (EditorWindow *self) {
     g_signal_connect_swapped(canvasEventBox, "button-press-event", (GCallback)device_mouseClick, self);
     g_signal_connect_swapped(canvasEventBox, "motion-notify-event", (GCallback)device_mouseMove, self);
     g_signal_connect_swapped(canvasEventBox, "button-release-event", (GCallback)device_mouseUnclick, self);
+    gtk_widget_add_events(canvasEventBox, GDK_SCROLL_MASK | GDK_SMOOTH_SCROLL_MASK);
+    g_signal_connect_swapped(canvasEventBox, "scroll-event", (GCallback)device_scroll, self);
     g_signal_connect(self, "key-press-event", (GCallback)device_keyPress, NULL);
 
 
@@ -769,9 +1232,19 @@ static void editor_window_init (EditorWindow *self) {
     //
     self->m_mousePosX = 0;
     self->m_mousePosY = 0;
-    self->m_mousePosX_prev = 0;
-    self->m_mousePosY_prev = 0;
     self->m_mouseDown = 0;
+    self->m_holdTickId = 0;
+    self->m_holdRate = 0.0;
+    self->m_holdLastFrameTime = 0;
+    self->m_holdDabsOwed = 0.0;
+    self->m_viewX = 0.0;
+    self->m_viewY = 0.0;
+    self->m_zoom = 1.0;
+    atomic_init(&self->m_refreshQueued, 0);
+    self->m_frameStats = frame_stats_new();
+    self->m_saveJobs = NULL;
+    self->m_savePollId = 0;
+    self->m_saveProgressBar = GTK_PROGRESS_BAR(gtk_builder_get_object(builder, "saveProgressBar"));
 
 
 
@@ -782,6 +1255,7 @@ static void editor_window_init (EditorWindow *self) {
     gtk_gl_area_set_required_version(self->m_canvasGLArea, 3, 2);
     g_signal_connect_swapped(self->m_canvasGLArea, "render", (GCallback)canvas_render, self);
     g_signal_connect_swapped(self->m_canvasGLArea, "realize", (GCallback)canvas_realize, self);
+    g_signal_connect_swapped(self->m_canvasGLArea, "unrealize", (GCallback)canvas_unrealize, self);
 
     // finally, unref the builder
     g_object_unref(builder);
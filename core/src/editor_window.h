@@ -10,12 +10,22 @@
 #include <gdk/gdk.h>  // GdkRGBA
 #include <gtk/gtk.h>
 
-/* The rate (in milliseconds) at which the gui checks if the mouse has moved
-from its previous position. */
-#define MOUSE_HOLD_POLL_RATE_MS 150
-
 G_BEGIN_DECLS
 
+/* The largest the canvas area of a window will ask to be. Larger images are
+scrolled within it. */
+#define CANVAS_MAX_VIEW_WIDTH 1600
+#define CANVAS_MAX_VIEW_HEIGHT 1000
+
+/* How many screen pixels one notch of the scroll wheel pans the canvas by. */
+#define CANVAS_SCROLL_STEP 64
+
+/* How far the canvas can be zoomed out and in, and how much one notch of
+ctrl+scroll (or one ctrl+plus / ctrl+minus) zooms it by. */
+#define CANVAS_MIN_ZOOM (1.0/64.0)
+#define CANVAS_MAX_ZOOM 32.0
+#define CANVAS_ZOOM_STEP 1.25
+
 #define EDITOR_WINDOW_TYPE_WINDOW (editor_window_get_type ())
 G_DECLARE_FINAL_TYPE(EditorWindow, editor_window, EDITOR_WINDOW, WINDOW, GtkWindow)
 
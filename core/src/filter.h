@@ -7,7 +7,8 @@
 #ifndef FILTER_H_
 #define FILTER_H_
 
-#include <gdk/gdk.h>  // GdkRGBA
+#include "color.h"  // Color
+#include "kernel.h"  // Kernel
 #include "pixel_buffer.h"  // PixelBuffer
 
 typedef enum filtertype {
@@ -63,6 +64,24 @@ typedef struct threshold_params {
     double cutoff;
 } ThresholdParams;
 
+/* Sets how many threads each filter application is split across (1 to
+however many it can use), for every thread. */
+void filter_set_num_threads(int numThreads);
+
+/* Returns how many threads each filter application is split across. */
+int filter_get_num_threads();
+
+/* Returns true if 'type' is a convolution filter (each pixel depends on its
+neighbours), false if it is a basic one (each pixel depends only on itself). */
+int filter_is_convolution(FilterType type);
+
+/* Returns 'color' with the basic filter 'type' applied to it, clamped to 0 - 1. */
+Color filter_apply_to_pixel(FilterType type, void *params, Color color);
+
+/* Returns a new kernel for the convolution filter 'type', to be freed with
+kernel_destroy(). */
+Kernel filter_create_kernel(FilterType type, void *params);
+
 /* Applies a basic filter to the input buffer. */
 void apply_basic_filter_to_pixelbuffer(FilterType type, void *params, PixelBuffer *buffer);
 
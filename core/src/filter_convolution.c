@@ -7,11 +7,13 @@
 #include "filter.h"
 
 #include "kernel.h"
+#include "kernel_cache.h"
 #include "utilities.h"
 
-#include <gdk/gdk.h>  // GdkRGBA
 #include <math.h>  // pow, sqrt
 #include <pthread.h> // pthread
+#include <stdatomic.h>  // atomic_int
+#include <stdio.h>  // printf
 
 /* How many threads to spawn for the filter application. I have found 25 is the
 goldilocks zone. On average, it reduces filter application times by a factor of 10. */
@@ -21,6 +23,10 @@ goldilocks zone. On average, it reduces filter application times by a factor of
 purposes. 0 is disabled, 1 is enabled. */
 #define MULTITHREADING 1
 
+/* How many of the NUM_THREADS threads filters actually spawn, so callers
+running several images at once can share the cores out between them. */
+static atomic_int s_numThreads = NUM_THREADS;
+
 
 
 //
@@ -97,6 +103,31 @@ Kernel create_edge_detect_kernel() {
 }
 
 
+void filter_set_num_threads(int numThreads) {
+    atomic_store(&s_numThreads, numThreads < 1 ? 1 : (numThreads > NUM_THREADS ? NUM_THREADS : numThreads));
+}
+
+int filter_get_num_threads() {
+    return atomic_load(&s_numThreads);
+}
+
+int filter_is_convolution(FilterType type) {
+    return type == GAUSSIANBLUR || type == MOTIONBLUR || type == SHARPEN || type == EDGEDETECT;
+}
+
+Kernel filter_create_kernel(FilterType type, void *params) {
+    if (type == GAUSSIANBLUR) {
+        return create_gaussian_blur_kernel((GaussianBlurParams *)params);
+    }
+    else if (type == MOTIONBLUR) {
+        return create_motion_blur_kernel((MotionBlurParams *)params);
+    }
+    else if (type == SHARPEN) {
+        return create_sharpen_kernel((SharpenParams *)params);
+    }
+    return create_edge_detect_kernel();
+}
+
 
 //
 // CONVOLUTION FILTER application methods
@@ -140,7 +171,7 @@ void* convolution_worker(void *data) {
     for (int y = 0; y < h; y++) {
         for (int x = start; x <= end; x++) {
             // accumulator
-            GdkRGBA accum = {0.0, 0.0, 0.0, 1.0};
+            Color accum = {0.0, 0.0, 0.0, 1.0};
 
             // convolve the kernel over the current pixel
             for (int v = 0; v < args->kernel->edgeLength; v++) {
@@ -154,15 +185,15 @@ void* convolution_worker(void *data) {
                         v_onBuffer = int_clamp(v_onBuffer, 0, args->read->height-1);
 
                         // calculate the value of the current pixel convolved
-                        GdkRGBA currentValue = GdkRGBA_scale(pixelbuffer_get_pixel(args->read,
+                        Color currentValue = Color_scale(pixelbuffer_get_pixel(args->read,
                             u_onBuffer, v_onBuffer), kernel_get_value(args->kernel, u, v));
 
-                        accum = GdkRGBA_add(accum, currentValue);
+                        accum = Color_add(accum, currentValue);
                 }
             }
 
             // and set the updated pixel
-            pixelbuffer_set_pixel(args->write, x, y, GdkRGBA_clamp(accum, 0.0, 1.0));
+            pixelbuffer_set_pixel(args->write, x, y, Color_clamp(accum, 0.0, 1.0));
         }
     }
 
@@ -171,49 +202,37 @@ void* convolution_worker(void *data) {
 
 
 void apply_convolution_filter_to_pixelbuffer(FilterType type, void *params, PixelBuffer *buffer) {
-    Kernel kernel;
-
-    if (type == GAUSSIANBLUR) {
-        kernel = create_gaussian_blur_kernel((GaussianBlurParams *)params);
-    }
-    else if (type == MOTIONBLUR) {
-        kernel = create_motion_blur_kernel((MotionBlurParams *)params);
-    }
-    else if (type == SHARPEN) {
-        kernel = create_sharpen_kernel((SharpenParams *)params);
-    }
-    else if (type == EDGEDETECT) {
-        kernel = create_edge_detect_kernel();
-    }
+    Kernel *kernel = kernel_cache_get(type, params);
 
     // convolution filter requires a copy of the pixelbuffer.
     PixelBuffer copy = pixelbuffer_copy(buffer);
 
     if (MULTITHREADING == 1) {
         // create an array of thread ids, and int ids to pass into the helper threads.
+        int numThreads = filter_get_num_threads();
         pthread_t tids[NUM_THREADS];
         ConvolutionWorkerArgs args[NUM_THREADS];
 
         /* we define these first, and each in their own array or else race
         conditions in the worker thread can cause multiple threads to get the
         same id, and consequently work on the same part of the image. */
-        for (int i = 0; i < NUM_THREADS; i++) {
+        for (int i = 0; i < numThreads; i++) {
             ConvolutionWorkerArgs arg;
             arg.read = &copy;
             arg.write = buffer;
-            arg.kernel = &kernel;
+            arg.kernel = kernel;
             arg.i = i;
-            arg.n = NUM_THREADS;
+            arg.n = numThreads;
             args[i] = arg;
         }
 
         // spawn the helper threads and pass in the necessary info as a struct.
-        for (int i = 0; i < NUM_THREADS; i++) {
+        for (int i = 0; i < numThreads; i++) {
             pthread_create(&tids[i], NULL, convolution_worker, (void *)(&args[i]));
         }
 
         // then wait for each thread to finish.
-        for (int i = 0; i < NUM_THREADS; i++) {
+        for (int i = 0; i < numThreads; i++) {
             pthread_join(tids[i], NULL);
         }
     }
@@ -221,34 +240,34 @@ void apply_convolution_filter_to_pixelbuffer(FilterType type, void *params, Pixe
         for (int y = 0; y < buffer->height; y++) {
             for (int x = 0; x < buffer->width; x++) {
                 // accumulator
-                GdkRGBA accum = {0.0, 0.0, 0.0, 1.0};
+                Color accum = {0.0, 0.0, 0.0, 1.0};
 
                 // convolve the kernel over the current pixel
-                for (int v = 0; v < kernel.edgeLength; v++) {
-                    for (int u = 0; u < kernel.edgeLength; u++) {
+                for (int v = 0; v < kernel->edgeLength; v++) {
+                    for (int u = 0; u < kernel->edgeLength; u++) {
                         // calculate the position of the current kernel value on the buffer
-                        int u_onBuffer = x + (u - kernel.radius);
-                        int v_onBuffer = y + (v - kernel.radius);
+                        int u_onBuffer = x + (u - kernel->radius);
+                        int v_onBuffer = y + (v - kernel->radius);
 
                         // and clamp it to be within the buffer bounds
                         u_onBuffer = int_clamp(u_onBuffer, 0, buffer->width-1);
                         v_onBuffer = int_clamp(v_onBuffer, 0, buffer->height-1);
 
                         // calculate the value of the current pixel convolved
-                        GdkRGBA currentValue = GdkRGBA_scale(pixelbuffer_get_pixel(&copy,
-                            u_onBuffer, v_onBuffer), kernel_get_value(&kernel, u, v));
+                        Color currentValue = Color_scale(pixelbuffer_get_pixel(&copy,
+                            u_onBuffer, v_onBuffer), kernel_get_value(kernel, u, v));
 
-                        accum = GdkRGBA_add(accum, currentValue);
+                        accum = Color_add(accum, currentValue);
                     }
                 }
 
                 // and set the updated pixel
-                pixelbuffer_set_pixel(buffer, x, y, GdkRGBA_clamp(accum, 0.0, 1.0));
+                pixelbuffer_set_pixel(buffer, x, y, Color_clamp(accum, 0.0, 1.0));
             }
         }
     }
 
     // and free the temporarily allocated memory.
     pixelbuffer_destroy(&copy);
-    kernel_destroy(&kernel);
+    kernel_cache_release(kernel);
 }
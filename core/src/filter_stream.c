@@ -0,0 +1,313 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "filter_stream.h"
+
+#include "image_io.h"
+#include "kernel.h"
+#include "kernel_cache.h"
+#include "utilities.h"
+
+#include <pthread.h>  // pthread
+#include <stdlib.h>  // malloc, calloc, free
+#include <string.h>  // memcpy
+
+/* The most threads each strip is split across (fewer if
+filter_set_num_threads() says so). */
+#define NUM_STREAM_THREADS 8
+
+/* Strips with fewer pixels than this are filtered on the calling thread. */
+#define MIN_THREADED_PIXELS (128*128)
+
+
+
+//
+// STAGE methods
+//
+
+/* One filter of the chain, and the rows it is holding on to. */
+typedef struct streamstage {
+    FilterType type;
+    void *params;
+
+    // convolution filters read 'radius' rows either side of every row they
+    // write. Basic filters have a radius of 0.
+    int convolution;
+    Kernel *kernel;
+    int radius;
+
+    // the last 'capacity' rows received, row y in slot y % capacity
+    Color *ring;
+    int capacity;
+
+    // one strip of filtered rows, on their way to the next stage
+    Color *out;
+
+    // how many rows have come in, and how many have been filtered and passed on
+    int received;
+    int emitted;
+} StreamStage;
+
+/* Everything the decoder's row sink needs to run the chain. */
+typedef struct filterstream {
+    const char *dstPath;
+    int compressionLevel;
+    int bitDepth;
+
+    int width;
+    int height;
+    int stripRows;
+
+    FilterStep *steps;
+    StreamStage *stages;
+    int numStages;
+
+    // a decoded row, converted for the first stage exactly as image_io_load()
+    // would (a pixelbuffer one row tall), and a filtered row, converted for the writer
+    PixelBuffer in;
+    float *floats;
+
+    ImageRowWriter writer;
+    int writerOpen;
+} FilterStream;
+
+/* Returns row 'y' (clamped to the image) of the rows held by 'stage'. */
+Color* stream_stage_row(StreamStage *stage, int y, int height, int width) {
+    y = int_clamp(y, 0, height - 1);
+    return stage->ring + (size_t)(y % stage->capacity) * width;
+}
+
+
+
+//
+// WORKER methods
+//
+
+/* a struct to hold everything one thread filtering part of a strip needs. */
+typedef struct stream_worker_args {
+    StreamStage *stage;
+    int width;
+    int height;
+
+    // the first row of the strip, and the rows of it this thread does
+    int y0;
+    int start;
+    int end;
+} StreamWorkerArgs;
+
+/* Filters rows start to end of the strip starting at y0 into stage->out,
+with exactly the same arithmetic as the pixelbuffer filters, so the results
+match them bit for bit. */
+void* stream_worker(void *data) {
+    StreamWorkerArgs *args = (StreamWorkerArgs *)data;
+    StreamStage *stage = args->stage;
+    int w = args->width;
+    Kernel *kernel = stage->kernel;
+
+    // the rows the kernel covers, resolved once per output row
+    Color **rows = malloc(sizeof(Color *) * (2 * stage->radius + 1));
+
+    for (int i = args->start; i < args->end; i++) {
+        int y = args->y0 + i;
+        Color *dst = stage->out + (size_t)i * w;
+
+        if (!stage->convolution) {
+            Color *src = stream_stage_row(stage, y, args->height, w);
+            for (int x = 0; x < w; x++) {
+                dst[x] = filter_apply_to_pixel(stage->type, stage->params, src[x]);
+            }
+            continue;
+        }
+
+        for (int v = 0; v < kernel->edgeLength; v++) {
+            rows[v] = stream_stage_row(stage, y + (v - kernel->radius), args->height, w);
+        }
+
+        for (int x = 0; x < w; x++) {
+            // accumulator
+            Color accum = {0.0, 0.0, 0.0, 1.0};
+
+            // convolve the kernel over the current pixel
+            for (int v = 0; v < kernel->edgeLength; v++) {
+                for (int u = 0; u < kernel->edgeLength; u++) {
+                    int u_onBuffer = int_clamp(x + (u - kernel->radius), 0, w - 1);
+                    Color currentValue = Color_scale(rows[v][u_onBuffer], kernel_get_value(kernel, u, v));
+                    accum = Color_add(accum, currentValue);
+                }
+            }
+
+            dst[x] = Color_clamp(accum, 0.0, 1.0);
+        }
+    }
+
+    free(rows);
+    return NULL;
+}
+
+/* Filters the 'count' rows of 'stage' starting at its next unfiltered row
+into stage->out, split across threads. */
+void stream_filter_strip(FilterStream *self, StreamStage *stage, int count) {
+    int numThreads = filter_get_num_threads();
+    numThreads = numThreads < NUM_STREAM_THREADS ? numThreads : NUM_STREAM_THREADS;
+    if (count < numThreads) {
+        numThreads = count;
+    }
+    if ((size_t)self->width * count * (2 * stage->radius + 1) < MIN_THREADED_PIXELS) {
+        numThreads = 1;
+    }
+
+    pthread_t tids[NUM_STREAM_THREADS];
+    StreamWorkerArgs args[NUM_STREAM_THREADS];
+    for (int i = 0; i < numThreads; i++) {
+        StreamWorkerArgs arg = {stage, self->width, self->height, stage->emitted,
+            (count * i) / numThreads, (count * (i + 1)) / numThreads};
+        args[i] = arg;
+    }
+
+    // the calling thread takes the first share itself
+    for (int i = 1; i < numThreads; i++) {
+        pthread_create(&tids[i], NULL, stream_worker, (void *)(&args[i]));
+    }
+    stream_worker((void *)(&args[0]));
+    for (int i = 1; i < numThreads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+}
+
+
+
+//
+// STREAM methods
+//
+
+/* Hands row 'y' to stage 'index' of the chain, or to the writer once it is
+past the last stage. Whenever that completes a strip (or the image), the
+strip is filtered and its rows handed on in turn. Returns false if a row
+could not be written. */
+int stream_push_row(FilterStream *self, int index, const Color *row) {
+    if (index == self->numStages) {
+        for (int x = 0; x < self->width; x++) {
+            self->floats[4*x + 0] = row[x].red;
+            self->floats[4*x + 1] = row[x].green;
+            self->floats[4*x + 2] = row[x].blue;
+            self->floats[4*x + 3] = row[x].alpha;
+        }
+        return self->writer.row(self->writer.data, self->floats);
+    }
+
+    // this overwrites the oldest row, which no row left to filter needs any more
+    StreamStage *stage = &self->stages[index];
+    memcpy(stream_stage_row(stage, stage->received, self->height, self->width), row, sizeof(Color) * self->width);
+    stage->received++;
+
+    // a row can be filtered once the row 'radius' below it is in (or the last row is)
+    int ready = stage->received == self->height ? self->height : stage->received - stage->radius;
+    while (stage->emitted < ready
+            && (ready - stage->emitted >= self->stripRows || stage->received == self->height)) {
+        int count = ready - stage->emitted;
+        count = count < self->stripRows ? count : self->stripRows;
+
+        stream_filter_strip(self, stage, count);
+        stage->emitted += count;
+        for (int i = 0; i < count; i++) {
+            if (!stream_push_row(self, index + 1, stage->out + (size_t)i * self->width)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/* Sets up every stage for an image of width x height, and opens the writer. */
+int stream_sink_begin(void *data, int width, int height) {
+    FilterStream *self = (FilterStream *)data;
+    self->width = width;
+    self->height = height;
+
+    self->stages = calloc(self->numStages, sizeof(StreamStage));
+    for (int i = 0; i < self->numStages; i++) {
+        StreamStage *stage = &self->stages[i];
+        stage->type = self->steps[i].type;
+        stage->params = self->steps[i].params;
+        stage->convolution = filter_is_convolution(stage->type);
+        if (stage->convolution) {
+            stage->kernel = kernel_cache_get(stage->type, stage->params);
+            stage->radius = stage->kernel->radius;
+        }
+
+        // a strip and the rows either side of it, but never more than the whole image
+        stage->capacity = self->stripRows + 2 * stage->radius;
+        stage->capacity = stage->capacity < height ? stage->capacity : height;
+        stage->ring = malloc(sizeof(Color) * width * (size_t)stage->capacity);
+        stage->out = malloc(sizeof(Color) * width * (size_t)self->stripRows);
+    }
+
+    self->in = pixelbuffer_new(width, 1);
+    self->floats = malloc(sizeof(float) * 4 * width);
+    self->writerOpen = image_io_open_writer(self->dstPath, width, height,
+        self->compressionLevel, self->bitDepth, &self->writer);
+    return self->writerOpen;
+}
+
+/* Converts a decoded row the same way loading the whole image would, and
+starts it down the chain. Rows always arrive in order, so 'y' is not needed. */
+int stream_sink_row(void *data, int y, const void *rgba, ImageRowFormat format) {
+    FilterStream *self = (FilterStream *)data;
+    (void)y;
+    image_io_set_row(&self->in, 0, rgba, format);
+    return stream_push_row(self, 0, self->in.data);
+}
+
+size_t filter_stream_estimate_bytes(int width, FilterStep *steps, int numSteps, int stripRows) {
+    stripRows = stripRows > 0 ? stripRows : FILTER_STREAM_STRIP_ROWS;
+
+    // every stage's ring and strip, plus the rows on their way in and out
+    size_t numRows = 2;
+    for (int i = 0; i < numSteps; i++) {
+        int radius = 0;
+        if (filter_is_convolution(steps[i].type)) {
+            Kernel *kernel = kernel_cache_get(steps[i].type, steps[i].params);
+            radius = kernel->radius;
+            kernel_cache_release(kernel);
+        }
+        numRows += 2 * stripRows + 2 * radius;
+    }
+    return numRows * width * sizeof(Color);
+}
+
+int filter_stream_file(const char *srcPath, const char *dstPath, FilterStep *steps, int numSteps, int stripRows, int compressionLevel, int bitDepth) {
+    FilterStream stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.dstPath = dstPath;
+    stream.compressionLevel = compressionLevel;
+    stream.bitDepth = bitDepth;
+    stream.stripRows = stripRows > 0 ? stripRows : FILTER_STREAM_STRIP_ROWS;
+    stream.steps = steps;
+    stream.numStages = numSteps;
+
+    ImageRowSink sink = {stream_sink_begin, stream_sink_row, &stream, NULL};
+    int ok = image_io_load_rows(srcPath, &sink);
+    if (stream.writerOpen) {
+        ok = stream.writer.finish(stream.writer.data, ok);
+    }
+    else {
+        ok = 0;
+    }
+
+    if (stream.stages != NULL) {
+        for (int i = 0; i < stream.numStages; i++) {
+            if (stream.stages[i].convolution) {
+                kernel_cache_release(stream.stages[i].kernel);
+            }
+            free(stream.stages[i].ring);
+            free(stream.stages[i].out);
+        }
+        free(stream.stages);
+    }
+    pixelbuffer_destroy(&stream.in);
+    free(stream.floats);
+    return ok;
+}
@@ -0,0 +1,45 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef FILTER_STREAM_H_
+#define FILTER_STREAM_H_
+
+#include "filter.h"  // FilterType
+
+#include <stddef.h>  // size_t
+
+/* How many rows each filter works on at once, if not told otherwise. */
+#define FILTER_STREAM_STRIP_ROWS 64
+
+/* One filter of a chain, and its params (NULL for the filters that have none). */
+typedef struct filterstep {
+    FilterType type;
+    void *params;
+} FilterStep;
+
+/* Applies 'numSteps' filters, one after the other, to the image at 'srcPath'
+and writes the result to 'dstPath' (see image_io_open_writer() for the formats
+and what 'compressionLevel' and 'bitDepth' mean), without ever holding the
+whole image.
+
+The source is decoded a row at a time, and each filter keeps a ring of just
+the rows it still needs: a strip of 'stripRows' rows (0 for the default), plus
+the radius of its kernel above and below. Once a strip's rows are all in, it
+is filtered (split across threads) and handed on to the next filter, and rows
+that come out of the last one are written out straight away. Memory is then
+O(width x (strip + 2 x radius)) per filter, however tall the image is. Edges
+are clamped, so the result is the same as loading the image, applying the
+filters to the pixelbuffer and saving it.
+
+Returns false (and prints why) if the source could not be decoded or the
+result could not be written, in which case 'dstPath' is left as it was. */
+int filter_stream_file(const char *srcPath, const char *dstPath, FilterStep *steps, int numSteps, int stripRows, int compressionLevel, int bitDepth);
+
+/* Returns about how much memory filter_stream_file() needs for an image
+'width' pixels wide, whatever its height. */
+size_t filter_stream_estimate_bytes(int width, FilterStep *steps, int numSteps, int stripRows);
+
+#endif  // FILTER_STREAM_H_
@@ -18,37 +18,47 @@
 
 /* These function headers are declared here rather than in flood_fill.h because
 they should not really be accessable to the programmer. */
-void flood_fill_stage2(PixelBuffer *buffer, int x, int y, GdkRGBA target, GdkRGBA replacement);
-void flood_fill_stage3(PixelBuffer *buffer, int x, int y, GdkRGBA target, GdkRGBA replacement);
+void flood_fill_stage2(PixelBuffer *buffer, int x, int y, Color target, Color replacement, PixelRect *bounds);
+void flood_fill_stage3(PixelBuffer *buffer, int x, int y, Color target, Color replacement, PixelRect *bounds);
 
 
 
 /* Returns whether the current pixel needs replacing, based on the target color */
-int pixelNeedsReplacement(PixelBuffer *buffer, int x, int y, GdkRGBA target) {
-    return GdkRGBA_equals(pixelbuffer_get_pixel(buffer, x, y), target, 0.05);
+int pixelNeedsReplacement(PixelBuffer *buffer, int x, int y, Color target) {
+    return Color_equals(pixelbuffer_get_pixel(buffer, x, y), target, 0.05);
 }
 
-void flood_fill(PixelBuffer *buffer, int x, int y, GdkRGBA target, GdkRGBA replacement) {
+/* Replaces the pixel at (x, y) and grows the bounds to include it. */
+void replacePixel(PixelBuffer *buffer, int x, int y, Color replacement, PixelRect *bounds) {
+    pixelbuffer_set_pixel(buffer, x, y, replacement);
+    PixelRect pixel = {x, y, x + 1, y + 1};
+    *bounds = pixelrect_union(*bounds, pixel);
+}
+
+PixelRect flood_fill(PixelBuffer *buffer, int x, int y, Color target, Color replacement) {
+    PixelRect bounds = pixelrect_empty();
+
     if (x < 0 || x >= buffer->width) {
-        return;
+        return bounds;
     }
 
     if (y < 0 || y >= buffer->height) {
-        return;
+        return bounds;
     }
 
-    if (GdkRGBA_equals(target, replacement, 0.05)) {
-        return;
+    if (Color_equals(target, replacement, 0.05)) {
+        return bounds;
     }
 
     if (!pixelNeedsReplacement(buffer, x, y, target)) {
-        return;
+        return bounds;
     }
 
-    flood_fill_stage2(buffer, x, y, target, replacement);
+    flood_fill_stage2(buffer, x, y, target, replacement, &bounds);
+    return bounds;
 }
 
-void flood_fill_stage2(PixelBuffer *buffer, int x, int y, GdkRGBA target, GdkRGBA replacement) {
+void flood_fill_stage2(PixelBuffer *buffer, int x, int y, Color target, Color replacement, PixelRect *bounds) {
     while (1) {
         int ox = x;
         int oy = y;
@@ -65,10 +75,10 @@ void flood_fill_stage2(PixelBuffer *buffer, int x, int y, GdkRGBA target, GdkRGB
             break;
         }
     }
-    flood_fill_stage3(buffer, x, y, target, replacement);
+    flood_fill_stage3(buffer, x, y, target, replacement, bounds);
 }
 
-void flood_fill_stage3(PixelBuffer *buffer, int x, int y, GdkRGBA target, GdkRGBA replacement) {
+void flood_fill_stage3(PixelBuffer *buffer, int x, int y, Color target, Color replacement, PixelRect *bounds) {
     int lastRowLength = 0;
     do {
         int rowLength = 0;
@@ -84,29 +94,29 @@ void flood_fill_stage3(PixelBuffer *buffer, int x, int y, GdkRGBA target, GdkRGB
         }
         else {
             for (; x != 0 && pixelNeedsReplacement(buffer, x-1, y, target); rowLength++, lastRowLength++) {
-                pixelbuffer_set_pixel(buffer, --x, y, replacement);
+                replacePixel(buffer, --x, y, replacement, bounds);
 
                 if (y != 0 && pixelNeedsReplacement(buffer, x, y-1, target)) {
-                    flood_fill_stage2(buffer, x, y-1, target, replacement);
+                    flood_fill_stage2(buffer, x, y-1, target, replacement, bounds);
                 }
             }
         }
 
         for (; sx < buffer->width && pixelNeedsReplacement(buffer, sx, y, target); rowLength++, sx++) {
-            pixelbuffer_set_pixel(buffer, sx, y, replacement);
+            replacePixel(buffer, sx, y, replacement, bounds);
         }
 
         if (rowLength < lastRowLength) {
             for (int end = x + lastRowLength; ++sx < end; ) {
                 if (pixelNeedsReplacement(buffer, sx, y, target)) {
-                    flood_fill_stage3(buffer, sx, y, target, replacement);
+                    flood_fill_stage3(buffer, sx, y, target, replacement, bounds);
                 }
             }
         }
         else if (rowLength > lastRowLength && y != 0) {
             for (int ux = x + lastRowLength; ++ux<sx; ) {
                 if (pixelNeedsReplacement(buffer, ux, y-1, target)) {
-                    flood_fill_stage2(buffer, ux, y-1, target, replacement);
+                    flood_fill_stage2(buffer, ux, y-1, target, replacement, bounds);
                 }
             }
         }
@@ -7,10 +7,11 @@
 #ifndef FLOOD_FILL_H_
 #define FLOOD_FILL_H_
 
-#include <gdk/gdk.h>  // GdkRGBA
+#include "color.h"  // Color
 #include "pixel_buffer.h"  // PixelBuffer
 
-/* Fills all pixels of target color connected to (x, y) with replacement color. */
-void flood_fill(PixelBuffer *buffer, int x, int y, GdkRGBA target, GdkRGBA replacement);
+/* Fills all pixels of target color connected to (x, y) with replacement color.
+Returns the bounds of the pixels that were filled. */
+PixelRect flood_fill(PixelBuffer *buffer, int x, int y, Color target, Color replacement);
 
 #endif  // FLOOD_FILL_H_
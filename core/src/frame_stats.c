@@ -0,0 +1,84 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "frame_stats.h"
+
+#include <stdio.h>  // printf
+#include <stdlib.h>  // getenv
+
+/* Starts a new summary period at 'now'. */
+void frame_stats_reset(FrameStats *self, long long now) {
+    self->periodStart = now;
+    self->numFrames = 0;
+    self->numSlowFrames = 0;
+    self->renderTotal = 0;
+    self->renderMax = 0;
+    self->intervalTotal = 0;
+    self->intervalMax = 0;
+    self->numIntervals = 0;
+    self->bytesUploaded = 0;
+}
+
+FrameStats frame_stats_new() {
+    FrameStats tmp;
+    tmp.enabled = getenv("TINYPAINT_FRAME_STATS") != NULL;
+    tmp.lastFrame = 0;
+    frame_stats_reset(&tmp, 0);
+    return tmp;
+}
+
+/* Prints a summary of the period ending at 'end'. */
+void frame_stats_report(FrameStats *self, long long end) {
+    // a single frame still took at least a frame's worth of time
+    long long duration = end - self->periodStart;
+    duration = duration > FRAME_STATS_TARGET_US ? duration : FRAME_STATS_TARGET_US;
+    double seconds = duration / 1000000.0;
+
+    printf("frames: %d (%.1f/s), render avg %.2f ms max %.2f ms, interval avg %.2f ms max %.2f ms, "
+        "%d missed 60 Hz, %.1f MB/s uploaded\n",
+        self->numFrames, self->numFrames / seconds,
+        self->renderTotal / 1000.0 / self->numFrames, self->renderMax / 1000.0,
+        self->numIntervals > 0 ? self->intervalTotal / 1000.0 / self->numIntervals : 0.0,
+        self->intervalMax / 1000.0, self->numSlowFrames,
+        self->bytesUploaded / (1024.0 * 1024.0) / seconds);
+    fflush(stdout);
+}
+
+void frame_stats_record(FrameStats *self, long long frameTime, long long renderTime, size_t bytesUploaded) {
+    if (!self->enabled) {
+        return;
+    }
+
+    // a long gap means the canvas went idle, so close off the burst before it
+    long long interval = frameTime - self->lastFrame;
+    if (self->lastFrame == 0 || interval >= FRAME_STATS_IDLE_US) {
+        if (self->numFrames > 0) {
+            frame_stats_report(self, self->lastFrame);
+        }
+        frame_stats_reset(self, frameTime);
+    }
+    else if (interval > 0) {
+        self->intervalTotal += interval;
+        self->intervalMax = interval > self->intervalMax ? interval : self->intervalMax;
+        self->numIntervals++;
+
+        // a little slack, since frame times jitter around the refresh interval
+        if (interval > FRAME_STATS_TARGET_US + FRAME_STATS_TARGET_US / 4) {
+            self->numSlowFrames++;
+        }
+    }
+    self->lastFrame = frameTime;
+
+    self->numFrames++;
+    self->renderTotal += renderTime;
+    self->renderMax = renderTime > self->renderMax ? renderTime : self->renderMax;
+    self->bytesUploaded += bytesUploaded;
+
+    if (frameTime - self->periodStart >= FRAME_STATS_REPORT_US) {
+        frame_stats_report(self, frameTime);
+        frame_stats_reset(self, frameTime);
+    }
+}
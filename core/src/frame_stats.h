@@ -0,0 +1,51 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef FRAME_STATS_H_
+#define FRAME_STATS_H_
+
+#include <stddef.h>  // size_t
+
+/* The frame interval to hold, in microseconds (60 Hz). */
+#define FRAME_STATS_TARGET_US 16667
+
+/* Gaps between renders longer than this mean the canvas was idle, not that a
+frame was slow, so they are left out of the interval figures. */
+#define FRAME_STATS_IDLE_US 250000
+
+/* How often to print a summary, in microseconds. */
+#define FRAME_STATS_REPORT_US 1000000
+
+/* Collects how long each canvas render takes and how far apart they are, and
+prints a summary once a second while the canvas is being redrawn, and at the
+end of each burst of redraws. Only enabled when TINYPAINT_FRAME_STATS is set
+in the environment. */
+typedef struct framestats {
+    int enabled;
+
+    // when the current summary period started, and the last frame in it
+    long long periodStart;
+    long long lastFrame;
+
+    int numFrames;
+    int numSlowFrames;
+    long long renderTotal;
+    long long renderMax;
+    long long intervalTotal;
+    long long intervalMax;
+    int numIntervals;
+    size_t bytesUploaded;
+} FrameStats;
+
+/* Returns new, empty framestats. */
+FrameStats frame_stats_new();
+
+/* Records one render: the frame clock time it was drawn for, how long the
+render took, and how many bytes of texture it uploaded. All times are in
+microseconds. */
+void frame_stats_record(FrameStats *self, long long frameTime, long long renderTime, size_t bytesUploaded);
+
+#endif  // FRAME_STATS_H_
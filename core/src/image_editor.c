@@ -6,11 +6,11 @@
 
 #include "image_editor.h"
 
-#include "lodepng.h"
 #include "filter.h"
+#include "image_io.h"
 #include "utilities.h"
 
-#include <math.h>  // pow, sqrt
+#include <math.h>  // floor, sqrt
 
 
 
@@ -59,6 +59,80 @@ void image_editor_history_update(ImageEditor *self) {
     self->m_undoStates[self->m_undoIndex] = copy;
 }
 
+/* Empties the history and starts it over with 'buffer', which the editor
+takes ownership of. */
+void image_editor_init_from_pixelbuffer(ImageEditor *self, PixelBuffer buffer) {
+    // clear the history states, if for by some reason they were not already empty...
+    image_editor_history_clear_redo(self);
+    image_editor_history_clear_undo(self);
+
+    self->m_undoStates[self->m_undoIndex] = buffer;
+
+    // and size the stroke coverage to match
+    strokebuffer_destroy(&(self->m_stroke));
+    self->m_stroke = strokebuffer_new(buffer.width, buffer.height);
+
+    image_editor_invalidate(self);
+}
+
+/* Grows the dirty rect to include 'rect'. */
+void image_editor_mark_dirty(ImageEditor *self, PixelRect rect) {
+    self->m_dirtyRect = pixelrect_union(self->m_dirtyRect, rect);
+}
+
+/* Adds a dab of the stroke's tool, centered on the pixel containing (x, y), to
+the stroke's coverage. */
+void image_editor_stroke_dab(ImageEditor *self, double posX, double posY) {
+    PixelBuffer *current = image_editor_get_current_pixelbuffer(self);
+    int x = (int)floor(posX);
+    int y = (int)floor(posY);
+    if (x >= 0 && x < current->width && y >= 0 && y < current->height) {
+        strokebuffer_add_dab(&(self->m_stroke), self->m_strokeTool.mask, x, y, self->m_strokeTool.accumulateCoverage);
+    }
+}
+
+/* Blends the coverage added since the last composite onto the current buffer.
+The blend always starts from the buffer as it was before the stroke began (the
+previous history state), so each pixel is written once per composite no matter
+how many dabs overlapped it. */
+void image_editor_stroke_composite(ImageEditor *self) {
+    PixelRect r = strokebuffer_take_pending(&(self->m_stroke));
+    PixelBuffer *current = image_editor_get_current_pixelbuffer(self);
+    PixelBuffer *base = &(self->m_undoStates[self->m_undoIndex - 1]);
+
+    for (int y = r.y0; y < r.y1; y++) {
+        tool_composite_row(&(self->m_strokeTool), current, base, r.x0, y,
+            strokebuffer_get_coverage(&(self->m_stroke), r.x0, y), r.x1 - r.x0);
+    }
+
+    image_editor_mark_dirty(self, r);
+}
+
+/* Lays dabs along the straight line from the stroke's last point to (x, y). */
+void image_editor_stroke_segment(ImageEditor *self, double x, double y) {
+    double prevX = self->m_strokeX;
+    double prevY = self->m_strokeY;
+    double distance = sqrt((x-prevX)*(x-prevX) + (y-prevY)*(y-prevY));
+    double spacing = tool_get_spacing(&(self->m_strokeTool));
+
+    // a move that goes nowhere lays no dabs, and would divide by zero below
+    if (distance <= 0.0) {
+        return;
+    }
+
+    // the first dab lands where the spacing left over from the last segment runs out
+    double travelled = spacing - self->m_strokeRemainder;
+    for (; travelled <= distance; travelled += spacing) {
+        double percent = travelled / distance;
+        image_editor_stroke_dab(self, double_lerp(prevX, x, percent), double_lerp(prevY, y, percent));
+    }
+
+    // then carry whatever is left of the path over to the next segment
+    self->m_strokeRemainder = distance - (travelled - spacing);
+    self->m_strokeX = x;
+    self->m_strokeY = y;
+}
+
 
 
 //
@@ -70,148 +144,134 @@ ImageEditor image_editor_new() {
     tmp.m_tool = tool_new();
     tmp.m_undoIndex = 0;
     tmp.m_redoIndex = 0;
+    tmp.m_stroke = strokebuffer_new(0, 0);
+    tmp.m_strokeActive = 0;
+    tmp.m_strokeRemainder = 0.0;
+    tmp.m_strokeX = 0.0;
+    tmp.m_strokeY = 0.0;
+    tmp.m_dirtyRect = pixelrect_empty();
     return tmp;
 }
 
-void image_editor_init_from_parameters(ImageEditor *self, int width, int height, GdkRGBA backgroundColor) {
-    // clear the history states, if for by some reason they were not already empty...
-    image_editor_history_clear_redo(self);
-    image_editor_history_clear_undo(self);
-
-    self->m_undoStates[self->m_undoIndex] = pixelbuffer_new(width, height);
+void image_editor_init_from_parameters(ImageEditor *self, int width, int height, Color backgroundColor) {
+    image_editor_init_from_pixelbuffer(self, pixelbuffer_new(width, height));
     pixelbuffer_set_all_pixels(image_editor_get_current_pixelbuffer(self), backgroundColor);
 }
 
 void image_editor_init_from_file(ImageEditor *self, const char *filepath) {
     // assumes the gui ensures the input filepath is valid
-
-    unsigned error;
-    unsigned char *tmp;
-    unsigned width, height;
-
-    // load the png from the filepath
-    error = lodepng_decode32_file(&tmp, &width, &height, filepath);
-    if (error) {
-        printf("error %u: %s\n", error, lodepng_error_text(error));
-    }
-
-    // create the buffer with the correct size and default background color of white
-    GdkRGBA color = {1.0, 1.0, 1.0, 1.0};
-    image_editor_init_from_parameters(self, width, height, color);
-
-    // set all the pixels in the buffer as from the loaded file
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            int offset = (width * 4 * y) + (x*4);
-            color.red = tmp[offset + 0] / (double)255.0;
-            color.green = tmp[offset + 1] / (double)255.0;
-            color.blue = tmp[offset + 2] / (double)255.0;
-            color.alpha = tmp[offset + 3] / (double)255.0;
-            pixelbuffer_set_pixel(image_editor_get_current_pixelbuffer(self), x, y, GdkRGBA_clamp(color, 0.0, 1.0));
-        }
+    PixelBuffer loaded;
+    if (!image_io_load(filepath, &loaded)) {
+        Color white = {1.0, 1.0, 1.0, 1.0};
+        image_editor_init_from_parameters(self, 1, 1, white);
+        return;
     }
-
-    // free the temporary buffer
-    free(tmp);
+    image_editor_init_from_pixelbuffer(self, loaded);
 }
 
 void image_editor_destroy(ImageEditor *self) {
     image_editor_history_clear_redo(self);
     image_editor_history_clear_undo(self);
+    strokebuffer_destroy(&(self->m_stroke));
 }
 
 PixelBuffer* image_editor_get_current_pixelbuffer(ImageEditor *self) {
     return &(self->m_undoStates[self->m_undoIndex]);
 }
 
-void image_editor_save_current_pixelbuffer(ImageEditor *self, const char *filepath) {
-    // assumes gui enforces the passed in filepath is valid
+PixelRect image_editor_take_dirty_rect(ImageEditor *self) {
+    PixelRect tmp = self->m_dirtyRect;
+    self->m_dirtyRect = pixelrect_empty();
+    return tmp;
+}
 
-    // get the current buffer
+void image_editor_invalidate(ImageEditor *self) {
     PixelBuffer *current = image_editor_get_current_pixelbuffer(self);
+    PixelRect all = {0, 0, current->width, current->height};
+    self->m_dirtyRect = all;
+}
 
-    // allocate space for the temporary buffer
-    unsigned char *tmp = malloc(4 * current->width * current->height);
-
-    // fill the temporary buffer in the correct format
-    for (int y = 0; y < current->height; y++) {
-        for (int x = 0; x < current->width; x++) {
-            GdkRGBA color = pixelbuffer_get_pixel(current, x, y);
-            int offset = (current->width*4*y) + (x*4);
-            memset(tmp + offset + 0, color.red * 255, 1);
-            memset(tmp + offset + 1, color.green * 255, 1);
-            memset(tmp + offset + 2, color.blue * 255, 1);
-            memset(tmp + offset + 3, color.alpha * 255, 1);
-        }
-    }
-
-    // attempt to encode with lodepng library
-    unsigned error = lodepng_encode32_file(filepath, tmp, current->width, current->height);
-    if (error) {
-        printf("error %u: %s\n", error, lodepng_error_text(error));
-    }
-
-    // free the temporary buffer
-    free(tmp);
+void image_editor_save_current_pixelbuffer(ImageEditor *self, const char *filepath, int compressionLevel, int bitDepth) {
+    // assumes gui enforces the passed in filepath is valid
+    image_io_save(image_editor_get_current_pixelbuffer(self), filepath, compressionLevel, bitDepth, NULL);
 }
 
-void image_editor_stroke_start(ImageEditor *self, int x, int y) {
+void image_editor_stroke_start(ImageEditor *self, Tool *tool, double x, double y) {
     image_editor_history_update(self);
-    PixelBuffer *current = image_editor_get_current_pixelbuffer(self);
-    if (x >= 0 && x < current->width && y >= 0 && y < current->height) {
-        tool_apply_to_pixelbuffer(&(self->m_tool), current, x, y);
+    self->m_strokeTool = *tool;
+    self->m_strokeActive = 1;
+    self->m_strokeRemainder = 0.0;
+    self->m_strokeX = x;
+    self->m_strokeY = y;
+
+    // stamps are applied straight to the canvas, once
+    if (self->m_strokeTool.isStamp) {
+        image_editor_mark_dirty(self, tool_apply_to_pixelbuffer(&(self->m_strokeTool),
+            image_editor_get_current_pixelbuffer(self), (int)floor(x), (int)floor(y)));
+        return;
     }
-}
 
-void image_editor_stroke_hold(ImageEditor *self, int x, int y) {
-    PixelBuffer *current = image_editor_get_current_pixelbuffer(self);
+    image_editor_stroke_dab(self, x, y);
+    image_editor_stroke_composite(self);
+}
 
-    if (x >= 0 && x < current->width && y >= 0 && y < current->height) {
-        tool_apply_to_pixelbuffer(&(self->m_tool), current, x, y);
+void image_editor_stroke_hold(ImageEditor *self, int numDabs) {
+    if (self->m_strokeActive && !self->m_strokeTool.isStamp) {
+        for (int i = 0; i < numDabs; i++) {
+            image_editor_stroke_dab(self, self->m_strokeX, self->m_strokeY);
+        }
+        image_editor_stroke_composite(self);
     }
 }
 
-void image_editor_stroke_move(ImageEditor *self, int x, int y, int prevX, int prevY) {
-    if (!self->m_tool.isStamp) {
-        PixelBuffer *current = image_editor_get_current_pixelbuffer(self);
-
-        int distance = sqrt(pow(x-prevX, 2.0) + pow(y-prevY, 2.0));
-        int stepSize = (1-self->m_tool.fillRate) * (distance-1) + 1;
-
-        for (int i = 0; i < distance; i += stepSize) {
-            double percent = i/(double)distance;
-            int tmpX = (int)double_lerp(prevX, x, percent);
-            int tmpY = (int)double_lerp(prevY, y, percent);
+void image_editor_stroke_move(ImageEditor *self, double x, double y) {
+    double point[2] = {x, y};
+    image_editor_stroke_polyline(self, point, 1);
+}
 
-            if (tmpX >= 0 && tmpX < current->width && tmpY >= 0 && tmpY < current->height) {
-                tool_apply_to_pixelbuffer(&(self->m_tool), current, tmpX, tmpY);
-            }
+void image_editor_stroke_polyline(ImageEditor *self, const double *points, int numPoints) {
+    if (self->m_strokeActive && !self->m_strokeTool.isStamp) {
+        for (int i = 0; i < numPoints; i++) {
+            image_editor_stroke_segment(self, points[2*i + 0], points[2*i + 1]);
         }
+        image_editor_stroke_composite(self);
     }
 }
 
-void image_editor_stroke_end(ImageEditor *self, int x, int y) {
-    if (!self->m_tool.isStamp) {
-        PixelBuffer *current = image_editor_get_current_pixelbuffer(self);
-        if (x >= 0 && x < current->width && y >= 0 && y < current->height) {
-            tool_apply_to_pixelbuffer(&(self->m_tool), current, x, y);
-        }
+void image_editor_stroke_end(ImageEditor *self, double x, double y) {
+    if (self->m_strokeActive && !self->m_strokeTool.isStamp) {
+        image_editor_stroke_segment(self, x, y);
+        image_editor_stroke_dab(self, x, y);
+        image_editor_stroke_composite(self);
+        strokebuffer_clear(&(self->m_stroke));
     }
+    self->m_strokeActive = 0;
 }
 
 void image_editor_undo(ImageEditor *self) {
+    // the stroke in progress blends from the previous state, so leave it alone
+    if (self->m_strokeActive) {
+        return;
+    }
+
     if (self->m_undoIndex > 0 && self->m_undoIndex < MAX_HISTORY_STATES) {
         self->m_redoStates[self->m_redoIndex] = self->m_undoStates[self->m_undoIndex];
         self->m_redoIndex++;
         self->m_undoIndex--;
+        image_editor_invalidate(self);
     }
 }
 
 void image_editor_redo(ImageEditor *self) {
+    if (self->m_strokeActive) {
+        return;
+    }
+
     if (self->m_redoIndex > 0 && self->m_redoIndex < MAX_HISTORY_STATES) {
         self->m_redoIndex--;
         self->m_undoIndex++;
         self->m_undoStates[self->m_undoIndex] = self->m_redoStates[self->m_redoIndex];
+        image_editor_invalidate(self);
     }
 }
 
@@ -219,56 +279,66 @@ void image_editor_apply_saturation_filter(ImageEditor *self, double scale) {
     image_editor_history_update(self);
     SaturationParams params = {scale};
     apply_basic_filter_to_pixelbuffer(SATURATION, (void *)(&params), image_editor_get_current_pixelbuffer(self));
+    image_editor_invalidate(self);
 }
 
 void image_editor_apply_channels_filter(ImageEditor *self, double r, double g, double b) {
     image_editor_history_update(self);
     ChannelsParams params = {r, g, b};
     apply_basic_filter_to_pixelbuffer(CHANNELS, (void *)(&params), image_editor_get_current_pixelbuffer(self));
+    image_editor_invalidate(self);
 }
 
 void image_editor_apply_invert_filter(ImageEditor *self) {
     image_editor_history_update(self);
     apply_basic_filter_to_pixelbuffer(INVERT, NULL, image_editor_get_current_pixelbuffer(self));
+    image_editor_invalidate(self);
 }
 
 void image_editor_apply_brightness_contrast_filter(ImageEditor *self, double brightness, double contrast) {
     image_editor_history_update(self);
     BrightnessContrastParams params = {brightness, contrast};
     apply_basic_filter_to_pixelbuffer(BRIGHTNESSCONTRAST, (void *)(&params), image_editor_get_current_pixelbuffer(self));
+    image_editor_invalidate(self);
 }
 
 void image_editor_apply_gaussian_blur_filter(ImageEditor *self, int radius) {
     image_editor_history_update(self);
     GaussianBlurParams params = {radius};
     apply_convolution_filter_to_pixelbuffer(GAUSSIANBLUR, (void *)(&params), image_editor_get_current_pixelbuffer(self));
+    image_editor_invalidate(self);
 }
 
 void image_editor_apply_motion_blur_filter(ImageEditor *self, int radius, double angle) {
     image_editor_history_update(self);
     MotionBlurParams params = {radius, angle};
     apply_convolution_filter_to_pixelbuffer(MOTIONBLUR, (void *)(&params), image_editor_get_current_pixelbuffer(self));
+    image_editor_invalidate(self);
 }
 
 void image_editor_apply_sharpen_filter(ImageEditor *self, int radius) {
     image_editor_history_update(self);
     SharpenParams params = {radius};
     apply_convolution_filter_to_pixelbuffer(SHARPEN, (void *)(&params), image_editor_get_current_pixelbuffer(self));
+    image_editor_invalidate(self);
 }
 
 void image_editor_apply_edge_detect_filter(ImageEditor *self) {
     image_editor_history_update(self);
     apply_convolution_filter_to_pixelbuffer(EDGEDETECT, NULL, image_editor_get_current_pixelbuffer(self));
+    image_editor_invalidate(self);
 }
 
 void image_editor_apply_posterize_filter(ImageEditor *self, int numBins) {
     image_editor_history_update(self);
     PosterizeParams params = {numBins};
     apply_basic_filter_to_pixelbuffer(POSTERIZE, (void *)(&params), image_editor_get_current_pixelbuffer(self));
+    image_editor_invalidate(self);
 }
 
 void image_editor_apply_threshold_filter(ImageEditor *self, double cutoff) {
     image_editor_history_update(self);
     ThresholdParams params = {cutoff};
     apply_basic_filter_to_pixelbuffer(THRESHOLD, (void *)(&params), image_editor_get_current_pixelbuffer(self));
+    image_editor_invalidate(self);
 }
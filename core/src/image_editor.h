@@ -7,11 +7,11 @@
 #ifndef IMAGE_EDITOR_H_
 #define IMAGE_EDITOR_H_
 
+#include "color.h"  // Color
 #include "pixel_buffer.h"  // PixelBuffer
+#include "stroke_buffer.h"  // StrokeBuffer
 #include "tool.h"  // Tool
 
-#include <gdk/gdk.h>  // GdkRGBA
-
 #define MAX_HISTORY_STATES 10
 
 typedef struct image_editor {
@@ -23,6 +23,21 @@ typedef struct image_editor {
 
     Tool m_tool;
 
+    // the coverage of the stroke in progress, and whether there is one
+    StrokeBuffer m_stroke;
+    int m_strokeActive;
+
+    // every pixel changed since the last call to image_editor_take_dirty_rect()
+    PixelRect m_dirtyRect;
+
+    // a copy of the tool the stroke in progress was started with
+    Tool m_strokeTool;
+
+    // the last point the stroke reached, and how far it has travelled since its last dab
+    double m_strokeX;
+    double m_strokeY;
+    double m_strokeRemainder;
+
 } ImageEditor;
 
 /* Returns a new ImadeEditor instance.
@@ -30,9 +45,9 @@ Note: you must immediately call init_from_parameters or init_from_file before us
 ImageEditor image_editor_new();
 
 /* Sets up the instance with a new pixelbuffer based on the input parameters. */
-void image_editor_init_from_parameters(ImageEditor *self, int width, int height, GdkRGBA backgroundColor);
+void image_editor_init_from_parameters(ImageEditor *self, int width, int height, Color backgroundColor);
 
-/* Imports the file at filepath, and sets up the instance with a new pixelbuffer based on it.
+/* Imports the file at filepath (a png or .tpaint), and sets up the instance with a new pixelbuffer based on it.
 Note: this assumes that the given filepath is valid! */
 void image_editor_init_from_file(ImageEditor *self, const char *filepath);
 
@@ -42,21 +57,39 @@ void image_editor_destroy(ImageEditor *self);
 /* Returns a pointer to the current pixelbuffer. This is the buffer that the gui should render to the screen. */
 PixelBuffer* image_editor_get_current_pixelbuffer(ImageEditor *self);
 
-/* Saves the current pixelbuffer to a file at filepath.
+/* Returns the bounds of every pixel of the current pixelbuffer that has changed
+since the last call (including the whole buffer after undo, redo or a filter),
+and starts collecting again from nothing. */
+PixelRect image_editor_take_dirty_rect(ImageEditor *self);
+
+/* Marks the whole of the current pixelbuffer as changed. */
+void image_editor_invalidate(ImageEditor *self);
+
+/* Saves the current pixelbuffer to filepath, in the format its extension asks
+for, compressed at 'compressionLevel' with 'bitDepth' bits per sample (see
+image_io.h).
 Note: this assumes that the given filepath is valid! */
-void image_editor_save_current_pixelbuffer(ImageEditor *self, const char *filepath);
+void image_editor_save_current_pixelbuffer(ImageEditor *self, const char *filepath, int compressionLevel, int bitDepth);
+
+/* When the user has began a stroke on the canvas. The stroke is painted with a
+copy of 'tool', so later changes to the tool do not affect it. */
+void image_editor_stroke_start(ImageEditor *self, Tool *tool, double x, double y);
 
-/* When the user has began a stroke on the canvas. */
-void image_editor_stroke_start(ImageEditor *self, int x, int y);
+/* When the user is holding a stroke in place on the canvas. Applies numDabs dabs
+at the stroke's last point, and blends the result onto the canvas once. */
+void image_editor_stroke_hold(ImageEditor *self, int numDabs);
 
-/* When the user is holding a stroke in place on the canvas. */
-void image_editor_stroke_hold(ImageEditor *self, int x, int y);
+/* When the user is moving a stroke on the canvas. Dabs are laid down every
+tool_get_spacing() pixels along the path, carrying the leftover distance over
+to the next move, so the result does not depend on how often this is called. */
+void image_editor_stroke_move(ImageEditor *self, double x, double y);
 
-/* When the user is moving a stroke on the canvas. */
-void image_editor_stroke_move(ImageEditor *self, int x, int y, int prevX, int prevY);
+/* Moves the stroke through each of the numPoints (x, y) pairs in 'points' in turn,
+and blends the result onto the canvas once at the end. */
+void image_editor_stroke_polyline(ImageEditor *self, const double *points, int numPoints);
 
 /* When the user has ended a stroke on the canvas. */
-void image_editor_stroke_end(ImageEditor *self, int x, int y);
+void image_editor_stroke_end(ImageEditor *self, double x, double y);
 
 /* Undoes the previously saved state (either stroke or filter application). */
 void image_editor_undo(ImageEditor *self);
@@ -0,0 +1,309 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "image_io.h"
+
+#include "bmp_io.h"
+#include "png_io.h"
+#include "pnm_io.h"
+#include "qoi_io.h"
+#include "tpaint_io.h"
+#include "utilities.h"
+
+#include <fcntl.h>  // open
+#include <stdlib.h>  // malloc, free, mkstemp
+#include <string.h>  // memcmp
+#include <sys/mman.h>  // mmap, munmap, madvise
+#include <sys/stat.h>  // fstat, stat, fchmod
+#include <unistd.h>  // close, fsync, unlink
+
+
+
+//
+// SAVE PROGRESS methods
+//
+
+void save_progress_report(SaveProgress *progress, size_t amount) {
+    if (progress != NULL) {
+        atomic_fetch_add(&progress->done, amount);
+    }
+}
+
+int save_progress_is_cancelled(SaveProgress *progress) {
+    return progress != NULL && atomic_load(&progress->cancelled);
+}
+
+
+
+//
+// ROW SINK methods
+//
+
+/* Creates the pixelbuffer a pixelbuffer sink fills in. */
+int pixelbuffer_sink_begin(void *data, int width, int height) {
+    Color white = {1.0, 1.0, 1.0, 1.0};
+    PixelBuffer *out = (PixelBuffer *)data;
+    *out = pixelbuffer_new(width, height);
+    out->backgroundColor = white;
+    return 1;
+}
+
+/* Converts one row into the pixelbuffer. */
+int pixelbuffer_sink_row(void *data, int y, const void *rgba, ImageRowFormat format) {
+    image_io_set_row((PixelBuffer *)data, y, rgba, format);
+    return 1;
+}
+
+/* Keeps the size it is given, and stops the decode before any pixels. */
+int size_sink_begin(void *data, int width, int height) {
+    int *size = (int *)data;
+    size[0] = width;
+    size[1] = height;
+    return 0;
+}
+
+
+
+//
+// FILE methods
+//
+
+int image_io_map_file(const char *filepath, MappedFile *out) {
+    int fd = open(filepath, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0) {
+        printf("error: could not open %s\n", filepath);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 0;
+    }
+
+    void *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("error: could not map %s\n", filepath);
+        return 0;
+    }
+
+    // let the kernel read ahead, since every reader goes through it in order
+    madvise(map, info.st_size, MADV_SEQUENTIAL);
+    out->data = map;
+    out->size = info.st_size;
+    return 1;
+}
+
+void image_io_unmap_file(MappedFile *self) {
+    munmap((void *)self->data, self->size);
+    self->data = NULL;
+    self->size = 0;
+}
+
+FILE* image_io_open_temp(const char *filepath, char **tmpPath) {
+    char *path = malloc(strlen(filepath) + 8);
+    sprintf(path, "%s.XXXXXX", filepath);
+    int fd = mkstemp(path);
+    FILE *file = NULL;
+    if (fd >= 0) {
+        // keep the permissions of the file being replaced, if there is one
+        struct stat existing;
+        fchmod(fd, stat(filepath, &existing) == 0 ? (existing.st_mode & 0777) : 0644);
+        file = fdopen(fd, "wb");
+        if (file == NULL) {
+            close(fd);
+            unlink(path);
+        }
+    }
+
+    if (file == NULL) {
+        printf("error: could not open %s for writing\n", filepath);
+        free(path);
+        return NULL;
+    }
+    *tmpPath = path;
+    return file;
+}
+
+int image_io_close_temp(FILE *file, char *tmpPath, const char *filepath, int ok) {
+    // make sure it is all on disk before it replaces anything
+    if (ok && (fflush(file) != 0 || ferror(file) || fsync(fileno(file)) != 0)) {
+        printf("error: could not write %s\n", filepath);
+        ok = 0;
+    }
+    if (fclose(file) != 0) {
+        ok = 0;
+    }
+
+    if (ok && rename(tmpPath, filepath) != 0) {
+        printf("error: could not replace %s\n", filepath);
+        ok = 0;
+    }
+    if (!ok) {
+        unlink(tmpPath);
+    }
+    free(tmpPath);
+    return ok;
+}
+
+
+
+//
+// IMAGE IO methods
+//
+
+ImageFormat image_io_format_from_extension(const char *filepath) {
+    if (string_ends_with(filepath, ".png") == 0) {
+        return IMAGE_FORMAT_PNG;
+    }
+    if (string_ends_with(filepath, ".tpaint") == 0) {
+        return IMAGE_FORMAT_TPAINT;
+    }
+    if (string_ends_with(filepath, ".qoi") == 0) {
+        return IMAGE_FORMAT_QOI;
+    }
+    if (string_ends_with(filepath, ".pam") == 0) {
+        return IMAGE_FORMAT_PAM;
+    }
+    if (string_ends_with(filepath, ".ppm") == 0 || string_ends_with(filepath, ".pnm") == 0) {
+        return IMAGE_FORMAT_PPM;
+    }
+    if (string_ends_with(filepath, ".bmp") == 0) {
+        return IMAGE_FORMAT_BMP;
+    }
+    return IMAGE_FORMAT_UNKNOWN;
+}
+
+ImageFormat image_io_detect_format(const char *filepath) {
+    unsigned char magic[8];
+    FILE *file = fopen(filepath, "rb");
+    size_t length = file != NULL ? fread(magic, 1, sizeof(magic), file) : 0;
+    if (file != NULL) {
+        fclose(file);
+    }
+
+    static const unsigned char pngMagic[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+    if (length == 8 && memcmp(magic, pngMagic, 8) == 0) {
+        return IMAGE_FORMAT_PNG;
+    }
+    if (length == 8 && memcmp(magic, TPAINT_MAGIC, 8) == 0) {
+        return IMAGE_FORMAT_TPAINT;
+    }
+    if (length >= 4 && memcmp(magic, QOI_MAGIC, 4) == 0) {
+        return IMAGE_FORMAT_QOI;
+    }
+    if (length >= 2 && memcmp(magic, "P7", 2) == 0) {
+        return IMAGE_FORMAT_PAM;
+    }
+    if (length >= 2 && (memcmp(magic, "P6", 2) == 0 || memcmp(magic, "P5", 2) == 0)) {
+        return IMAGE_FORMAT_PPM;
+    }
+    if (length >= 2 && memcmp(magic, "BM", 2) == 0) {
+        return IMAGE_FORMAT_BMP;
+    }
+    return image_io_format_from_extension(filepath);
+}
+
+int image_io_load(const char *filepath, PixelBuffer *out) {
+    switch (image_io_detect_format(filepath)) {
+        case IMAGE_FORMAT_TPAINT:
+            return tpaint_load(filepath, out);
+        case IMAGE_FORMAT_QOI:
+            return qoi_load(filepath, out);
+        case IMAGE_FORMAT_PAM:
+        case IMAGE_FORMAT_PPM:
+            return pnm_load(filepath, out);
+        case IMAGE_FORMAT_BMP:
+            return bmp_load(filepath, out);
+        default:
+            return png_load(filepath, out);
+    }
+}
+
+void image_io_set_row(PixelBuffer *buf, int y, const void *rgba, ImageRowFormat format) {
+    switch (format) {
+        case IMAGE_ROW_UNORM16:
+            pixelbuffer_set_row_unorm16(buf, y, (const uint16_t *)rgba);
+            break;
+        case IMAGE_ROW_FLOATS:
+            pixelbuffer_set_span_floats(buf, 0, y, buf->width, (const float *)rgba);
+            break;
+        default:
+            pixelbuffer_set_row_unorm8(buf, y, (const unsigned char *)rgba);
+            break;
+    }
+}
+
+int image_row_sink_is_cancelled(ImageRowSink *sink) {
+    return sink->cancelled != NULL && atomic_load(sink->cancelled);
+}
+
+ImageRowSink image_io_pixelbuffer_sink(PixelBuffer *out) {
+    ImageRowSink tmp = {pixelbuffer_sink_begin, pixelbuffer_sink_row, out, NULL};
+    return tmp;
+}
+
+int image_io_load_rows(const char *filepath, ImageRowSink *sink) {
+    switch (image_io_detect_format(filepath)) {
+        case IMAGE_FORMAT_TPAINT:
+            return tpaint_load_rows(filepath, sink);
+        case IMAGE_FORMAT_QOI:
+            return qoi_load_rows(filepath, sink);
+        case IMAGE_FORMAT_PAM:
+        case IMAGE_FORMAT_PPM:
+            return pnm_load_rows(filepath, sink);
+        case IMAGE_FORMAT_BMP:
+            return bmp_load_rows(filepath, sink);
+        default:
+            return png_load_rows(filepath, sink);
+    }
+}
+
+int image_io_read_size(const char *filepath, int *width, int *height) {
+    int size[2] = {-1, -1};
+    ImageRowSink sink = {size_sink_begin, NULL, size, NULL};
+    image_io_load_rows(filepath, &sink);
+    if (size[0] < 0) {
+        return 0;
+    }
+    *width = size[0];
+    *height = size[1];
+    return 1;
+}
+
+int image_io_open_writer(const char *filepath, int width, int height, int compressionLevel, int bitDepth, ImageRowWriter *out) {
+    switch (image_io_format_from_extension(filepath)) {
+        case IMAGE_FORMAT_TPAINT:
+            printf("error: .tpaint files can not be written a row at a time\n");
+            return 0;
+        case IMAGE_FORMAT_QOI:
+            return qoi_open_writer(filepath, width, height, out);
+        case IMAGE_FORMAT_PAM:
+            return pnm_open_writer(filepath, width, height, 1, out);
+        case IMAGE_FORMAT_PPM:
+            return pnm_open_writer(filepath, width, height, 0, out);
+        case IMAGE_FORMAT_BMP:
+            return bmp_open_writer(filepath, width, height, out);
+        default:
+            return png_open_writer(filepath, width, height, compressionLevel, bitDepth, out);
+    }
+}
+
+int image_io_save(PixelBuffer *source, const char *filepath, int compressionLevel, int bitDepth, SaveProgress *progress) {
+    switch (image_io_format_from_extension(filepath)) {
+        case IMAGE_FORMAT_TPAINT:
+            return tpaint_save(source, filepath, compressionLevel, progress);
+        case IMAGE_FORMAT_QOI:
+            return qoi_save(source, filepath, progress);
+        case IMAGE_FORMAT_PAM:
+            return pnm_save(source, filepath, 1, progress);
+        case IMAGE_FORMAT_PPM:
+            return pnm_save(source, filepath, 0, progress);
+        case IMAGE_FORMAT_BMP:
+            return bmp_save(source, filepath, progress);
+        default:
+            return png_save(source, filepath, compressionLevel, bitDepth, progress);
+    }
+}
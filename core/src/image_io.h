@@ -0,0 +1,175 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef IMAGE_IO_H_
+#define IMAGE_IO_H_
+
+#include "pixel_buffer.h"  // PixelBuffer
+
+#include <stdatomic.h>  // atomic_size_t, atomic_int
+#include <stddef.h>  // size_t
+#include <stdio.h>  // FILE
+
+/* Compression levels for image_io_save(), from zlib's 0 (none) to 9 (smallest). */
+#define IMAGE_COMPRESSION_FAST 1
+#define IMAGE_COMPRESSION_DEFAULT 6
+#define IMAGE_COMPRESSION_SMALLEST 9
+
+/* The bits per sample images can be saved with, in the formats that offer a
+choice (png). The other formats are always 8-bit, except .tpaint, which
+stores the floats themselves. */
+#define IMAGE_DEPTH_8 8
+#define IMAGE_DEPTH_16 16
+
+/* The file formats images can be loaded from and saved to. */
+typedef enum imageformat {
+    IMAGE_FORMAT_UNKNOWN,
+    IMAGE_FORMAT_PNG,
+    IMAGE_FORMAT_TPAINT,
+    IMAGE_FORMAT_QOI,
+    IMAGE_FORMAT_PAM,
+    IMAGE_FORMAT_PPM,
+    IMAGE_FORMAT_BMP
+} ImageFormat;
+
+/* Lets another thread follow (and stop) a save in progress. Zero it before
+passing it in. */
+typedef struct saveprogress {
+    // how much of the work is done so far, out of 'total'. Both are set by the saver.
+    atomic_size_t done;
+    atomic_size_t total;
+
+    // set this to make the save give up as soon as it can
+    atomic_int cancelled;
+} SaveProgress;
+
+/* Adds 'amount' to the work done, if 'progress' is not NULL. */
+void save_progress_report(SaveProgress *progress, size_t amount);
+
+/* Returns true if 'progress' is not NULL and the save has been cancelled. */
+int save_progress_is_cancelled(SaveProgress *progress);
+
+/* How the samples of a decoded row are laid out: whichever keeps all of the
+precision the file has. */
+typedef enum imagerowformat {
+    IMAGE_ROW_UNORM8,  // 4 bytes per pixel (rgba)
+    IMAGE_ROW_UNORM16,  // 4 uint16_t per pixel, in the machine's byte order
+    IMAGE_ROW_FLOATS  // 4 floats per pixel
+} ImageRowFormat;
+
+/* Receives an image one row at a time, as it is decoded. */
+typedef struct imagerowsink {
+    // called with the size of the image once its header has been read, before
+    // any rows. Returning false stops the decode there.
+    int (*begin)(void *data, int width, int height);
+
+    // called with every row, top to bottom, as 'width' rgba pixels laid out
+    // as 'format' says (image_io_set_row() converts them the way
+    // image_io_load() would). Returning false stops the decode there.
+    int (*row)(void *data, int y, const void *rgba, ImageRowFormat format);
+
+    void *data;
+
+    // may be NULL. Once it is set the decode stops, even where it is busy
+    // without handing on any rows (the passes of an interlaced png, or a band
+    // of .tpaint tiles).
+    atomic_int *cancelled;
+} ImageRowSink;
+
+/* Writes an image to a file one row at a time, as the rows are produced, so
+the whole image never has to be held at once. */
+typedef struct imagerowwriter {
+    // writes the next row, top to bottom, from 'width' pixels of 4 floats
+    // (rgba). Returns false (and prints why) if it could not be written.
+    int (*row)(void *data, const float *rgba);
+
+    // finishes the file and, if 'ok' and every row was written, renames it into
+    // place (otherwise it is deleted). Frees 'data'. Returns whether the file
+    // was replaced.
+    int (*finish)(void *data, int ok);
+
+    void *data;
+} ImageRowWriter;
+
+/* A whole file, mapped read-only into memory. */
+typedef struct mappedfile {
+    const unsigned char *data;
+    size_t size;
+} MappedFile;
+
+/* Maps the file at 'filepath' into memory, to be read front to back. Pages are
+only read in as they are touched, and nothing is copied out of the page cache.
+Returns false (and prints why) if it could not be opened or is empty. */
+int image_io_map_file(const char *filepath, MappedFile *out);
+
+/* Unmaps a file mapped by image_io_map_file(). */
+void image_io_unmap_file(MappedFile *self);
+
+/* Creates a temporary file next to 'filepath' to write a new version of it
+into, with the permissions of the file it will replace (if there is one).
+Returns NULL (and prints why) if it could not be created, otherwise stores its
+path in a new string at 'tmpPath'. */
+FILE* image_io_open_temp(const char *filepath, char **tmpPath);
+
+/* Closes a file from image_io_open_temp() and, if 'ok' and everything it was
+given made it to disk, renames it over 'filepath'. Otherwise it is deleted and
+'filepath' is left as it was. Frees 'tmpPath'. Returns whether 'filepath' was
+replaced (and prints why not, unless 'ok' was already false). */
+int image_io_close_temp(FILE *file, char *tmpPath, const char *filepath, int ok);
+
+/* Returns the format 'filepath' should be saved in, going by its extension. */
+ImageFormat image_io_format_from_extension(const char *filepath);
+
+/* Returns the format of the file at 'filepath', going by its first few bytes,
+or by its extension if those are not recognized. */
+ImageFormat image_io_detect_format(const char *filepath);
+
+/* Loads the image at 'filepath' into a new pixelbuffer at 'out', in whichever
+format it turns out to be. Returns false (and prints why, leaving 'out' alone)
+if it could not be loaded at all. */
+int image_io_load(const char *filepath, PixelBuffer *out);
+
+/* Sets row 'y' of 'buf' from a decoded row in 'format' (see ImageRowSink),
+exactly as loading the whole image would have. */
+void image_io_set_row(PixelBuffer *buf, int y, const void *rgba, ImageRowFormat format);
+
+/* Returns true if 'sink' has been cancelled. */
+int image_row_sink_is_cancelled(ImageRowSink *sink);
+
+/* Returns a sink that creates a pixelbuffer at 'out' (with a white background)
+and fills it in with the rows it is given. */
+ImageRowSink image_io_pixelbuffer_sink(PixelBuffer *out);
+
+/* Decodes the image at 'filepath', in whichever format it turns out to be,
+and hands it to 'sink' one row at a time, at the full precision of the file.
+Only a few rows (or one band of tiles, for .tpaint) are held at once, however
+large the image is, except for interlaced pngs, which have to be decoded
+whole (though still in 8 or 16-bit) before their first row is done. Returns
+false (and prints why) if it could not be decoded, or false (quietly) if
+'sink' stopped it. */
+int image_io_load_rows(const char *filepath, ImageRowSink *sink);
+
+/* Reads just the header of the image at 'filepath' for its size, without
+decoding any pixels. Returns false if it could not be read. */
+int image_io_read_size(const char *filepath, int *width, int *height);
+
+/* Starts writing a width x height image to 'filepath' one row at a time, in
+the format its extension asks for (png if it has none we know), with the same
+meaning of 'compressionLevel' and 'bitDepth' as image_io_save(). Only a row or
+two is ever held. .tpaint files are made of tiles rather than rows, so they
+can not be written this way. Returns false (and prints why) if the file could
+not be created. */
+int image_io_open_writer(const char *filepath, int width, int height, int compressionLevel, int bitDepth, ImageRowWriter *out);
+
+/* Saves 'source' to 'filepath' in the format its extension asks for (png if
+it has none we know). 'compressionLevel' only matters to the formats that
+compress (png and .tpaint), and 'bitDepth' (one of the IMAGE_DEPTH_ values)
+only to png. Only the float copy of the pixels (rgbadata) is
+read. 'progress' may be NULL. Returns false (and prints why) if the file could not
+be written, or if the save was cancelled. */
+int image_io_save(PixelBuffer *source, const char *filepath, int compressionLevel, int bitDepth, SaveProgress *progress);
+
+#endif  // IMAGE_IO_H_
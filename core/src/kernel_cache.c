@@ -0,0 +1,165 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "kernel_cache.h"
+
+#include <pthread.h>  // pthread
+#include <stdlib.h>  // malloc, free
+
+/* How many kernels are kept. Motion blur angles are continuous, so the cache
+has to stay bounded. */
+#define KERNEL_CACHE_SIZE 32
+
+typedef enum kernelcachestate {
+    KERNEL_MISSING,
+    KERNEL_BUILDING,
+    KERNEL_READY
+} KernelCacheState;
+
+/* A kernel, and the filter and params it was built for. Only the params that
+shape a kernel are kept: the radius, and the angle of motion blurs. */
+typedef struct kernelcacheentry {
+    KernelCacheState state;
+    FilterType type;
+    int radius;
+    double angle;
+    Kernel kernel;
+
+    // how many callers are using the kernel, and when it was last asked for.
+    // Only kernels nobody is using are ever thrown out.
+    int refs;
+    unsigned long lastUsed;
+} KernelCacheEntry;
+
+static KernelCacheEntry s_entries[KERNEL_CACHE_SIZE];
+static unsigned long s_clock = 0;
+static long s_hits = 0;
+static long s_misses = 0;
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_built = PTHREAD_COND_INITIALIZER;
+
+
+
+/* Returns the entry for type and params, or NULL if there is none. Must be
+called with s_lock held. */
+KernelCacheEntry* kernel_cache_find(FilterType type, int radius, double angle) {
+    for (int i = 0; i < KERNEL_CACHE_SIZE; i++) {
+        KernelCacheEntry *entry = &s_entries[i];
+        if (entry->state != KERNEL_MISSING && entry->type == type
+                && entry->radius == radius && entry->angle == angle) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/* Returns an empty entry, or else the least recently used one nobody is using
+(after freeing its kernel), or NULL if every kernel is in use. Must be called
+with s_lock held. */
+KernelCacheEntry* kernel_cache_claim() {
+    KernelCacheEntry *oldest = NULL;
+    for (int i = 0; i < KERNEL_CACHE_SIZE; i++) {
+        KernelCacheEntry *entry = &s_entries[i];
+        if (entry->state == KERNEL_MISSING) {
+            return entry;
+        }
+        if (entry->state == KERNEL_READY && entry->refs == 0
+                && (oldest == NULL || entry->lastUsed < oldest->lastUsed)) {
+            oldest = entry;
+        }
+    }
+
+    if (oldest != NULL) {
+        kernel_destroy(&oldest->kernel);
+        oldest->state = KERNEL_MISSING;
+    }
+    return oldest;
+}
+
+Kernel* kernel_cache_get(FilterType type, void *params) {
+    // the params that shape the kernel (edge detect has none)
+    int radius = 0;
+    double angle = 0.0;
+    if (type == GAUSSIANBLUR) {
+        radius = ((GaussianBlurParams *)params)->radius;
+    }
+    else if (type == MOTIONBLUR) {
+        radius = ((MotionBlurParams *)params)->radius;
+        angle = ((MotionBlurParams *)params)->angle;
+    }
+    else if (type == SHARPEN) {
+        radius = ((SharpenParams *)params)->radius;
+    }
+
+    pthread_mutex_lock(&s_lock);
+
+    // if another thread is already building this kernel, wait for it rather
+    // than building it a second time
+    KernelCacheEntry *entry;
+    while ((entry = kernel_cache_find(type, radius, angle)) != NULL && entry->state == KERNEL_BUILDING) {
+        pthread_cond_wait(&s_built, &s_lock);
+    }
+
+    if (entry != NULL) {
+        entry->refs++;
+        entry->lastUsed = ++s_clock;
+        s_hits++;
+        pthread_mutex_unlock(&s_lock);
+        return &entry->kernel;
+    }
+
+    // otherwise claim an entry, and build it without holding the lock
+    s_misses++;
+    entry = kernel_cache_claim();
+    if (entry == NULL) {
+        // every kernel is in use, so this one is not kept
+        pthread_mutex_unlock(&s_lock);
+        Kernel *kernel = malloc(sizeof(Kernel));
+        *kernel = filter_create_kernel(type, params);
+        return kernel;
+    }
+    entry->state = KERNEL_BUILDING;
+    entry->type = type;
+    entry->radius = radius;
+    entry->angle = angle;
+    entry->refs = 1;
+    entry->lastUsed = ++s_clock;
+    pthread_mutex_unlock(&s_lock);
+
+    Kernel kernel = filter_create_kernel(type, params);
+
+    pthread_mutex_lock(&s_lock);
+    entry->kernel = kernel;
+    entry->state = KERNEL_READY;
+    pthread_cond_broadcast(&s_built);
+    pthread_mutex_unlock(&s_lock);
+
+    return &entry->kernel;
+}
+
+void kernel_cache_release(Kernel *kernel) {
+    pthread_mutex_lock(&s_lock);
+    for (int i = 0; i < KERNEL_CACHE_SIZE; i++) {
+        if (kernel == &s_entries[i].kernel) {
+            s_entries[i].refs--;
+            pthread_mutex_unlock(&s_lock);
+            return;
+        }
+    }
+    pthread_mutex_unlock(&s_lock);
+
+    // one that was not kept
+    kernel_destroy(kernel);
+    free(kernel);
+}
+
+void kernel_cache_get_stats(long *hits, long *misses) {
+    pthread_mutex_lock(&s_lock);
+    *hits = s_hits;
+    *misses = s_misses;
+    pthread_mutex_unlock(&s_lock);
+}
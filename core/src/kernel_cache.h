@@ -0,0 +1,27 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef KERNEL_CACHE_H_
+#define KERNEL_CACHE_H_
+
+#include "filter.h"  // FilterType
+#include "kernel.h"  // Kernel
+
+/* Returns the kernel of the convolution filter 'type' with 'params' (see
+filter_create_kernel()), building it the first time it is asked for. The most
+recently used kernels are kept, so applying the same filters again (another
+file of a batch, or another request to the daemon) skips building them. The
+kernel must not be changed, and must be given back with kernel_cache_release().
+Safe to call from any thread; each kernel is only ever built once at a time. */
+Kernel* kernel_cache_get(FilterType type, void *params);
+
+/* Gives back a kernel returned by kernel_cache_get(). */
+void kernel_cache_release(Kernel *kernel);
+
+/* Returns how many kernels were found in the cache, and how many had to be built. */
+void kernel_cache_get_stats(long *hits, long *misses);
+
+#endif  // KERNEL_CACHE_H_
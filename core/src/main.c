@@ -4,10 +4,20 @@
 // www.github.com/danielshervheim
 //
 
+#include "batch.h"
+#include "server.h"
 #include "tinypaint_app.h"
 
 #include <gtk/gtk.h>
+#include <string.h>  // strcmp
 
 int main(int argc, char *argv[]) {
+    // batch and daemon modes have to be picked before gtk is touched, so they run without a display
+    if (argc > 1 && strcmp(argv[1], BATCH_FLAG) == 0) {
+        return batch_main(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], SERVER_FLAG) == 0) {
+        return server_main(argc - 1, argv + 1);
+    }
     return g_application_run(G_APPLICATION(tinypaint_app_new()), argc, argv);
 }
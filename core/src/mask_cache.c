@@ -0,0 +1,127 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "mask_cache.h"
+
+#include <pthread.h>  // pthread
+#include <stdlib.h>  // malloc, realloc
+#include <string.h>  // memcpy
+
+#define NUM_TOOL_TYPES (ERASER + 1)
+
+typedef enum maskcachestate {
+    MASK_MISSING,
+    MASK_BUILDING,
+    MASK_READY
+} MaskCacheState;
+
+typedef struct maskcacheentry {
+    MaskCacheState state;
+    ToolMask *mask;
+} MaskCacheEntry;
+
+/* One growable array of entries per tooltype, indexed by radius. */
+static MaskCacheEntry *s_entries[NUM_TOOL_TYPES];
+static int s_capacity[NUM_TOOL_TYPES];
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_built = PTHREAD_COND_INITIALIZER;
+
+
+
+/* Makes sure there is an entry for 'radius'. Must be called with s_lock held. */
+void mask_cache_reserve(ToolType tooltype, int radius) {
+    if (radius < s_capacity[tooltype]) {
+        return;
+    }
+
+    int capacity = s_capacity[tooltype] == 0 ? 32 : s_capacity[tooltype];
+    while (capacity <= radius) {
+        capacity *= 2;
+    }
+
+    s_entries[tooltype] = realloc(s_entries[tooltype], sizeof(MaskCacheEntry) * capacity);
+    for (int i = s_capacity[tooltype]; i < capacity; i++) {
+        s_entries[tooltype][i].state = MASK_MISSING;
+        s_entries[tooltype][i].mask = NULL;
+    }
+    s_capacity[tooltype] = capacity;
+}
+
+ToolMask* mask_cache_get(ToolType tooltype, int radius) {
+    pthread_mutex_lock(&s_lock);
+    mask_cache_reserve(tooltype, radius);
+
+    // if another thread is already building this mask, wait for it rather than
+    // building it a second time
+    while (s_entries[tooltype][radius].state == MASK_BUILDING) {
+        pthread_cond_wait(&s_built, &s_lock);
+    }
+
+    if (s_entries[tooltype][radius].state == MASK_READY) {
+        ToolMask *mask = s_entries[tooltype][radius].mask;
+        pthread_mutex_unlock(&s_lock);
+        return mask;
+    }
+
+    // otherwise claim it, and build it without holding the lock
+    s_entries[tooltype][radius].state = MASK_BUILDING;
+    pthread_mutex_unlock(&s_lock);
+
+    ToolMask *mask = tool_mask_new(tooltype, radius);
+
+    pthread_mutex_lock(&s_lock);
+    s_entries[tooltype][radius].mask = mask;
+    s_entries[tooltype][radius].state = MASK_READY;
+    pthread_cond_broadcast(&s_built);
+    pthread_mutex_unlock(&s_lock);
+
+    return mask;
+}
+
+
+
+//
+// PREBUILD methods
+//
+
+typedef struct maskprebuildargs {
+    int *radii;
+    int numRadii;
+} MaskPrebuildArgs;
+
+void* mask_cache_prebuild_worker(void *data) {
+    MaskPrebuildArgs *args = (MaskPrebuildArgs *)data;
+
+    for (int i = 0; i < args->numRadii; i++) {
+        for (int type = 0; type < NUM_TOOL_TYPES; type++) {
+            // the flood fill never uses its mask
+            if (type != FLOODFILL) {
+                mask_cache_get(type, args->radii[i]);
+            }
+        }
+    }
+
+    free(args->radii);
+    free(args);
+    return NULL;
+}
+
+void mask_cache_prebuild_async(const int *radii, int numRadii) {
+    MaskPrebuildArgs *args = malloc(sizeof(MaskPrebuildArgs));
+    args->radii = malloc(sizeof(int) * numRadii);
+    args->numRadii = numRadii;
+    memcpy(args->radii, radii, sizeof(int) * numRadii);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, mask_cache_prebuild_worker, (void *)args) != 0) {
+        // not worth failing over, the masks will just be built on demand
+        free(args->radii);
+        free(args);
+        return;
+    }
+    pthread_detach(tid);
+}
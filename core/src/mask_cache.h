@@ -0,0 +1,21 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef MASK_CACHE_H_
+#define MASK_CACHE_H_
+
+#include "tool.h"  // ToolMask, ToolType
+
+/* Returns the mask for the given tooltype and radius, building it the first time
+it is asked for. The mask is owned by the cache and must not be freed or changed.
+Safe to call from any thread; each mask is only ever built once. */
+ToolMask* mask_cache_get(ToolType tooltype, int radius);
+
+/* Builds the masks for every brush tooltype at each of the given radii on a
+background thread, so they are ready before the user asks for them. */
+void mask_cache_prebuild_async(const int *radii, int numRadii);
+
+#endif  // MASK_CACHE_H_
@@ -0,0 +1,214 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "mip_pyramid.h"
+
+#include "render_buffer.h"
+
+#include <pthread.h>  // pthread
+#include <stdio.h>  // printf
+#include <stdlib.h>  // malloc, free
+#include <string.h>  // memcpy
+
+/* How many threads to split a large reduction across. */
+#define NUM_REDUCE_THREADS 8
+
+/* Regions with fewer output pixels than this are reduced on the calling
+thread. */
+#define MIN_THREADED_PIXELS (128*128)
+
+
+
+//
+// REDUCTION methods
+//
+
+/* a struct to hold everything one reduction thread needs. */
+typedef struct reduce_worker_args {
+    MipPyramid *pyramid;
+    PixelBuffer *source;
+    int level;
+    PixelRect rect;
+} ReduceWorkerArgs;
+
+/* Computes 'args->rect' of 'args->level' from the level above it. Odd edges
+reuse their last row or column. */
+void* reduce_worker(void *data) {
+    ReduceWorkerArgs *args = (ReduceWorkerArgs *)data;
+    MipLevel *dst = &(args->pyramid->levels[args->level]);
+    PixelRect r = args->rect;
+
+    if (args->level == 1) {
+        // straight from the floating point pixels, rounding once at the end
+        PixelBuffer *src = args->source;
+        for (int y = r.y0; y < r.y1; y++) {
+            const float *row0 = src->rgbadata + 4 * (2*y) * src->width;
+            const float *row1 = src->rgbadata + 4 * (2*y + 1 < src->height ? 2*y + 1 : 2*y) * src->width;
+            unsigned char *out = dst->data + 4 * (y * dst->width + r.x0);
+
+            for (int x = r.x0; x < r.x1; x++) {
+                int xa = 2*x;
+                int xb = 2*x + 1 < src->width ? 2*x + 1 : 2*x;
+                for (int c = 0; c < 4; c++) {
+                    float v = 0.25f * (row0[4*xa + c] + row0[4*xb + c] + row1[4*xa + c] + row1[4*xb + c]);
+                    v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+                    *out++ = (unsigned char)(v * 255.0f + 0.5f);
+                }
+            }
+        }
+    }
+    else {
+        MipLevel *src = &(args->pyramid->levels[args->level - 1]);
+        for (int y = r.y0; y < r.y1; y++) {
+            const unsigned char *row0 = src->data + 4 * (2*y) * src->width;
+            const unsigned char *row1 = src->data + 4 * (2*y + 1 < src->height ? 2*y + 1 : 2*y) * src->width;
+            unsigned char *out = dst->data + 4 * (y * dst->width + r.x0);
+
+            for (int x = r.x0; x < r.x1; x++) {
+                int xa = 2*x;
+                int xb = 2*x + 1 < src->width ? 2*x + 1 : 2*x;
+                for (int c = 0; c < 4; c++) {
+                    *out++ = (unsigned char)((row0[4*xa + c] + row0[4*xb + c] + row1[4*xa + c] + row1[4*xb + c] + 2) >> 2);
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* Computes 'rect' of 'level' from the level above it. */
+void mip_pyramid_reduce(MipPyramid *self, PixelBuffer *source, int level, PixelRect rect) {
+    int rows = rect.y1 - rect.y0;
+    int pixels = (rect.x1 - rect.x0) * rows;
+
+    // small regions are not worth the thread overhead
+    if (pixels < MIN_THREADED_PIXELS || rows < NUM_REDUCE_THREADS) {
+        ReduceWorkerArgs args = {self, source, level, rect};
+        reduce_worker((void *)(&args));
+        return;
+    }
+
+    // otherwise split the rows into bands, one per thread
+    pthread_t tids[NUM_REDUCE_THREADS];
+    ReduceWorkerArgs args[NUM_REDUCE_THREADS];
+
+    for (int i = 0; i < NUM_REDUCE_THREADS; i++) {
+        args[i].pyramid = self;
+        args[i].source = source;
+        args[i].level = level;
+        args[i].rect = rect;
+        args[i].rect.y0 = rect.y0 + (rows * i) / NUM_REDUCE_THREADS;
+        args[i].rect.y1 = rect.y0 + (rows * (i + 1)) / NUM_REDUCE_THREADS;
+    }
+
+    // the calling thread takes the first band itself
+    for (int i = 1; i < NUM_REDUCE_THREADS; i++) {
+        pthread_create(&tids[i], NULL, reduce_worker, (void *)(&args[i]));
+    }
+    reduce_worker((void *)(&args[0]));
+
+    for (int i = 1; i < NUM_REDUCE_THREADS; i++) {
+        pthread_join(tids[i], NULL);
+    }
+}
+
+
+
+//
+// MIPPYRAMID methods
+//
+
+MipPyramid mip_pyramid_new(int width, int height) {
+    MipPyramid tmp;
+    tmp.width = width;
+    tmp.height = height;
+
+    // level 0 is the source itself
+    tmp.levels[0].width = width;
+    tmp.levels[0].height = height;
+    tmp.levels[0].data = NULL;
+    tmp.levels[0].pending = pixelrect_empty();
+
+    // keep halving until there is nothing left to halve
+    tmp.numLevels = 1;
+    while (tmp.numLevels < MIP_MAX_LEVELS) {
+        MipLevel *above = &(tmp.levels[tmp.numLevels - 1]);
+        if (above->width == 1 && above->height == 1) {
+            break;
+        }
+
+        MipLevel *level = &(tmp.levels[tmp.numLevels]);
+        level->width = (above->width + 1) / 2;
+        level->height = (above->height + 1) / 2;
+        level->data = malloc(sizeof(unsigned char) * 4 * level->width * level->height);
+        PixelRect all = {0, 0, level->width, level->height};
+        level->pending = all;
+        tmp.numLevels++;
+    }
+
+    return tmp;
+}
+
+void mip_pyramid_destroy(MipPyramid *self) {
+    for (int i = 1; i < self->numLevels; i++) {
+        free(self->levels[i].data);
+        self->levels[i].data = NULL;
+    }
+}
+
+PixelRect mip_rect_at_level(PixelRect rect, int level) {
+    if (pixelrect_is_empty(rect)) {
+        return pixelrect_empty();
+    }
+
+    // round outwards, so every level pixel touched by the rect is included
+    int size = 1 << level;
+    PixelRect tmp = {rect.x0 >> level, rect.y0 >> level,
+        (rect.x1 + size - 1) >> level, (rect.y1 + size - 1) >> level};
+    return tmp;
+}
+
+void mip_pyramid_invalidate(MipPyramid *self, PixelRect rect) {
+    for (int i = 1; i < self->numLevels; i++) {
+        MipLevel *level = &(self->levels[i]);
+        PixelRect bounds = {0, 0, level->width, level->height};
+        PixelRect part = pixelrect_intersect(mip_rect_at_level(rect, i), bounds);
+        level->pending = pixelrect_union(level->pending, part);
+    }
+}
+
+void mip_pyramid_update(MipPyramid *self, PixelBuffer *source, int level) {
+    if (source->width != self->width || source->height != self->height) {
+        printf("ERROR: dimension mismatch in mip pyramid update\n");
+        return;
+    }
+
+    level = level < self->numLevels ? level : self->numLevels - 1;
+
+    // each level only depends on the one above, so go top down
+    for (int i = 1; i <= level; i++) {
+        MipLevel *current = &(self->levels[i]);
+        if (!pixelrect_is_empty(current->pending)) {
+            mip_pyramid_reduce(self, source, i, current->pending);
+            current->pending = pixelrect_empty();
+        }
+    }
+}
+
+void mip_pyramid_read(MipPyramid *self, PixelBuffer *source, int level, PixelRect rect,
+    unsigned char *dst, int dstRowLength) {
+    if (level == 0) {
+        pixelbuffer_convert_to_unorm8(source, rect, dst, dstRowLength);
+        return;
+    }
+
+    MipLevel *current = &(self->levels[level]);
+    for (int y = rect.y0; y < rect.y1; y++) {
+        memcpy(dst + 4 * (y - rect.y0) * dstRowLength, current->data + 4 * (y * current->width + rect.x0),
+            4 * (rect.x1 - rect.x0));
+    }
+}
@@ -0,0 +1,61 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef MIP_PYRAMID_H_
+#define MIP_PYRAMID_H_
+
+#include "pixel_buffer.h"  // PixelBuffer, PixelRect
+
+/* The most levels a pyramid will have, counting the full size image as level 0.
+At level 7 each pixel stands for a 128x128 block of the canvas. */
+#define MIP_MAX_LEVELS 8
+
+/* One level of the pyramid, 8-bit rgba, half the size of the one above. */
+typedef struct miplevel {
+    int width;
+    int height;
+    unsigned char *data;
+
+    // the part of this level that is behind the level above it
+    PixelRect pending;
+} MipLevel;
+
+/* Successively halved, 8-bit copies of a pixelbuffer, for displaying it zoomed
+out without reading every pixel. Level 0 is the pixelbuffer itself and is not
+stored. The rest are only brought up to date as deep as they are asked for,
+and only in the parts that have changed. */
+typedef struct mippyramid {
+    int width;
+    int height;
+    int numLevels;
+    MipLevel levels[MIP_MAX_LEVELS];
+} MipPyramid;
+
+/* Returns a new pyramid for a width x height pixelbuffer. Every level starts
+out pending. */
+MipPyramid mip_pyramid_new(int width, int height);
+
+/* Frees the memory allocated to the pyramid. */
+void mip_pyramid_destroy(MipPyramid *self);
+
+/* Returns the part of 'level' covering 'rect' of level 0. */
+PixelRect mip_rect_at_level(PixelRect rect, int level);
+
+/* Marks 'rect' of level 0 as changed, in every level. */
+void mip_pyramid_invalidate(MipPyramid *self, PixelRect rect);
+
+/* Brings levels 1 to 'level' up to date with 'source', reducing each changed
+2x2 block of the level above to one pixel. Large regions are split across
+threads. */
+void mip_pyramid_update(MipPyramid *self, PixelBuffer *source, int level);
+
+/* Writes 8-bit rgba for 'rect' of 'level' to 'dst', which holds 'dstRowLength'
+pixels per row. Level 0 is converted from 'source', deeper levels are copied
+and should be up to date. */
+void mip_pyramid_read(MipPyramid *self, PixelBuffer *source, int level, PixelRect rect,
+    unsigned char *dst, int dstRowLength);
+
+#endif  // MIP_PYRAMID_H_
@@ -6,13 +6,20 @@
 
 #include "pixel_buffer.h"
 
+#include <stdlib.h>  // malloc, free
+#include <string.h>  // memcpy
+
+#ifdef __SSE2__
+#include <emmintrin.h>  // SSE2 intrinsics
+#endif
+
 
 
 PixelBuffer pixelbuffer_new(int width, int height) {
     PixelBuffer tmp;
     tmp.width = width;
     tmp.height = height;
-    tmp.data = malloc(sizeof(GdkRGBA) * width * height);
+    tmp.data = malloc(sizeof(Color) * width * height);
     tmp.rgbadata = malloc(sizeof(float) * 4 * width * height);
     return tmp;
 }
@@ -35,7 +42,7 @@ PixelBuffer pixelbuffer_copy(PixelBuffer *original) {
     return copy;
 }
 
-void pixelbuffer_set_pixel(PixelBuffer *buf, int x, int y, GdkRGBA color) {
+void pixelbuffer_set_pixel(PixelBuffer *buf, int x, int y, Color color) {
     buf->data[y*buf->width+x] = color;
     buf->rgbadata[y * (4*buf->width) + (x * 4) + 0] = color.red;
     buf->rgbadata[y * (4*buf->width) + (x * 4) + 1] = color.green;
@@ -43,11 +50,11 @@ void pixelbuffer_set_pixel(PixelBuffer *buf, int x, int y, GdkRGBA color) {
     buf->rgbadata[y * (4*buf->width) + (x * 4) + 3] = color.alpha;
 }
 
-GdkRGBA pixelbuffer_get_pixel(PixelBuffer *buf, int x, int y) {
+Color pixelbuffer_get_pixel(PixelBuffer *buf, int x, int y) {
     return buf->data[y*buf->width+x];
 }
 
-void pixelbuffer_set_all_pixels(PixelBuffer *buf, GdkRGBA color) {
+void pixelbuffer_set_all_pixels(PixelBuffer *buf, Color color) {
     for (int x = 0; x < buf->width; x++) {
         for (int y = 0; y < buf->height; y++) {
             pixelbuffer_set_pixel(buf, x, y, color);
@@ -55,3 +62,123 @@ void pixelbuffer_set_all_pixels(PixelBuffer *buf, GdkRGBA color) {
     }
     buf->backgroundColor = color;
 }
+
+void pixelbuffer_set_row_unorm8(PixelBuffer *buf, int y, const unsigned char *src) {
+    double *data = (double *)(buf->data + y * buf->width);
+    float *rgbadata = buf->rgbadata + y * 4 * buf->width;
+    int count = 4 * buf->width;
+    int i = 0;
+
+#ifdef __SSE2__
+    // dividing in double precision gives exactly what the scalar path stores
+    const __m128i zero = _mm_setzero_si128();
+    const __m128d scale = _mm_set1_pd(255.0);
+
+    // 16 bytes (4 pixels) per iteration
+    for (; i + 16 <= count; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i words[2] = {_mm_unpacklo_epi8(bytes, zero), _mm_unpackhi_epi8(bytes, zero)};
+
+        for (int w = 0; w < 2; w++) {
+            __m128i ints[2] = {_mm_unpacklo_epi16(words[w], zero), _mm_unpackhi_epi16(words[w], zero)};
+
+            for (int p = 0; p < 2; p++) {
+                int offset = i + 8*w + 4*p;
+                __m128d rg = _mm_div_pd(_mm_cvtepi32_pd(ints[p]), scale);
+                __m128d ba = _mm_div_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(ints[p], _MM_SHUFFLE(1, 0, 3, 2))), scale);
+                _mm_storeu_pd(data + offset + 0, rg);
+                _mm_storeu_pd(data + offset + 2, ba);
+                _mm_storeu_ps(rgbadata + offset, _mm_movelh_ps(_mm_cvtpd_ps(rg), _mm_cvtpd_ps(ba)));
+            }
+        }
+    }
+#endif
+
+    // whatever is left over (or everything, without SSE2)
+    for (; i < count; i++) {
+        data[i] = src[i] / 255.0;
+        rgbadata[i] = data[i];
+    }
+}
+
+void pixelbuffer_set_row_unorm16(PixelBuffer *buf, int y, const uint16_t *src) {
+    double *data = (double *)(buf->data + y * buf->width);
+    float *rgbadata = buf->rgbadata + y * 4 * buf->width;
+    int count = 4 * buf->width;
+    int i = 0;
+
+#ifdef __SSE2__
+    // a float division is exact to the nearest float, and 16 bits fit a float's mantissa
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 scale = _mm_set1_ps(65535.0f);
+
+    // 8 values (2 pixels) per iteration
+    for (; i + 8 <= count; i += 8) {
+        __m128i words = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128 lo = _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero)), scale);
+        __m128 hi = _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(words, zero)), scale);
+        _mm_storeu_ps(rgbadata + i + 0, lo);
+        _mm_storeu_ps(rgbadata + i + 4, hi);
+        _mm_storeu_pd(data + i + 0, _mm_cvtps_pd(lo));
+        _mm_storeu_pd(data + i + 2, _mm_cvtps_pd(_mm_movehl_ps(lo, lo)));
+        _mm_storeu_pd(data + i + 4, _mm_cvtps_pd(hi));
+        _mm_storeu_pd(data + i + 6, _mm_cvtps_pd(_mm_movehl_ps(hi, hi)));
+    }
+#endif
+
+    // whatever is left over (or everything, without SSE2)
+    for (; i < count; i++) {
+        rgbadata[i] = src[i] / 65535.0f;
+        data[i] = rgbadata[i];
+    }
+}
+
+void pixelbuffer_set_span_floats(PixelBuffer *buf, int x, int y, int count, const float *src) {
+    double *data = (double *)(buf->data + y * buf->width + x);
+    float *rgbadata = buf->rgbadata + 4 * (y * buf->width + x);
+    memcpy(rgbadata, src, sizeof(float) * 4 * count);
+    for (int i = 0; i < 4 * count; i++) {
+        data[i] = src[i];
+    }
+}
+
+
+
+PixelRect pixelrect_empty() {
+    PixelRect tmp = {0, 0, 0, 0};
+    return tmp;
+}
+
+int pixelrect_is_empty(PixelRect rect) {
+    return rect.x0 >= rect.x1 || rect.y0 >= rect.y1;
+}
+
+PixelRect pixelrect_union(PixelRect a, PixelRect b) {
+    if (pixelrect_is_empty(a)) {
+        return b;
+    }
+    if (pixelrect_is_empty(b)) {
+        return a;
+    }
+
+    PixelRect tmp;
+    tmp.x0 = a.x0 < b.x0 ? a.x0 : b.x0;
+    tmp.y0 = a.y0 < b.y0 ? a.y0 : b.y0;
+    tmp.x1 = a.x1 > b.x1 ? a.x1 : b.x1;
+    tmp.y1 = a.y1 > b.y1 ? a.y1 : b.y1;
+    return tmp;
+}
+
+PixelRect pixelrect_intersect(PixelRect a, PixelRect b) {
+    PixelRect tmp;
+    tmp.x0 = a.x0 > b.x0 ? a.x0 : b.x0;
+    tmp.y0 = a.y0 > b.y0 ? a.y0 : b.y0;
+    tmp.x1 = a.x1 < b.x1 ? a.x1 : b.x1;
+    tmp.y1 = a.y1 < b.y1 ? a.y1 : b.y1;
+    return pixelrect_is_empty(tmp) ? pixelrect_empty() : tmp;
+}
+
+PixelRect pixelrect_clip(PixelRect rect, PixelBuffer *buf) {
+    PixelRect bounds = {0, 0, buf->width, buf->height};
+    return pixelrect_intersect(rect, bounds);
+}
@@ -7,16 +7,26 @@
 #ifndef PIXEL_BUFFER_H_
 #define PIXEL_BUFFER_H_
 
-#include <gdk/gdk.h>  // GdkRGBA
+#include "color.h"  // Color
+
+#include <stdint.h>  // uint16_t
 
 typedef struct pixelbuffer {
     int width;
     int height;
-    GdkRGBA *data;
-    GdkRGBA backgroundColor;
+    Color *data;
+    Color backgroundColor;
     float *rgbadata;
 } PixelBuffer;
 
+/* A rectangle of pixels, from (x0, y0) inclusive to (x1, y1) exclusive. */
+typedef struct pixelrect {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+} PixelRect;
+
 /* Returns a new pixelbuffer of width x height. */
 PixelBuffer pixelbuffer_new(int width, int height);
 
@@ -27,12 +37,39 @@ void pixelbuffer_destroy(PixelBuffer *buf);
 PixelBuffer pixelbuffer_copy(PixelBuffer *original);
 
 /* Sets the pixel at x,y to color. */
-void pixelbuffer_set_pixel(PixelBuffer *buf, int x, int y, GdkRGBA color);
+void pixelbuffer_set_pixel(PixelBuffer *buf, int x, int y, Color color);
 
 /* Returns the color of the pixel at x,y. */
-GdkRGBA pixelbuffer_get_pixel(PixelBuffer *buf, int x, int y);
+Color pixelbuffer_get_pixel(PixelBuffer *buf, int x, int y);
 
 /* Sets all pixels (and the backgroundColor) to color. */
-void pixelbuffer_set_all_pixels(PixelBuffer *buf, GdkRGBA color);
+void pixelbuffer_set_all_pixels(PixelBuffer *buf, Color color);
+
+/* Sets every pixel of row 'y' from 'src', which holds 'width' 8-bit rgba pixels. */
+void pixelbuffer_set_row_unorm8(PixelBuffer *buf, int y, const unsigned char *src);
+
+/* Sets every pixel of row 'y' from 'src', which holds 'width' 16-bit rgba
+pixels in the machine's byte order. Each value is converted once, to the
+nearest float, and the double copy is widened from that. */
+void pixelbuffer_set_row_unorm16(PixelBuffer *buf, int y, const uint16_t *src);
+
+/* Sets 'count' pixels of row 'y', starting at column 'x', from 'src', which
+holds 4 floats (rgba) per pixel. */
+void pixelbuffer_set_span_floats(PixelBuffer *buf, int x, int y, int count, const float *src);
+
+/* Returns a rect that contains no pixels. */
+PixelRect pixelrect_empty();
+
+/* Returns true if the rect contains no pixels. */
+int pixelrect_is_empty(PixelRect rect);
+
+/* Returns the smallest rect containing both 'a' and 'b'. */
+PixelRect pixelrect_union(PixelRect a, PixelRect b);
+
+/* Returns the pixels contained in both 'a' and 'b'. */
+PixelRect pixelrect_intersect(PixelRect a, PixelRect b);
+
+/* Returns the part of 'rect' that lies within the buffer. */
+PixelRect pixelrect_clip(PixelRect rect, PixelBuffer *buf);
 
 #endif  // PIXEL_BUFFER_H_
@@ -0,0 +1,778 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "png_io.h"
+
+#include "render_buffer.h"  // convert_floats_to_unorm8
+
+#include <pthread.h>  // pthread
+#include <stdint.h>  // uint16_t
+#include <stdlib.h>  // malloc, calloc, free
+#include <string.h>  // memcpy, strdup
+#include <zlib.h>  // deflate, crc32, adler32
+
+#ifdef __SSE2__
+#include <emmintrin.h>  // SSE2 intrinsics
+#endif
+
+/* How many threads to split saving a large image across. */
+#define NUM_ENCODE_THREADS 8
+
+/* Images with fewer pixels than this are saved on the calling thread, in a
+single deflate stream. */
+#define MIN_THREADED_PIXELS (256*256)
+
+/* The most filtered bytes one deflate call is given, so every length fits in
+zlib's 32-bit counters. Bigger images are just split into more chunks. */
+#define MAX_CHUNK_BYTES (1 << 30)
+
+/* How many bytes each deflate call is fed at a time, between progress reports
+and checks for cancellation. */
+#define DEFLATE_SLICE_BYTES (1 << 20)
+
+/* How much compressed data a png row writer collects before writing it out as
+an IDAT chunk. */
+#define WRITER_IDAT_BYTES (1 << 16)
+
+/* How much of the preceding chunk each chunk can refer back to. This is the
+largest window deflate supports, so chunking costs almost no compression. */
+#define DEFLATE_WINDOW_SIZE 32768
+
+
+
+//
+// HELPER methods
+//
+
+/* Prints libpng's errors the same way the rest of the program does, then
+returns to the setjmp() of whichever call hit it. */
+void png_io_on_error(png_structp png, png_const_charp message) {
+    printf("error: %s\n", message);
+    png_longjmp(png, 1);
+}
+
+/* Warnings (e.g. a bad checksum on an ancillary chunk) don't stop decoding. */
+void png_io_on_warning(png_structp png, png_const_charp message) {
+    (void)png;
+    (void)message;
+}
+
+/* Converts each decoded row into the pixelbuffer 'data'. */
+int png_io_pixelbuffer_row(void *data, int y, const void *rgba, ImageRowFormat format) {
+    image_io_set_row((PixelBuffer *)data, y, rgba, format);
+    return 1;
+}
+
+/* Converts 'count' floats to 16-bit big endian samples (as pngs store them),
+rounding to the nearest. */
+void png_io_convert_floats_to_unorm16(unsigned char *dst, const float *src, int count) {
+    int i = 0;
+
+#ifdef __SSE2__
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(65535.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+
+    // there is no unsigned pack before SSE4.1, so pack around 0 and flip the top bit back
+    const __m128i bias = _mm_set1_epi32(32768);
+    const __m128i flip = _mm_set1_epi16((short)0x8000);
+
+    // 8 floats (2 pixels) per iteration
+    for (; i + 8 <= count; i += 8) {
+        __m128i a = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + 0), zero), one), scale), half));
+        __m128i b = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + 4), zero), one), scale), half));
+        __m128i words = _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(a, bias), _mm_sub_epi32(b, bias)), flip);
+        words = _mm_or_si128(_mm_slli_epi16(words, 8), _mm_srli_epi16(words, 8));
+        _mm_storeu_si128((__m128i *)(dst + 2*i), words);
+    }
+#endif
+
+    // whatever is left over (or everything, without SSE2)
+    for (; i < count; i++) {
+        float v = src[i];
+        v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+        unsigned int value = (unsigned int)(v * 65535.0f + 0.5f);
+        dst[2*i + 0] = value >> 8;
+        dst[2*i + 1] = value;
+    }
+}
+
+/* Converts a row of 'count' floats to 8 or 16-bit samples, as they are stored in a png. */
+void png_io_convert_row(unsigned char *dst, const float *src, int count, int bitDepth) {
+    if (bitDepth == 16) {
+        png_io_convert_floats_to_unorm16(dst, src, count);
+    }
+    else {
+        convert_floats_to_unorm8(dst, src, count);
+    }
+}
+
+/* Stores 'value' big-endian, the way png wants every integer. */
+void png_io_put_uint32(unsigned char *dst, unsigned long value) {
+    dst[0] = (value >> 24) & 0xff;
+    dst[1] = (value >> 16) & 0xff;
+    dst[2] = (value >> 8) & 0xff;
+    dst[3] = value & 0xff;
+}
+
+/* Writes one png chunk, whose data is the concatenation of 'numParts' parts. */
+void png_io_write_chunk(FILE *file, const char *type, const unsigned char **parts, const size_t *lengths, int numParts) {
+    size_t length = 0;
+    for (int i = 0; i < numParts; i++) {
+        length += lengths[i];
+    }
+
+    unsigned char header[8];
+    png_io_put_uint32(header, length);
+    memcpy(header + 4, type, 4);
+    fwrite(header, 1, 8, file);
+
+    // the crc covers the type and the data, but not the length
+    unsigned long crc = crc32(0, header + 4, 4);
+    for (int i = 0; i < numParts; i++) {
+        fwrite(parts[i], 1, lengths[i], file);
+        crc = crc32(crc, parts[i], lengths[i]);
+    }
+
+    unsigned char footer[4];
+    png_io_put_uint32(footer, crc);
+    fwrite(footer, 1, 4, file);
+}
+
+
+/* Writes the png signature and the header of a width x height, 8 or 16-bit
+rgba png, not interlaced. */
+void png_io_write_header(FILE *file, int width, int height, int bitDepth) {
+    static const unsigned char signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+    fwrite(signature, 1, 8, file);
+
+    unsigned char ihdr[13] = {0, 0, 0, 0, 0, 0, 0, 0, bitDepth, 6, 0, 0, 0};
+    png_io_put_uint32(ihdr, width);
+    png_io_put_uint32(ihdr + 4, height);
+    const unsigned char *ihdrParts[1] = {ihdr};
+    size_t ihdrLengths[1] = {13};
+    png_io_write_chunk(file, "IHDR", ihdrParts, ihdrLengths, 1);
+}
+
+
+//
+// FILTERING methods
+//
+
+/* The png paeth predictor. */
+int png_io_paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return pb <= pc ? b : c;
+}
+
+/* Filters one row of pixels 'bpp' bytes wide into 'dst' (the filter type byte,
+then 'rowBytes' bytes). 'prev' is the unfiltered row above, all zeroes for the
+first row. Picks whichever filter gives the smallest sum of absolute
+differences, the heuristic libpng uses. */
+void png_io_filter_row(unsigned char *dst, const unsigned char *row, const unsigned char *prev, int rowBytes, int bpp) {
+    unsigned long sums[5] = {0, 0, 0, 0, 0};
+    for (int i = 0; i < rowBytes; i++) {
+        int x = row[i];
+        int a = i >= bpp ? row[i - bpp] : 0;
+        int b = prev[i];
+        int c = i >= bpp ? prev[i - bpp] : 0;
+        sums[0] += abs((signed char)x);
+        sums[1] += abs((signed char)(x - a));
+        sums[2] += abs((signed char)(x - b));
+        sums[3] += abs((signed char)(x - ((a + b) >> 1)));
+        sums[4] += abs((signed char)(x - png_io_paeth(a, b, c)));
+    }
+
+    int best = 0;
+    for (int f = 1; f < 5; f++) {
+        if (sums[f] < sums[best]) {
+            best = f;
+        }
+    }
+
+    dst[0] = best;
+    dst++;
+    for (int i = 0; i < rowBytes; i++) {
+        int x = row[i];
+        int a = i >= bpp ? row[i - bpp] : 0;
+        int b = prev[i];
+        int c = i >= bpp ? prev[i - bpp] : 0;
+        switch (best) {
+            case 0: dst[i] = x; break;
+            case 1: dst[i] = x - a; break;
+            case 2: dst[i] = x - b; break;
+            case 3: dst[i] = x - ((a + b) >> 1); break;
+            default: dst[i] = x - png_io_paeth(a, b, c); break;
+        }
+    }
+}
+
+/* a struct to hold everything one filtering thread needs. */
+typedef struct filter_worker_args {
+    PixelBuffer *src;
+    int bitDepth;
+    unsigned char *filtered;
+    int y0;
+    int y1;
+    SaveProgress *progress;
+} FilterWorkerArgs;
+
+/* Converts rows y0 to y1 to 8 or 16-bit and filters them into their place in
+'filtered'. The row above the band is converted too, as the filters need it. */
+void* filter_worker(void *data) {
+    FilterWorkerArgs *args = (FilterWorkerArgs *)data;
+    int width = args->src->width;
+    int bpp = 4 * (args->bitDepth / 8);
+    int rowBytes = bpp * width;
+
+    unsigned char *prev = calloc(rowBytes, 1);
+    unsigned char *row = malloc(rowBytes);
+    if (args->y0 > 0) {
+        png_io_convert_row(prev, args->src->rgbadata + 4 * (size_t)width * (args->y0 - 1), 4 * width, args->bitDepth);
+    }
+
+    for (int y = args->y0; y < args->y1; y++) {
+        png_io_convert_row(row, args->src->rgbadata + 4 * (size_t)width * y, 4 * width, args->bitDepth);
+        png_io_filter_row(args->filtered + (size_t)(rowBytes + 1) * y, row, prev, rowBytes, bpp);
+        save_progress_report(args->progress, rowBytes + 1);
+        if (save_progress_is_cancelled(args->progress)) {
+            break;
+        }
+
+        unsigned char *tmp = prev;
+        prev = row;
+        row = tmp;
+    }
+
+    free(prev);
+    free(row);
+    return NULL;
+}
+
+
+
+//
+// COMPRESSION methods
+//
+
+/* One piece of the filtered image, deflated on its own. */
+typedef struct deflatechunk {
+    size_t start;
+    size_t length;
+    unsigned char *out;
+    size_t outLength;
+    unsigned long adler;
+} DeflateChunk;
+
+/* a struct to hold everything one compression thread needs. */
+typedef struct deflate_worker_args {
+    const unsigned char *filtered;
+    DeflateChunk *chunks;
+    int numChunks;
+    int first;
+    int stride;
+    int level;
+    SaveProgress *progress;
+    int ok;
+} DeflateWorkerArgs;
+
+/* Deflates chunks first, first + stride, ... as raw deflate data. Each is
+primed with the end of the chunk before it, and all but the last end on a sync
+flush (byte aligned, final bit unset), so they concatenate into one stream. */
+void* deflate_worker(void *data) {
+    DeflateWorkerArgs *args = (DeflateWorkerArgs *)data;
+    args->ok = 1;
+
+    for (int i = args->first; i < args->numChunks; i += args->stride) {
+        DeflateChunk *chunk = &args->chunks[i];
+        const unsigned char *in = args->filtered + chunk->start;
+        chunk->adler = adler32(adler32(0, NULL, 0), in, chunk->length);
+
+        z_stream z;
+        memset(&z, 0, sizeof(z));
+        if (deflateInit2(&z, args->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            args->ok = 0;
+            return NULL;
+        }
+        if (chunk->start > 0) {
+            size_t window = chunk->start < DEFLATE_WINDOW_SIZE ? chunk->start : DEFLATE_WINDOW_SIZE;
+            deflateSetDictionary(&z, in - window, window);
+        }
+
+        // room for the worst case, plus the empty stored block of the sync flush
+        size_t capacity = deflateBound(&z, chunk->length) + 16;
+        chunk->out = malloc(capacity);
+        z.next_out = chunk->out;
+        z.avail_out = capacity;
+
+        // feed it a slice at a time, so progress is reported as it goes...
+        size_t fed = 0;
+        while (fed < chunk->length && args->ok) {
+            size_t slice = chunk->length - fed < DEFLATE_SLICE_BYTES ? chunk->length - fed : DEFLATE_SLICE_BYTES;
+            z.next_in = (unsigned char *)in + fed;
+            z.avail_in = slice;
+            if (deflate(&z, Z_NO_FLUSH) != Z_OK || z.avail_in != 0) {
+                args->ok = 0;
+            }
+            fed += slice;
+            save_progress_report(args->progress, slice);
+            if (save_progress_is_cancelled(args->progress)) {
+                args->ok = 0;
+            }
+        }
+
+        // ...then end it
+        int last = i == args->numChunks - 1;
+        if (args->ok && deflate(&z, last ? Z_FINISH : Z_SYNC_FLUSH) != (last ? Z_STREAM_END : Z_OK)) {
+            args->ok = 0;
+        }
+        chunk->outLength = capacity - z.avail_out;
+        deflateEnd(&z);
+
+        if (!args->ok) {
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+
+
+//
+// PNG READER methods
+//
+
+int png_reader_open(PngReader *self, const char *filepath) {
+    self->png = NULL;
+    self->info = NULL;
+    self->rowsRead = 0;
+    self->file = fopen(filepath, "rb");
+    if (self->file == NULL) {
+        printf("error: could not open %s\n", filepath);
+        return 0;
+    }
+
+    // check the signature before handing it to libpng
+    unsigned char signature[8];
+    if (fread(signature, 1, 8, self->file) != 8 || png_sig_cmp(signature, 0, 8) != 0) {
+        printf("error: %s is not a png\n", filepath);
+        return 0;
+    }
+
+    self->png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, png_io_on_error, png_io_on_warning);
+    self->info = png_create_info_struct(self->png);
+    if (self->png == NULL || self->info == NULL) {
+        printf("error: out of memory\n");
+        return 0;
+    }
+    if (setjmp(png_jmpbuf(self->png))) {
+        return 0;
+    }
+
+    png_init_io(self->png, self->file);
+    png_set_sig_bytes(self->png, 8);
+    png_read_info(self->png, self->info);
+
+    // whatever the file holds, have libpng hand out rgba rows, keeping 16-bit
+    // samples as they are (in the machine's byte order) and widening the rest to 8
+    self->bitDepth = png_get_bit_depth(self->png, self->info) == 16 ? 16 : 8;
+    png_set_expand(self->png);
+    png_set_gray_to_rgb(self->png);
+    png_set_add_alpha(self->png, self->bitDepth == 16 ? 0xffff : 0xff, PNG_FILLER_AFTER);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (self->bitDepth == 16) {
+        png_set_swap(self->png);
+    }
+#endif
+    self->interlaced = png_set_interlace_handling(self->png) > 1;
+    png_read_update_info(self->png, self->info);
+
+    self->width = png_get_image_width(self->png, self->info);
+    self->height = png_get_image_height(self->png, self->info);
+    return 1;
+}
+
+int png_reader_read_rows(PngReader *self, ImageRowSink *sink) {
+    // volatile, since they have to survive the longjmp
+    unsigned char * volatile row = NULL;
+    unsigned char ** volatile rows = NULL;
+
+    if (setjmp(png_jmpbuf(self->png))) {
+        free(row);
+        free(rows);
+        return 0;
+    }
+
+    size_t rowBytes = 4 * (size_t)self->width * (self->bitDepth / 8);
+    if (png_get_rowbytes(self->png, self->info) != rowBytes) {
+        printf("error: unsupported png format\n");
+        return 0;
+    }
+
+    ImageRowFormat format = self->bitDepth == 16 ? IMAGE_ROW_UNORM16 : IMAGE_ROW_UNORM8;
+    int ok = 1;
+    if (!self->interlaced) {
+        // decode one row, hand it on, and reuse it for the next
+        row = malloc(rowBytes);
+        for (int y = 0; y < self->height && ok; y++) {
+            png_read_row(self->png, row, NULL);
+            ok = !image_row_sink_is_cancelled(sink) && sink->row(sink->data, y, row, format);
+            self->rowsRead = y + 1;
+        }
+    }
+    else {
+        // every pass touches every row, so the whole image has to be kept in
+        // 8 or 16-bit until the last one (still a quarter or half the size of the floats)
+        row = malloc(rowBytes * self->height);
+        rows = malloc(sizeof(unsigned char *) * self->height);
+        for (int y = 0; y < self->height; y++) {
+            rows[y] = row + rowBytes * y;
+        }
+
+        // as png_read_image() would, but checking for a cancel after every row
+        for (int pass = 0; pass < PNG_INTERLACE_ADAM7_PASSES && ok; pass++) {
+            for (int y = 0; y < self->height && ok; y++) {
+                png_read_row(self->png, rows[y], NULL);
+                ok = !image_row_sink_is_cancelled(sink);
+            }
+        }
+        for (int y = 0; y < self->height && ok; y++) {
+            ok = sink->row(sink->data, y, rows[y], format);
+            self->rowsRead = y + 1;
+        }
+    }
+
+    if (ok) {
+        png_read_end(self->png, NULL);
+    }
+    free(row);
+    free(rows);
+    return ok;
+}
+
+int png_reader_read(PngReader *self, PixelBuffer *dst) {
+    ImageRowSink sink = {NULL, png_io_pixelbuffer_row, dst, NULL};
+    return png_reader_read_rows(self, &sink);
+}
+
+void png_reader_close(PngReader *self) {
+    if (self->png != NULL) {
+        png_destroy_read_struct(&self->png, self->info != NULL ? &self->info : NULL, NULL);
+    }
+    if (self->file != NULL) {
+        fclose(self->file);
+    }
+    self->png = NULL;
+    self->info = NULL;
+    self->file = NULL;
+}
+
+int png_load_rows(const char *filepath, ImageRowSink *sink) {
+    PngReader reader;
+    int ok = png_reader_open(&reader, filepath)
+        && sink->begin(sink->data, reader.width, reader.height)
+        && png_reader_read_rows(&reader, sink);
+    png_reader_close(&reader);
+    return ok;
+}
+
+int png_load(const char *filepath, PixelBuffer *out) {
+    // read just the header, to know how big the buffer must be
+    PngReader reader;
+    if (!png_reader_open(&reader, filepath)) {
+        png_reader_close(&reader);
+        return 0;
+    }
+
+    // create the buffer without clearing it, since every row is about to be overwritten
+    Color white = {1.0, 1.0, 1.0, 1.0};
+    *out = pixelbuffer_new(reader.width, reader.height);
+    out->backgroundColor = white;
+
+    // then decode the pixels straight into it, and fill whatever could not be read
+    if (!png_reader_read(&reader, out)) {
+        for (int y = reader.rowsRead; y < out->height; y++) {
+            for (int x = 0; x < out->width; x++) {
+                pixelbuffer_set_pixel(out, x, y, white);
+            }
+        }
+    }
+    png_reader_close(&reader);
+    return 1;
+}
+
+
+
+//
+// PNG WRITER methods
+//
+
+int png_save(PixelBuffer *source, const char *filepath, int level, int bitDepth, SaveProgress *progress) {
+    int width = source->width;
+    int height = source->height;
+    bitDepth = bitDepth == 16 ? 16 : 8;
+    size_t stride = 4 * (size_t)width * (bitDepth / 8) + 1;
+    size_t total = stride * height;
+    level = level < 0 ? 0 : (level > 9 ? 9 : level);
+
+    // every filtered byte is produced once and then compressed once
+    if (progress != NULL) {
+        atomic_store(&progress->total, 2 * total);
+    }
+
+    // small images are not worth the thread overhead
+    int numThreads = NUM_ENCODE_THREADS;
+    if ((size_t)width * height < MIN_THREADED_PIXELS || height < NUM_ENCODE_THREADS) {
+        numThreads = 1;
+    }
+    pthread_t tids[NUM_ENCODE_THREADS];
+
+    // filter every row, split into bands of rows, one per thread
+    unsigned char *filtered = malloc(total);
+    FilterWorkerArgs filterArgs[NUM_ENCODE_THREADS];
+    for (int i = 0; i < numThreads; i++) {
+        filterArgs[i].src = source;
+        filterArgs[i].bitDepth = bitDepth;
+        filterArgs[i].filtered = filtered;
+        filterArgs[i].y0 = (height * i) / numThreads;
+        filterArgs[i].y1 = (height * (i + 1)) / numThreads;
+        filterArgs[i].progress = progress;
+    }
+
+    // the calling thread takes the first band itself
+    for (int i = 1; i < numThreads; i++) {
+        pthread_create(&tids[i], NULL, filter_worker, (void *)(&filterArgs[i]));
+    }
+    filter_worker((void *)(&filterArgs[0]));
+    for (int i = 1; i < numThreads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    if (save_progress_is_cancelled(progress)) {
+        free(filtered);
+        return 0;
+    }
+
+    // then split the filtered rows into chunks, at least one per thread
+    int numChunks = numThreads;
+    if ((total + numChunks - 1) / numChunks > MAX_CHUNK_BYTES) {
+        numChunks = (total + MAX_CHUNK_BYTES - 1) / MAX_CHUNK_BYTES;
+    }
+    DeflateChunk *chunks = malloc(sizeof(DeflateChunk) * numChunks);
+    for (int i = 0; i < numChunks; i++) {
+        chunks[i].start = (total * i) / numChunks;
+        chunks[i].length = (total * (i + 1)) / numChunks - chunks[i].start;
+        chunks[i].out = NULL;
+    }
+
+    // and deflate them all at once
+    DeflateWorkerArgs deflateArgs[NUM_ENCODE_THREADS];
+    for (int i = 0; i < numThreads; i++) {
+        DeflateWorkerArgs args = {filtered, chunks, numChunks, i, numThreads, level, progress, 1};
+        deflateArgs[i] = args;
+    }
+    for (int i = 1; i < numThreads; i++) {
+        pthread_create(&tids[i], NULL, deflate_worker, (void *)(&deflateArgs[i]));
+    }
+    deflate_worker((void *)(&deflateArgs[0]));
+
+    int ok = deflateArgs[0].ok;
+    for (int i = 1; i < numThreads; i++) {
+        pthread_join(tids[i], NULL);
+        ok = ok && deflateArgs[i].ok;
+    }
+    free(filtered);
+
+    // the zlib header, with the level hint zlib itself would write...
+    int levelHint = level < 2 ? 0 : (level < 6 ? 1 : (level == 6 ? 2 : 3));
+    unsigned char zlibHeader[2] = {0x78, levelHint << 6};
+    zlibHeader[1] += 31 - ((zlibHeader[0] << 8) + zlibHeader[1]) % 31;
+
+    // ...and the checksum of the whole stream, from the checksum of each chunk
+    unsigned long adler = adler32(0, NULL, 0);
+    for (int i = 0; i < numChunks; i++) {
+        adler = adler32_combine(adler, chunks[i].adler, chunks[i].length);
+    }
+    unsigned char zlibFooter[4];
+    png_io_put_uint32(zlibFooter, adler);
+
+    // write to a temporary file next to the real one, so it can be renamed into place
+    char *tmpPath = NULL;
+    FILE *file = NULL;
+    if (!ok) {
+        if (!save_progress_is_cancelled(progress)) {
+            printf("error: could not compress the image\n");
+        }
+    }
+    else if ((file = image_io_open_temp(filepath, &tmpPath)) == NULL) {
+        ok = 0;
+    }
+    else {
+        png_io_write_header(file, width, height, bitDepth);
+
+        // one IDAT per chunk, with the zlib header and checksum wrapped around them
+        for (int i = 0; i < numChunks && !save_progress_is_cancelled(progress); i++) {
+            const unsigned char *parts[3] = {zlibHeader, chunks[i].out, zlibFooter};
+            size_t lengths[3] = {i == 0 ? 2 : 0, chunks[i].outLength, i == numChunks - 1 ? 4 : 0};
+            png_io_write_chunk(file, "IDAT", parts, lengths, 3);
+        }
+
+        png_io_write_chunk(file, "IEND", NULL, NULL, 0);
+        ok = image_io_close_temp(file, tmpPath, filepath, !save_progress_is_cancelled(progress));
+    }
+
+    for (int i = 0; i < numChunks; i++) {
+        free(chunks[i].out);
+    }
+    free(chunks);
+    return ok;
+}
+
+
+
+//
+// PNG ROW WRITER methods
+//
+
+/* Everything a png row writer carries from one row to the next. */
+typedef struct pngwriter {
+    FILE *file;
+    char *tmpPath;
+    char *filepath;
+    int width;
+    int height;
+    int bitDepth;
+    int rowsWritten;
+
+    // the row being written and the one above it (which the filters need),
+    // as 8 or 16-bit samples, and the row filtered
+    unsigned char *row;
+    unsigned char *prev;
+    unsigned char *filtered;
+
+    // a single deflate stream over every filtered row, written out an IDAT at a time
+    z_stream z;
+    unsigned char *idat;
+} PngWriter;
+
+/* Writes whatever has been compressed so far as an IDAT, and starts over. */
+void png_writer_flush(PngWriter *self) {
+    const unsigned char *parts[1] = {self->idat};
+    size_t lengths[1] = {WRITER_IDAT_BYTES - self->z.avail_out};
+    if (lengths[0] > 0) {
+        png_io_write_chunk(self->file, "IDAT", parts, lengths, 1);
+    }
+    self->z.next_out = self->idat;
+    self->z.avail_out = WRITER_IDAT_BYTES;
+}
+
+/* Filters and compresses the next row. */
+int png_writer_row(void *data, const float *rgba) {
+    PngWriter *self = (PngWriter *)data;
+    if (self->rowsWritten == self->height) {
+        printf("error: too many rows for %s\n", self->filepath);
+        return 0;
+    }
+
+    int bpp = 4 * (self->bitDepth / 8);
+    int rowBytes = bpp * self->width;
+    png_io_convert_row(self->row, rgba, 4 * self->width, self->bitDepth);
+    png_io_filter_row(self->filtered, self->row, self->prev, rowBytes, bpp);
+
+    unsigned char *tmp = self->prev;
+    self->prev = self->row;
+    self->row = tmp;
+    self->rowsWritten++;
+
+    self->z.next_in = self->filtered;
+    self->z.avail_in = rowBytes + 1;
+    while (self->z.avail_in > 0) {
+        if (deflate(&self->z, Z_NO_FLUSH) != Z_OK) {
+            printf("error: could not compress the image\n");
+            return 0;
+        }
+        if (self->z.avail_out == 0) {
+            png_writer_flush(self);
+        }
+    }
+    return 1;
+}
+
+/* Ends the deflate stream and the png, and moves the file into place. */
+int png_writer_finish(void *data, int ok) {
+    PngWriter *self = (PngWriter *)data;
+    if (ok && self->rowsWritten != self->height) {
+        printf("error: only %d of %d rows were written to %s\n", self->rowsWritten, self->height, self->filepath);
+        ok = 0;
+    }
+
+    int status = Z_OK;
+    while (ok && status == Z_OK) {
+        status = deflate(&self->z, Z_FINISH);
+        if (status != Z_OK && status != Z_STREAM_END) {
+            printf("error: could not compress the image\n");
+            ok = 0;
+        }
+        png_writer_flush(self);
+    }
+    if (ok) {
+        png_io_write_chunk(self->file, "IEND", NULL, NULL, 0);
+    }
+
+    ok = image_io_close_temp(self->file, self->tmpPath, self->filepath, ok);
+    deflateEnd(&self->z);
+    free(self->filepath);
+    free(self->row);
+    free(self->prev);
+    free(self->filtered);
+    free(self->idat);
+    free(self);
+    return ok;
+}
+
+int png_open_writer(const char *filepath, int width, int height, int level, int bitDepth, ImageRowWriter *out) {
+    bitDepth = bitDepth == 16 ? 16 : 8;
+    level = level < 0 ? 0 : (level > 9 ? 9 : level);
+
+    PngWriter *self = calloc(1, sizeof(PngWriter));
+    if (deflateInit(&self->z, level) != Z_OK) {
+        printf("error: could not compress the image\n");
+        free(self);
+        return 0;
+    }
+
+    self->file = image_io_open_temp(filepath, &self->tmpPath);
+    if (self->file == NULL) {
+        deflateEnd(&self->z);
+        free(self);
+        return 0;
+    }
+    png_io_write_header(self->file, width, height, bitDepth);
+
+    size_t rowBytes = 4 * (size_t)width * (bitDepth / 8);
+    self->filepath = strdup(filepath);
+    self->width = width;
+    self->height = height;
+    self->bitDepth = bitDepth;
+    self->row = malloc(rowBytes);
+    self->prev = calloc(rowBytes, 1);
+    self->filtered = malloc(rowBytes + 1);
+    self->idat = malloc(WRITER_IDAT_BYTES);
+    self->z.next_out = self->idat;
+    self->z.avail_out = WRITER_IDAT_BYTES;
+
+    out->row = png_writer_row;
+    out->finish = png_writer_finish;
+    out->data = self;
+    return 1;
+}
@@ -0,0 +1,83 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef PNG_IO_H_
+#define PNG_IO_H_
+
+#include "image_io.h"  // SaveProgress
+#include "pixel_buffer.h"  // PixelBuffer
+
+#include <png.h>  // png_structp, png_infop
+#include <stdio.h>  // FILE
+
+/* Decodes a png one row at a time, straight into a pixelbuffer. Only a single
+8 or 16-bit row is ever held besides the pixelbuffer itself (except for
+interlaced pngs, which have to be decoded whole). */
+typedef struct pngreader {
+    FILE *file;
+    png_structp png;
+    png_infop info;
+
+    // filled in by png_reader_open()
+    int width;
+    int height;
+    int interlaced;
+
+    // 16 for pngs with 16-bit samples, which are read without losing any of
+    // their precision, otherwise 8
+    int bitDepth;
+
+    // how many rows png_reader_read() has filled in so far
+    int rowsRead;
+} PngReader;
+
+/* Opens the png at 'filepath' and reads its header, but none of its pixels.
+Returns false (and prints why) if it is not a readable png. */
+int png_reader_open(PngReader *self, const char *filepath);
+
+/* Decodes every pixel into 'dst', which must be self->width x self->height.
+Returns false (and prints why) if the file is truncated or corrupt, in which
+case only the first self->rowsRead rows were filled in. */
+int png_reader_read(PngReader *self, PixelBuffer *dst);
+
+/* Decodes every pixel into 'sink' (see ImageRowSink), as 8 or 16-bit rows
+depending on self->bitDepth. Returns false (and prints why) if the file is
+truncated or corrupt, or false (quietly) if 'sink' stopped it. Either way
+self->rowsRead says how many rows were handed on. */
+int png_reader_read_rows(PngReader *self, ImageRowSink *sink);
+
+/* Closes the file and frees the decoder. Safe to call after a failed open. */
+void png_reader_close(PngReader *self);
+
+/* Decodes the png at 'filepath' into 'sink' (see image_io_load_rows()), keeping
+16-bit samples as they are. Only a row is held at a time, except for
+interlaced pngs, which are decoded whole first. */
+int png_load_rows(const char *filepath, ImageRowSink *sink);
+
+/* Loads the png at 'filepath' into a new pixelbuffer at 'out', with a white
+background. Returns false (and prints why, leaving 'out' alone) if it is not a
+readable png. A truncated png still loads, with whatever could not be decoded
+left white. */
+int png_load(const char *filepath, PixelBuffer *out);
+
+/* Writes 'source' to 'filepath' as an rgba png with 'bitDepth' (8 or 16) bits
+per sample, compressed at 'level' (one of the IMAGE_COMPRESSION_ levels, or
+anything from 0 to 9). Large images are filtered and deflated on several
+threads at once. Only the float copy of the pixels (rgbadata) is read.
+
+The png is written to a temporary file next to 'filepath' and renamed over it
+once complete, so an existing file is never left half written. 'progress' may
+be NULL. Returns false (and prints why) if the file could not be written, or
+if the save was cancelled. */
+int png_save(PixelBuffer *source, const char *filepath, int level, int bitDepth, SaveProgress *progress);
+
+/* Starts writing a width x height png to 'filepath' one row at a time (see
+image_io_open_writer()), with the same 'level' and 'bitDepth' as png_save().
+Each row is filtered and fed to a single deflate stream as it is given, on the
+calling thread, so only the row and the one above it are held. */
+int png_open_writer(const char *filepath, int width, int height, int level, int bitDepth, ImageRowWriter *out);
+
+#endif  // PNG_IO_H_
@@ -0,0 +1,351 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "pnm_io.h"
+
+#include "render_buffer.h"  // convert_floats_to_unorm8
+
+#include <stdint.h>  // uint64_t
+#include <stdlib.h>  // malloc, calloc, free
+#include <string.h>  // memmove, strcmp, strdup
+
+/* The largest width, height, depth or maxval a header may hold. */
+#define PNM_MAX_NUMBER (1 << 30)
+
+
+
+//
+// HELPER methods
+//
+
+/* What a netpbm header says about the samples that follow it. */
+typedef struct pnmheader {
+    int width;
+    int height;
+    int depth;
+    int maxval;
+
+    // where the samples start in the file, how many bytes each one takes up
+    // (two, big endian, if maxval is over 255) and how many each row does
+    size_t dataOffset;
+    int sampleBytes;
+    size_t stride;
+} PnmHeader;
+
+/* Moves 'p' past any whitespace and comments (which run from a # to the end
+of the line). */
+void pnm_io_skip_space(const unsigned char *data, size_t size, size_t *p) {
+    while (*p < size) {
+        if (data[*p] == '#') {
+            while (*p < size && data[*p] != '\n') {
+                (*p)++;
+            }
+        }
+        else if (data[*p] == ' ' || data[*p] == '\t' || data[*p] == '\n' || data[*p] == '\r'
+            || data[*p] == '\v' || data[*p] == '\f') {
+            (*p)++;
+        }
+        else {
+            break;
+        }
+    }
+}
+
+/* Reads the decimal number at 'p' into 'value', skipping anything before it.
+Returns false if there is none, or it is too large. */
+int pnm_io_read_number(const unsigned char *data, size_t size, size_t *p, int *value) {
+    pnm_io_skip_space(data, size, p);
+    if (*p >= size || data[*p] < '0' || data[*p] > '9') {
+        return 0;
+    }
+
+    long number = 0;
+    while (*p < size && data[*p] >= '0' && data[*p] <= '9') {
+        number = number * 10 + (data[*p] - '0');
+        if (number > PNM_MAX_NUMBER) {
+            return 0;
+        }
+        (*p)++;
+    }
+    *value = number;
+    return 1;
+}
+
+/* Reads the word at 'p' into 'dst' (which holds 'capacity' bytes, and is cut
+short if the word does not fit), skipping anything before it. */
+void pnm_io_read_word(const unsigned char *data, size_t size, size_t *p, char *dst, int capacity) {
+    pnm_io_skip_space(data, size, p);
+    int length = 0;
+    while (*p < size && data[*p] > ' ' && data[*p] != '#') {
+        if (length < capacity - 1) {
+            dst[length++] = data[*p];
+        }
+        (*p)++;
+    }
+    dst[length] = '\0';
+}
+
+/* Parses the header of a P5, P6 or P7 image. Returns false if it is not one,
+or it is missing something. */
+int pnm_io_read_header(const unsigned char *data, size_t size, PnmHeader *header) {
+    if (size < 3 || data[0] != 'P' || data[1] < '5' || data[1] > '7') {
+        return 0;
+    }
+    size_t p = 2;
+
+    if (data[1] != '7') {
+        // the width, height and maxval, and then a single whitespace character
+        header->depth = data[1] == '6' ? 3 : 1;
+        if (!pnm_io_read_number(data, size, &p, &header->width)
+            || !pnm_io_read_number(data, size, &p, &header->height)
+            || !pnm_io_read_number(data, size, &p, &header->maxval)
+            || p >= size) {
+            return 0;
+        }
+        header->dataOffset = p + 1;
+        return 1;
+    }
+
+    // a PAM header is a line per field, ending in ENDHDR
+    header->width = header->height = header->depth = header->maxval = 0;
+    for (;;) {
+        char field[16];
+        pnm_io_read_word(data, size, &p, field, sizeof(field));
+        if (strcmp(field, "ENDHDR") == 0) {
+            break;
+        }
+
+        int ok;
+        if (strcmp(field, "WIDTH") == 0) {
+            ok = pnm_io_read_number(data, size, &p, &header->width);
+        }
+        else if (strcmp(field, "HEIGHT") == 0) {
+            ok = pnm_io_read_number(data, size, &p, &header->height);
+        }
+        else if (strcmp(field, "DEPTH") == 0) {
+            ok = pnm_io_read_number(data, size, &p, &header->depth);
+        }
+        else if (strcmp(field, "MAXVAL") == 0) {
+            ok = pnm_io_read_number(data, size, &p, &header->maxval);
+        }
+        else if (strcmp(field, "TUPLTYPE") == 0) {
+            // the depth already says everything needed to read the samples
+            while (p < size && data[p] != '\n') {
+                p++;
+            }
+            ok = 1;
+        }
+        else {
+            ok = 0;
+        }
+        if (!ok) {
+            return 0;
+        }
+    }
+
+    // the samples start on the line after ENDHDR
+    while (p < size && data[p] != '\n') {
+        p++;
+    }
+    header->dataOffset = p + 1;
+    return 1;
+}
+
+
+
+/* Maps the netpbm image at 'filepath' and reads its header. Returns false
+(and prints why) if it is not a readable image, or is shorter than its header
+says. */
+int pnm_io_map(const char *filepath, MappedFile *file, PnmHeader *header) {
+    if (!image_io_map_file(filepath, file)) {
+        return 0;
+    }
+
+    int ok = pnm_io_read_header(file->data, file->size, header)
+        && header->width > 0 && header->height > 0
+        && header->depth >= 1 && header->depth <= 4
+        && header->maxval >= 1 && header->maxval <= 65535;
+
+    header->sampleBytes = ok && header->maxval > 255 ? 2 : 1;
+    header->stride = ok ? (size_t)header->width * header->depth * header->sampleBytes : 0;
+    ok = ok && header->dataOffset <= file->size
+        && (uint64_t)header->stride * header->height <= file->size - header->dataOffset;
+    if (!ok) {
+        printf("error: %s is not a valid netpbm image\n", filepath);
+        image_io_unmap_file(file);
+    }
+    return ok;
+}
+
+
+
+//
+// PNM methods
+//
+
+int pnm_load_rows(const char *filepath, ImageRowSink *sink) {
+    MappedFile file;
+    PnmHeader header;
+    if (!pnm_io_map(filepath, &file, &header)) {
+        return 0;
+    }
+    if (!sink->begin(sink->data, header.width, header.height)) {
+        image_io_unmap_file(&file);
+        return 0;
+    }
+
+    // gray is spread across red, green and blue, and alpha is opaque unless given
+    int hasAlpha = header.depth == 2 || header.depth == 4;
+    int numColors = hasAlpha ? header.depth - 1 : header.depth;
+    unsigned char *bytes = NULL;
+    float *floats = NULL;
+    if (header.maxval == 255) {
+        bytes = malloc(4 * (size_t)header.width);
+    }
+    else {
+        floats = malloc(sizeof(float) * 4 * header.width);
+    }
+    int ok = 1;
+
+    for (int y = 0; y < header.height && ok; y++) {
+        const unsigned char *src = file.data + header.dataOffset + y * header.stride;
+
+        if (header.maxval == 255 && header.depth == 4) {
+            // already laid out the way the pixelbuffer wants it
+            ok = sink->row(sink->data, y, src, IMAGE_ROW_UNORM8);
+        }
+        else if (header.maxval == 255) {
+            for (int x = 0; x < header.width; x++, src += header.depth) {
+                bytes[4*x + 0] = src[0];
+                bytes[4*x + 1] = src[numColors == 3 ? 1 : 0];
+                bytes[4*x + 2] = src[numColors == 3 ? 2 : 0];
+                bytes[4*x + 3] = hasAlpha ? src[numColors] : 255;
+            }
+            ok = sink->row(sink->data, y, bytes, IMAGE_ROW_UNORM8);
+        }
+        else {
+            for (int x = 0; x < header.width; x++) {
+                float sample[4] = {1.0, 1.0, 1.0, 1.0};
+                for (int c = 0; c < header.depth; c++, src += header.sampleBytes) {
+                    int value = header.sampleBytes == 2 ? (src[0] << 8 | src[1]) : src[0];
+                    sample[c] = (value < header.maxval ? value : header.maxval) / (double)header.maxval;
+                }
+                floats[4*x + 0] = sample[0];
+                floats[4*x + 1] = sample[numColors == 3 ? 1 : 0];
+                floats[4*x + 2] = sample[numColors == 3 ? 2 : 0];
+                floats[4*x + 3] = hasAlpha ? sample[numColors] : 1.0;
+            }
+            ok = sink->row(sink->data, y, floats, IMAGE_ROW_FLOATS);
+        }
+    }
+
+    free(bytes);
+    free(floats);
+    image_io_unmap_file(&file);
+    return ok;
+}
+
+int pnm_load(const char *filepath, PixelBuffer *out) {
+    ImageRowSink sink = image_io_pixelbuffer_sink(out);
+    return pnm_load_rows(filepath, &sink);
+}
+
+/* Everything a netpbm row writer needs between rows. */
+typedef struct pnmwriter {
+    FILE *file;
+    char *tmpPath;
+    char *filepath;
+    int width;
+    int height;
+    int withAlpha;
+    int rowsWritten;
+    unsigned char *row;
+} PnmWriter;
+
+/* Converts and writes the next row. */
+int pnm_writer_row(void *data, const float *rgba) {
+    PnmWriter *self = (PnmWriter *)data;
+    if (self->rowsWritten == self->height) {
+        printf("error: too many rows for %s\n", self->filepath);
+        return 0;
+    }
+    convert_floats_to_unorm8(self->row, rgba, 4 * self->width);
+
+    // packing rgb down over rgba in place is safe, since it only ever moves bytes back
+    if (!self->withAlpha) {
+        for (int x = 0; x < self->width; x++) {
+            memmove(self->row + 3*x, self->row + 4*x, 3);
+        }
+    }
+
+    self->rowsWritten++;
+    return fwrite(self->row, self->withAlpha ? 4 : 3, self->width, self->file) == (size_t)self->width;
+}
+
+/* Moves the file into place, if every row made it. */
+int pnm_writer_finish(void *data, int ok) {
+    PnmWriter *self = (PnmWriter *)data;
+    if (ok && self->rowsWritten != self->height) {
+        printf("error: only %d of %d rows were written to %s\n", self->rowsWritten, self->height, self->filepath);
+        ok = 0;
+    }
+
+    ok = image_io_close_temp(self->file, self->tmpPath, self->filepath, ok);
+    free(self->filepath);
+    free(self->row);
+    free(self);
+    return ok;
+}
+
+int pnm_open_writer(const char *filepath, int width, int height, int withAlpha, ImageRowWriter *out) {
+    char *tmpPath;
+    FILE *file = image_io_open_temp(filepath, &tmpPath);
+    if (file == NULL) {
+        return 0;
+    }
+
+    if (withAlpha) {
+        fprintf(file, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", width, height);
+    }
+    else {
+        fprintf(file, "P6\n%d %d\n255\n", width, height);
+    }
+
+    PnmWriter *self = calloc(1, sizeof(PnmWriter));
+    self->file = file;
+    self->tmpPath = tmpPath;
+    self->filepath = strdup(filepath);
+    self->width = width;
+    self->height = height;
+    self->withAlpha = withAlpha;
+    self->row = malloc(4 * (size_t)width);
+
+    out->row = pnm_writer_row;
+    out->finish = pnm_writer_finish;
+    out->data = self;
+    return 1;
+}
+
+int pnm_save(PixelBuffer *source, const char *filepath, int withAlpha, SaveProgress *progress) {
+    int width = source->width;
+    int height = source->height;
+    if (progress != NULL) {
+        atomic_store(&progress->total, height);
+    }
+
+    ImageRowWriter writer;
+    if (!pnm_open_writer(filepath, width, height, withAlpha, &writer)) {
+        return 0;
+    }
+
+    int ok = 1;
+    for (int y = 0; y < height && ok; y++) {
+        ok = writer.row(writer.data, source->rgbadata + 4 * (size_t)y * width);
+        save_progress_report(progress, 1);
+        ok = ok && !save_progress_is_cancelled(progress);
+    }
+    return writer.finish(writer.data, ok);
+}
@@ -0,0 +1,37 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef PNM_IO_H_
+#define PNM_IO_H_
+
+#include "image_io.h"  // SaveProgress
+#include "pixel_buffer.h"  // PixelBuffer
+
+/* Decodes the binary netpbm image at 'filepath' (see pnm_load()) into 'sink',
+one row at a time, straight out of the memory mapped file (see
+image_io_load_rows()). 8-bit images are handed on as bytes, and any other
+maxval as floats. */
+int pnm_load_rows(const char *filepath, ImageRowSink *sink);
+
+/* Loads the binary netpbm image at 'filepath' into a new pixelbuffer at 'out',
+with a white background. That is a PAM (P7) of 1 to 4 channels, a PPM (P6) or
+a PGM (P5), with up to 16 bits per sample. The file is memory mapped and its
+samples converted straight out of it. Returns false (and prints why, leaving
+'out' alone) if it is not a readable image, or is shorter than its header says. */
+int pnm_load(const char *filepath, PixelBuffer *out);
+
+/* Starts writing a width x height image to 'filepath' one row at a time (see
+image_io_open_writer()), as a PAM or PPM the same way pnm_save() does. */
+int pnm_open_writer(const char *filepath, int width, int height, int withAlpha, ImageRowWriter *out);
+
+/* Writes 'source' to 'filepath' as an 8-bit RGB_ALPHA PAM if 'withAlpha' is
+true, otherwise as an 8-bit PPM (which drops the alpha). Only the float copy
+of the pixels (rgbadata) is read. 'progress' may be NULL. Returns false (and
+prints why) if the file could not be written, or if the save was cancelled,
+in which case the file is left as it was. */
+int pnm_save(PixelBuffer *source, const char *filepath, int withAlpha, SaveProgress *progress);
+
+#endif  // PNM_IO_H_
@@ -0,0 +1,307 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "qoi_io.h"
+
+#include "render_buffer.h"  // convert_floats_to_unorm8
+
+#include <stdint.h>  // uint32_t, uint64_t
+#include <stdlib.h>  // malloc, calloc, free
+#include <string.h>  // memcpy, memcmp, strdup
+
+/* The tags of the chunks pixels are encoded as. The 8-bit tags take priority
+over the 2-bit ones. */
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xc0
+#define QOI_OP_RGB 0xfe
+#define QOI_OP_RGBA 0xff
+#define QOI_MASK_2 0xc0
+
+/* How many bytes the header takes up, and the marker every .qoi ends with. */
+#define QOI_HEADER_SIZE 14
+static const unsigned char QOI_PADDING[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+/* Where a pixel goes in the table of recently seen pixels. */
+#define QOI_HASH(px) (((px)[0]*3 + (px)[1]*5 + (px)[2]*7 + (px)[3]*11) % 64)
+
+
+
+//
+// HELPER methods
+//
+
+/* Stores 'value' as 4 big endian bytes at 'dst'. */
+void qoi_io_put_uint32(unsigned char *dst, uint32_t value) {
+    dst[0] = value >> 24;
+    dst[1] = value >> 16;
+    dst[2] = value >> 8;
+    dst[3] = value;
+}
+
+/* Reads 4 big endian bytes from 'src'. */
+uint32_t qoi_io_get_uint32(const unsigned char *src) {
+    return ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 8) | src[3];
+}
+
+
+
+//
+// QOI methods
+//
+
+int qoi_load_rows(const char *filepath, ImageRowSink *sink) {
+    MappedFile file;
+    if (!image_io_map_file(filepath, &file)) {
+        return 0;
+    }
+
+    const unsigned char *data = file.data;
+    int ok = file.size >= QOI_HEADER_SIZE + sizeof(QOI_PADDING) && memcmp(data, QOI_MAGIC, 4) == 0;
+    uint32_t width = ok ? qoi_io_get_uint32(data + 4) : 0;
+    uint32_t height = ok ? qoi_io_get_uint32(data + 8) : 0;
+    ok = ok && width > 0 && height > 0 && (uint64_t)width * height <= QOI_MAX_PIXELS
+        && (data[12] == 3 || data[12] == 4) && data[13] <= 1;
+    if (!ok) {
+        printf("error: %s is not a valid .qoi file\n", filepath);
+        image_io_unmap_file(&file);
+        return 0;
+    }
+
+    if (!sink->begin(sink->data, width, height)) {
+        image_io_unmap_file(&file);
+        return 0;
+    }
+
+    // decode straight out of the mapped file, one row at a time
+    unsigned char *row = malloc(4 * (size_t)width);
+    unsigned char index[64][4];
+    unsigned char px[4] = {0, 0, 0, 255};
+    memset(index, 0, sizeof(index));
+    size_t p = QOI_HEADER_SIZE;
+    size_t end = file.size - sizeof(QOI_PADDING);
+    int run = 0;
+
+    for (uint32_t y = 0; y < height && ok; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            if (run > 0) {
+                run--;
+            }
+            else if (p < end) {
+                // the padding after 'end' means even a 5 byte chunk never reads past the file
+                int b1 = data[p++];
+                if (b1 == QOI_OP_RGB) {
+                    memcpy(px, data + p, 3);
+                    p += 3;
+                }
+                else if (b1 == QOI_OP_RGBA) {
+                    memcpy(px, data + p, 4);
+                    p += 4;
+                }
+                else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+                    memcpy(px, index[b1], 4);
+                }
+                else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+                    px[0] += ((b1 >> 4) & 0x03) - 2;
+                    px[1] += ((b1 >> 2) & 0x03) - 2;
+                    px[2] += (b1 & 0x03) - 2;
+                }
+                else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+                    int b2 = data[p++];
+                    int dg = (b1 & 0x3f) - 32;
+                    px[0] += dg - 8 + ((b2 >> 4) & 0x0f);
+                    px[1] += dg;
+                    px[2] += dg - 8 + (b2 & 0x0f);
+                }
+                else {
+                    run = b1 & 0x3f;
+                }
+                memcpy(index[QOI_HASH(px)], px, 4);
+            }
+            memcpy(row + 4 * x, px, 4);
+        }
+        ok = sink->row(sink->data, y, row, IMAGE_ROW_UNORM8);
+    }
+
+    free(row);
+    image_io_unmap_file(&file);
+    return ok;
+}
+
+int qoi_load(const char *filepath, PixelBuffer *out) {
+    ImageRowSink sink = image_io_pixelbuffer_sink(out);
+    return qoi_load_rows(filepath, &sink);
+}
+
+/* Everything a .qoi row writer carries from one row to the next. */
+typedef struct qoiwriter {
+    FILE *file;
+    char *tmpPath;
+    char *filepath;
+    int width;
+    int height;
+    int rowsWritten;
+
+    // the row being encoded, as 8-bit rgba, and the chunks it encodes to
+    unsigned char *row;
+    unsigned char *encoded;
+
+    // the encoder's state, which carries across rows
+    unsigned char index[64][4];
+    unsigned char prev[4];
+    int run;
+} QoiWriter;
+
+/* Encodes and writes the next row. A run of pixels is left open at the end of
+the row, since it may carry on into the next one. */
+int qoi_writer_row(void *data, const float *rgba) {
+    QoiWriter *self = (QoiWriter *)data;
+    if (self->rowsWritten == self->height) {
+        printf("error: too many rows for %s\n", self->filepath);
+        return 0;
+    }
+
+    convert_floats_to_unorm8(self->row, rgba, 4 * self->width);
+    unsigned char *encoded = self->encoded;
+    unsigned char *prev = self->prev;
+    size_t length = 0;
+
+    for (int x = 0; x < self->width; x++) {
+        const unsigned char *px = self->row + 4 * x;
+        if (memcmp(px, prev, 4) == 0) {
+            if (++self->run == 62) {
+                encoded[length++] = QOI_OP_RUN | (self->run - 1);
+                self->run = 0;
+            }
+            continue;
+        }
+        if (self->run > 0) {
+            encoded[length++] = QOI_OP_RUN | (self->run - 1);
+            self->run = 0;
+        }
+
+        int hash = QOI_HASH(px);
+        if (memcmp(self->index[hash], px, 4) == 0) {
+            encoded[length++] = QOI_OP_INDEX | hash;
+        }
+        else if (px[3] == prev[3]) {
+            memcpy(self->index[hash], px, 4);
+
+            // the differences wrap around, just like the decoder's sums do
+            signed char dr = px[0] - prev[0];
+            signed char dg = px[1] - prev[1];
+            signed char db = px[2] - prev[2];
+            signed char drg = dr - dg;
+            signed char dbg = db - dg;
+
+            if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                encoded[length++] = QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+            }
+            else if (drg >= -8 && drg <= 7 && dg >= -32 && dg <= 31 && dbg >= -8 && dbg <= 7) {
+                encoded[length++] = QOI_OP_LUMA | (dg + 32);
+                encoded[length++] = (drg + 8) << 4 | (dbg + 8);
+            }
+            else {
+                encoded[length++] = QOI_OP_RGB;
+                memcpy(encoded + length, px, 3);
+                length += 3;
+            }
+        }
+        else {
+            memcpy(self->index[hash], px, 4);
+            encoded[length++] = QOI_OP_RGBA;
+            memcpy(encoded + length, px, 4);
+            length += 4;
+        }
+        memcpy(prev, px, 4);
+    }
+
+    self->rowsWritten++;
+    return fwrite(encoded, 1, length, self->file) == length;
+}
+
+/* Closes the last run and the stream, and moves the file into place. */
+int qoi_writer_finish(void *data, int ok) {
+    QoiWriter *self = (QoiWriter *)data;
+    if (ok && self->rowsWritten != self->height) {
+        printf("error: only %d of %d rows were written to %s\n", self->rowsWritten, self->height, self->filepath);
+        ok = 0;
+    }
+    if (ok) {
+        if (self->run > 0) {
+            fputc(QOI_OP_RUN | (self->run - 1), self->file);
+        }
+        fwrite(QOI_PADDING, 1, sizeof(QOI_PADDING), self->file);
+    }
+
+    ok = image_io_close_temp(self->file, self->tmpPath, self->filepath, ok);
+    free(self->filepath);
+    free(self->row);
+    free(self->encoded);
+    free(self);
+    return ok;
+}
+
+int qoi_open_writer(const char *filepath, int width, int height, ImageRowWriter *out) {
+    if ((uint64_t)width * height > QOI_MAX_PIXELS) {
+        printf("error: the image is too large to save as a .qoi\n");
+        return 0;
+    }
+
+    char *tmpPath;
+    FILE *file = image_io_open_temp(filepath, &tmpPath);
+    if (file == NULL) {
+        return 0;
+    }
+
+    // 4 channels, srgb with linear alpha
+    unsigned char header[QOI_HEADER_SIZE];
+    memcpy(header, QOI_MAGIC, 4);
+    qoi_io_put_uint32(header + 4, width);
+    qoi_io_put_uint32(header + 8, height);
+    header[12] = 4;
+    header[13] = 0;
+    fwrite(header, 1, QOI_HEADER_SIZE, file);
+
+    QoiWriter *self = calloc(1, sizeof(QoiWriter));
+    self->file = file;
+    self->tmpPath = tmpPath;
+    self->filepath = strdup(filepath);
+    self->width = width;
+    self->height = height;
+    self->prev[3] = 255;
+
+    // no pixel takes more than 5 bytes, plus one for a run carried over from the last row
+    self->row = malloc(4 * (size_t)width);
+    self->encoded = malloc(5 * (size_t)width + 1);
+
+    out->row = qoi_writer_row;
+    out->finish = qoi_writer_finish;
+    out->data = self;
+    return 1;
+}
+
+int qoi_save(PixelBuffer *source, const char *filepath, SaveProgress *progress) {
+    int width = source->width;
+    int height = source->height;
+    if (progress != NULL) {
+        atomic_store(&progress->total, height);
+    }
+
+    ImageRowWriter writer;
+    if (!qoi_open_writer(filepath, width, height, &writer)) {
+        return 0;
+    }
+
+    int ok = 1;
+    for (int y = 0; y < height && ok; y++) {
+        ok = writer.row(writer.data, source->rgbadata + 4 * (size_t)y * width);
+        save_progress_report(progress, 1);
+        ok = ok && !save_progress_is_cancelled(progress);
+    }
+    return writer.finish(writer.data, ok);
+}
@@ -0,0 +1,40 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef QOI_IO_H_
+#define QOI_IO_H_
+
+#include "image_io.h"  // SaveProgress
+#include "pixel_buffer.h"  // PixelBuffer
+
+/* The first 4 bytes of every .qoi file. */
+#define QOI_MAGIC "qoif"
+
+/* The largest image (in pixels) a .qoi is allowed to hold. */
+#define QOI_MAX_PIXELS 400000000
+
+/* Decodes the .qoi at 'filepath' into 'sink', one row at a time, straight out
+of the memory mapped file (see image_io_load_rows()). */
+int qoi_load_rows(const char *filepath, ImageRowSink *sink);
+
+/* Loads the .qoi at 'filepath' into a new pixelbuffer at 'out', with a white
+background, decoded in a single pass. Returns false (and prints why, leaving
+'out' alone) if it is not a readable .qoi. A truncated .qoi still loads, with
+its last decoded pixel repeated to the end. */
+int qoi_load(const char *filepath, PixelBuffer *out);
+
+/* Starts writing a width x height 4-channel .qoi to 'filepath' one row at a
+time (see image_io_open_writer()). Each row is encoded as it is given, so
+nothing but the row itself is held. */
+int qoi_open_writer(const char *filepath, int width, int height, ImageRowWriter *out);
+
+/* Writes 'source' to 'filepath' as a 4-channel .qoi, in a single pass over
+its pixels. Only the float copy of the pixels (rgbadata) is read. 'progress'
+may be NULL. Returns false (and prints why) if the file could not be written,
+or if the save was cancelled, in which case the file is left as it was. */
+int qoi_save(PixelBuffer *source, const char *filepath, SaveProgress *progress);
+
+#endif  // QOI_IO_H_
@@ -0,0 +1,272 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "recipe.h"
+
+#include "utilities.h"  // load_file
+
+#include <ctype.h>  // isspace
+#include <math.h>  // floor, M_PI
+#include <stddef.h>  // offsetof
+#include <stdio.h>  // printf
+#include <stdlib.h>  // malloc, calloc, free, strtod
+#include <string.h>  // strcmp, strdup, strchr
+
+/* The largest kernel radius a recipe may ask for. */
+#define RECIPE_MAX_RADIUS 256
+
+/* A filter a recipe can name. */
+typedef struct recipefilter {
+    const char *name;
+    FilterType type;
+} RecipeFilter;
+
+static const RecipeFilter RECIPE_FILTERS[] = {
+    {"saturation", SATURATION},
+    {"channels", CHANNELS},
+    {"invert", INVERT},
+    {"brightness-contrast", BRIGHTNESSCONTRAST},
+    {"gaussian", GAUSSIANBLUR},
+    {"motion", MOTIONBLUR},
+    {"sharpen", SHARPEN},
+    {"edge-detect", EDGEDETECT},
+    {"posterize", POSTERIZE},
+    {"threshold", THRESHOLD}
+};
+#define NUM_RECIPE_FILTERS (sizeof(RECIPE_FILTERS) / sizeof(RECIPE_FILTERS[0]))
+
+/* A param of a filter, where it is kept in FilterParams, and the values it may
+take. The defaults are the ones the filter dialogs start with. */
+typedef struct recipeparam {
+    FilterType type;
+    const char *name;
+    size_t offset;
+    int isInt;
+    double min;
+    double max;
+    double defaultValue;
+} RecipeParam;
+
+static const RecipeParam RECIPE_PARAMS[] = {
+    {SATURATION, "scale", offsetof(FilterParams, saturation.scale), 0, 0.0, 10.0, 1.0},
+    {CHANNELS, "r", offsetof(FilterParams, channels.r_scale), 0, 0.0, 10.0, 1.0},
+    {CHANNELS, "g", offsetof(FilterParams, channels.g_scale), 0, 0.0, 10.0, 1.0},
+    {CHANNELS, "b", offsetof(FilterParams, channels.b_scale), 0, 0.0, 10.0, 1.0},
+    {BRIGHTNESSCONTRAST, "brightness", offsetof(FilterParams, brightnessContrast.brightness_scale), 0, -1.0, 1.0, 0.0},
+    {BRIGHTNESSCONTRAST, "contrast", offsetof(FilterParams, brightnessContrast.contrast_scale), 0, -1.0, 1.0, 0.0},
+    {GAUSSIANBLUR, "radius", offsetof(FilterParams, gaussianBlur.radius), 1, 1, RECIPE_MAX_RADIUS, 5},
+    {MOTIONBLUR, "radius", offsetof(FilterParams, motionBlur.radius), 1, 1, RECIPE_MAX_RADIUS, 5},
+    {MOTIONBLUR, "angle", offsetof(FilterParams, motionBlur.angle), 0, 0.0, 2*M_PI, 0.0},
+    {SHARPEN, "radius", offsetof(FilterParams, sharpen.radius), 1, 1, RECIPE_MAX_RADIUS, 5},
+    {POSTERIZE, "bins", offsetof(FilterParams, posterize.num_bins), 1, 2, 256, 4},
+    {THRESHOLD, "cutoff", offsetof(FilterParams, threshold.cutoff), 0, 0.0, 1.0, 0.5}
+};
+#define NUM_RECIPE_PARAMS (sizeof(RECIPE_PARAMS) / sizeof(RECIPE_PARAMS[0]))
+
+
+
+//
+// HELPER methods
+//
+
+/* Stores 'value' as the param 'param' of 'params'. */
+void recipe_set_param(FilterParams *params, const RecipeParam *param, double value) {
+    char *dst = (char *)params + param->offset;
+    if (param->isInt) {
+        *(int *)dst = (int)value;
+    }
+    else {
+        *(double *)dst = value;
+    }
+}
+
+/* Returns 'text' with any whitespace at either end cut off, in place. */
+char* recipe_trim(char *text) {
+    while (isspace((unsigned char)*text)) {
+        text++;
+    }
+    char *end = text + strlen(text);
+    while (end > text && isspace((unsigned char)end[-1])) {
+        *--end = '\0';
+    }
+    return text;
+}
+
+/* Parses one step ("name:param=value:...") into 'step' and 'params'. Safe to
+call from several threads at once (the daemon parses every request's recipe
+on its own worker). */
+int recipe_parse_step(char *text, FilterStep *step, FilterParams *params) {
+    // a step of nothing but colons has no name at all
+    char *saved;
+    char *name = strtok_r(text, ":", &saved);
+    name = recipe_trim(name != NULL ? name : text);
+    const RecipeFilter *filter = NULL;
+    for (size_t i = 0; i < NUM_RECIPE_FILTERS; i++) {
+        if (strcmp(RECIPE_FILTERS[i].name, name) == 0) {
+            filter = &RECIPE_FILTERS[i];
+        }
+    }
+    if (filter == NULL) {
+        printf("error: there is no filter called '%s'\n", name);
+        return 0;
+    }
+
+    // start from the defaults
+    int hasParams = 0;
+    memset(params, 0, sizeof(FilterParams));
+    for (size_t i = 0; i < NUM_RECIPE_PARAMS; i++) {
+        if (RECIPE_PARAMS[i].type == filter->type) {
+            recipe_set_param(params, &RECIPE_PARAMS[i], RECIPE_PARAMS[i].defaultValue);
+            hasParams = 1;
+        }
+    }
+    step->type = filter->type;
+    step->params = hasParams ? params : NULL;
+
+    char *assignment;
+    while ((assignment = strtok_r(NULL, ":", &saved)) != NULL) {
+        char *equals = strchr(assignment, '=');
+        if (equals == NULL) {
+            printf("error: '%s' should be name=value, in %s\n", recipe_trim(assignment), name);
+            return 0;
+        }
+        *equals = '\0';
+        char *key = recipe_trim(assignment);
+        char *valueText = recipe_trim(equals + 1);
+
+        const RecipeParam *param = NULL;
+        for (size_t i = 0; i < NUM_RECIPE_PARAMS; i++) {
+            if (RECIPE_PARAMS[i].type == filter->type && strcmp(RECIPE_PARAMS[i].name, key) == 0) {
+                param = &RECIPE_PARAMS[i];
+            }
+        }
+        if (param == NULL) {
+            printf("error: %s has no param called '%s'\n", name, key);
+            return 0;
+        }
+
+        char *end;
+        double value = strtod(valueText, &end);
+        if (*valueText == '\0' || *end != '\0' || (param->isInt && value != floor(value))) {
+            printf("error: '%s' is not a valid %s for %s\n", valueText, key, name);
+            return 0;
+        }
+        if (!(value >= param->min && value <= param->max)) {
+            printf("error: %s for %s must be from %g to %g\n", key, name, param->min, param->max);
+            return 0;
+        }
+        recipe_set_param(params, param, value);
+    }
+
+    return 1;
+}
+
+
+
+//
+// RECIPE methods
+//
+
+int recipe_parse(const char *text, Recipe *out) {
+    char *copy = strdup(text);
+
+    // blank out comments, then make every step end in a comma
+    int maxSteps = 1;
+    for (char *c = copy; *c != '\0'; c++) {
+        if (*c == '#') {
+            while (*c != '\0' && *c != '\n') {
+                *c++ = ' ';
+            }
+            if (*c == '\0') {
+                break;
+            }
+        }
+        if (*c == '\n') {
+            *c = ',';
+        }
+        maxSteps += (*c == ',');
+    }
+
+    Recipe tmp;
+    tmp.steps = calloc(maxSteps, sizeof(FilterStep));
+    tmp.params = calloc(maxSteps, sizeof(FilterParams));
+    tmp.numSteps = 0;
+
+    // find the end of each step by hand, and leave splitting it up to recipe_parse_step()
+    int ok = 1;
+    char *stepText = copy;
+    while (ok && stepText != NULL) {
+        char *comma = strchr(stepText, ',');
+        if (comma != NULL) {
+            *comma = '\0';
+        }
+
+        char *trimmed = recipe_trim(stepText);
+        if (*trimmed != '\0') {
+            ok = recipe_parse_step(trimmed, &tmp.steps[tmp.numSteps], &tmp.params[tmp.numSteps]);
+            tmp.numSteps++;
+        }
+        stepText = comma != NULL ? comma + 1 : NULL;
+    }
+    free(copy);
+
+    if (ok && tmp.numSteps == 0) {
+        printf("error: the recipe has no filters in it\n");
+        ok = 0;
+    }
+    if (!ok) {
+        recipe_destroy(&tmp);
+        return 0;
+    }
+
+    // the steps point into 'params', which does not move from here on
+    *out = tmp;
+    return 1;
+}
+
+int recipe_load(const char *filepath, Recipe *out) {
+    int length;
+    char *text = load_file((char *)filepath, &length);
+    if (text == NULL) {
+        printf("error: could not read %s\n", filepath);
+        return 0;
+    }
+    int ok = recipe_parse(text, out);
+    free(text);
+    return ok;
+}
+
+void recipe_apply_to_pixelbuffer(Recipe *self, PixelBuffer *buffer) {
+    for (int i = 0; i < self->numSteps; i++) {
+        if (filter_is_convolution(self->steps[i].type)) {
+            apply_convolution_filter_to_pixelbuffer(self->steps[i].type, self->steps[i].params, buffer);
+        }
+        else {
+            apply_basic_filter_to_pixelbuffer(self->steps[i].type, self->steps[i].params, buffer);
+        }
+    }
+}
+
+void recipe_print_help() {
+    for (size_t i = 0; i < NUM_RECIPE_FILTERS; i++) {
+        printf("  %s", RECIPE_FILTERS[i].name);
+        for (size_t j = 0; j < NUM_RECIPE_PARAMS; j++) {
+            const RecipeParam *param = &RECIPE_PARAMS[j];
+            if (param->type == RECIPE_FILTERS[i].type) {
+                printf(" :%s=%g (%g to %g)", param->name, param->defaultValue, param->min, param->max);
+            }
+        }
+        printf("\n");
+    }
+}
+
+void recipe_destroy(Recipe *self) {
+    free(self->steps);
+    free(self->params);
+    self->steps = NULL;
+    self->params = NULL;
+    self->numSteps = 0;
+}
@@ -0,0 +1,54 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef RECIPE_H_
+#define RECIPE_H_
+
+#include "filter.h"  // FilterType, *Params
+#include "filter_stream.h"  // FilterStep
+
+/* The params of any one filter. */
+typedef union filterparams {
+    SaturationParams saturation;
+    ChannelsParams channels;
+    BrightnessContrastParams brightnessContrast;
+    GaussianBlurParams gaussianBlur;
+    MotionBlurParams motionBlur;
+    SharpenParams sharpen;
+    PosterizeParams posterize;
+    ThresholdParams threshold;
+} FilterParams;
+
+/* A chain of filters to apply one after the other, parsed from text like
+"gaussian:radius=8,sharpen:radius=2". */
+typedef struct recipe {
+    // steps[i].params points at params[i] (or is NULL for filters without any)
+    FilterStep *steps;
+    FilterParams *params;
+    int numSteps;
+} Recipe;
+
+/* Parses 'text' into a new recipe at 'out'. Steps are separated by commas or
+new lines, and each is a filter's name followed by any of its params as
+:name=value, in any order. Params that are left out keep the value the
+filter's dialog starts with. Anything from a # to the end of a line is a
+comment. Returns false (and prints why, leaving 'out' alone) if a name or
+value is not recognized, or a value is out of range (which nan always is). */
+int recipe_parse(const char *text, Recipe *out);
+
+/* Parses the recipe in the file at 'filepath' (see recipe_parse()). */
+int recipe_load(const char *filepath, Recipe *out);
+
+/* Applies every step of the recipe to 'buffer', in order. */
+void recipe_apply_to_pixelbuffer(Recipe *self, PixelBuffer *buffer);
+
+/* Prints the filters and params a recipe can use, for --help. */
+void recipe_print_help();
+
+/* Frees the memory allocated for the recipe. */
+void recipe_destroy(Recipe *self);
+
+#endif  // RECIPE_H_
@@ -0,0 +1,160 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "render_buffer.h"
+
+#include <pthread.h>  // pthread
+#include <stdio.h>  // printf
+#include <stdlib.h>  // malloc, free
+
+#ifdef __SSE2__
+#include <emmintrin.h>  // SSE2 intrinsics
+#endif
+
+/* How many threads to split a large conversion across. */
+#define NUM_CONVERT_THREADS 8
+
+/* Regions with fewer pixels than this are converted on the calling thread, since
+spawning threads would cost more than the conversion itself (a typical brush
+dab is well under this). */
+#define MIN_THREADED_PIXELS (256*256)
+
+
+
+//
+// CONVERSION methods
+//
+
+void convert_floats_to_unorm8(unsigned char *dst, const float *src, int count) {
+    int i = 0;
+
+#ifdef __SSE2__
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(255.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+
+    // 16 floats (4 pixels) per iteration, packed down to 16 bytes
+    for (; i + 16 <= count; i += 16) {
+        __m128i a = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + 0), zero), one), scale), half));
+        __m128i b = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + 4), zero), one), scale), half));
+        __m128i c = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + 8), zero), one), scale), half));
+        __m128i d = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + 12), zero), one), scale), half));
+
+        // every value is already in [0, 255], so the saturating packs are exact
+        __m128i ab = _mm_packs_epi32(a, b);
+        __m128i cd = _mm_packs_epi32(c, d);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(ab, cd));
+    }
+#endif
+
+    // whatever is left over (or everything, without SSE2)
+    for (; i < count; i++) {
+        float v = src[i];
+        v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+        dst[i] = (unsigned char)(v * 255.0f + 0.5f);
+    }
+}
+
+/* a struct to hold everything one conversion thread needs. */
+typedef struct convert_worker_args {
+    unsigned char *dst;
+    int dstRowLength;
+    PixelBuffer *src;
+    PixelRect rect;
+} ConvertWorkerArgs;
+
+/* Converts every row of args->rect. 'dst' points at the first pixel of the
+worker's first row. */
+void* convert_worker(void *data) {
+    ConvertWorkerArgs *args = (ConvertWorkerArgs *)data;
+    PixelRect r = args->rect;
+
+    for (int y = r.y0; y < r.y1; y++) {
+        float *src = args->src->rgbadata + 4 * (y * args->src->width + r.x0);
+        unsigned char *dst = args->dst + 4 * (y - r.y0) * args->dstRowLength;
+        convert_floats_to_unorm8(dst, src, 4 * (r.x1 - r.x0));
+    }
+
+    return NULL;
+}
+
+void pixelbuffer_convert_to_unorm8(PixelBuffer *source, PixelRect rect, unsigned char *dst, int dstRowLength) {
+    rect = pixelrect_clip(rect, source);
+    if (pixelrect_is_empty(rect)) {
+        return;
+    }
+
+    int rows = rect.y1 - rect.y0;
+    int pixels = (rect.x1 - rect.x0) * rows;
+
+    // small regions are not worth the thread overhead
+    if (pixels < MIN_THREADED_PIXELS || rows < NUM_CONVERT_THREADS) {
+        ConvertWorkerArgs args = {dst, dstRowLength, source, rect};
+        convert_worker((void *)(&args));
+        return;
+    }
+
+    // otherwise split the rows into bands, one per thread
+    pthread_t tids[NUM_CONVERT_THREADS];
+    ConvertWorkerArgs args[NUM_CONVERT_THREADS];
+
+    for (int i = 0; i < NUM_CONVERT_THREADS; i++) {
+        args[i].src = source;
+        args[i].dstRowLength = dstRowLength;
+        args[i].rect = rect;
+        args[i].rect.y0 = rect.y0 + (rows * i) / NUM_CONVERT_THREADS;
+        args[i].rect.y1 = rect.y0 + (rows * (i + 1)) / NUM_CONVERT_THREADS;
+        args[i].dst = dst + 4 * (args[i].rect.y0 - rect.y0) * dstRowLength;
+    }
+
+    // the calling thread takes the first band itself
+    for (int i = 1; i < NUM_CONVERT_THREADS; i++) {
+        pthread_create(&tids[i], NULL, convert_worker, (void *)(&args[i]));
+    }
+    convert_worker((void *)(&args[0]));
+
+    for (int i = 1; i < NUM_CONVERT_THREADS; i++) {
+        pthread_join(tids[i], NULL);
+    }
+}
+
+
+
+//
+// RENDERBUFFER methods
+//
+
+RenderBuffer renderbuffer_new(int width, int height) {
+    RenderBuffer tmp;
+    tmp.width = width;
+    tmp.height = height;
+    tmp.data = malloc(sizeof(unsigned char) * 4 * width * height);
+    return tmp;
+}
+
+void renderbuffer_destroy(RenderBuffer *self) {
+    free(self->data);
+    self->data = NULL;
+}
+
+void renderbuffer_update(RenderBuffer *self, PixelBuffer *source, PixelRect rect) {
+    if (self->width != source->width || self->height != source->height) {
+        printf("ERROR: dimension mismatch in renderbuffer update\n");
+        return;
+    }
+
+    rect = pixelrect_clip(rect, source);
+    if (pixelrect_is_empty(rect)) {
+        return;
+    }
+
+    pixelbuffer_convert_to_unorm8(source, rect, renderbuffer_get_pixel_pointer(self, rect.x0, rect.y0), self->width);
+}
+
+unsigned char* renderbuffer_get_pixel_pointer(RenderBuffer *self, int x, int y) {
+    return self->data + 4 * (y * self->width + x);
+}
@@ -0,0 +1,45 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef RENDER_BUFFER_H_
+#define RENDER_BUFFER_H_
+
+#include "pixel_buffer.h"  // PixelBuffer, PixelRect
+
+/* An 8-bit-per-channel copy of a pixelbuffer, laid out the way GL_RGBA8 textures
+expect it. Only the display uses it; editing stays in floating point. */
+typedef struct renderbuffer {
+    int width;
+    int height;
+
+    // width * height * 4 bytes, rgba
+    unsigned char *data;
+} RenderBuffer;
+
+/* Converts 'count' floats in [0, 1] to bytes in [0, 255], rounding to nearest.
+Values outside [0, 1] are clamped. */
+void convert_floats_to_unorm8(unsigned char *dst, const float *src, int count);
+
+/* Converts the pixels of 'source' inside 'rect' to 8-bit rgba and writes them to
+'dst', which holds 'dstRowLength' pixels per row and starts at the top-left
+pixel of the rect. Large rects are split across threads. */
+void pixelbuffer_convert_to_unorm8(PixelBuffer *source, PixelRect rect, unsigned char *dst, int dstRowLength);
+
+/* Returns a new renderbuffer of width x height. Its contents are undefined until
+the first call to renderbuffer_update(). */
+RenderBuffer renderbuffer_new(int width, int height);
+
+/* Frees the memory allocated to the renderbuffer. */
+void renderbuffer_destroy(RenderBuffer *self);
+
+/* Converts the pixels of 'source' inside 'rect' to 8-bit and stores them in the
+renderbuffer. Both must be the same size. */
+void renderbuffer_update(RenderBuffer *self, PixelBuffer *source, PixelRect rect);
+
+/* Returns a pointer to the first byte of pixel (x, y). */
+unsigned char* renderbuffer_get_pixel_pointer(RenderBuffer *self, int x, int y);
+
+#endif  // RENDER_BUFFER_H_
@@ -0,0 +1,88 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "save_job.h"
+
+#include <stdlib.h>  // malloc, free
+#include <string.h>  // memcpy, strdup
+
+
+
+//
+// WORKER methods
+//
+
+/* Encodes and writes the snapshot, then frees it straight away, since that
+memory is no use to anyone once the file is written. */
+void* save_job_worker(void *data) {
+    SaveJob *self = (SaveJob *)data;
+
+    self->succeeded = image_io_save(&self->snapshot, self->filepath, self->compressionLevel, self->bitDepth, &self->progress);
+
+    free(self->snapshot.rgbadata);
+    self->snapshot.rgbadata = NULL;
+    atomic_store(&self->finished, 1);
+    return NULL;
+}
+
+
+
+//
+// SAVE JOB methods
+//
+
+SaveJob* save_job_start(PixelBuffer *source, const char *filepath, int compressionLevel, int bitDepth) {
+    SaveJob *self = malloc(sizeof(SaveJob));
+
+    // one memcpy of the floats is all the snapshot needs
+    size_t numFloats = 4 * (size_t)source->width * source->height;
+    self->snapshot.width = source->width;
+    self->snapshot.height = source->height;
+    self->snapshot.data = NULL;
+    self->snapshot.backgroundColor = source->backgroundColor;
+    self->snapshot.rgbadata = malloc(sizeof(float) * numFloats);
+    memcpy(self->snapshot.rgbadata, source->rgbadata, sizeof(float) * numFloats);
+
+    self->filepath = strdup(filepath);
+    self->compressionLevel = compressionLevel;
+    self->bitDepth = bitDepth;
+    atomic_init(&self->progress.done, 0);
+    atomic_init(&self->progress.total, 0);
+    atomic_init(&self->progress.cancelled, 0);
+    atomic_init(&self->finished, 0);
+    self->succeeded = 0;
+
+    pthread_create(&self->thread, NULL, save_job_worker, (void *)self);
+    return self;
+}
+
+void save_job_cancel(SaveJob *self) {
+    atomic_store(&self->progress.cancelled, 1);
+}
+
+int save_job_is_cancelled(SaveJob *self) {
+    return atomic_load(&self->progress.cancelled);
+}
+
+int save_job_is_finished(SaveJob *self) {
+    return atomic_load(&self->finished);
+}
+
+double save_job_get_progress(SaveJob *self) {
+    size_t total = atomic_load(&self->progress.total);
+    if (total == 0) {
+        return 0.0;
+    }
+    return (double)atomic_load(&self->progress.done) / total;
+}
+
+int save_job_finish(SaveJob *self) {
+    pthread_join(self->thread, NULL);
+    int succeeded = self->succeeded;
+    free(self->filepath);
+    free(self);
+    return succeeded;
+}
@@ -0,0 +1,57 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef SAVE_JOB_H_
+#define SAVE_JOB_H_
+
+#include "pixel_buffer.h"  // PixelBuffer
+#include "image_io.h"  // SaveProgress
+
+#include <pthread.h>  // pthread_t
+#include <stdatomic.h>  // atomic_int
+
+/* Saves a snapshot of a pixelbuffer to a file on its own thread, so the buffer
+can go on being edited while the file is written. */
+typedef struct savejob {
+    // a private copy of the pixels being saved (only the floats, which is all
+    // image_io_save() reads)
+    PixelBuffer snapshot;
+
+    char *filepath;
+    int compressionLevel;
+    int bitDepth;
+
+    SaveProgress progress;
+
+    // set by the worker once it is done, and whether the file was written
+    atomic_int finished;
+    int succeeded;
+
+    pthread_t thread;
+} SaveJob;
+
+/* Copies the pixels of 'source' and starts writing them to 'filepath' in the
+background, in the format its extension asks for (see image_io_save()). The
+caller can change (or free) 'source' as soon as this returns, but must hold
+whatever lock protects it until then. */
+SaveJob* save_job_start(PixelBuffer *source, const char *filepath, int compressionLevel, int bitDepth);
+
+/* Asks the job to stop early. The file being replaced is left as it was. */
+void save_job_cancel(SaveJob *self);
+
+/* Returns true if the job was cancelled. */
+int save_job_is_cancelled(SaveJob *self);
+
+/* Returns true once the job has stopped, whether or not it succeeded. */
+int save_job_is_finished(SaveJob *self);
+
+/* Returns roughly how much of the job is done, from 0.0 to 1.0. */
+double save_job_get_progress(SaveJob *self);
+
+/* Waits for the job to stop, then frees it. Returns true if the file was written. */
+int save_job_finish(SaveJob *self);
+
+#endif  // SAVE_JOB_H_
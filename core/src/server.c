@@ -0,0 +1,977 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+// for memmem, memfd_create, accept4 and pipe2
+#define _GNU_SOURCE
+
+#include "server.h"
+
+#include "batch_scheduler.h"  // batch_now
+#include "filter.h"
+#include "image_io.h"
+#include "kernel_cache.h"
+#include "pixel_buffer.h"
+#include "recipe.h"
+
+#include <errno.h>  // errno, EINTR
+#include <fcntl.h>  // O_NONBLOCK, O_CLOEXEC
+#include <getopt.h>  // getopt_long
+#include <poll.h>  // poll
+#include <pthread.h>  // pthread
+#include <signal.h>  // sigaction, pthread_sigmask
+#include <stdio.h>  // printf, snprintf
+#include <stdlib.h>  // malloc, free, strtol, getenv, qsort
+#include <string.h>  // memset, memcpy, memmove, memmem, strchr, strcmp, strerror
+#include <sys/mman.h>  // mmap, munmap, memfd_create
+#include <sys/socket.h>  // socket, bind, listen, accept4, sendmsg, recvmsg
+#include <sys/stat.h>  // fstat, umask
+#include <sys/un.h>  // sockaddr_un
+#include <unistd.h>  // close, read, write, pipe2, unlink, ftruncate, sysconf, getuid
+
+#ifdef __GLIBC__
+#include <malloc.h>  // mallopt
+#endif
+
+/* The longest a request may be, including its recipe. */
+#define SERVER_MAX_REQUEST_BYTES (1 << 16)
+
+/* The most descriptors a single request may send along. */
+#define SERVER_MAX_PASSED_FDS 4
+
+/* How many connections with a request in may wait for a worker before the
+daemon stops taking more off the sockets. */
+#define SERVER_MAX_PENDING 64
+
+/* How long an answer may wait for a client that is not reading them, before
+the client is given up on. */
+#define SERVER_SEND_TIMEOUT_MS 10000
+
+/* How many of the latest requests the latency percentiles are taken over. */
+#define SERVER_RECENT_REQUESTS 1024
+
+/* How many requests are served at once, if not told otherwise. The cores
+left over go to the filters of each request. */
+#define SERVER_DEFAULT_JOBS 4
+
+/* The stages of a request that are timed. */
+typedef enum serverstage {
+    SERVER_READ,
+    SERVER_FILTER,
+    SERVER_WRITE,
+    NUM_SERVER_STAGES
+} ServerStage;
+
+/* How many requests have been served, and how long they took. */
+typedef struct serverstats {
+    long numRequests;
+    long numFailed;
+    double stageSeconds[NUM_SERVER_STAGES];
+    double totalSeconds;
+    double maxSeconds;
+
+    // the whole time of the latest requests, oldest overwritten first
+    double recent[SERVER_RECENT_REQUESTS];
+    int numRecent;
+} ServerStats;
+
+static ServerStats s_stats;
+static pthread_mutex_t s_statsLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Set by SIGINT and SIGTERM, to stop accepting connections. */
+static volatile sig_atomic_t s_stop = 0;
+
+
+
+//
+// STATS methods
+//
+
+/* Adds a request that took 'total' seconds, 'stageSeconds' of them in each stage. */
+void server_stats_record(int ok, const double *stageSeconds, double total) {
+    pthread_mutex_lock(&s_statsLock);
+    s_stats.numRequests++;
+    s_stats.numFailed += !ok;
+    for (int stage = 0; stage < NUM_SERVER_STAGES; stage++) {
+        s_stats.stageSeconds[stage] += stageSeconds[stage];
+    }
+    s_stats.totalSeconds += total;
+    s_stats.maxSeconds = total > s_stats.maxSeconds ? total : s_stats.maxSeconds;
+    s_stats.recent[s_stats.numRecent % SERVER_RECENT_REQUESTS] = total;
+    s_stats.numRecent++;
+    pthread_mutex_unlock(&s_statsLock);
+}
+
+int server_compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Writes the stats into 'text' as "key value" lines, ended by an empty line.
+Times are in seconds. */
+void server_stats_format(char *text, size_t size) {
+    pthread_mutex_lock(&s_statsLock);
+    ServerStats stats = s_stats;
+    pthread_mutex_unlock(&s_statsLock);
+
+    int numRecent = stats.numRecent < SERVER_RECENT_REQUESTS ? stats.numRecent : SERVER_RECENT_REQUESTS;
+    qsort(stats.recent, numRecent, sizeof(double), server_compare_doubles);
+    double percentiles[3] = {0.5, 0.95, 0.99};
+    double latencies[3] = {0.0, 0.0, 0.0};
+    for (int i = 0; i < 3 && numRecent > 0; i++) {
+        latencies[i] = stats.recent[(int)(percentiles[i] * (numRecent - 1) + 0.5)];
+    }
+
+    long hits, misses;
+    kernel_cache_get_stats(&hits, &misses);
+    double n = stats.numRequests > 0 ? stats.numRequests : 1;
+    snprintf(text, size,
+        "requests %ld\n"
+        "failed %ld\n"
+        "read_mean %.6f\n"
+        "filter_mean %.6f\n"
+        "write_mean %.6f\n"
+        "total_mean %.6f\n"
+        "total_p50 %.6f\n"
+        "total_p95 %.6f\n"
+        "total_p99 %.6f\n"
+        "total_max %.6f\n"
+        "kernel_cache_hits %ld\n"
+        "kernel_cache_misses %ld\n"
+        "\n",
+        stats.numRequests, stats.numFailed,
+        stats.stageSeconds[SERVER_READ] / n, stats.stageSeconds[SERVER_FILTER] / n,
+        stats.stageSeconds[SERVER_WRITE] / n, stats.totalSeconds / n,
+        latencies[0], latencies[1], latencies[2], stats.maxSeconds, hits, misses);
+}
+
+
+
+//
+// CONNECTION methods
+//
+
+/* A client's connection, and what it has sent that is not yet handled. Its
+socket never blocks: a connection only goes to a worker once it has something
+to read, and goes back to waiting once what it sent has been answered. */
+typedef struct serverconnection {
+    int fd;
+
+    // the bytes received, starting at the next request
+    char *buffer;
+    size_t length;
+
+    // the descriptors received with them
+    int passedFds[SERVER_MAX_PASSED_FDS];
+    int numPassedFds;
+
+    // set once the client has hung up (or the socket failed)
+    int hungUp;
+
+    // the next connection handed back to the poller
+    struct serverconnection *next;
+} ServerConnection;
+
+/* Returns a new connection for the client socket 'fd'. */
+ServerConnection* server_connection_new(int fd) {
+    ServerConnection *self = calloc(1, sizeof(ServerConnection));
+    self->fd = fd;
+    self->buffer = malloc(SERVER_MAX_REQUEST_BYTES);
+    return self;
+}
+
+/* Returns the length of the first whole request in the connection (up to and
+including the empty line that ends it), or 0 if there is none yet. */
+size_t server_connection_find_request(ServerConnection *self) {
+    char *end = memmem(self->buffer, self->length, "\n\n", 2);
+    return end != NULL ? (size_t)(end - self->buffer + 2) : 0;
+}
+
+/* Reads whatever the client has sent so far, without waiting for more, or
+until the buffer is full. Sets self->hungUp if the client has gone. */
+void server_connection_receive(ServerConnection *self) {
+    while (self->length < SERVER_MAX_REQUEST_BYTES) {
+        struct iovec iov = {self->buffer + self->length, SERVER_MAX_REQUEST_BYTES - self->length};
+        union {
+            struct cmsghdr header;
+            char bytes[CMSG_SPACE(sizeof(int) * SERVER_MAX_PASSED_FDS)];
+        } control;
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control.bytes;
+        message.msg_controllen = sizeof(control.bytes);
+
+        ssize_t received = recvmsg(self->fd, &message, MSG_CMSG_CLOEXEC);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (received <= 0) {
+            self->hungUp = 1;
+            return;
+        }
+        self->length += received;
+
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(&message); c != NULL; c = CMSG_NXTHDR(&message, c)) {
+            if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+            int numFds = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int fds[SERVER_MAX_PASSED_FDS];
+            memcpy(fds, CMSG_DATA(c), sizeof(int) * numFds);
+            for (int i = 0; i < numFds; i++) {
+                if (self->numPassedFds < SERVER_MAX_PASSED_FDS) {
+                    self->passedFds[self->numPassedFds++] = fds[i];
+                }
+                else {
+                    close(fds[i]);
+                }
+            }
+        }
+    }
+}
+
+/* Drops the first 'length' bytes (a handled request) and any descriptors sent with them. */
+void server_connection_consume(ServerConnection *self, size_t length) {
+    memmove(self->buffer, self->buffer + length, self->length - length);
+    self->length -= length;
+    for (int i = 0; i < self->numPassedFds; i++) {
+        close(self->passedFds[i]);
+    }
+    self->numPassedFds = 0;
+}
+
+/* Hangs up on the client and frees the connection. */
+void server_connection_close(ServerConnection *self) {
+    server_connection_consume(self, self->length);
+    close(self->fd);
+    free(self->buffer);
+    free(self);
+}
+
+/* Waits until the client can be sent more. Returns false if it has gone, or
+has not read anything for SERVER_SEND_TIMEOUT_MS. */
+int server_connection_wait_writable(ServerConnection *self) {
+    struct pollfd client = {self->fd, POLLOUT, 0};
+    int ready;
+    while ((ready = poll(&client, 1, SERVER_SEND_TIMEOUT_MS)) < 0 && errno == EINTR);
+    return ready == 1 && (client.revents & POLLOUT);
+}
+
+/* Sends 'text' to the client, along with 'fd' unless it is -1. Returns false
+if the client has gone. */
+int server_connection_reply(ServerConnection *self, const char *text, int fd) {
+    struct iovec iov = {(void *)text, strlen(text)};
+    union {
+        struct cmsghdr header;
+        char bytes[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+
+    if (fd >= 0) {
+        message.msg_control = control.bytes;
+        message.msg_controllen = sizeof(control.bytes);
+        struct cmsghdr *c = CMSG_FIRSTHDR(&message);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(c), &fd, sizeof(int));
+    }
+
+    // the descriptor goes with the first byte, so only the rest can need resending
+    ssize_t sent;
+    while ((sent = sendmsg(self->fd, &message, MSG_NOSIGNAL)) < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            if (!server_connection_wait_writable(self)) {
+                return 0;
+            }
+        }
+        else if (errno != EINTR) {
+            return 0;
+        }
+    }
+    size_t length = iov.iov_len;
+    while ((size_t)sent < length) {
+        ssize_t more = send(self->fd, text + sent, length - sent, MSG_NOSIGNAL);
+        if (more < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!server_connection_wait_writable(self)) {
+                return 0;
+            }
+            continue;
+        }
+        if (more < 0 && errno == EINTR) {
+            continue;
+        }
+        if (more <= 0) {
+            return 0;
+        }
+        sent += more;
+    }
+    return 1;
+}
+
+
+
+//
+// REQUEST methods
+//
+
+/* A parsed request. The strings point into the connection's buffer. */
+typedef struct serverrequest {
+    int stats;
+    char *recipe;
+
+    // paths, or NULL for pixels in shared memory
+    char *input;
+    char *output;
+
+    // the size of the input, when it is in shared memory
+    int width;
+    int height;
+
+    int compressionLevel;
+    int bitDepth;
+} ServerRequest;
+
+/* Parses the 'length' bytes of 'text' (a request, ending in an empty line)
+into 'request', splitting 'text' up into its strings. Returns NULL, or what is
+wrong with it. */
+const char* server_parse_request(char *text, size_t length, ServerRequest *request) {
+    memset(request, 0, sizeof(ServerRequest));
+    request->compressionLevel = IMAGE_COMPRESSION_DEFAULT;
+    request->bitDepth = IMAGE_DEPTH_8;
+    int hasInput = 0;
+    int hasOutput = 0;
+
+    // a NUL would end a line before its newline, so it is never let in
+    if (memchr(text, '\0', length) != NULL) {
+        return "malformed request";
+    }
+
+    // each line is a key, a space, and the rest is its value
+    text[length - 1] = '\0';
+    char *line = text;
+    while (*line != '\0') {
+        char *end = strchr(line, '\n');
+        if (end == NULL) {
+            return "malformed request";
+        }
+        *end = '\0';
+        char *value = strchr(line, ' ');
+        if (value != NULL) {
+            *value++ = '\0';
+        }
+
+        if (strcmp(line, "stats") == 0) {
+            request->stats = 1;
+        }
+        else if (value == NULL) {
+            return "every line but stats needs a value";
+        }
+        else if (strcmp(line, "recipe") == 0) {
+            request->recipe = value;
+        }
+        else if (strcmp(line, "input") == 0) {
+            hasInput = 1;
+            if (strncmp(value, "memfd ", 6) == 0) {
+                if (sscanf(value + 6, "%d %d", &request->width, &request->height) != 2
+                        || request->width <= 0 || request->height <= 0) {
+                    return "input memfd needs a width and height";
+                }
+            }
+            else {
+                request->input = value;
+            }
+        }
+        else if (strcmp(line, "output") == 0) {
+            hasOutput = 1;
+            request->output = strcmp(value, "memfd") == 0 ? NULL : value;
+        }
+        else if (strcmp(line, "compression") == 0) {
+            request->compressionLevel = strtol(value, NULL, 10);
+            if (request->compressionLevel < 0 || request->compressionLevel > 9) {
+                return "compression must be from 0 to 9";
+            }
+        }
+        else if (strcmp(line, "depth") == 0) {
+            request->bitDepth = strtol(value, NULL, 10);
+            if (request->bitDepth != IMAGE_DEPTH_8 && request->bitDepth != IMAGE_DEPTH_16) {
+                return "depth must be 8 or 16";
+            }
+        }
+        else {
+            return "unknown key";
+        }
+        line = end + 1;
+    }
+
+    if (!request->stats && (request->recipe == NULL || !hasInput || !hasOutput)) {
+        return "a request needs a recipe, an input and an output";
+    }
+    return NULL;
+}
+
+/* Maps the first 'bytes' of 'fd' for reading and writing, or returns NULL if
+it is shorter than that or can't be mapped. */
+float* server_map(int fd, size_t bytes) {
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < bytes) {
+        return NULL;
+    }
+    void *pixels = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return pixels != MAP_FAILED ? (float *)pixels : NULL;
+}
+
+
+
+//
+// WORKER methods
+//
+
+/* The connections that have something to read, waiting for a worker. */
+typedef struct serverqueue {
+    ServerConnection *connections[SERVER_MAX_PENDING];
+    int head;
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} ServerQueue;
+
+/* The connections waiting on their clients, watched by the thread that
+accepts them. A worker that has answered everything a client sent hands its
+connection back here, so an idle client never holds a worker. */
+typedef struct serverpoller {
+    // only ever touched by the polling thread
+    ServerConnection **idle;
+    int numIdle;
+    int capacity;
+
+    // handed back by the workers, and taken in by the polling thread once
+    // 'wake' (a pipe) tells it there are some
+    ServerConnection *returned;
+    pthread_mutex_t lock;
+    int wake[2];
+} ServerPoller;
+
+/* What each worker keeps between requests: the pixelbuffer of the last one,
+reused when the next is the same size, so the allocator stays warm. */
+typedef struct serverworker {
+    ServerQueue *queue;
+    ServerPoller *poller;
+    int quiet;
+    PixelBuffer buffer;
+    int hasBuffer;
+
+    // while a result is filtered straight into shared memory, the buffer's
+    // floats point at that, and its own are kept here
+    float *ownFloats;
+} ServerWorker;
+
+void server_queue_push(ServerQueue *self, ServerConnection *connection) {
+    pthread_mutex_lock(&self->lock);
+    while (self->count == SERVER_MAX_PENDING) {
+        pthread_cond_wait(&self->changed, &self->lock);
+    }
+    self->connections[(self->head + self->count) % SERVER_MAX_PENDING] = connection;
+    self->count++;
+    pthread_cond_broadcast(&self->changed);
+    pthread_mutex_unlock(&self->lock);
+}
+
+ServerConnection* server_queue_pop(ServerQueue *self) {
+    pthread_mutex_lock(&self->lock);
+    while (self->count == 0) {
+        pthread_cond_wait(&self->changed, &self->lock);
+    }
+    ServerConnection *connection = self->connections[self->head];
+    self->head = (self->head + 1) % SERVER_MAX_PENDING;
+    self->count--;
+    pthread_cond_broadcast(&self->changed);
+    pthread_mutex_unlock(&self->lock);
+    return connection;
+}
+
+/* Adds a connection to the ones being waited on. Only called by the polling thread. */
+void server_poller_add(ServerPoller *self, ServerConnection *connection) {
+    if (self->numIdle == self->capacity) {
+        self->capacity = self->capacity > 0 ? 2 * self->capacity : 64;
+        self->idle = realloc(self->idle, sizeof(ServerConnection *) * self->capacity);
+    }
+    self->idle[self->numIdle++] = connection;
+}
+
+/* Hands a connection back from a worker, to wait for its client's next request. */
+void server_poller_give_back(ServerPoller *self, ServerConnection *connection) {
+    pthread_mutex_lock(&self->lock);
+    connection->next = self->returned;
+    self->returned = connection;
+    pthread_mutex_unlock(&self->lock);
+
+    // the pipe never blocks; if it is full, the poller is already due to wake
+    char byte = 0;
+    while (write(self->wake[1], &byte, 1) < 0 && errno == EINTR);
+}
+
+/* Takes in the connections the workers have handed back. Only called by the
+polling thread. */
+void server_poller_take_back(ServerPoller *self) {
+    char bytes[64];
+    while (read(self->wake[0], bytes, sizeof(bytes)) > 0);
+
+    pthread_mutex_lock(&self->lock);
+    ServerConnection *connection = self->returned;
+    self->returned = NULL;
+    pthread_mutex_unlock(&self->lock);
+
+    while (connection != NULL) {
+        ServerConnection *next = connection->next;
+        server_poller_add(self, connection);
+        connection = next;
+    }
+}
+
+/* Loads the input of 'request' into the worker's buffer. If it is in shared
+memory, its mapping is returned in 'pixels' (to be unmapped by the caller).
+Returns NULL, or what went wrong. */
+const char* server_read_input(ServerWorker *self, ServerConnection *connection, ServerRequest *request, float **pixels) {
+    if (request->input != NULL) {
+        PixelBuffer loaded;
+        if (!image_io_load(request->input, &loaded)) {
+            return "could not read the input";
+        }
+        if (self->hasBuffer) {
+            pixelbuffer_destroy(&self->buffer);
+        }
+        self->buffer = loaded;
+        self->hasBuffer = 1;
+        return NULL;
+    }
+
+    if (connection->numPassedFds == 0) {
+        return "input memfd needs a file descriptor sent with the request";
+    }
+    int w = request->width;
+    int h = request->height;
+    *pixels = server_map(connection->passedFds[0], (size_t)w * h * 4 * sizeof(float));
+    if (*pixels == NULL) {
+        return "could not map the input, or it is smaller than width x height";
+    }
+
+    if (!self->hasBuffer || self->buffer.width != w || self->buffer.height != h) {
+        if (self->hasBuffer) {
+            pixelbuffer_destroy(&self->buffer);
+        }
+        self->buffer = pixelbuffer_new(w, h);
+        self->hasBuffer = 1;
+    }
+    Color white = {1.0, 1.0, 1.0, 1.0};
+    self->buffer.backgroundColor = white;
+
+    // the filters work on the doubles, so the pixels are always converted into
+    // those. But if the result goes back into the same memory, the float copy
+    // the filters keep up to date is the mapping itself, so they write the
+    // result straight into it and it is never copied out again.
+    if (request->output == NULL) {
+        self->ownFloats = self->buffer.rgbadata;
+        self->buffer.rgbadata = *pixels;
+        double *data = (double *)self->buffer.data;
+        for (size_t i = 0; i < 4 * (size_t)w * h; i++) {
+            data[i] = (*pixels)[i];
+        }
+        return NULL;
+    }
+    for (int y = 0; y < h; y++) {
+        pixelbuffer_set_span_floats(&self->buffer, 0, y, w, *pixels + (size_t)y * w * 4);
+    }
+    return NULL;
+}
+
+/* Writes the worker's buffer to the output of 'request'. A result in shared
+memory overwrites 'pixels' (the input's mapping) if there is one, or else goes
+into a new memfd, returned in 'fd'. Returns NULL, or what went wrong. */
+const char* server_write_output(ServerWorker *self, ServerRequest *request, float *pixels, int *fd) {
+    if (request->output != NULL) {
+        if (!image_io_save(&self->buffer, request->output, request->compressionLevel, request->bitDepth, NULL)) {
+            return "could not write the output";
+        }
+        return NULL;
+    }
+
+    // a result filtered in place is already there (see server_read_input())
+    if (pixels != NULL) {
+        return NULL;
+    }
+
+    size_t bytes = (size_t)self->buffer.width * self->buffer.height * 4 * sizeof(float);
+    float *result;
+    *fd = memfd_create("tinypaint-result", MFD_CLOEXEC);
+    if (*fd < 0 || ftruncate(*fd, bytes) != 0 || (result = server_map(*fd, bytes)) == NULL) {
+        return "could not create the output memfd";
+    }
+
+    // the float copy the pixelbuffer keeps is exactly the shared layout
+    memcpy(result, self->buffer.rgbadata, bytes);
+    munmap(result, bytes);
+    return NULL;
+}
+
+/* Serves one request, and writes the answer to it into 'reply'. 'fd' is set
+to a descriptor to send along with it, or -1. */
+void server_handle_request(ServerWorker *self, ServerConnection *connection, ServerRequest *request, char *reply, size_t size, int *fd) {
+    double seconds[NUM_SERVER_STAGES] = {0.0, 0.0, 0.0};
+    double start = batch_now();
+    *fd = -1;
+
+    Recipe recipe;
+    int parsed = recipe_parse(request->recipe, &recipe);
+    const char *problem = parsed ? NULL : "could not parse the recipe";
+
+    float *pixels = NULL;
+    if (problem == NULL) {
+        problem = server_read_input(self, connection, request, &pixels);
+    }
+    seconds[SERVER_READ] = batch_now() - start;
+
+    if (problem == NULL) {
+        double filterStart = batch_now();
+        recipe_apply_to_pixelbuffer(&recipe, &self->buffer);
+        seconds[SERVER_FILTER] = batch_now() - filterStart;
+
+        double writeStart = batch_now();
+        problem = server_write_output(self, request, pixels, fd);
+        seconds[SERVER_WRITE] = batch_now() - writeStart;
+    }
+
+    if (self->ownFloats != NULL) {
+        self->buffer.rgbadata = self->ownFloats;
+        self->ownFloats = NULL;
+    }
+    if (pixels != NULL) {
+        munmap(pixels, (size_t)request->width * request->height * 4 * sizeof(float));
+    }
+    if (problem != NULL && *fd >= 0) {
+        close(*fd);
+        *fd = -1;
+    }
+    if (parsed) {
+        recipe_destroy(&recipe);
+    }
+
+    double total = batch_now() - start;
+    server_stats_record(problem == NULL, seconds, total);
+    if (problem != NULL) {
+        snprintf(reply, size, "error %s\n", problem);
+        return;
+    }
+
+    snprintf(reply, size, "ok %d %d %.6f\n", self->buffer.width, self->buffer.height, total);
+    if (!self->quiet) {
+        printf("%s -> %s (%d x %d, read %.1f ms, filter %.1f ms, write %.1f ms)\n",
+            request->input != NULL ? request->input : "memfd", request->output != NULL ? request->output : "memfd",
+            self->buffer.width, self->buffer.height,
+            1000.0 * seconds[SERVER_READ], 1000.0 * seconds[SERVER_FILTER], 1000.0 * seconds[SERVER_WRITE]);
+    }
+}
+
+/* Reads what the client has sent, and answers every whole request in it, one
+after the other. Returns true to wait for the client's next request, or false
+once it has hung up (or sent a request longer than SERVER_MAX_REQUEST_BYTES). */
+int server_serve_connection(ServerWorker *self, ServerConnection *connection) {
+    server_connection_receive(connection);
+
+    size_t length;
+    while ((length = server_connection_find_request(connection)) > 0) {
+        char reply[1024];
+        int replyFd = -1;
+        ServerRequest request;
+        const char *problem = server_parse_request(connection->buffer, length, &request);
+        if (problem != NULL) {
+            snprintf(reply, sizeof(reply), "error %s\n", problem);
+        }
+        else if (request.stats) {
+            server_stats_format(reply, sizeof(reply));
+        }
+        else {
+            server_handle_request(self, connection, &request, reply, sizeof(reply), &replyFd);
+        }
+
+        int sent = server_connection_reply(connection, reply, replyFd);
+        if (replyFd >= 0) {
+            close(replyFd);
+        }
+        server_connection_consume(connection, length);
+        if (!sent) {
+            return 0;
+        }
+    }
+    return !connection->hungUp && connection->length < SERVER_MAX_REQUEST_BYTES;
+}
+
+void* server_worker(void *data) {
+    ServerWorker *self = (ServerWorker *)data;
+    while (1) {
+        ServerConnection *connection = server_queue_pop(self->queue);
+        if (server_serve_connection(self, connection)) {
+            server_poller_give_back(self->poller, connection);
+        }
+        else {
+            server_connection_close(connection);
+        }
+    }
+    return NULL;
+}
+
+
+
+//
+// SERVER methods
+//
+
+void server_on_signal(int number) {
+    (void)number;
+    s_stop = 1;
+}
+
+/* Prints how to use daemon mode. */
+void server_print_usage(const char *socketPath) {
+    printf("usage: tinypaint --daemon [options]\n"
+        "\n"
+        "Listens on a unix domain socket and applies recipes of filters for other\n"
+        "processes, keeping its threads, kernels and memory warm between requests.\n"
+        "See server.h for the protocol. Stops on SIGINT or SIGTERM.\n"
+        "\n"
+        "  -s, --socket PATH        where to listen (default %s)\n"
+        "  -j, --jobs N             how many requests to serve at once (default: up to %d,\n"
+        "                           and any cores left over filter each request)\n"
+        "  -q, --quiet              only print errors\n"
+        "  -h, --help               print this\n",
+        socketPath, SERVER_DEFAULT_JOBS);
+}
+
+int server_main(int argc, char *argv[]) {
+    static const struct option longOptions[] = {
+        {"socket", required_argument, NULL, 's'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"quiet", no_argument, NULL, 'q'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    // in the user's runtime directory, or else in /tmp under their uid
+    char socketPath[sizeof(((struct sockaddr_un *)NULL)->sun_path)];
+    const char *runtimeDir = getenv("XDG_RUNTIME_DIR");
+    if (runtimeDir != NULL && runtimeDir[0] != '\0') {
+        snprintf(socketPath, sizeof(socketPath), "%s/tinypaint.sock", runtimeDir);
+    }
+    else {
+        snprintf(socketPath, sizeof(socketPath), "/tmp/tinypaint-%d.sock", (int)getuid());
+    }
+
+    int numJobs = 0;
+    int quiet = 0;
+    int option;
+    while ((option = getopt_long(argc, argv, "s:j:qh", longOptions, NULL)) != -1) {
+        char *end;
+        switch (option) {
+            case 's':
+                if (strlen(optarg) >= sizeof(socketPath)) {
+                    printf("error: the socket path is too long\n");
+                    return 2;
+                }
+                strcpy(socketPath, optarg);
+                break;
+            case 'j':
+                numJobs = strtol(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || numJobs < 1 || numJobs > 1024) {
+                    printf("error: --jobs must be a whole number from 1 to 1024\n");
+                    return 2;
+                }
+                break;
+            case 'q': quiet = 1; break;
+            case 'h':
+                server_print_usage(socketPath);
+                return 0;
+            default: return 2;
+        }
+    }
+    if (optind < argc) {
+        printf("error: unexpected argument '%s' (see --help)\n", argv[optind]);
+        return 2;
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+
+    // a socket left behind by a daemon that was killed is replaced, but not
+    // one another daemon is still listening on
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener >= 0 && connect(listener, (struct sockaddr *)&address, sizeof(address)) == 0) {
+        printf("error: another daemon is already listening on %s\n", socketPath);
+        close(listener);
+        return 1;
+    }
+    if (listener >= 0) {
+        close(listener);
+    }
+    unlink(socketPath);
+
+    // only the user who started the daemon can connect to it
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    mode_t mask = umask(0077);
+    int bound = listener >= 0 && bind(listener, (struct sockaddr *)&address, sizeof(address)) == 0;
+    umask(mask);
+    if (!bound || listen(listener, SERVER_MAX_PENDING) != 0) {
+        printf("error: could not listen on %s: %s\n", socketPath, strerror(errno));
+        if (listener >= 0) {
+            close(listener);
+        }
+        return 1;
+    }
+
+#ifdef __GLIBC__
+    // keep freed pixelbuffers in the heap rather than handing them back to the
+    // system, so the next request of a similar size does not fault them in again
+    mallopt(M_MMAP_THRESHOLD, 32 << 20);
+    mallopt(M_TRIM_THRESHOLD, 256 << 20);
+#endif
+
+    // several requests at once, then whatever cores are left over for each one's filters
+    int numCores = sysconf(_SC_NPROCESSORS_ONLN);
+    numCores = numCores > 0 ? numCores : 1;
+    if (numJobs == 0) {
+        numJobs = numCores < SERVER_DEFAULT_JOBS ? numCores : SERVER_DEFAULT_JOBS;
+    }
+    int threadsPerJob = numCores / numJobs > 0 ? numCores / numJobs : 1;
+    filter_set_num_threads(threadsPerJob);
+
+    // only the polling thread sees the signals, so they interrupt poll()
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = server_on_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    sigset_t signals, previous;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &previous);
+
+    ServerQueue queue;
+    memset(&queue, 0, sizeof(queue));
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.changed, NULL);
+
+    ServerPoller poller;
+    memset(&poller, 0, sizeof(poller));
+    pthread_mutex_init(&poller.lock, NULL);
+    if (pipe2(poller.wake, O_NONBLOCK | O_CLOEXEC) != 0) {
+        printf("error: could not create a pipe: %s\n", strerror(errno));
+        close(listener);
+        unlink(socketPath);
+        return 1;
+    }
+
+    // the workers live as long as the daemon, so nothing is spawned per request
+    ServerWorker *workers = calloc(numJobs, sizeof(ServerWorker));
+    for (int i = 0; i < numJobs; i++) {
+        workers[i].queue = &queue;
+        workers[i].poller = &poller;
+        workers[i].quiet = quiet;
+        pthread_t tid;
+        pthread_create(&tid, NULL, server_worker, (void *)(&workers[i]));
+        pthread_detach(tid);
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+    if (!quiet) {
+        printf("listening on %s, %d request%s at a time with %d filter thread%s each\n", socketPath,
+            numJobs, numJobs == 1 ? "" : "s", threadsPerJob, threadsPerJob == 1 ? "" : "s");
+        fflush(stdout);
+    }
+
+    // wait on the listener and every idle client at once, and hand a client
+    // to a worker only once it has sent something
+    struct pollfd *fds = NULL;
+    int fdsCapacity = 0;
+    while (!s_stop) {
+        server_poller_take_back(&poller);
+        int numFds = 2 + poller.numIdle;
+        if (numFds > fdsCapacity) {
+            fdsCapacity = 2 + poller.capacity;
+            fds = realloc(fds, sizeof(struct pollfd) * fdsCapacity);
+        }
+        fds[0] = (struct pollfd){listener, POLLIN, 0};
+        fds[1] = (struct pollfd){poller.wake[0], POLLIN, 0};
+        for (int i = 0; i < poller.numIdle; i++) {
+            fds[2 + i] = (struct pollfd){poller.idle[i]->fd, POLLIN, 0};
+        }
+
+        if (poll(fds, numFds, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("error: could not wait for connections: %s\n", strerror(errno));
+            break;
+        }
+
+        // a client that sent something (or hung up) goes to a worker
+        int numKept = 0;
+        for (int i = 0; i < poller.numIdle; i++) {
+            if (fds[2 + i].revents != 0) {
+                server_queue_push(&queue, poller.idle[i]);
+            }
+            else {
+                poller.idle[numKept++] = poller.idle[i];
+            }
+        }
+        poller.numIdle = numKept;
+
+        int failed = 0;
+        while (fds[0].revents & POLLIN) {
+            int client = accept4(listener, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if (client >= 0) {
+                server_poller_add(&poller, server_connection_new(client));
+            }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            else if (errno != EINTR && errno != ECONNABORTED) {
+                printf("error: could not accept a connection: %s\n", strerror(errno));
+                failed = 1;
+                break;
+            }
+        }
+        if (failed) {
+            break;
+        }
+    }
+    free(fds);
+
+    // requests still being served are cut off when the process exits
+    for (int i = 0; i < poller.numIdle; i++) {
+        server_connection_close(poller.idle[i]);
+    }
+    free(poller.idle);
+    close(listener);
+    unlink(socketPath);
+    if (!quiet) {
+        char stats[1024];
+        server_stats_format(stats, sizeof(stats));
+        printf("stopped\n%s", stats);
+    }
+    return 0;
+}
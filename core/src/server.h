@@ -0,0 +1,50 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef SERVER_H_
+#define SERVER_H_
+
+/* The first argument that runs tinypaint as a daemon instead of opening a window. */
+#define SERVER_FLAG "--daemon"
+
+/* Runs "tinypaint --daemon ...", which listens on a unix domain socket and
+applies recipes of filters (see recipe.h) for other processes, until it is
+interrupted or terminated. 'argv' starts at SERVER_FLAG. Like batch mode,
+gtk, the display and GL are never initialized.
+
+A request is a list of "key value" lines, ended by an empty line:
+
+    recipe gaussian:radius=8,sharpen:radius=2
+    input /path/to/image.png
+    output /path/to/result.qoi
+
+and is answered with a single line, "ok WIDTH HEIGHT SECONDS" or "error WHY".
+Several requests can be sent over one connection, one after the other. A
+connection only holds a worker while a request it sent is being served, so
+clients that stay connected without sending anything never hold up others.
+"compression N" and "depth 8|16" set what image_io_save() uses for outputs.
+
+Pixels can also be passed in shared memory instead of image files, so they
+are never encoded, decoded or copied through the socket. "input memfd WIDTH
+HEIGHT" reads the pixels from a file descriptor (usually a memfd) sent along
+with the request (as SCM_RIGHTS), which holds WIDTH x HEIGHT pixels of 4
+native floats each (rgba, 0 to 1), row after row. "output memfd" writes the
+result in the same layout: back into the input's memory if that was a memfd
+too, or else into a new memfd sent back with the answer. This is not quite
+zero-copy: the filters work on doubles, so the input is converted into the
+daemon's own buffer once. A result that goes back into the input's memory is
+then filtered straight into it, and one that goes into a new memfd is copied
+there once.
+
+A request of just "stats" is answered with "key value" lines of how many
+requests have been served and how long they took (the mean time in each
+stage, and percentiles of the whole), ended by an empty line.
+
+Returns the exit status: 0 once stopped, 1 if the socket could not be
+opened, 2 if the command line was wrong. */
+int server_main(int argc, char *argv[]);
+
+#endif  // SERVER_H_
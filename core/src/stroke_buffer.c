@@ -0,0 +1,139 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "stroke_buffer.h"
+
+#include <stdlib.h>  // calloc, free
+#include <string.h>  // memcpy
+
+/* The fewest pixels the coverage grows by on each side, so a stroke heading
+one way does not reallocate it at every dab. It also grows by half its size. */
+#define MIN_COVERAGE_GROWTH 64
+
+
+
+/* Returns the part of the canvas covered by the spans of 'mask' centered at (x, y). */
+PixelRect strokebuffer_get_dab_rect(StrokeBuffer *self, ToolMask *mask, int x, int y) {
+    PixelRect dabRect = pixelrect_empty();
+    for (int s = 0; s < mask->numSpans; s++) {
+        ToolSpan *span = &(mask->spans[s]);
+        PixelRect spanRect = {x + span->dx, y + span->dy, x + span->dx + span->length, y + span->dy + 1};
+        dabRect = pixelrect_union(dabRect, spanRect);
+    }
+
+    PixelRect canvas = {0, 0, self->width, self->height};
+    return pixelrect_intersect(dabRect, canvas);
+}
+
+/* Grows the coverage to take in 'r' (with room to spare), keeping what it
+already holds. */
+void strokebuffer_grow(StrokeBuffer *self, PixelRect r) {
+    PixelRect old = self->bounds;
+    PixelRect bounds = pixelrect_union(old, r);
+    if (bounds.x0 == old.x0 && bounds.y0 == old.y0 && bounds.x1 == old.x1 && bounds.y1 == old.y1) {
+        return;
+    }
+
+    int growX = (bounds.x1 - bounds.x0) / 2 > MIN_COVERAGE_GROWTH ? (bounds.x1 - bounds.x0) / 2 : MIN_COVERAGE_GROWTH;
+    int growY = (bounds.y1 - bounds.y0) / 2 > MIN_COVERAGE_GROWTH ? (bounds.y1 - bounds.y0) / 2 : MIN_COVERAGE_GROWTH;
+    PixelRect grown = {bounds.x0 - growX, bounds.y0 - growY, bounds.x1 + growX, bounds.y1 + growY};
+    PixelRect canvas = {0, 0, self->width, self->height};
+    bounds = pixelrect_intersect(grown, canvas);
+
+    int stride = bounds.x1 - bounds.x0;
+    float *coverage = calloc((size_t)stride * (bounds.y1 - bounds.y0), sizeof(float));
+    int oldStride = old.x1 - old.x0;
+    for (int y = old.y0; y < old.y1; y++) {
+        memcpy(coverage + (size_t)(y - bounds.y0) * stride + (old.x0 - bounds.x0),
+            self->coverage + (size_t)(y - old.y0) * oldStride, sizeof(float) * oldStride);
+    }
+
+    free(self->coverage);
+    self->coverage = coverage;
+    self->bounds = bounds;
+}
+
+
+
+StrokeBuffer strokebuffer_new(int width, int height) {
+    StrokeBuffer tmp;
+    tmp.width = width;
+    tmp.height = height;
+    tmp.coverage = NULL;
+    tmp.bounds = pixelrect_empty();
+    tmp.strokeRect = pixelrect_empty();
+    tmp.pendingRect = pixelrect_empty();
+    return tmp;
+}
+
+void strokebuffer_destroy(StrokeBuffer *self) {
+    self->width = -1;
+    self->height = -1;
+    free(self->coverage);
+    self->coverage = NULL;
+}
+
+void strokebuffer_add_dab(StrokeBuffer *self, ToolMask *mask, int x, int y, int accumulate) {
+    PixelRect dabRect = strokebuffer_get_dab_rect(self, mask, x, y);
+    if (pixelrect_is_empty(dabRect)) {
+        return;
+    }
+    strokebuffer_grow(self, dabRect);
+
+    for (int s = 0; s < mask->numSpans; s++) {
+        ToolSpan *span = &(mask->spans[s]);
+        int row = y + span->dy;
+        if (row < 0 || row >= self->height) {
+            continue;
+        }
+
+        // clip the span against the left and right edges of the canvas
+        int start = x + span->dx;
+        int end = start + span->length;
+        int clippedStart = start < 0 ? 0 : start;
+        int clippedEnd = end > self->width ? self->width : end;
+        if (clippedStart >= clippedEnd) {
+            continue;
+        }
+
+        float *coverage = strokebuffer_get_coverage(self, clippedStart, row);
+        const float *weights = span->weights + (clippedStart - start);
+        int length = clippedEnd - clippedStart;
+
+        if (accumulate) {
+            for (int i = 0; i < length; i++) {
+                coverage[i] = coverage[i] + weights[i] - coverage[i]*weights[i];
+            }
+        }
+        else {
+            for (int i = 0; i < length; i++) {
+                coverage[i] = coverage[i] > weights[i] ? coverage[i] : weights[i];
+            }
+        }
+    }
+
+    self->strokeRect = pixelrect_union(self->strokeRect, dabRect);
+    self->pendingRect = pixelrect_union(self->pendingRect, dabRect);
+}
+
+PixelRect strokebuffer_take_pending(StrokeBuffer *self) {
+    PixelRect tmp = self->pendingRect;
+    self->pendingRect = pixelrect_empty();
+    return tmp;
+}
+
+float* strokebuffer_get_coverage(StrokeBuffer *self, int x, int y) {
+    PixelRect b = self->bounds;
+    return self->coverage + ((size_t)(y - b.y0) * (b.x1 - b.x0) + (x - b.x0));
+}
+
+void strokebuffer_clear(StrokeBuffer *self) {
+    free(self->coverage);
+    self->coverage = NULL;
+    self->bounds = pixelrect_empty();
+    self->strokeRect = pixelrect_empty();
+    self->pendingRect = pixelrect_empty();
+}
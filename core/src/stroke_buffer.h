@@ -0,0 +1,54 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef STROKE_BUFFER_H_
+#define STROKE_BUFFER_H_
+
+#include "pixel_buffer.h"  // PixelRect
+#include "tool.h"  // ToolMask
+
+/* Accumulates the coverage of every dab in a stroke, so that the canvas only
+has to be blended once per pixel per composite rather than once per dab.
+Coverage is only held for the part of the canvas the stroke has reached, which
+grows as it goes, and is freed when the stroke is cleared. */
+typedef struct strokebuffer {
+    // the size of the canvas
+    int width;
+    int height;
+
+    // one coverage value per pixel of 'bounds', row after row, 0.0 wherever
+    // the stroke has not been. Pixels outside 'bounds' have no coverage.
+    float *coverage;
+    PixelRect bounds;
+
+    // everything the current stroke has covered so far
+    PixelRect strokeRect;
+
+    // everything covered since the last call to strokebuffer_take_pending()
+    PixelRect pendingRect;
+} StrokeBuffer;
+
+/* Returns a new, empty strokebuffer of width x height. */
+StrokeBuffer strokebuffer_new(int width, int height);
+
+/* Frees the memory allocated to the strokebuffer. */
+void strokebuffer_destroy(StrokeBuffer *self);
+
+/* Adds the mask, centered at (x, y), to the coverage. If 'accumulate' is true
+overlapping dabs build on each other, otherwise the larger weight wins. */
+void strokebuffer_add_dab(StrokeBuffer *self, ToolMask *mask, int x, int y, int accumulate);
+
+/* Returns the region covered since the last call, and resets it. */
+PixelRect strokebuffer_take_pending(StrokeBuffer *self);
+
+/* Returns a pointer to the coverage value of pixel (x, y), which must be
+within the strokeRect. The values of a row are next to each other. */
+float* strokebuffer_get_coverage(StrokeBuffer *self, int x, int y);
+
+/* Throws away the coverage of the current stroke, ready for the next one. */
+void strokebuffer_clear(StrokeBuffer *self);
+
+#endif  // STROKE_BUFFER_H_
@@ -0,0 +1,256 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "stroke_engine.h"
+
+#include <sched.h>  // sched_yield
+#include <stdlib.h>  // malloc, free
+
+/* The most samples painted in one go. If a render is waiting for editorLock,
+it is let go between chunks, so a render never waits on more than one chunk,
+however far behind painting has fallen. */
+#define STROKE_CHUNK_SAMPLES 32
+
+
+
+//
+// QUEUE methods
+//
+
+/* Returns true if there are samples the worker has not taken yet. */
+int stroke_engine_has_pending(StrokeEngine *self) {
+    return atomic_load(&self->head) != atomic_load(&self->tail);
+}
+
+/* Adds a sample to the back of the queue and wakes the worker if it is asleep. */
+void stroke_engine_push(StrokeEngine *self, StrokeSample *sample) {
+    unsigned tail = atomic_load_explicit(&self->tail, memory_order_relaxed);
+
+    /* the worker drains the whole queue every time it wakes, so it is only ever
+    full if painting has fallen very far behind. Wait for room rather than drop
+    samples, since losing a start or end would break the stroke. */
+    while (tail - atomic_load_explicit(&self->head, memory_order_acquire) >= STROKE_QUEUE_SIZE) {
+        sched_yield();
+    }
+
+    self->queue[tail & (STROKE_QUEUE_SIZE - 1)] = *sample;
+
+    // sequentially consistent, so it cannot be reordered with the check of 'sleeping' below
+    atomic_store(&self->tail, tail + 1);
+
+    if (atomic_load(&self->sleeping)) {
+        pthread_mutex_lock(&self->wakeLock);
+        pthread_cond_signal(&self->wake);
+        pthread_mutex_unlock(&self->wakeLock);
+    }
+}
+
+
+
+//
+// WORKER methods
+//
+
+/* Paints up to 'maxSamples' of the samples currently in the queue.
+Consecutive move samples are collected and painted as one polyline, so they
+are composited only once. Must be called with editorLock held. Returns true if
+anything was painted. */
+int stroke_engine_drain(StrokeEngine *self, unsigned maxSamples) {
+    unsigned head = atomic_load_explicit(&self->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&self->tail, memory_order_acquire);
+    if (head == tail) {
+        return 0;
+    }
+    if (tail - head > maxSamples) {
+        tail = head + maxSamples;
+    }
+
+    double *points = malloc(sizeof(double) * 2 * (tail - head));
+    int numPoints = 0;
+
+    for (; head != tail; head++) {
+        StrokeSample *sample = &(self->queue[head & (STROKE_QUEUE_SIZE - 1)]);
+
+        if (sample->type == STROKE_SAMPLE_MOVE) {
+            points[2*numPoints + 0] = sample->x;
+            points[2*numPoints + 1] = sample->y;
+            numPoints++;
+            continue;
+        }
+
+        // anything other than a move ends the current polyline
+        if (numPoints > 0) {
+            image_editor_stroke_polyline(self->editor, points, numPoints);
+            numPoints = 0;
+        }
+
+        switch (sample->type) {
+        case STROKE_SAMPLE_START:
+            image_editor_stroke_start(self->editor, &(sample->tool), sample->x, sample->y);
+            break;
+        case STROKE_SAMPLE_HOLD:
+            image_editor_stroke_hold(self->editor, sample->count);
+            break;
+        case STROKE_SAMPLE_END:
+            image_editor_stroke_end(self->editor, sample->x, sample->y);
+            break;
+        case STROKE_SAMPLE_MOVE:
+            break;
+        }
+    }
+
+    if (numPoints > 0) {
+        image_editor_stroke_polyline(self->editor, points, numPoints);
+    }
+
+    free(points);
+    atomic_store_explicit(&self->head, tail, memory_order_release);
+    return 1;
+}
+
+void* stroke_engine_worker(void *data) {
+    StrokeEngine *self = (StrokeEngine *)data;
+
+    while (1) {
+        // sleep until there is something to paint (or we are told to stop)
+        pthread_mutex_lock(&self->wakeLock);
+        atomic_store(&self->sleeping, 1);
+        while (!stroke_engine_has_pending(self) && atomic_load(&self->running)) {
+            pthread_cond_wait(&self->wake, &self->wakeLock);
+        }
+        atomic_store(&self->sleeping, 0);
+        pthread_mutex_unlock(&self->wakeLock);
+
+        // paint a chunk at a time, and let go of the editor between chunks
+        // whenever a render is waiting for it
+        pthread_mutex_lock(&self->editorLock);
+        int painted = 0;
+        while (stroke_engine_has_pending(self)) {
+            painted |= stroke_engine_drain(self, STROKE_CHUNK_SAMPLES);
+            if (atomic_load(&self->readersWaiting) > 0 && stroke_engine_has_pending(self)) {
+                pthread_mutex_unlock(&self->editorLock);
+                if (self->onPainted != NULL) {
+                    self->onPainted(self->onPaintedData);
+                }
+
+                // a mutex is not fair, so make sure the render has the lock
+                // before trying for it again
+                while (atomic_load(&self->readersWaiting) > 0) {
+                    sched_yield();
+                }
+                pthread_mutex_lock(&self->editorLock);
+            }
+        }
+        pthread_cond_broadcast(&self->drained);
+        pthread_mutex_unlock(&self->editorLock);
+
+        if (painted && self->onPainted != NULL) {
+            self->onPainted(self->onPaintedData);
+        }
+
+        if (!atomic_load(&self->running) && !stroke_engine_has_pending(self)) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+
+
+//
+// PUBLIC methods
+//
+
+StrokeEngine* stroke_engine_new(ImageEditor *editor, void (*onPainted)(void *data), void *onPaintedData) {
+    StrokeEngine *tmp = malloc(sizeof(StrokeEngine));
+    tmp->editor = editor;
+    tmp->onPainted = onPainted;
+    tmp->onPaintedData = onPaintedData;
+
+    pthread_mutex_init(&tmp->editorLock, NULL);
+    pthread_cond_init(&tmp->drained, NULL);
+    pthread_mutex_init(&tmp->wakeLock, NULL);
+    pthread_cond_init(&tmp->wake, NULL);
+
+    atomic_init(&tmp->head, 0);
+    atomic_init(&tmp->tail, 0);
+    atomic_init(&tmp->sleeping, 0);
+    atomic_init(&tmp->running, 1);
+    atomic_init(&tmp->readersWaiting, 0);
+
+    pthread_create(&tmp->thread, NULL, stroke_engine_worker, (void *)tmp);
+    return tmp;
+}
+
+void stroke_engine_destroy(StrokeEngine *self) {
+    pthread_mutex_lock(&self->wakeLock);
+    atomic_store(&self->running, 0);
+    pthread_cond_signal(&self->wake);
+    pthread_mutex_unlock(&self->wakeLock);
+
+    pthread_join(self->thread, NULL);
+
+    pthread_mutex_destroy(&self->editorLock);
+    pthread_cond_destroy(&self->drained);
+    pthread_mutex_destroy(&self->wakeLock);
+    pthread_cond_destroy(&self->wake);
+    free(self);
+}
+
+void stroke_engine_push_start(StrokeEngine *self, double x, double y) {
+    StrokeSample sample;
+    sample.type = STROKE_SAMPLE_START;
+    sample.x = x;
+    sample.y = y;
+    sample.tool = self->editor->m_tool;
+    stroke_engine_push(self, &sample);
+}
+
+void stroke_engine_push_move(StrokeEngine *self, double x, double y) {
+    StrokeSample sample;
+    sample.type = STROKE_SAMPLE_MOVE;
+    sample.x = x;
+    sample.y = y;
+    stroke_engine_push(self, &sample);
+}
+
+void stroke_engine_push_hold(StrokeEngine *self, int numDabs) {
+    StrokeSample sample;
+    sample.type = STROKE_SAMPLE_HOLD;
+    sample.x = 0.0;
+    sample.y = 0.0;
+    sample.count = numDabs;
+    stroke_engine_push(self, &sample);
+}
+
+void stroke_engine_push_end(StrokeEngine *self, double x, double y) {
+    StrokeSample sample;
+    sample.type = STROKE_SAMPLE_END;
+    sample.x = x;
+    sample.y = y;
+    stroke_engine_push(self, &sample);
+}
+
+void stroke_engine_lock(StrokeEngine *self) {
+    pthread_mutex_lock(&self->editorLock);
+
+    /* only the gui thread pushes samples, and it is the one waiting here, so once
+    the queue is empty nothing new can arrive until it unlocks. */
+    while (stroke_engine_has_pending(self)) {
+        pthread_cond_wait(&self->drained, &self->editorLock);
+    }
+}
+
+void stroke_engine_lock_for_read(StrokeEngine *self) {
+    atomic_fetch_add(&self->readersWaiting, 1);
+    pthread_mutex_lock(&self->editorLock);
+    atomic_fetch_sub(&self->readersWaiting, 1);
+}
+
+void stroke_engine_unlock(StrokeEngine *self) {
+    pthread_mutex_unlock(&self->editorLock);
+}
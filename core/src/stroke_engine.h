@@ -0,0 +1,99 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef STROKE_ENGINE_H_
+#define STROKE_ENGINE_H_
+
+#include "image_editor.h"  // ImageEditor
+#include "tool.h"  // Tool
+
+#include <pthread.h>  // pthread
+#include <stdatomic.h>  // atomic_uint, atomic_int
+
+/* How many input samples can be waiting for the worker at once. Must be a power of two. */
+#define STROKE_QUEUE_SIZE 1024
+
+typedef enum strokesampletype {
+    STROKE_SAMPLE_START,
+    STROKE_SAMPLE_MOVE,
+    STROKE_SAMPLE_HOLD,
+    STROKE_SAMPLE_END
+} StrokeSampleType;
+
+typedef struct strokesample {
+    StrokeSampleType type;
+    double x;
+    double y;
+
+    // how many dabs to apply, only used for STROKE_SAMPLE_HOLD
+    int count;
+
+    // a copy of the editor's tool, only filled in for STROKE_SAMPLE_START
+    Tool tool;
+} StrokeSample;
+
+/* Paints strokes into an ImageEditor on a dedicated worker thread. The gui thread
+pushes input samples into a lock-free single-producer single-consumer queue and
+returns immediately. The worker drains what is pending a chunk at a time, so a
+run of motion samples becomes a single polyline and a single composite, but the
+editor is never held for more than one chunk while rendering waits for it. */
+typedef struct strokeengine {
+    ImageEditor *editor;
+
+    // held by the worker while it paints a chunk. Anyone else touching the
+    // editor must hold it too (see stroke_engine_lock()).
+    pthread_mutex_t editorLock;
+    pthread_cond_t drained;
+
+    // how many threads are waiting in stroke_engine_lock_for_read(), which the
+    // worker lets in between chunks
+    atomic_int readersWaiting;
+
+    // the sample queue. 'head' is only written by the worker, 'tail' only by the producer.
+    StrokeSample queue[STROKE_QUEUE_SIZE];
+    atomic_uint head;
+    atomic_uint tail;
+
+    // how the producer wakes the worker up when it is asleep
+    pthread_mutex_t wakeLock;
+    pthread_cond_t wake;
+    atomic_int sleeping;
+    atomic_int running;
+
+    pthread_t thread;
+
+    // called from the worker thread (without any locks held) after it has painted
+    void (*onPainted)(void *data);
+    void *onPaintedData;
+} StrokeEngine;
+
+/* Returns a new StrokeEngine painting into 'editor', with its worker thread running.
+'onPainted' is called from the worker thread whenever the editor's pixels change. */
+StrokeEngine* stroke_engine_new(ImageEditor *editor, void (*onPainted)(void *data), void *onPaintedData);
+
+/* Paints whatever is still queued, stops the worker and frees the engine. */
+void stroke_engine_destroy(StrokeEngine *self);
+
+/* The following queue a sample for the worker. They must all be called from the
+same (gui) thread. stroke_engine_push_start() copies the editor's current tool. */
+void stroke_engine_push_start(StrokeEngine *self, double x, double y);
+void stroke_engine_push_move(StrokeEngine *self, double x, double y);
+void stroke_engine_push_hold(StrokeEngine *self, int numDabs);
+void stroke_engine_push_end(StrokeEngine *self, double x, double y);
+
+/* Waits until every queued sample has been painted, then locks the editor. Use
+this before anything that changes the editor (undo, filters, saving...). */
+void stroke_engine_lock(StrokeEngine *self);
+
+/* Locks the editor without waiting for the queue to drain. Use this for reading
+the pixels while a stroke may still be in progress (i.e. rendering). Waits for
+at most the chunk of samples the worker is painting. */
+void stroke_engine_lock_for_read(StrokeEngine *self);
+
+/* Unlocks the editor after either of the lock calls. */
+void stroke_engine_unlock(StrokeEngine *self);
+
+#endif  // STROKE_ENGINE_H_
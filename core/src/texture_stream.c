@@ -0,0 +1,236 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "texture_stream.h"
+
+#include <stdio.h>  // printf
+#include <stdlib.h>  // getenv, realloc, free
+#include <string.h>  // strcmp
+
+
+
+//
+// HELPER methods
+//
+
+/* Returns true if the current context can map buffers and create fences (ie.
+it is at least GL 3.2), and the user has not asked for synchronous uploads. */
+int texture_stream_supports_pbos() {
+    const char *env = getenv("TINYPAINT_SYNC_UPLOAD");
+    if (env != NULL && strcmp(env, "0") != 0) {
+        return 0;
+    }
+
+    GLint major = 0;
+    GLint minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    return major > 3 || (major == 3 && minor >= 2);
+}
+
+/* Returns true if buffer 'i' is not being read by the gpu anymore. */
+int texture_stream_buffer_is_free(TextureStream *self, int i) {
+    if (self->fences[i] == NULL) {
+        return 1;
+    }
+
+    // poll, never block
+    GLenum status = glClientWaitSync(self->fences[i], 0, 0);
+    if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+        glDeleteSync(self->fences[i]);
+        self->fences[i] = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+/* Maps 'numBytes' of the first buffer the gpu has finished with. Returns NULL
+if there is none. */
+unsigned char* texture_stream_map(TextureStream *self, size_t numBytes) {
+    for (int i = 0; i < TEXTURE_STREAM_NUM_BUFFERS; i++) {
+        if (!texture_stream_buffer_is_free(self, i)) {
+            continue;
+        }
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, self->pbos[i]);
+
+        // grow it if this frame needs more than it has ever held
+        if (self->capacities[i] < (GLsizeiptr)numBytes) {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)numBytes, NULL, GL_STREAM_DRAW);
+            self->capacities[i] = (GLsizeiptr)numBytes;
+        }
+
+        /* the fence says nothing is reading it, so the driver does not need
+        to synchronize, and the old contents can be thrown away. */
+        void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)numBytes,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        if (dst != NULL) {
+            self->mapped = i;
+        }
+        return (unsigned char *)dst;
+    }
+    return NULL;
+}
+
+
+
+//
+// TEXTURESTREAM methods
+//
+
+TextureStream texture_stream_new() {
+    TextureStream tmp;
+    tmp.usePBOs = texture_stream_supports_pbos();
+    tmp.mapped = -1;
+    tmp.fallback = NULL;
+    tmp.fallbackCapacity = 0;
+    tmp.data = NULL;
+    tmp.size = 0;
+    tmp.used = 0;
+    tmp.uploads = NULL;
+    tmp.numUploads = 0;
+    tmp.maxUploads = 0;
+    tmp.numAsyncUploads = 0;
+    tmp.numSyncUploads = 0;
+    tmp.bytesUploaded = 0;
+
+    for (int i = 0; i < TEXTURE_STREAM_NUM_BUFFERS; i++) {
+        tmp.pbos[i] = 0;
+        tmp.capacities[i] = 0;
+        tmp.fences[i] = NULL;
+    }
+
+    // the buffers are sized by the first frame that uses them
+    if (tmp.usePBOs) {
+        glGenBuffers(TEXTURE_STREAM_NUM_BUFFERS, tmp.pbos);
+    }
+
+    return tmp;
+}
+
+void texture_stream_destroy(TextureStream *self) {
+    for (int i = 0; i < TEXTURE_STREAM_NUM_BUFFERS; i++) {
+        if (self->fences[i] != NULL) {
+            glDeleteSync(self->fences[i]);
+            self->fences[i] = NULL;
+        }
+    }
+
+    if (self->usePBOs) {
+        glDeleteBuffers(TEXTURE_STREAM_NUM_BUFFERS, self->pbos);
+    }
+
+    free(self->fallback);
+    free(self->uploads);
+    self->fallback = NULL;
+    self->uploads = NULL;
+}
+
+void texture_stream_begin(TextureStream *self, size_t numBytes) {
+    self->numUploads = 0;
+    self->used = 0;
+    self->size = numBytes;
+    self->mapped = -1;
+    self->data = NULL;
+
+    if (numBytes == 0) {
+        return;
+    }
+
+    if (self->usePBOs) {
+        self->data = texture_stream_map(self, numBytes);
+    }
+
+    // every buffer is busy (or there are none), so stage it in client memory
+    if (self->data == NULL) {
+        if (self->fallbackCapacity < numBytes) {
+            self->fallback = realloc(self->fallback, numBytes);
+            self->fallbackCapacity = numBytes;
+        }
+        self->data = self->fallback;
+    }
+}
+
+unsigned char* texture_stream_add(TextureStream *self, GLuint texture, int x, int y, int width, int height) {
+    if (self->numUploads == self->maxUploads) {
+        self->maxUploads = self->maxUploads == 0 ? 64 : self->maxUploads * 2;
+        self->uploads = realloc(self->uploads, sizeof(TextureStreamUpload) * self->maxUploads);
+    }
+
+    // never write past what was mapped (or staged)
+    size_t numBytes = (size_t)4 * width * height;
+    if (self->data == NULL || numBytes > self->size - self->used) {
+        printf("WARNING: texture stream overflow, uploading synchronously\n");
+        return NULL;
+    }
+
+    TextureStreamUpload upload = {texture, x, y, width, height, self->used};
+    self->uploads[self->numUploads++] = upload;
+    self->used += numBytes;
+
+    return self->data + upload.offset;
+}
+
+void texture_stream_upload(TextureStream *self, GLuint texture, int x, int y, int width, int height, const unsigned char *pixels) {
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+    self->numSyncUploads++;
+    self->bytesUploaded += (size_t)4 * width * height;
+}
+
+int texture_stream_end(TextureStream *self) {
+    if (self->numUploads == 0 && self->mapped < 0) {
+        return 1;
+    }
+
+    int fromBuffer = self->mapped >= 0;
+
+    if (fromBuffer) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, self->pbos[self->mapped]);
+
+        /* if the buffer was lost while mapped, its contents are undefined, so
+        upload nothing rather than garbage. */
+        if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) != GL_TRUE) {
+            printf("WARNING: pixel buffer contents lost during upload\n");
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            self->mapped = -1;
+            self->numUploads = 0;
+            return 0;
+        }
+    }
+
+    // the data is tightly packed
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    for (int i = 0; i < self->numUploads; i++) {
+        TextureStreamUpload *u = &(self->uploads[i]);
+        // with a buffer bound, the pixel pointer is an offset into it
+        const void *pixels = fromBuffer ? (const void *)u->offset : (const void *)(self->data + u->offset);
+        glBindTexture(GL_TEXTURE_2D, u->texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, u->x, u->y, u->width, u->height,
+            GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    }
+
+    if (fromBuffer) {
+        self->fences[self->mapped] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        self->numAsyncUploads += self->numUploads;
+    }
+    else {
+        self->numSyncUploads += self->numUploads;
+    }
+
+    self->bytesUploaded += self->used;
+    self->mapped = -1;
+    self->numUploads = 0;
+    return 1;
+}
@@ -0,0 +1,101 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef TEXTURE_STREAM_H_
+#define TEXTURE_STREAM_H_
+
+// needed for the buffer mapping and sync object prototypes
+#ifndef GL_GLEXT_PROTOTYPES
+#define GL_GLEXT_PROTOTYPES
+#endif
+
+#if defined(__APPLE__)
+#include <OpenGL/gl.h>
+#else
+#include <GL/gl.h>
+#endif
+
+#include <stddef.h>  // size_t
+
+/* How many pixel buffer objects to cycle through. With three, the cpu can be
+filling one while the gpu is still reading the previous two. */
+#define TEXTURE_STREAM_NUM_BUFFERS 3
+
+/* One rectangle queued for upload by texture_stream_add(). */
+typedef struct texturestreamupload {
+    GLuint texture;
+    int x;
+    int y;
+    int width;
+    int height;
+
+    // where its pixels start in the mapped buffer
+    size_t offset;
+} TextureStreamUpload;
+
+/* Streams rectangles of 8-bit rgba into textures through a ring of pixel buffer
+objects, so glTexSubImage2D returns straight away instead of copying out of
+client memory. Each frame's uploads are packed into one buffer, and a buffer
+is only reused once the fence placed after its uploads has signalled. If every
+buffer is still in flight, or the context cannot do this at all, it falls back
+to plain synchronous uploads. */
+typedef struct texturestream {
+    // false if pixel buffer objects are unavailable or disabled
+    int usePBOs;
+
+    GLuint pbos[TEXTURE_STREAM_NUM_BUFFERS];
+    GLsizeiptr capacities[TEXTURE_STREAM_NUM_BUFFERS];
+    GLsync fences[TEXTURE_STREAM_NUM_BUFFERS];
+
+    // the buffer mapped by the last call to texture_stream_begin(), or -1 if
+    // that call fell back to client memory
+    int mapped;
+
+    // client side staging for the synchronous path
+    unsigned char *fallback;
+    size_t fallbackCapacity;
+
+    // where this frame's pixels are being written, and how much is used
+    unsigned char *data;
+    size_t size;
+    size_t used;
+
+    // the rectangles queued this frame
+    TextureStreamUpload *uploads;
+    int numUploads;
+    int maxUploads;
+
+    // how many uploads have gone through each path, for debugging
+    int numAsyncUploads;
+    int numSyncUploads;
+    size_t bytesUploaded;
+} TextureStream;
+
+/* Returns a new texturestream. The GL context must be current. Setting
+TINYPAINT_SYNC_UPLOAD=1 in the environment forces the synchronous path. */
+TextureStream texture_stream_new();
+
+/* Frees the buffers and sync objects. The GL context must be current. */
+void texture_stream_destroy(TextureStream *self);
+
+/* Starts a batch of uploads whose pixels total at most 'numBytes'. */
+void texture_stream_begin(TextureStream *self, size_t numBytes);
+
+/* Queues an upload of a width x height rect to (x, y) of 'texture', and returns
+where to write its pixels, rows tightly packed. Returns NULL, and queues
+nothing, if its pixels do not fit in what was passed to texture_stream_begin();
+texture_stream_upload() has to be used for it instead. */
+unsigned char* texture_stream_add(TextureStream *self, GLuint texture, int x, int y, int width, int height);
+
+/* Uploads a width x height rect of tightly packed 'pixels' to (x, y) of
+'texture' straight away, the synchronous way. */
+void texture_stream_upload(TextureStream *self, GLuint texture, int x, int y, int width, int height, const unsigned char *pixels);
+
+/* Issues every upload queued since texture_stream_begin(). Returns false if
+the driver lost the data on the way, in which case it has to be sent again. */
+int texture_stream_end(TextureStream *self);
+
+#endif  // TEXTURE_STREAM_H_
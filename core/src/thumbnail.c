@@ -0,0 +1,484 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "thumbnail.h"
+
+#include "image_io.h"  // image_io_load_rows, ImageRowSink
+#include "png_io.h"  // PngReader
+#include "render_buffer.h"  // convert_floats_to_unorm8
+
+#include <limits.h>  // PATH_MAX
+#include <png.h>  // png_read_row, png_jmpbuf
+#include <setjmp.h>  // setjmp
+#include <stddef.h>  // offsetof
+#include <stdint.h>  // uint32_t, uint64_t, int64_t
+#include <stdio.h>  // FILE, snprintf
+#include <stdlib.h>  // malloc, calloc, free, getenv, realpath, mkstemp
+#include <string.h>  // memcpy, memcmp, memset, strlen
+#include <sys/stat.h>  // stat, mkdir
+#include <unistd.h>  // unlink
+
+/* What a cached thumbnail starts with. The path of the image follows it (to
+tell apart two paths that hash the same), and then the pixels. */
+typedef struct thumbnailcacheheader {
+    char magic[8];
+    uint32_t maxSize;
+    uint32_t pathLength;
+
+    // what the image file was like when the thumbnail was made
+    int64_t fileSize;
+    int64_t modifiedSeconds;
+    int64_t modifiedNanoseconds;
+
+    uint32_t imageWidth;
+    uint32_t imageHeight;
+    uint32_t width;
+    uint32_t height;
+} ThumbnailCacheHeader;
+
+
+
+//
+// SHRINKING methods
+//
+
+/* Box filters the rows of an image down to a thumbnail as they are decoded,
+one thumbnail row at a time. */
+typedef struct shrinker {
+    Thumbnail *out;
+    atomic_int *cancelled;
+
+    // the thumbnail column each image column lands in, and how many land in each
+    int *columns;
+    int *columnCounts;
+
+    // the sums (with color weighted by alpha) for the thumbnail row being built
+    uint64_t *sums;
+
+    // rows that are not 8-bit already are rounded to it here first
+    unsigned char *row8;
+    int currentRow;
+    int rowsSummed;
+} Shrinker;
+
+/* Averages the sums into the current thumbnail row, and clears them for the next. */
+void shrinker_flush(Shrinker *self) {
+    Thumbnail *out = self->out;
+    unsigned char *dst = out->rgba + 4 * (size_t)out->width * self->currentRow;
+
+    for (int x = 0; x < out->width; x++) {
+        uint64_t *sum = self->sums + 4*x;
+        uint64_t count = (uint64_t)self->columnCounts[x] * self->rowsSummed;
+        if (sum[3] > 0 && count > 0) {
+            dst[4*x + 0] = (sum[0] + sum[3]/2) / sum[3];
+            dst[4*x + 1] = (sum[1] + sum[3]/2) / sum[3];
+            dst[4*x + 2] = (sum[2] + sum[3]/2) / sum[3];
+            dst[4*x + 3] = (sum[3] + count/2) / count;
+        }
+    }
+
+    memset(self->sums, 0, sizeof(uint64_t) * 4 * out->width);
+    self->rowsSummed = 0;
+}
+
+/* Works out the thumbnail's size from the image's, and sets up the sums. */
+int shrinker_begin(void *data, int width, int height) {
+    Shrinker *self = (Shrinker *)data;
+    Thumbnail *out = self->out;
+    out->imageWidth = width;
+    out->imageHeight = height;
+
+    // keep the aspect ratio, with the longer side at most THUMBNAIL_SIZE
+    int longest = width > height ? width : height;
+    int size = longest < THUMBNAIL_SIZE ? longest : THUMBNAIL_SIZE;
+    out->width = ((int64_t)width * size + longest/2) / longest;
+    out->height = ((int64_t)height * size + longest/2) / longest;
+    out->width = out->width < 1 ? 1 : out->width;
+    out->height = out->height < 1 ? 1 : out->height;
+    out->rgba = calloc(4 * (size_t)out->width * out->height, 1);
+
+    self->columns = malloc(sizeof(int) * width);
+    self->columnCounts = calloc(out->width, sizeof(int));
+    for (int x = 0; x < width; x++) {
+        self->columns[x] = (int64_t)x * out->width / width;
+        self->columnCounts[self->columns[x]]++;
+    }
+    self->sums = calloc(4 * (size_t)out->width, sizeof(uint64_t));
+    self->row8 = malloc(4 * (size_t)width);
+    self->currentRow = 0;
+    self->rowsSummed = 0;
+    return self->cancelled == NULL || !atomic_load(self->cancelled);
+}
+
+/* Adds one row of the image to the sums of the thumbnail row it lands in. */
+int shrinker_row(void *data, int y, const void *pixels, ImageRowFormat format) {
+    Shrinker *self = (Shrinker *)data;
+    int count = 4 * self->out->imageWidth;
+    const unsigned char *rgba = self->row8;
+    if (format == IMAGE_ROW_UNORM16) {
+        const uint16_t *samples = (const uint16_t *)pixels;
+        for (int i = 0; i < count; i++) {
+            self->row8[i] = (samples[i] * 255 + 32767) / 65535;
+        }
+    }
+    else if (format == IMAGE_ROW_FLOATS) {
+        convert_floats_to_unorm8(self->row8, (const float *)pixels, count);
+    }
+    else {
+        rgba = (const unsigned char *)pixels;
+    }
+
+    int row = (int64_t)y * self->out->height / self->out->imageHeight;
+    if (row != self->currentRow) {
+        if (self->rowsSummed > 0) {
+            shrinker_flush(self);
+        }
+        self->currentRow = row;
+    }
+
+    for (int x = 0; x < self->out->imageWidth; x++, rgba += 4) {
+        uint64_t *sum = self->sums + 4 * self->columns[x];
+        sum[0] += rgba[0] * rgba[3];
+        sum[1] += rgba[1] * rgba[3];
+        sum[2] += rgba[2] * rgba[3];
+        sum[3] += rgba[3];
+    }
+    self->rowsSummed++;
+    return self->cancelled == NULL || !atomic_load(self->cancelled);
+}
+
+/* Hands an interlaced png to 'sink' without holding it whole, as
+image_io_load_rows() would, at the cost of half its rows: the last pass holds
+every odd row complete, so only those are handed on, each standing in for the
+even row above it too. Close enough for a thumbnail, and nothing else. */
+int shrinker_read_interlaced_png(PngReader *reader, ImageRowSink *sink) {
+    // volatile, since it has to survive the longjmp
+    unsigned char * volatile row = NULL;
+
+    if (setjmp(png_jmpbuf(reader->png))) {
+        free(row);
+        return 0;
+    }
+
+    size_t rowBytes = 4 * (size_t)reader->width * (reader->bitDepth / 8);
+    if (png_get_rowbytes(reader->png, reader->info) != rowBytes) {
+        printf("error: unsupported png format\n");
+        return 0;
+    }
+    row = malloc(rowBytes);
+
+    ImageRowFormat format = reader->bitDepth == 16 ? IMAGE_ROW_UNORM16 : IMAGE_ROW_UNORM8;
+    int numPasses = 7;
+    int ok = 1;
+    for (int pass = 0; pass < numPasses && ok; pass++) {
+        for (int y = 0; y < reader->height && ok; y++) {
+            png_read_row(reader->png, row, NULL);
+            ok = !image_row_sink_is_cancelled(sink);
+
+            // a single row gets every pass combined into it, so it can be handed on whole
+            int complete = pass == numPasses - 1 && (y % 2 == 1 || reader->height == 1);
+            if (!ok || !complete) {
+                continue;
+            }
+
+            if (y % 2 == 1) {
+                ok = sink->row(sink->data, y - 1, row, format);
+            }
+            ok = ok && sink->row(sink->data, y, row, format);
+
+            // and the last row of an odd height has no odd row below it to use
+            if (ok && y == reader->height - 2) {
+                ok = sink->row(sink->data, y + 1, row, format);
+            }
+        }
+    }
+
+    free(row);
+    return ok;
+}
+
+/* Decodes the image at 'filepath' into 'sink', taking the shortcut above for
+interlaced pngs. */
+void shrinker_decode(const char *filepath, ImageRowSink *sink) {
+    ImageFormat format = image_io_detect_format(filepath);
+    if (format != IMAGE_FORMAT_PNG && format != IMAGE_FORMAT_UNKNOWN) {
+        image_io_load_rows(filepath, sink);
+        return;
+    }
+
+    PngReader reader;
+    if (png_reader_open(&reader, filepath) && sink->begin(sink->data, reader.width, reader.height)) {
+        if (reader.interlaced) {
+            shrinker_read_interlaced_png(&reader, sink);
+        }
+        else {
+            png_reader_read_rows(&reader, sink);
+        }
+    }
+    png_reader_close(&reader);
+}
+
+
+
+//
+// CACHE methods
+//
+
+/* Returns the directory thumbnails are cached in, as a new string. */
+char* thumbnail_cache_dir() {
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char *dir = malloc(PATH_MAX);
+    if (base != NULL && base[0] == '/') {
+        snprintf(dir, PATH_MAX, "%s/tinypaint/thumbnails", base);
+    }
+    else {
+        snprintf(dir, PATH_MAX, "%s/.cache/tinypaint/thumbnails", home != NULL ? home : "/tmp");
+    }
+    return dir;
+}
+
+/* Returns the file the thumbnail of the image at 'path' (which should be
+absolute) is cached in, as a new string. It is named after a hash of the path. */
+char* thumbnail_cache_path(const char *path) {
+    // 64-bit FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char *c = (const unsigned char *)path; *c != '\0'; c++) {
+        hash = (hash ^ *c) * 1099511628211ULL;
+    }
+
+    char *dir = thumbnail_cache_dir();
+    char *cachePath = malloc(PATH_MAX);
+    snprintf(cachePath, PATH_MAX, "%s/%016llx.thumb", dir, (unsigned long long)hash);
+    free(dir);
+    return cachePath;
+}
+
+/* Creates 'dir' and any of its parents that are missing. */
+void thumbnail_make_dirs(char *dir) {
+    for (char *c = dir + 1; *c != '\0'; c++) {
+        if (*c == '/') {
+            *c = '\0';
+            mkdir(dir, 0755);
+            *c = '/';
+        }
+    }
+    mkdir(dir, 0755);
+}
+
+/* Fills in the header a cached thumbnail of the image at 'path' (which is
+like 'info') should have. */
+ThumbnailCacheHeader thumbnail_cache_header(const char *path, struct stat *info) {
+    ThumbnailCacheHeader tmp;
+    memset(&tmp, 0, sizeof(tmp));
+    memcpy(tmp.magic, THUMBNAIL_CACHE_MAGIC, 8);
+    tmp.maxSize = THUMBNAIL_SIZE;
+    tmp.pathLength = strlen(path);
+    tmp.fileSize = info->st_size;
+    tmp.modifiedSeconds = info->st_mtim.tv_sec;
+    tmp.modifiedNanoseconds = info->st_mtim.tv_nsec;
+    return tmp;
+}
+
+/* Reads the cached thumbnail of the image at 'path' into 'out', if there is
+one and it was made from the file as it is now. */
+int thumbnail_cache_read(const char *path, struct stat *info, Thumbnail *out) {
+    char *cachePath = thumbnail_cache_path(path);
+    FILE *file = fopen(cachePath, "rb");
+    free(cachePath);
+    if (file == NULL) {
+        return 0;
+    }
+
+    // everything but the sizes has to match what the image is like now
+    ThumbnailCacheHeader expected = thumbnail_cache_header(path, info);
+    ThumbnailCacheHeader header;
+    char *storedPath = malloc(expected.pathLength);
+    int ok = fread(&header, sizeof(header), 1, file) == 1
+        && memcmp(&header, &expected, offsetof(ThumbnailCacheHeader, imageWidth)) == 0
+        && header.width > 0 && header.width <= THUMBNAIL_SIZE
+        && header.height > 0 && header.height <= THUMBNAIL_SIZE
+        && fread(storedPath, 1, expected.pathLength, file) == expected.pathLength
+        && memcmp(storedPath, path, expected.pathLength) == 0;
+    free(storedPath);
+
+    if (ok) {
+        out->imageWidth = header.imageWidth;
+        out->imageHeight = header.imageHeight;
+        out->width = header.width;
+        out->height = header.height;
+        out->rgba = malloc(4 * (size_t)out->width * out->height);
+        ok = fread(out->rgba, 4 * (size_t)out->width, out->height, file) == (size_t)out->height;
+        if (!ok) {
+            free(out->rgba);
+        }
+    }
+
+    fclose(file);
+    return ok;
+}
+
+/* Caches 'thumbnail' of the image at 'path'. It is written under a temporary
+name and renamed into place, so a reader never sees half of one. Failing to
+cache it is not an error. */
+void thumbnail_cache_write(const char *path, struct stat *info, Thumbnail *thumbnail) {
+    char *dir = thumbnail_cache_dir();
+    thumbnail_make_dirs(dir);
+    free(dir);
+
+    char *cachePath = thumbnail_cache_path(path);
+    char *tmpPath = malloc(strlen(cachePath) + 8);
+    sprintf(tmpPath, "%s.XXXXXX", cachePath);
+    int fd = mkstemp(tmpPath);
+    FILE *file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+
+    if (file != NULL) {
+        ThumbnailCacheHeader header = thumbnail_cache_header(path, info);
+        header.imageWidth = thumbnail->imageWidth;
+        header.imageHeight = thumbnail->imageHeight;
+        header.width = thumbnail->width;
+        header.height = thumbnail->height;
+
+        // no need to fsync, since a lost thumbnail is just made again
+        int ok = fwrite(&header, sizeof(header), 1, file) == 1
+            && fwrite(path, 1, header.pathLength, file) == header.pathLength
+            && fwrite(thumbnail->rgba, 4 * (size_t)thumbnail->width, thumbnail->height, file) == (size_t)thumbnail->height;
+        ok = fclose(file) == 0 && ok;
+        if (!ok || rename(tmpPath, cachePath) != 0) {
+            unlink(tmpPath);
+        }
+    }
+    else if (fd >= 0) {
+        close(fd);
+        unlink(tmpPath);
+    }
+
+    free(tmpPath);
+    free(cachePath);
+}
+
+
+
+//
+// THUMBNAIL methods
+//
+
+int thumbnail_load(const char *filepath, atomic_int *cancelled, Thumbnail *out) {
+    struct stat info;
+    if (stat(filepath, &info) != 0 || !S_ISREG(info.st_mode)) {
+        return 0;
+    }
+
+    // the cache is keyed by the absolute path, so it is the same whichever way it is reached
+    char *path = realpath(filepath, NULL);
+    if (path == NULL) {
+        return 0;
+    }
+    if (thumbnail_cache_read(path, &info, out)) {
+        free(path);
+        return 1;
+    }
+
+    Thumbnail thumbnail;
+    memset(&thumbnail, 0, sizeof(thumbnail));
+    Shrinker shrinker;
+    memset(&shrinker, 0, sizeof(shrinker));
+    shrinker.out = &thumbnail;
+    shrinker.cancelled = cancelled;
+
+    // whatever rows were decoded make a thumbnail, even if the file is cut short
+    ImageRowSink sink = {shrinker_begin, shrinker_row, &shrinker, cancelled};
+    shrinker_decode(filepath, &sink);
+    int ok = thumbnail.rgba != NULL && (cancelled == NULL || !atomic_load(cancelled));
+    if (ok && shrinker.rowsSummed > 0) {
+        shrinker_flush(&shrinker);
+    }
+    free(shrinker.columns);
+    free(shrinker.columnCounts);
+    free(shrinker.sums);
+    free(shrinker.row8);
+
+    if (ok) {
+        thumbnail_cache_write(path, &info, &thumbnail);
+        *out = thumbnail;
+    }
+    else {
+        free(thumbnail.rgba);
+    }
+    free(path);
+    return ok;
+}
+
+void thumbnail_destroy(Thumbnail *self) {
+    free(self->rgba);
+    self->rgba = NULL;
+}
+
+
+
+//
+// THUMBNAIL JOB methods
+//
+
+/* Frees the job, and its thumbnail if it made one. */
+void thumbnail_job_free(ThumbnailJob *self) {
+    if (self->succeeded) {
+        thumbnail_destroy(&self->thumbnail);
+    }
+    free(self->filepath);
+    free(self);
+}
+
+/* Makes the thumbnail, then frees the job if it was abandoned in the meantime. */
+void* thumbnail_job_worker(void *data) {
+    ThumbnailJob *self = (ThumbnailJob *)data;
+    self->succeeded = thumbnail_load(self->filepath, &self->cancelled, &self->thumbnail);
+    atomic_store(&self->finished, 1);
+    if (atomic_fetch_sub(&self->owners, 1) == 1) {
+        thumbnail_job_free(self);
+    }
+    return NULL;
+}
+
+ThumbnailJob* thumbnail_job_start(const char *filepath) {
+    ThumbnailJob *self = malloc(sizeof(ThumbnailJob));
+    self->filepath = strdup(filepath);
+    memset(&self->thumbnail, 0, sizeof(self->thumbnail));
+    atomic_init(&self->cancelled, 0);
+    atomic_init(&self->finished, 0);
+    atomic_init(&self->owners, 2);
+    self->succeeded = 0;
+
+    pthread_create(&self->thread, NULL, thumbnail_job_worker, (void *)self);
+    return self;
+}
+
+void thumbnail_job_cancel(ThumbnailJob *self) {
+    atomic_store(&self->cancelled, 1);
+}
+
+void thumbnail_job_abandon(ThumbnailJob *self) {
+    atomic_store(&self->cancelled, 1);
+    pthread_detach(self->thread);
+    if (atomic_fetch_sub(&self->owners, 1) == 1) {
+        thumbnail_job_free(self);
+    }
+}
+
+int thumbnail_job_is_finished(ThumbnailJob *self) {
+    return atomic_load(&self->finished);
+}
+
+int thumbnail_job_finish(ThumbnailJob *self, Thumbnail *out) {
+    pthread_join(self->thread, NULL);
+    int succeeded = self->succeeded;
+    if (succeeded && out != NULL) {
+        *out = self->thumbnail;
+        self->succeeded = 0;
+    }
+    thumbnail_job_free(self);
+    return succeeded;
+}
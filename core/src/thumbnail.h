@@ -0,0 +1,81 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef THUMBNAIL_H_
+#define THUMBNAIL_H_
+
+#include <pthread.h>  // pthread_t
+#include <stdatomic.h>  // atomic_int
+
+/* The most pixels a thumbnail is across or down. */
+#define THUMBNAIL_SIZE 160
+
+/* The first 8 bytes of every cached thumbnail. */
+#define THUMBNAIL_CACHE_MAGIC "TPTHUMB\x01"
+
+/* A small copy of an image, for previews. */
+typedef struct thumbnail {
+    // the size of the image it was made from
+    int imageWidth;
+    int imageHeight;
+
+    // its own size, and its pixels as 8-bit rgba, row after row
+    int width;
+    int height;
+    unsigned char *rgba;
+} Thumbnail;
+
+/* Makes a thumbnail of the image at 'filepath' into 'out'. If one was cached
+(in ~/.cache/tinypaint/thumbnails) since the file was last modified, going by
+its path, modification time and size, that is used. Otherwise the image is
+decoded one row at a time and shrunk as it goes, so memory use does not grow
+with its size, and the result is cached. 'cancelled' may be NULL; once it is
+set the decode stops. Returns false if the image could not be read, or the
+decode was cancelled. */
+int thumbnail_load(const char *filepath, atomic_int *cancelled, Thumbnail *out);
+
+/* Frees the pixels of a thumbnail. */
+void thumbnail_destroy(Thumbnail *self);
+
+/* Makes a thumbnail on a thread of its own, so the dialog showing it does not
+wait on large images. */
+typedef struct thumbnailjob {
+    char *filepath;
+    Thumbnail thumbnail;
+
+    // set to stop the decode early
+    atomic_int cancelled;
+
+    // set by the worker once it is done, and whether it made a thumbnail
+    atomic_int finished;
+    int succeeded;
+
+    // the worker and whoever started the job, until one of them lets go of it
+    // with thumbnail_job_abandon(). The last one to let go frees it.
+    atomic_int owners;
+
+    pthread_t thread;
+} ThumbnailJob;
+
+/* Starts making a thumbnail of the image at 'filepath' in the background. */
+ThumbnailJob* thumbnail_job_start(const char *filepath);
+
+/* Asks the job to stop early. */
+void thumbnail_job_cancel(ThumbnailJob *self);
+
+/* Returns true once the job is done, so thumbnail_job_finish() will not block. */
+int thumbnail_job_is_finished(ThumbnailJob *self);
+
+/* Cancels the job and lets go of it without waiting for the worker, which
+frees it once the decode has stopped. The job must not be used again. */
+void thumbnail_job_abandon(ThumbnailJob *self);
+
+/* Waits for the job to finish and frees it. Returns whether it made a
+thumbnail, which is moved to 'out' (to be destroyed by the caller), or
+destroyed if 'out' is NULL. */
+int thumbnail_job_finish(ThumbnailJob *self, Thumbnail *out);
+
+#endif  // THUMBNAIL_H_
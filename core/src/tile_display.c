@@ -0,0 +1,291 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "tile_display.h"
+
+#include <stdio.h>  // printf
+#include <stdlib.h>  // getenv, atoi, malloc, free
+
+
+
+//
+// HELPER methods
+//
+
+/* Returns tile (tx, ty) of 'level'. */
+DisplayTile* tile_display_get_tile(TileDisplay *self, int level, int tx, int ty) {
+    TileLevel *l = &(self->levels[level]);
+    return &(l->tiles[ty * l->tilesX + tx]);
+}
+
+/* Returns the part of 'level' tile (tx, ty) covers. */
+PixelRect tile_display_get_tile_rect(TileDisplay *self, int level, int tx, int ty) {
+    TileLevel *l = &(self->levels[level]);
+    PixelRect r = {tx * self->tileSize, ty * self->tileSize,
+        (tx + 1) * self->tileSize, (ty + 1) * self->tileSize};
+    r.x1 = r.x1 > l->width ? l->width : r.x1;
+    r.y1 = r.y1 > l->height ? l->height : r.y1;
+    return r;
+}
+
+/* Returns the range of tiles of 'level' (exclusive max) that intersect 'rect',
+which is in that level's coordinates. */
+PixelRect tile_display_get_tile_range(TileDisplay *self, int level, PixelRect rect) {
+    TileLevel *l = &(self->levels[level]);
+    PixelRect bounds = {0, 0, l->width, l->height};
+    rect = pixelrect_intersect(rect, bounds);
+    if (pixelrect_is_empty(rect)) {
+        return pixelrect_empty();
+    }
+
+    PixelRect range = {rect.x0 / self->tileSize, rect.y0 / self->tileSize,
+        (rect.x1 - 1) / self->tileSize + 1, (rect.y1 - 1) / self->tileSize + 1};
+    return range;
+}
+
+/* Returns the texture of the least recently viewed tile not in view after
+taking it from that tile, or 0 if every resident tile is in view. */
+GLuint tile_display_evict(TileDisplay *self) {
+    DisplayTile *oldest = NULL;
+    PixelRect range = self->visibleTiles;
+
+    for (int level = 0; level < self->numLevels; level++) {
+        TileLevel *l = &(self->levels[level]);
+        for (int ty = 0; ty < l->tilesY; ty++) {
+            for (int tx = 0; tx < l->tilesX; tx++) {
+                DisplayTile *tile = tile_display_get_tile(self, level, tx, ty);
+                if (tile->texture == 0) {
+                    continue;
+                }
+                if (level == self->visibleLevel &&
+                    tx >= range.x0 && tx < range.x1 && ty >= range.y0 && ty < range.y1) {
+                    continue;
+                }
+                if (oldest == NULL || tile->lastUsed < oldest->lastUsed) {
+                    oldest = tile;
+                }
+            }
+        }
+    }
+
+    if (oldest == NULL) {
+        return 0;
+    }
+
+    GLuint texture = oldest->texture;
+    oldest->texture = 0;
+    oldest->stale = pixelrect_empty();
+    self->numResident--;
+    return texture;
+}
+
+/* Gives tile (tx, ty) of 'level' a texture, recycling another tile's if over
+budget. */
+void tile_display_make_resident(TileDisplay *self, int level, int tx, int ty) {
+    DisplayTile *tile = tile_display_get_tile(self, level, tx, ty);
+
+    GLuint texture = 0;
+    if (self->numResident >= self->maxResident) {
+        texture = tile_display_evict(self);
+    }
+
+    if (texture == 0) {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, self->tileSize, self->tileSize, 0,
+            GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    }
+
+    tile->texture = texture;
+    tile->stale = tile_display_get_tile_rect(self, level, tx, ty);
+    self->numResident++;
+}
+
+
+
+//
+// TILEDISPLAY methods
+//
+
+TileDisplay tile_display_new(MipPyramid *mips) {
+    TileDisplay tmp;
+
+    // the tiles must fit within the driver's limit, however small it is
+    GLint maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    tmp.tileSize = DISPLAY_TILE_SIZE;
+    if (maxTextureSize > 0 && maxTextureSize < tmp.tileSize) {
+        tmp.tileSize = maxTextureSize;
+    }
+
+    tmp.numLevels = mips->numLevels;
+    for (int level = 0; level < tmp.numLevels; level++) {
+        TileLevel *l = &(tmp.levels[level]);
+        l->width = mips->levels[level].width;
+        l->height = mips->levels[level].height;
+        l->tilesX = (l->width + tmp.tileSize - 1) / tmp.tileSize;
+        l->tilesY = (l->height + tmp.tileSize - 1) / tmp.tileSize;
+        l->tiles = malloc(sizeof(DisplayTile) * l->tilesX * l->tilesY);
+        for (int i = 0; i < l->tilesX * l->tilesY; i++) {
+            l->tiles[i].texture = 0;
+            l->tiles[i].stale = pixelrect_empty();
+            l->tiles[i].lastUsed = 0;
+        }
+    }
+
+    long budgetMB = DISPLAY_DEFAULT_BUDGET_MB;
+    const char *env = getenv("TINYPAINT_TEXTURE_BUDGET_MB");
+    if (env != NULL && atoi(env) > 0) {
+        budgetMB = atoi(env);
+    }
+    long bytesPerTile = 4L * tmp.tileSize * tmp.tileSize;
+    tmp.maxResident = (int)((budgetMB * 1024 * 1024) / bytesPerTile);
+    tmp.maxResident = tmp.maxResident < 1 ? 1 : tmp.maxResident;
+    tmp.numResident = 0;
+
+    tmp.frame = 0;
+    tmp.visibleLevel = 0;
+    tmp.visibleTiles = pixelrect_empty();
+    tmp.stream = texture_stream_new();
+    return tmp;
+}
+
+void tile_display_destroy(TileDisplay *self) {
+    for (int level = 0; level < self->numLevels; level++) {
+        TileLevel *l = &(self->levels[level]);
+        for (int i = 0; i < l->tilesX * l->tilesY; i++) {
+            if (l->tiles[i].texture != 0) {
+                glDeleteTextures(1, &(l->tiles[i].texture));
+            }
+        }
+        free(l->tiles);
+        l->tiles = NULL;
+    }
+    texture_stream_destroy(&(self->stream));
+}
+
+void tile_display_invalidate(TileDisplay *self, PixelRect rect) {
+    for (int level = 0; level < self->numLevels; level++) {
+        PixelRect levelRect = mip_rect_at_level(rect, level);
+        PixelRect range = tile_display_get_tile_range(self, level, levelRect);
+
+        for (int ty = range.y0; ty < range.y1; ty++) {
+            for (int tx = range.x0; tx < range.x1; tx++) {
+                DisplayTile *tile = tile_display_get_tile(self, level, tx, ty);
+
+                // tiles without a texture get uploaded in full when they get one
+                if (tile->texture != 0) {
+                    PixelRect part = pixelrect_intersect(levelRect, tile_display_get_tile_rect(self, level, tx, ty));
+                    tile->stale = pixelrect_union(tile->stale, part);
+                }
+            }
+        }
+    }
+}
+
+void tile_display_update(TileDisplay *self, MipPyramid *mips, PixelBuffer *source, int level, PixelRect view) {
+    if (level < 0 || level >= self->numLevels) {
+        printf("ERROR: no mip level %d in tile display update\n", level);
+        return;
+    }
+
+    self->frame++;
+    self->visibleLevel = level;
+    self->visibleTiles = tile_display_get_tile_range(self, level, mip_rect_at_level(view, level));
+    PixelRect range = self->visibleTiles;
+
+    // make sure everything in view has a texture, and add up what to send
+    size_t numBytes = 0;
+    for (int ty = range.y0; ty < range.y1; ty++) {
+        for (int tx = range.x0; tx < range.x1; tx++) {
+            DisplayTile *tile = tile_display_get_tile(self, level, tx, ty);
+            if (tile->texture == 0) {
+                tile_display_make_resident(self, level, tx, ty);
+            }
+            tile->lastUsed = self->frame;
+
+            PixelRect s = tile->stale;
+            if (!pixelrect_is_empty(s)) {
+                numBytes += (size_t)4 * (s.x1 - s.x0) * (s.y1 - s.y0);
+            }
+        }
+    }
+
+    // then read the stale parts straight into the stream
+    texture_stream_begin(&(self->stream), numBytes);
+    for (int ty = range.y0; ty < range.y1; ty++) {
+        for (int tx = range.x0; tx < range.x1; tx++) {
+            DisplayTile *tile = tile_display_get_tile(self, level, tx, ty);
+            PixelRect s = tile->stale;
+            if (pixelrect_is_empty(s)) {
+                continue;
+            }
+
+            int x = s.x0 - tx * self->tileSize;
+            int y = s.y0 - ty * self->tileSize;
+            int w = s.x1 - s.x0;
+            int h = s.y1 - s.y0;
+            unsigned char *dst = texture_stream_add(&(self->stream), tile->texture, x, y, w, h);
+            if (dst != NULL) {
+                mip_pyramid_read(mips, source, level, s, dst, w);
+            }
+            else {
+                // it did not fit in the stream, so stage it in client memory
+                unsigned char *pixels = malloc((size_t)4 * w * h);
+                mip_pyramid_read(mips, source, level, s, pixels, w);
+                texture_stream_upload(&(self->stream), tile->texture, x, y, w, h, pixels);
+                free(pixels);
+            }
+            tile->stale = pixelrect_empty();
+        }
+    }
+}
+
+int tile_display_draw(TileDisplay *self, double originX, double originY, double zoom,
+    int viewportWidth, int viewportHeight, GLint rectUniform, GLint uvScaleUniform) {
+    int uploaded = texture_stream_end(&(self->stream));
+
+    // if the data was lost, send the tiles in view again next frame
+    int level = self->visibleLevel;
+    PixelRect range = self->visibleTiles;
+    if (!uploaded) {
+        for (int ty = range.y0; ty < range.y1; ty++) {
+            for (int tx = range.x0; tx < range.x1; tx++) {
+                tile_display_get_tile(self, level, tx, ty)->stale = tile_display_get_tile_rect(self, level, tx, ty);
+            }
+        }
+    }
+
+    // each pixel of the level covers this many viewport pixels
+    double scale = zoom * (1 << level);
+    glActiveTexture(GL_TEXTURE0);
+
+    for (int ty = range.y0; ty < range.y1; ty++) {
+        for (int tx = range.x0; tx < range.x1; tx++) {
+            DisplayTile *tile = tile_display_get_tile(self, level, tx, ty);
+            PixelRect r = tile_display_get_tile_rect(self, level, tx, ty);
+
+            // level coordinates to viewport pixels to clip space, where y grows upwards
+            double x0 = r.x0 * scale - originX * zoom;
+            double x1 = r.x1 * scale - originX * zoom;
+            double y0 = r.y0 * scale - originY * zoom;
+            double y1 = r.y1 * scale - originY * zoom;
+
+            glUniform4f(rectUniform,
+                (float)(2.0 * x0 / viewportWidth - 1.0), (float)(1.0 - 2.0 * y1 / viewportHeight),
+                (float)(2.0 * x1 / viewportWidth - 1.0), (float)(1.0 - 2.0 * y0 / viewportHeight));
+            glUniform2f(uvScaleUniform, (r.x1 - r.x0) / (float)self->tileSize, (r.y1 - r.y0) / (float)self->tileSize);
+            glBindTexture(GL_TEXTURE_2D, tile->texture);
+            glDrawArrays(GL_TRIANGLES, 0, 6);
+        }
+    }
+
+    return uploaded;
+}
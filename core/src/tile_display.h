@@ -0,0 +1,90 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef TILE_DISPLAY_H_
+#define TILE_DISPLAY_H_
+
+#include "mip_pyramid.h"  // MipPyramid, MIP_MAX_LEVELS
+#include "pixel_buffer.h"  // PixelBuffer, PixelRect
+#include "texture_stream.h"  // TextureStream, GL types
+
+/* The edge length, in pixels, of each display tile. */
+#define DISPLAY_TILE_SIZE 256
+
+/* How much texture memory the display may keep resident, unless overridden by
+TINYPAINT_TEXTURE_BUDGET_MB. Tiles in view are always kept, even past it. */
+#define DISPLAY_DEFAULT_BUDGET_MB 256
+
+/* One square of one mip level, and the texture (if any) showing it. */
+typedef struct displaytile {
+    // 0 if the tile has no texture right now
+    GLuint texture;
+
+    // the part of the tile, in level coordinates, the texture is behind on
+    PixelRect stale;
+
+    // the last frame the tile was in view
+    unsigned long lastUsed;
+} DisplayTile;
+
+/* The grid of tiles covering one mip level. */
+typedef struct tilelevel {
+    int width;
+    int height;
+    int tilesX;
+    int tilesY;
+    DisplayTile *tiles;
+} TileLevel;
+
+/* Shows a pixelbuffer, at any of its mip levels, as a grid of fixed-size
+textures, so no single texture has to be as large as the canvas. Only tiles in
+view get textures, and when the budget is used up the least recently viewed
+tile (of any level) gives its texture up. */
+typedef struct tiledisplay {
+    int tileSize;
+    int numLevels;
+    TileLevel levels[MIP_MAX_LEVELS];
+
+    // how many tiles may hold a texture at once, and how many do
+    int maxResident;
+    int numResident;
+
+    // counts up every update, for the lru
+    unsigned long frame;
+
+    // the level and tiles in view at the last update
+    int visibleLevel;
+    PixelRect visibleTiles;
+
+    TextureStream stream;
+} TileDisplay;
+
+/* Returns a new tiledisplay for the levels of 'mips'. The GL context must be
+current. */
+TileDisplay tile_display_new(MipPyramid *mips);
+
+/* Frees every texture and buffer. The GL context must be current. */
+void tile_display_destroy(TileDisplay *self);
+
+/* Marks 'rect' of the canvas as changed, in every level. */
+void tile_display_invalidate(TileDisplay *self, PixelRect rect);
+
+/* Gives every tile of 'level' intersecting 'view' (in canvas coordinates) a
+texture, and reads whatever has changed in them from 'mips' (which must be up
+to date to that level) into the upload stream. 'source' must not change while
+this runs. */
+void tile_display_update(TileDisplay *self, MipPyramid *mips, PixelBuffer *source, int level, PixelRect view);
+
+/* Uploads what the last update read, then draws its tiles with the current
+program, the canvas scaled by 'zoom' and canvas point (originX, originY) at the
+top left of a viewportWidth x viewportHeight viewport. 'rectUniform' receives
+each tile's corners in clip space (left, bottom, right, top) and
+'uvScaleUniform' how much of its texture it covers. Returns false if the upload
+was lost and another frame is needed. */
+int tile_display_draw(TileDisplay *self, double originX, double originY, double zoom,
+    int viewportWidth, int viewportHeight, GLint rectUniform, GLint uvScaleUniform);
+
+#endif  // TILE_DISPLAY_H_
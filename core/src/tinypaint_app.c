@@ -6,8 +6,10 @@
 
 #include "tinypaint_app.h"
 
+#include "canvas_program.h"
 #include "new_image_dialog.h"
 #include "editor_window.h"
+#include "mask_cache.h"
 
 #include "tinypaint_gresource.h"
 
@@ -78,6 +80,18 @@ void add_editor_window_from_file(GtkApplication *self, const char *filepath) {
 /* initializes the instance */
 static void tinypaint_app_init (TinyPaintApp *self) { }
 
+/* Fires once when the primary instance starts up (before activate or open) */
+static void tinypaint_app_startup(GApplication *app) {
+    G_APPLICATION_CLASS(tinypaint_app_parent_class)->startup(app);
+
+    // have the masks for the most common brush sizes ready before the first stroke
+    const int commonRadii[] = {10, 5, 1, 2, 3, 4, 15, 20, 25, 30, 40, 50, 75, 100};
+    mask_cache_prebuild_async(commonRadii, sizeof(commonRadii) / sizeof(commonRadii[0]));
+
+    // and the canvas shader binary from the last run, ready for the first window
+    canvas_program_preload();
+}
+
 /* Fires when the user opens TinyPaint without arguments (i.e. from the launcher) */
 static void tinypaint_app_activate(GApplication *app) {
     add_editor_window(GTK_APPLICATION(app));
@@ -95,6 +109,7 @@ static void tinypaint_app_open (GApplication *app, GFile **files, gint n_files,
 
 static void tinypaint_app_class_init(TinyPaintAppClass *class) {
     // virtual function overrides go here
+    G_APPLICATION_CLASS(class)->startup = tinypaint_app_startup;
     G_APPLICATION_CLASS(class)->activate = tinypaint_app_activate;
     G_APPLICATION_CLASS(class)->open = tinypaint_app_open;
 }
@@ -7,44 +7,55 @@
 #include "tool.h"
 
 #include "flood_fill.h"
+#include "mask_cache.h"
 #include "utilities.h"
 
-#include <math.h>  // pow(), sqrt()
+#include <math.h>  // sqrt()
+#include <stdlib.h>  // malloc, free
+#include <string.h>  // memcpy
 
 
 
 Tool tool_new() {
     Tool tmp;
-    GdkRGBA color = {1.0, 0.0, 0.0, 1.0};
+    Color color = {1.0, 0.0, 0.0, 1.0};
     tmp.tooltype = PENCIL;
     tmp.radius = 5;
     tmp.color = color;
     tmp.mask = NULL;
     tmp.applyWhenStationary = 0;
+    tmp.stationaryRate = 0.0;
     tmp.isStamp = 0;
-    tmp.fillRate = 1.0;
+    tmp.accumulateCoverage = 0;
+    tmp.spacing = 0.25;
     return tmp;
 }
 
 void tool_reset_parameters(Tool *tool) {
     // set the "default" tool parameters
     tool->applyWhenStationary = 0;
-    tool->fillRate = 1.0;
+    tool->stationaryRate = 0.0;
+    tool->spacing = 0.25;
     tool->isStamp = 0;
+    tool->accumulateCoverage = 0;
 
     // then change as needed based on the tooltype
     switch (tool->tooltype) {
     case PENCIL:
         break;
     case BRUSH:
+        // the soft falloff shows ripples along the stroke if dabs are far apart
+        tool->spacing = 0.1;
         break;
     case MARKER:
         tool->applyWhenStationary = 1;
-        tool->fillRate = 0.85;
+        tool->stationaryRate = 10.0;
         break;
     case SPRAYCAN:
         tool->applyWhenStationary = 1;
-        tool->fillRate = 0.375;
+        tool->stationaryRate = 20.0;
+        tool->spacing = 0.5;
+        tool->accumulateCoverage = 1;
         break;
     case FLOODFILL:
         tool->isStamp = 1;
@@ -54,98 +65,191 @@ void tool_reset_parameters(Tool *tool) {
     }
 }
 
-void tool_update_mask(Tool *tool) {
-    // if the mask has memory allocated to it, then free it first
-    /* NOTE: Tool instances MUST be created with "tool_new()" method, or else
-    their "mask" parameter will default to random memory location and this
-    free() call will cause coredump */
-    if (tool->mask != NULL) {
-        free(tool->mask);
+double tool_get_spacing(Tool *tool) {
+    return double_max(tool->spacing * tool->radius, MIN_DAB_SPACING);
+}
+
+/* Returns the mask weight of cell (x, y) for a mask of the given tooltype and radius. */
+double tool_mask_weight(ToolType tooltype, int radius, int x, int y) {
+    int edgeLength = (2 * radius) + 1;
+    double distanceFromCenter = sqrt((x - radius)*(x - radius) + (y - radius)*(y - radius));
+    double distanceNormalized = (radius == 0) ? 0.0 : distanceFromCenter / radius;
+
+    switch (tooltype) {
+    case PENCIL:
+        return distanceFromCenter <= radius;
+    case BRUSH:
+        return 1.0 - double_clamp(distanceNormalized, 0.0, 1.0);
+    case MARKER:
+        return (x / (double)edgeLength) >= 0.25 && (x / (double)edgeLength) <= 0.75;
+    case SPRAYCAN:
+        return 0.05 * (1.0 - double_clamp(distanceNormalized, 0.0, 1.0));
+    case FLOODFILL:
+        return 1.0;
+    case ERASER:
+        return distanceFromCenter <= radius;
     }
+    return 0.0;
+}
 
-    // calculate the radius and edgeLength of the mask
-    double radius = tool->radius;
+ToolMask* tool_mask_new(ToolType tooltype, int radius) {
     int edgeLength = (2 * radius) + 1;
 
-    // then allocate a new memory block of the correct size
-    tool->mask = malloc(sizeof(double) * edgeLength * edgeLength);
-
-    // and fill the mask array based on the tooltype
-    for (int x = 0; x < edgeLength; x++) {
-        for (int y = 0; y < edgeLength; y++) {
-            int maskIndex = y * edgeLength + x;
-            double distanceFromCenter = sqrt(pow(x - radius, 2.0) + pow(y - radius, 2.0));
-            double distanceNormalized = (radius == 0) ? 0.0 : distanceFromCenter / radius;
-
-            switch (tool->tooltype) {
-            case PENCIL:
-                tool->mask[maskIndex] = distanceFromCenter <= radius;
-                break;
-            case BRUSH:
-                tool->mask[maskIndex] = 1.0 - double_clamp(distanceNormalized, 0.0, 1.0);
-                break;
-            case MARKER:
-                tool->mask[maskIndex] = (x / (double)edgeLength) >= 0.25 && (x / (double)edgeLength) <= 0.75;
-                break;
-            case SPRAYCAN:
-                tool->mask[maskIndex] = 1.0 - double_clamp(distanceNormalized, 0.0, 1.0);
-                break;
-            case FLOODFILL:
-                /* not technically required but in apply code we check if the
-                mask is not 0.0 and don't bother applying in that case */
-                tool->mask[maskIndex] = 1.0;
-                break;
-            case ERASER:
-                tool->mask[maskIndex] = distanceFromCenter <= radius;
-                break;
-            }
+    ToolMask *mask = malloc(sizeof(ToolMask));
+    mask->radius = radius;
+    mask->numSpans = 0;
+    mask->spans = malloc(sizeof(ToolSpan) * edgeLength);
+    mask->weights = malloc(sizeof(float) * edgeLength * edgeLength);
+
+    float *row = malloc(sizeof(float) * edgeLength);
+    int used = 0;
+
+    for (int y = 0; y < edgeLength; y++) {
+        for (int x = 0; x < edgeLength; x++) {
+            row[x] = tool_mask_weight(tooltype, radius, x, y);
+        }
+
+        // trim the empty cells from either end of the row
+        int first = 0;
+        int last = edgeLength - 1;
+        while (first <= last && row[first] <= 0.0f) {
+            first++;
         }
+        while (last >= first && row[last] <= 0.0f) {
+            last--;
+        }
+
+        // rows with nothing left in them are not stored at all
+        if (first > last) {
+            continue;
+        }
+
+        ToolSpan *span = &(mask->spans[mask->numSpans++]);
+        span->dx = first - radius;
+        span->dy = y - radius;
+        span->length = last - first + 1;
+        span->weights = mask->weights + used;
+        memcpy(span->weights, row + first, sizeof(float) * span->length);
+        used += span->length;
     }
+
+    free(row);
+    return mask;
+}
+
+void tool_mask_destroy(ToolMask *mask) {
+    free(mask->spans);
+    free(mask->weights);
+    free(mask);
 }
 
-void tool_apply_to_pixelbuffer(Tool *tool, PixelBuffer *buffer, int x, int y) {
-    int edgeLength = (2 * tool->radius) + 1;
-
-    // go through each cell in the tool mask
-    for (int j = 0; j < edgeLength; j++) {
-        for (int i = 0; i < edgeLength; i++) {
-            int maskIndex = j * edgeLength + i;
-            int i_bufferPos = x + (i - tool->radius);
-            int j_bufferPos = y + (j - tool->radius);
-
-            // verify that the current mask cell is still within the canvas bounds
-            if (i_bufferPos >= 0 && i_bufferPos < buffer->width &&
-                j_bufferPos >= 0 && j_bufferPos < buffer->height &&
-                tool->mask[maskIndex] > 0.0) {
-                GdkRGBA currentColor = pixelbuffer_get_pixel(buffer, i_bufferPos, j_bufferPos);
-
-                // set the current pixel color based on the tooltype
-                switch (tool->tooltype) {
-                case PENCIL:
-                    pixelbuffer_set_pixel(buffer, i_bufferPos, j_bufferPos,
-                        GdkRGBA_lerp(currentColor, tool->color, tool->mask[maskIndex]));
-                    break;
-                case BRUSH:
-                    pixelbuffer_set_pixel(buffer, i_bufferPos, j_bufferPos,
-                        GdkRGBA_lerp(currentColor, tool->color, tool->mask[maskIndex]));
-                    break;
-                case MARKER:
-                    pixelbuffer_set_pixel(buffer, i_bufferPos, j_bufferPos,
-                        GdkRGBA_lerp(currentColor, GdkRGBA_min(currentColor, tool->color), tool->mask[maskIndex]));
-                    break;
-                case SPRAYCAN:
-                    pixelbuffer_set_pixel(buffer, i_bufferPos, j_bufferPos,
-                        GdkRGBA_lerp(currentColor, tool->color, tool->mask[maskIndex] * 0.05));
-                    break;
-                case FLOODFILL:
-                    flood_fill(buffer, x, y, currentColor, tool->color);
-                    break;
-                case ERASER:
-                    pixelbuffer_set_pixel(buffer, i_bufferPos, j_bufferPos,
-                        GdkRGBA_lerp(currentColor, buffer->backgroundColor, tool->mask[maskIndex]));
-                    break;
-                }
-            }
+void tool_update_mask(Tool *tool) {
+    // masks are shared between tools and owned by the cache, so never freed here
+    tool->mask = mask_cache_get(tool->tooltype, tool->radius);
+}
+
+
+
+//
+// ROW COMPOSITORS
+// Each one blends a row of pixels from src into dst by a row of weights. They
+// are chosen once per row, so the per-pixel loops carry no branches.
+//
+
+/* Blends each pixel toward 'color' by its weight. */
+void composite_row_lerp(Color *dst, float *dstf, const Color *src,
+    const float *weights, int length, Color color) {
+    for (int i = 0; i < length; i++) {
+        double t = weights[i];
+        Color c = src[i];
+        c.red += (color.red - c.red) * t;
+        c.green += (color.green - c.green) * t;
+        c.blue += (color.blue - c.blue) * t;
+        c.alpha += (color.alpha - c.alpha) * t;
+        dst[i] = c;
+        dstf[4*i + 0] = c.red;
+        dstf[4*i + 1] = c.green;
+        dstf[4*i + 2] = c.blue;
+        dstf[4*i + 3] = c.alpha;
+    }
+}
+
+/* Blends each pixel toward the channel-wise minimum of itself and 'color' by
+its weight. */
+void composite_row_min(Color *dst, float *dstf, const Color *src,
+    const float *weights, int length, Color color) {
+    for (int i = 0; i < length; i++) {
+        double t = weights[i];
+        Color c = src[i];
+        c.red += (double_min(c.red, color.red) - c.red) * t;
+        c.green += (double_min(c.green, color.green) - c.green) * t;
+        c.blue += (double_min(c.blue, color.blue) - c.blue) * t;
+        c.alpha += (double_min(c.alpha, color.alpha) - c.alpha) * t;
+        dst[i] = c;
+        dstf[4*i + 0] = c.red;
+        dstf[4*i + 1] = c.green;
+        dstf[4*i + 2] = c.blue;
+        dstf[4*i + 3] = c.alpha;
+    }
+}
+
+void tool_composite_row(Tool *tool, PixelBuffer *dst, PixelBuffer *src, int x, int y,
+    const float *weights, int length) {
+    int offset = y * dst->width + x;
+    Color *dstRow = dst->data + offset;
+    float *dstRowf = dst->rgbadata + 4*offset;
+    const Color *srcRow = src->data + offset;
+
+    switch (tool->tooltype) {
+    case PENCIL:
+    case BRUSH:
+    case SPRAYCAN:
+        composite_row_lerp(dstRow, dstRowf, srcRow, weights, length, tool->color);
+        break;
+    case MARKER:
+        composite_row_min(dstRow, dstRowf, srcRow, weights, length, tool->color);
+        break;
+    case FLOODFILL:
+        break;
+    case ERASER:
+        composite_row_lerp(dstRow, dstRowf, srcRow, weights, length, dst->backgroundColor);
+        break;
+    }
+}
+
+PixelRect tool_apply_to_pixelbuffer(Tool *tool, PixelBuffer *buffer, int x, int y) {
+    // the flood fill only cares about the pixel that was clicked on
+    if (tool->tooltype == FLOODFILL) {
+        if (x >= 0 && x < buffer->width && y >= 0 && y < buffer->height) {
+            return flood_fill(buffer, x, y, pixelbuffer_get_pixel(buffer, x, y), tool->color);
         }
+        return pixelrect_empty();
     }
+
+    PixelRect changed = pixelrect_empty();
+
+    // go through each span in the tool mask
+    for (int s = 0; s < tool->mask->numSpans; s++) {
+        ToolSpan *span = &(tool->mask->spans[s]);
+        int row = y + span->dy;
+        if (row < 0 || row >= buffer->height) {
+            continue;
+        }
+
+        // clip the span against the left and right edges of the canvas
+        int start = x + span->dx;
+        int end = start + span->length;
+        int clippedStart = start < 0 ? 0 : start;
+        int clippedEnd = end > buffer->width ? buffer->width : end;
+
+        if (clippedStart < clippedEnd) {
+            tool_composite_row(tool, buffer, buffer, clippedStart, row,
+                span->weights + (clippedStart - start), clippedEnd - clippedStart);
+
+            PixelRect spanRect = {clippedStart, row, clippedEnd, row + 1};
+            changed = pixelrect_union(changed, spanRect);
+        }
+    }
+
+    return changed;
 }
@@ -7,9 +7,12 @@
 #ifndef TOOL_H_
 #define TOOL_H_
 
-#include <gdk/gdk.h>  // GdkRGBA
+#include "color.h"  // Color
 #include "pixel_buffer.h"  // PixelBuffer
 
+/* The smallest distance (in pixels) between consecutive dabs along a stroke. */
+#define MIN_DAB_SPACING 1.0
+
 typedef enum tooltype {
     PENCIL,
     BRUSH,
@@ -19,21 +22,49 @@ typedef enum tooltype {
     ERASER
 } ToolType;
 
+/* A horizontal run of non-zero mask weights. 'dx' and 'dy' are the offsets of
+the run's first pixel from the center of the tool. */
+typedef struct toolspan {
+    int dx;
+    int dy;
+    int length;
+    float *weights;
+} ToolSpan;
+
+/* A tool footprint stored as one span per non-empty row, ordered top to bottom. */
+typedef struct toolmask {
+    int radius;
+    int numSpans;
+    ToolSpan *spans;
+
+    // backing storage for the weights of every span
+    float *weights;
+} ToolMask;
+
 typedef struct tool {
     ToolType tooltype;
     int radius;
-    GdkRGBA color;
-    double *mask;
+    Color color;
+
+    // shared with every other tool of the same type and radius (see mask_cache.h)
+    ToolMask *mask;
 
     // if true, tool is applied when the user is not moving the mouse.
     int applyWhenStationary;
 
+    // how many dabs per second are applied while the mouse is held down (if applyWhenStationary)
+    double stationaryRate;
+
     // if true, tool is only applied on stroke start (not stroke continue or end).
     int isStamp;
 
-    /* 1.0 fills every pixel between the current and previous mouse positions
-    0.0 fills no pixel between the current and previous mouse positions. */
-    double fillRate;
+    /* if true, overlapping dabs within a single stroke build on each other.
+    Otherwise each pixel takes the strongest dab that has covered it. */
+    int accumulateCoverage;
+
+    /* the distance between consecutive dabs along a stroke, as a fraction of
+    the radius. It is never allowed to fall below MIN_DAB_SPACING pixels. */
+    double spacing;
 } Tool;
 
 
@@ -47,7 +78,23 @@ void tool_reset_parameters(Tool *tool);
 /* Updates the tool's mask based on its type and current radius. */
 void tool_update_mask(Tool *tool);
 
-/* Applies the tool to the pixelbuffer at position (x, y) */
-void tool_apply_to_pixelbuffer(Tool *tool, PixelBuffer *buffer, int x, int y);
+/* Returns the distance (in pixels) between consecutive dabs along a stroke. */
+double tool_get_spacing(Tool *tool);
+
+/* Returns a new mask for the given tooltype and radius, in span form. */
+ToolMask* tool_mask_new(ToolType tooltype, int radius);
+
+/* Frees the memory allocated to the mask. */
+void tool_mask_destroy(ToolMask *mask);
+
+/* Applies the tool to the pixelbuffer at position (x, y). Returns the bounds of
+the pixels it changed. */
+PixelRect tool_apply_to_pixelbuffer(Tool *tool, PixelBuffer *buffer, int x, int y);
+
+/* Composites 'length' pixels of row y, starting at column x, from 'src' into 'dst'.
+Each pixel is blended toward the tool's color by its matching entry in 'weights'.
+'src' and 'dst' may be the same buffer. */
+void tool_composite_row(Tool *tool, PixelBuffer *dst, PixelBuffer *src, int x, int y,
+    const float *weights, int length);
 
 #endif  // TOOL_H_
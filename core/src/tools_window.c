@@ -116,7 +116,10 @@ void on_toolColor_color_set(GtkColorButton *button, gpointer user_data) {
         return;
     }
 
-    gtk_color_chooser_get_rgba(GTK_COLOR_CHOOSER(button), &(self->m_tool->color));
+    GdkRGBA rgba;
+    gtk_color_chooser_get_rgba(GTK_COLOR_CHOOSER(button), &rgba);
+    Color color = {rgba.red, rgba.green, rgba.blue, rgba.alpha};
+    self->m_tool->color = color;
 }
 
 
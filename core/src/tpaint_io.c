@@ -0,0 +1,664 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "tpaint_io.h"
+
+#include <errno.h>  // errno, EINTR
+#include <fcntl.h>  // open
+#include <pthread.h>  // pthread
+#include <stdint.h>  // uintptr_t
+#include <stdio.h>  // printf
+#include <stdlib.h>  // malloc, free, mkstemp
+#include <string.h>  // memcpy, memcmp
+#include <sys/file.h>  // flock
+#include <sys/stat.h>  // fstat, fchmod
+#include <unistd.h>  // pread, pwrite, fsync, ftruncate
+#include <zlib.h>  // compress2, uncompress, crc32, adler32
+
+/* How many threads to split encoding and decoding tiles across. */
+#define NUM_TILE_THREADS 8
+
+/* How many changed tiles are encoded before they are written out, which
+bounds the memory a save needs (at most 1 MB per tile). */
+#define TILES_PER_BATCH 64
+
+/* A tile is only stored compressed if that saves at least this fraction of it. */
+#define MIN_COMPRESSION_SAVING 8
+
+/* The most pixels a .tpaint is across or down, which keeps the number of
+tiles well within an int. */
+#define TPAINT_MAX_SIDE (1 << 20)
+
+
+
+//
+// HELPER methods
+//
+
+/* The tiles an image of a given size is split into. */
+typedef struct tilegrid {
+    int width;
+    int height;
+    int tilesX;
+    int tilesY;
+    int numTiles;
+} TileGrid;
+
+/* Returns the grid of tiles for a width x height image, neither of which may
+be more than TPAINT_MAX_SIDE. */
+TileGrid tpaint_grid(int width, int height) {
+    TileGrid grid;
+    grid.width = width;
+    grid.height = height;
+    grid.tilesX = ((int64_t)width + TPAINT_TILE_SIZE - 1) / TPAINT_TILE_SIZE;
+    grid.tilesY = ((int64_t)height + TPAINT_TILE_SIZE - 1) / TPAINT_TILE_SIZE;
+    grid.numTiles = (int64_t)grid.tilesX * grid.tilesY;
+    return grid;
+}
+
+/* Returns the pixels covered by tile 'index'. */
+PixelRect tpaint_tile_rect(TileGrid *grid, int index) {
+    PixelRect r;
+    r.x0 = (index % grid->tilesX) * TPAINT_TILE_SIZE;
+    r.y0 = (index / grid->tilesX) * TPAINT_TILE_SIZE;
+    r.x1 = r.x0 + TPAINT_TILE_SIZE < grid->width ? r.x0 + TPAINT_TILE_SIZE : grid->width;
+    r.y1 = r.y0 + TPAINT_TILE_SIZE < grid->height ? r.y0 + TPAINT_TILE_SIZE : grid->height;
+    return r;
+}
+
+/* Returns how many bytes the unencoded pixels of a tile take up. */
+size_t tpaint_tile_bytes(PixelRect r) {
+    return sizeof(float) * 4 * (size_t)(r.x1 - r.x0) * (r.y1 - r.y0);
+}
+
+/* Copies the floats of the pixels in 'r' into 'dst', one row after another. */
+void tpaint_gather_tile(PixelBuffer *src, PixelRect r, float *dst) {
+    int width = r.x1 - r.x0;
+    for (int y = r.y0; y < r.y1; y++) {
+        memcpy(dst, src->rgbadata + 4 * ((size_t)y * src->width + r.x0), sizeof(float) * 4 * width);
+        dst += 4 * width;
+    }
+}
+
+/* Groups the bytes of 'numFloats' floats by significance: every first byte,
+then every second byte, and so on. Neighbouring pixels tend to share their
+high bytes, so this gives deflate long runs to work with. */
+void tpaint_shuffle(unsigned char *dst, const unsigned char *src, size_t numFloats) {
+    for (size_t i = 0; i < numFloats; i++) {
+        for (int k = 0; k < 4; k++) {
+            dst[k * numFloats + i] = src[4 * i + k];
+        }
+    }
+}
+
+/* Undoes tpaint_shuffle(). */
+void tpaint_unshuffle(unsigned char *dst, const unsigned char *src, size_t numFloats) {
+    for (size_t i = 0; i < numFloats; i++) {
+        for (int k = 0; k < 4; k++) {
+            dst[4 * i + k] = src[k * numFloats + i];
+        }
+    }
+}
+
+/* Writes all of 'data' at 'offset', however many calls it takes. Returns false on failure. */
+int tpaint_write_all(int fd, const void *data, size_t length, off_t offset) {
+    const unsigned char *bytes = data;
+    while (length > 0) {
+        ssize_t written = pwrite(fd, bytes, length, offset);
+        if (written <= 0) {
+            return 0;
+        }
+        bytes += written;
+        length -= written;
+        offset += written;
+    }
+    return 1;
+}
+
+/* Opens the existing .tpaint at 'filepath' for appending to, and waits for an
+exclusive lock on it, so two saves to the same file never append to it at
+once: a save that supersedes another only reads the file once the older one
+has finished with it (or cut its append off again). Returns -1 if there is no
+such file yet, in which case there is nothing to append to. */
+int tpaint_lock_existing(const char *filepath) {
+    while (1) {
+        int fd = open(filepath, O_RDWR);
+        if (fd < 0) {
+            return -1;
+        }
+        if (flock(fd, LOCK_EX) != 0) {
+            if (errno == EINTR) {
+                close(fd);
+                continue;
+            }
+            // a file system without locks still gets saved to, just unguarded
+            return fd;
+        }
+
+        // a save that started the file over renames a new one into place, so
+        // make sure the file that was locked is still the one at 'filepath'
+        struct stat locked;
+        struct stat current;
+        if (fstat(fd, &locked) == 0 && stat(filepath, &current) == 0
+                && locked.st_dev == current.st_dev && locked.st_ino == current.st_ino) {
+            return fd;
+        }
+        close(fd);
+    }
+}
+
+/* Returns true if 'header' is one this version can read, of an image no
+larger than TPAINT_MAX_SIDE either way. */
+int tpaint_header_is_valid(TPaintHeader *header) {
+    return memcmp(header->magic, TPAINT_MAGIC, 8) == 0
+        && header->version == TPAINT_VERSION
+        && header->tileSize == TPAINT_TILE_SIZE
+        && header->width > 0 && header->width <= TPAINT_MAX_SIDE
+        && header->height > 0 && header->height <= TPAINT_MAX_SIDE;
+}
+
+/* Returns true if an index for 'grid' at 'indexOffset', and every tile in it
+(once read), lie within a file of 'fileSize' bytes. 'index' may be NULL to only
+check the index itself. Nothing here can wrap around, whatever the file says. */
+int tpaint_index_fits(TileGrid *grid, uint64_t indexOffset, TPaintTile *index, uint64_t fileSize) {
+    if (indexOffset > fileSize || (uint64_t)grid->numTiles > (fileSize - indexOffset) / sizeof(TPaintTile)) {
+        return 0;
+    }
+    for (int i = 0; index != NULL && i < grid->numTiles; i++) {
+        if (index[i].offset > fileSize || index[i].length > fileSize - index[i].offset) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Reads the header and index of the existing .tpaint open as 'fd' (see
+tpaint_lock_existing()) into 'header' and 'index', and its size into
+'fileSize'. Returns false if 'fd' is -1, or it is not a .tpaint laid out on
+the same grid. */
+int tpaint_read_existing(int fd, TileGrid *grid, TPaintHeader *header, TPaintTile *index, off_t *fileSize) {
+    if (fd < 0) {
+        return 0;
+    }
+
+    size_t indexBytes = sizeof(TPaintTile) * grid->numTiles;
+    struct stat info;
+    int ok = fstat(fd, &info) == 0
+        && pread(fd, header, sizeof(TPaintHeader), 0) == sizeof(TPaintHeader)
+        && tpaint_header_is_valid(header)
+        && header->width == (uint32_t)grid->width
+        && header->height == (uint32_t)grid->height
+        && tpaint_index_fits(grid, header->indexOffset, NULL, info.st_size)
+        && pread(fd, index, indexBytes, header->indexOffset) == (ssize_t)indexBytes
+        && tpaint_index_fits(grid, header->indexOffset, index, info.st_size);
+    *fileSize = info.st_size;
+    return ok;
+}
+
+
+
+/* Maps the .tpaint at 'filepath' and reads its header, and its index into a
+new array at 'index'. Returns false (and prints why) if it is not a readable
+.tpaint. */
+int tpaint_map(const char *filepath, MappedFile *file, TPaintHeader *header, TPaintTile **index) {
+    if (!image_io_map_file(filepath, file)) {
+        return 0;
+    }
+
+    int ok = file->size >= sizeof(TPaintHeader);
+    if (ok) {
+        memcpy(header, file->data, sizeof(TPaintHeader));
+    }
+    ok = ok && tpaint_header_is_valid(header);
+    TileGrid grid = tpaint_grid(ok ? header->width : 0, ok ? header->height : 0);
+    ok = ok && tpaint_index_fits(&grid, header->indexOffset, NULL, file->size);
+
+    // the index is copied out, since nothing says it is aligned in the file
+    *index = NULL;
+    if (ok) {
+        *index = malloc(sizeof(TPaintTile) * grid.numTiles);
+        memcpy(*index, file->data + header->indexOffset, sizeof(TPaintTile) * grid.numTiles);
+        ok = tpaint_index_fits(&grid, header->indexOffset, *index, file->size);
+    }
+
+    if (!ok) {
+        printf("error: %s is not a valid .tpaint file\n", filepath);
+        free(*index);
+        image_io_unmap_file(file);
+    }
+    return ok;
+}
+
+
+
+//
+// WORKER methods
+//
+
+/* a struct to hold everything one tile thread needs. */
+typedef struct tile_worker_args {
+    PixelBuffer *buffer;
+    TileGrid *grid;
+    TPaintTile *index;
+
+    // the tiles this worker handles: tiles[first], tiles[first + stride], ...
+    const int *tiles;
+    int numTiles;
+    int first;
+    int stride;
+
+    // only for encoding: the compression level, and where each encoded tile goes
+    int level;
+    unsigned char **encoded;
+
+    // only for decoding: the mapped file, and the row of the image the first
+    // row of 'buffer' holds (when it holds just one band of tiles)
+    const unsigned char *map;
+    size_t mapSize;
+    int bandY0;
+
+    SaveProgress *progress;
+    int ok;
+} TileWorkerArgs;
+
+/* Works out the checksums of each tile, as they are in the buffer. */
+void* checksum_worker(void *data) {
+    TileWorkerArgs *args = (TileWorkerArgs *)data;
+    float *raw = malloc(sizeof(float) * 4 * TPAINT_TILE_SIZE * TPAINT_TILE_SIZE);
+
+    for (int i = args->first; i < args->numTiles && !save_progress_is_cancelled(args->progress); i += args->stride) {
+        int tile = args->tiles[i];
+        PixelRect r = tpaint_tile_rect(args->grid, tile);
+        size_t bytes = tpaint_tile_bytes(r);
+        tpaint_gather_tile(args->buffer, r, raw);
+        args->index[tile].crc = crc32(0, (const unsigned char *)raw, bytes);
+        args->index[tile].adler = adler32(adler32(0, NULL, 0), (const unsigned char *)raw, bytes);
+        save_progress_report(args->progress, 1);
+    }
+
+    free(raw);
+    return NULL;
+}
+
+/* Encodes each tile into a buffer of its own (stored in encoded[i]), and fills
+in its length and compression in the index. */
+void* encode_worker(void *data) {
+    TileWorkerArgs *args = (TileWorkerArgs *)data;
+    unsigned char *shuffled = malloc(sizeof(float) * 4 * TPAINT_TILE_SIZE * TPAINT_TILE_SIZE);
+
+    for (int i = args->first; i < args->numTiles; i += args->stride) {
+        int tile = args->tiles[i];
+        PixelRect r = tpaint_tile_rect(args->grid, tile);
+        size_t bytes = tpaint_tile_bytes(r);
+        unsigned char *raw = malloc(bytes);
+        tpaint_gather_tile(args->buffer, r, (float *)raw);
+
+        args->encoded[i] = raw;
+        args->index[tile].length = bytes;
+        args->index[tile].compression = TPAINT_TILE_RAW;
+        if (args->level == 0) {
+            continue;
+        }
+
+        // deflate at the fastest level, and only keep it if it was worth it
+        tpaint_shuffle(shuffled, raw, bytes / sizeof(float));
+        uLongf length = compressBound(bytes);
+        unsigned char *compressed = malloc(length);
+        if (compress2(compressed, &length, shuffled, bytes, 1) == Z_OK
+            && length < bytes - bytes / MIN_COMPRESSION_SAVING) {
+            free(raw);
+            args->encoded[i] = compressed;
+            args->index[tile].length = length;
+            args->index[tile].compression = TPAINT_TILE_DEFLATE;
+        }
+        else {
+            free(compressed);
+        }
+    }
+
+    free(shuffled);
+    return NULL;
+}
+
+/* Decodes each tile from the mapped file into the buffer. */
+void* decode_worker(void *data) {
+    TileWorkerArgs *args = (TileWorkerArgs *)data;
+    unsigned char *inflated = malloc(sizeof(float) * 4 * TPAINT_TILE_SIZE * TPAINT_TILE_SIZE);
+    float *raw = malloc(sizeof(float) * 4 * TPAINT_TILE_SIZE * TPAINT_TILE_SIZE);
+    args->ok = 1;
+
+    for (int i = args->first; i < args->numTiles && args->ok; i += args->stride) {
+        TPaintTile *entry = &args->index[args->tiles[i]];
+        PixelRect r = tpaint_tile_rect(args->grid, args->tiles[i]);
+        size_t bytes = tpaint_tile_bytes(r);
+        const unsigned char *stored = args->map + entry->offset;
+
+        // raw tiles are read straight out of the mapping, unless they were
+        // appended after deflated ones by a save that didn't align them
+        const float *pixels = (const float *)stored;
+        if (entry->compression == TPAINT_TILE_RAW) {
+            args->ok = entry->length == bytes;
+            if (args->ok && (uintptr_t)stored % _Alignof(float) != 0) {
+                memcpy(raw, stored, bytes);
+                pixels = raw;
+            }
+        }
+        else if (entry->compression == TPAINT_TILE_DEFLATE) {
+            uLongf length = bytes;
+            args->ok = uncompress(inflated, &length, stored, entry->length) == Z_OK && length == bytes;
+            tpaint_unshuffle((unsigned char *)raw, inflated, bytes / sizeof(float));
+            pixels = raw;
+        }
+        else {
+            args->ok = 0;
+        }
+
+        int width = r.x1 - r.x0;
+        for (int y = r.y0; y < r.y1 && args->ok; y++) {
+            pixelbuffer_set_span_floats(args->buffer, r.x0, y - args->bandY0, width, pixels + 4 * width * (y - r.y0));
+        }
+    }
+
+    free(inflated);
+    free(raw);
+    return NULL;
+}
+
+/* Runs 'worker' over 'numTiles' tiles, split across threads. Returns false if
+any of them failed. */
+int tpaint_run_workers(void* (*worker)(void *), TileWorkerArgs *shared, int numTiles) {
+    int numThreads = numTiles < NUM_TILE_THREADS ? numTiles : NUM_TILE_THREADS;
+    if (numThreads < 1) {
+        return 1;
+    }
+
+    pthread_t tids[NUM_TILE_THREADS];
+    TileWorkerArgs args[NUM_TILE_THREADS];
+    for (int i = 0; i < numThreads; i++) {
+        args[i] = *shared;
+        args[i].numTiles = numTiles;
+        args[i].first = i;
+        args[i].stride = numThreads;
+        args[i].ok = 1;
+    }
+
+    // the calling thread takes the first share itself
+    for (int i = 1; i < numThreads; i++) {
+        pthread_create(&tids[i], NULL, worker, (void *)(&args[i]));
+    }
+    worker((void *)(&args[0]));
+
+    int ok = args[0].ok;
+    for (int i = 1; i < numThreads; i++) {
+        pthread_join(tids[i], NULL);
+        ok = ok && args[i].ok;
+    }
+    return ok;
+}
+
+
+
+//
+// TPAINT methods
+//
+
+int tpaint_load(const char *filepath, PixelBuffer *out) {
+    MappedFile file;
+    TPaintHeader header;
+    TPaintTile *index;
+    if (!tpaint_map(filepath, &file, &header, &index)) {
+        return 0;
+    }
+
+    TileGrid grid = tpaint_grid(header.width, header.height);
+    PixelBuffer buffer = pixelbuffer_new(header.width, header.height);
+    Color background = {header.backgroundColor[0], header.backgroundColor[1],
+        header.backgroundColor[2], header.backgroundColor[3]};
+    buffer.backgroundColor = background;
+
+    int *tiles = malloc(sizeof(int) * grid.numTiles);
+    for (int i = 0; i < grid.numTiles; i++) {
+        tiles[i] = i;
+    }
+
+    TileWorkerArgs args;
+    memset(&args, 0, sizeof(args));
+    args.buffer = &buffer;
+    args.grid = &grid;
+    args.index = index;
+    args.tiles = tiles;
+    args.map = file.data;
+    args.mapSize = file.size;
+    int ok = tpaint_run_workers(decode_worker, &args, grid.numTiles);
+
+    if (ok) {
+        *out = buffer;
+    }
+    else {
+        printf("error: %s is not a valid .tpaint file\n", filepath);
+        pixelbuffer_destroy(&buffer);
+    }
+
+    free(tiles);
+    free(index);
+    image_io_unmap_file(&file);
+    return ok;
+}
+
+int tpaint_load_rows(const char *filepath, ImageRowSink *sink) {
+    MappedFile file;
+    TPaintHeader header;
+    TPaintTile *index;
+    if (!tpaint_map(filepath, &file, &header, &index)) {
+        return 0;
+    }
+
+    TileGrid grid = tpaint_grid(header.width, header.height);
+    int ok = sink->begin(sink->data, header.width, header.height);
+
+    // decode one row of tiles at a time into a buffer just tall enough for it
+    PixelBuffer band = pixelbuffer_new(grid.width, ok ? TPAINT_TILE_SIZE : 0);
+    int *tiles = malloc(sizeof(int) * grid.tilesX);
+
+    TileWorkerArgs args;
+    memset(&args, 0, sizeof(args));
+    args.buffer = &band;
+    args.grid = &grid;
+    args.index = index;
+    args.tiles = tiles;
+    args.map = file.data;
+    args.mapSize = file.size;
+
+    for (int ty = 0; ty < grid.tilesY && ok; ty++) {
+        if (image_row_sink_is_cancelled(sink)) {
+            ok = 0;
+            break;
+        }
+        for (int tx = 0; tx < grid.tilesX; tx++) {
+            tiles[tx] = ty * grid.tilesX + tx;
+        }
+        args.bandY0 = ty * TPAINT_TILE_SIZE;
+        if (!tpaint_run_workers(decode_worker, &args, grid.tilesX)) {
+            printf("error: %s is not a valid .tpaint file\n", filepath);
+            ok = 0;
+        }
+
+        int y1 = args.bandY0 + TPAINT_TILE_SIZE < grid.height ? args.bandY0 + TPAINT_TILE_SIZE : grid.height;
+        for (int y = args.bandY0; y < y1 && ok; y++) {
+            const float *row = band.rgbadata + 4 * (size_t)grid.width * (y - args.bandY0);
+            ok = sink->row(sink->data, y, row, IMAGE_ROW_FLOATS);
+        }
+    }
+
+    pixelbuffer_destroy(&band);
+    free(tiles);
+    free(index);
+    image_io_unmap_file(&file);
+    return ok;
+}
+
+int tpaint_save(PixelBuffer *source, const char *filepath, int compressionLevel, SaveProgress *progress) {
+    if (source->width > TPAINT_MAX_SIDE || source->height > TPAINT_MAX_SIDE) {
+        printf("error: the image is too large to save as a .tpaint\n");
+        return 0;
+    }
+
+    TileGrid grid = tpaint_grid(source->width, source->height);
+    size_t indexBytes = sizeof(TPaintTile) * grid.numTiles;
+
+    // every tile is checksummed, then written (or found to be unchanged)
+    if (progress != NULL) {
+        atomic_store(&progress->total, 2 * (size_t)grid.numTiles);
+    }
+
+    int *tiles = malloc(sizeof(int) * grid.numTiles);
+    for (int i = 0; i < grid.numTiles; i++) {
+        tiles[i] = i;
+    }
+
+    TPaintTile *index = calloc(grid.numTiles, sizeof(TPaintTile));
+    TileWorkerArgs args;
+    memset(&args, 0, sizeof(args));
+    args.buffer = source;
+    args.grid = &grid;
+    args.index = index;
+    args.tiles = tiles;
+    args.level = compressionLevel;
+    args.progress = progress;
+    tpaint_run_workers(checksum_worker, &args, grid.numTiles);
+
+    // find the tiles that differ from the ones already in the file (if any),
+    // which stays locked until this save is done with it
+    TPaintHeader header;
+    TPaintTile *old = malloc(indexBytes);
+    off_t fileEnd = 0;
+    int existing = tpaint_lock_existing(filepath);
+    int incremental = tpaint_read_existing(existing, &grid, &header, old, &fileEnd);
+    uint64_t garbage = incremental ? header.garbageBytes + indexBytes : 0;
+    uint64_t live = 0;
+    int numChanged = 0;
+    for (int i = 0; i < grid.numTiles; i++) {
+        if (incremental && old[i].crc == index[i].crc && old[i].adler == index[i].adler) {
+            index[i] = old[i];
+            live += old[i].length;
+        }
+        else {
+            garbage += incremental ? old[i].length : 0;
+            tiles[numChanged++] = i;
+        }
+    }
+    free(old);
+
+    // once most of the file would be outdated, start it over instead
+    if (incremental && garbage > live) {
+        incremental = 0;
+        numChanged = grid.numTiles;
+        for (int i = 0; i < grid.numTiles; i++) {
+            tiles[i] = i;
+        }
+    }
+    save_progress_report(progress, grid.numTiles - numChanged);
+
+    // changed tiles are appended to the file, or written to a new one that replaces it
+    int fd = -1;
+    char *tmpPath = NULL;
+    off_t offset;
+    if (incremental) {
+        fd = existing;
+        offset = fileEnd;
+    }
+    else {
+        tmpPath = malloc(strlen(filepath) + 8);
+        sprintf(tmpPath, "%s.XXXXXX", filepath);
+        fd = mkstemp(tmpPath);
+        if (fd >= 0) {
+            struct stat existing;
+            fchmod(fd, stat(filepath, &existing) == 0 ? (existing.st_mode & 0777) : 0644);
+        }
+        offset = sizeof(TPaintHeader);
+        garbage = 0;
+    }
+
+    int ok = fd >= 0 && !save_progress_is_cancelled(progress);
+    if (fd < 0) {
+        printf("error: could not open %s for writing\n", filepath);
+    }
+
+    // encode a batch of tiles on every thread, then write them out in order
+    unsigned char *encoded[TILES_PER_BATCH];
+    for (int batch = 0; batch < numChanged && ok; batch += TILES_PER_BATCH) {
+        int count = numChanged - batch < TILES_PER_BATCH ? numChanged - batch : TILES_PER_BATCH;
+        args.tiles = tiles + batch;
+        args.encoded = encoded;
+        tpaint_run_workers(encode_worker, &args, count);
+
+        for (int i = 0; i < count; i++) {
+            // raw tiles start on a float, so they can be loaded straight out of the mapping
+            TPaintTile *entry = &index[tiles[batch + i]];
+            if (entry->compression == TPAINT_TILE_RAW) {
+                offset += (sizeof(float) - offset % sizeof(float)) % sizeof(float);
+            }
+            entry->offset = offset;
+            ok = ok && tpaint_write_all(fd, encoded[i], entry->length, offset);
+            offset += entry->length;
+            free(encoded[i]);
+        }
+        save_progress_report(progress, count);
+        ok = ok && !save_progress_is_cancelled(progress);
+    }
+
+    // then the index, and once all of that is on disk, the header pointing at it
+    if (ok) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, TPAINT_MAGIC, 8);
+        header.version = TPAINT_VERSION;
+        header.tileSize = TPAINT_TILE_SIZE;
+        header.width = grid.width;
+        header.height = grid.height;
+        header.backgroundColor[0] = source->backgroundColor.red;
+        header.backgroundColor[1] = source->backgroundColor.green;
+        header.backgroundColor[2] = source->backgroundColor.blue;
+        header.backgroundColor[3] = source->backgroundColor.alpha;
+        header.indexOffset = offset;
+        header.garbageBytes = garbage;
+
+        ok = tpaint_write_all(fd, index, indexBytes, offset)
+            && fsync(fd) == 0
+            && !save_progress_is_cancelled(progress)
+            && tpaint_write_all(fd, &header, sizeof(header), 0)
+            && fsync(fd) == 0;
+        if (!ok && !save_progress_is_cancelled(progress)) {
+            printf("error: could not write %s\n", filepath);
+        }
+    }
+
+    // a failed append is cut off again, leaving the file as it was
+    if (fd >= 0 && incremental && !ok) {
+        ftruncate(fd, fileEnd);
+    }
+    if (fd >= 0 && fd != existing) {
+        close(fd);
+    }
+    if (tmpPath != NULL) {
+        if (ok && rename(tmpPath, filepath) != 0) {
+            printf("error: could not replace %s\n", filepath);
+            ok = 0;
+        }
+        if (!ok) {
+            unlink(tmpPath);
+        }
+        free(tmpPath);
+    }
+
+    // and only once the new file is in place can another save have it
+    if (existing >= 0) {
+        close(existing);
+    }
+
+    free(tiles);
+    free(index);
+    return ok;
+}
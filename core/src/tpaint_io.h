@@ -0,0 +1,81 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef TPAINT_IO_H_
+#define TPAINT_IO_H_
+
+#include "image_io.h"  // SaveProgress, ImageRowSink
+#include "pixel_buffer.h"  // PixelBuffer
+
+#include <stdint.h>  // uint32_t, uint64_t
+
+/* The first 8 bytes of every .tpaint file. */
+#define TPAINT_MAGIC "TPAINT\x1a\n"
+#define TPAINT_VERSION 1
+
+/* The width and height of the square tiles the pixels are stored in. */
+#define TPAINT_TILE_SIZE 256
+
+/* How a tile's pixels are stored: as they are in memory, or with the bytes of
+every float grouped by significance (which makes them far more compressible)
+and then deflated. */
+#define TPAINT_TILE_RAW 0
+#define TPAINT_TILE_DEFLATE 1
+
+/* A .tpaint file is a header, then the tiles in any order, then an index of
+where each tile is. All numbers are stored in the machine's own byte order
+(little endian on every platform TinyPaint runs on). Raw tiles are written
+at offsets that are a multiple of 4, so their floats can be used where they
+are mapped.
+
+Saving over an existing .tpaint of the same size only appends the tiles that
+changed, followed by a new index, and then points the header at it. Until the
+header is rewritten the old index is still intact, so an interrupted save
+leaves the previous version readable. Once the space taken up by outdated
+tiles exceeds the space of the live ones, the file is rewritten from scratch. */
+typedef struct tpaintheader {
+    char magic[8];
+    uint32_t version;
+    uint32_t tileSize;
+    uint32_t width;
+    uint32_t height;
+    float backgroundColor[4];
+
+    // where the index is, and how many bytes are taken up by outdated tiles
+    uint64_t indexOffset;
+    uint64_t garbageBytes;
+} TPaintHeader;
+
+/* One entry of the index, in row-major tile order. Each tile holds tileSize x
+tileSize pixels (less along the right and bottom edges) of 4 floats each. */
+typedef struct tpainttile {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t compression;
+
+    // checksums of the unencoded pixels, to tell which tiles a save has to rewrite
+    uint32_t crc;
+    uint32_t adler;
+} TPaintTile;
+
+/* Decodes the .tpaint at 'filepath' into 'sink' (see image_io_load_rows()),
+one row of tiles at a time, handing on the floats themselves. */
+int tpaint_load_rows(const char *filepath, ImageRowSink *sink);
+
+/* Loads the .tpaint at 'filepath' into a new pixelbuffer at 'out'. The file is
+memory mapped, and its tiles decoded on several threads. Returns false (and
+prints why, leaving 'out' alone) if it is not a readable .tpaint. */
+int tpaint_load(const char *filepath, PixelBuffer *out);
+
+/* Writes 'source' to 'filepath' as a .tpaint. Tiles are stored raw if
+'compressionLevel' is 0, otherwise they are lightly compressed (whatever the
+level, so saving stays fast). Only the float copy of the pixels (rgbadata) is
+read. 'progress' may be NULL. Returns false (and prints why) if the file could
+not be written, if the image is more than a million pixels across or down, or
+if the save was cancelled, in which case the file is left as it was. */
+int tpaint_save(PixelBuffer *source, const char *filepath, int compressionLevel, SaveProgress *progress);
+
+#endif  // TPAINT_IO_H_
@@ -8,16 +8,9 @@
 
 #include <math.h>
 
-// for GL stuff.
 #include "stdio.h"
 #include "stdlib.h"
-#if defined(__APPLE__)
-#include <OpenGL/gl.h>
-#include <OpenGL/glu.h>
-#else
-#include <GL/gl.h>
-#include <GL/glu.h>
-#endif
+#include "string.h"
 
 
 
@@ -52,10 +45,10 @@ double double_min(double x, double y) {
 
 
 //
-// GdkRGBA functions
+// Color functions
 //
 
-GdkRGBA GdkRGBA_add(GdkRGBA a, GdkRGBA b) {
+Color Color_add(Color a, Color b) {
     a.red += b.red;
     a.green += b.green;
     a.blue += b.blue;
@@ -63,7 +56,7 @@ GdkRGBA GdkRGBA_add(GdkRGBA a, GdkRGBA b) {
     return a;
 }
 
-GdkRGBA GdkRGBA_clamp(GdkRGBA color, double min, double max) {
+Color Color_clamp(Color color, double min, double max) {
     color.red = double_clamp(color.red, min, max);
     color.green = double_clamp(color.green, min, max);
     color.blue = double_clamp(color.blue, min, max);
@@ -71,7 +64,7 @@ GdkRGBA GdkRGBA_clamp(GdkRGBA color, double min, double max) {
     return color;
 }
 
-GdkRGBA GdkRGBA_divide(GdkRGBA a, GdkRGBA b) {
+Color Color_divide(Color a, Color b) {
     a.red /= b.red;
     a.green /= b.green;
     a.blue /= b.blue;
@@ -79,7 +72,7 @@ GdkRGBA GdkRGBA_divide(GdkRGBA a, GdkRGBA b) {
     return a;
 }
 
-int GdkRGBA_equals(GdkRGBA a, GdkRGBA b, double threshold) {
+int Color_equals(Color a, Color b, double threshold) {
     if (double_abs(a.red - b.red) > threshold ||
         double_abs(a.green - b.green) > threshold ||
         double_abs(a.blue - b.blue) > threshold ||
@@ -91,7 +84,7 @@ int GdkRGBA_equals(GdkRGBA a, GdkRGBA b, double threshold) {
     }
 }
 
-GdkRGBA GdkRGBA_lerp(GdkRGBA a, GdkRGBA b, double t) {
+Color Color_lerp(Color a, Color b, double t) {
     a.red = double_lerp(a.red, b.red, t);
     a.green = double_lerp(a.green, b.green, t);
     a.blue = double_lerp(a.blue, b.blue, t);
@@ -99,11 +92,11 @@ GdkRGBA GdkRGBA_lerp(GdkRGBA a, GdkRGBA b, double t) {
     return a;
 }
 
-double GdkRGBA_luminance(GdkRGBA color) {
+double Color_luminance(Color color) {
     return color.red*0.2126 + color.green*0.7152 + color.blue*0.0722;
 }
 
-GdkRGBA GdkRGBA_min(GdkRGBA a, GdkRGBA b) {
+Color Color_min(Color a, Color b) {
     a.red = double_min(a.red, b.red);
     a.green = double_min(a.green, b.green);
     a.blue = double_min(a.blue, b.blue);
@@ -111,7 +104,7 @@ GdkRGBA GdkRGBA_min(GdkRGBA a, GdkRGBA b) {
     return a;
 }
 
-GdkRGBA GdkRGBA_multiply(GdkRGBA a, GdkRGBA b) {
+Color Color_multiply(Color a, Color b) {
     a.red *= b.red;
     a.green *= b.green;
     a.blue *= b.blue;
@@ -119,7 +112,7 @@ GdkRGBA GdkRGBA_multiply(GdkRGBA a, GdkRGBA b) {
     return a;
 }
 
-GdkRGBA GdkRGBA_scale(GdkRGBA color, double scale) {
+Color Color_scale(Color color, double scale) {
     color.red *= scale;
     color.green *= scale;
     color.blue *= scale;
@@ -127,7 +120,7 @@ GdkRGBA GdkRGBA_scale(GdkRGBA color, double scale) {
     return color;
 }
 
-GdkRGBA GdkRGBA_subtract(GdkRGBA a, GdkRGBA b) {
+Color Color_subtract(Color a, Color b) {
     a.red -= b.red;
     a.green -= b.green;
     a.blue -= b.blue;
@@ -173,38 +166,9 @@ int string_ends_with(const char *string, const char *end) {
 
 
 //
-// GL functions.
+// FILE functions
 //
 
-// Source:
-// http://schabby.de/shader-loading/
-int compile_shader(char* shaderSource, int shaderType) {
-	// handle will be non-zero if succefully created.
-	int handle = glCreateShader(shaderType);
-
-    // upload code to OpenGL and associate code with shader
-    const GLchar* shader_ptr = shaderSource;
-    glShaderSource(handle, 1, &shader_ptr, NULL);
-
-	// compile source code into binary
-	glCompileShader(handle);
-
-	// acquire compilation status
-	int shaderStatus = 0;
-    glGetShaderiv(handle, GL_COMPILE_STATUS, &shaderStatus);
-
-	// check whether compilation was successful
-	if(shaderStatus == GL_FALSE) {
-        char msg[512];
-        glGetShaderInfoLog(handle, 512, NULL, &msg);
-        printf("%s\n", msg);
-        return -1;
-	}
-
-    printf("Compiled shader.\n");
-	return handle;
-}
-
 // Source:
 // https://stackoverflow.com/a/2029227
 char* load_file(char* filename, int* length) {
@@ -218,7 +182,8 @@ char* load_file(char* filename, int* length) {
             long bufsize = ftell(fp);
             if (bufsize == -1) {
                 // ERROR.
-                return -1;
+                fclose(fp);
+                return NULL;
             }
 
             // Allocate our buffer to that size.
@@ -227,7 +192,9 @@ char* load_file(char* filename, int* length) {
             // Go back to the start of the file.
             if (fseek(fp, 0L, SEEK_SET) != 0) {
                 // ERROR.
-                return -1;
+                free(source);
+                fclose(fp);
+                return NULL;
             }
 
             // Read the entire file into memory.
@@ -238,6 +205,7 @@ char* load_file(char* filename, int* length) {
             else {
                 source[newLen++] = '\0';  // Just to be safe.
                 *length = newLen;
+                fclose(fp);
                 return source;
             }
         }
@@ -7,7 +7,7 @@
 #ifndef UTILITIES_H_
 #define UTILITIES_H_
 
-#include <gdk/gdk.h>  // GdkRGBA
+#include "color.h"  // Color
 
 //
 // DOUBLE functions
@@ -34,38 +34,38 @@ double double_min(double x, double y);
 
 
 //
-// GdkRGBA functions
+// Color functions
 //
 
 /* color+color : Returns 'a' added channel-wise to 'b' */
-GdkRGBA GdkRGBA_add(GdkRGBA a, GdkRGBA b);
+Color Color_add(Color a, Color b);
 
 /* Returns 'color' clamped channel-wise between 'min' and 'max' */
-GdkRGBA GdkRGBA_clamp(GdkRGBA color, double min, double max);
+Color Color_clamp(Color color, double min, double max);
 
 /* color/color : Returns 'a' divided channel-wise by 'b' */
-GdkRGBA GdkRGBA_divide(GdkRGBA a, GdkRGBA b);
+Color Color_divide(Color a, Color b);
 
 /* color==color : Returns true if 'a' equals 'b' (within the threshold) */
-int GdkRGBA_equals(GdkRGBA a, GdkRGBA b, double threshold);
+int Color_equals(Color a, Color b, double threshold);
 
 /* Returns the interpolation of 'a' and 'b' by 't' */
-GdkRGBA GdkRGBA_lerp(GdkRGBA a, GdkRGBA b, double t);
+Color Color_lerp(Color a, Color b, double t);
 
 /* Returns the perceived "brightness" of 'color' */
-double GdkRGBA_luminance(GdkRGBA color);
+double Color_luminance(Color color);
 
 /* Returns the channel-wise minimum of 'a' and 'b' */
-GdkRGBA GdkRGBA_min(GdkRGBA a, GdkRGBA b);
+Color Color_min(Color a, Color b);
 
 /* color*color : Returns 'a' multiplied channel-wise by 'b' */
-GdkRGBA GdkRGBA_multiply(GdkRGBA a, GdkRGBA b);
+Color Color_multiply(Color a, Color b);
 
 /* color*scalar : Returns 'color' multiplied channel-wise by 'scale' */
-GdkRGBA GdkRGBA_scale(GdkRGBA color, double scale);
+Color Color_scale(Color color, double scale);
 
 /* color-color : Returns 'b' subtracted channel-wise from 'a' */
-GdkRGBA GdkRGBA_subtract(GdkRGBA a, GdkRGBA b);
+Color Color_subtract(Color a, Color b);
 
 
 
@@ -88,12 +88,9 @@ int string_ends_with(const char *string, const char *end);
 
 
 //
-// GL functions
+// FILE functions
 //
 
-/* Loads and compiles the shader at "filename" and returns a GL handle to the shader. */
-int compile_shader(char* shaderSource, int shaderType);
-
 /* Loads the file at "filename" and returns a buffer containing the file contents.
 Also returns the length of the buffer in the "length" parameter. */
 char* load_file(char* filename, int* length);
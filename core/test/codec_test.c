@@ -0,0 +1,218 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+// Checks that every format image_io_save() writes loads back as what was
+// saved, to within the precision of the format, that 16-bit pngs really do
+// keep 16 bits all the way through, whole or a row at a time, and that pngs
+// large enough to be compressed on several threads are still ones libpng
+// reads back exactly.
+
+#include "test.h"
+
+#include "image_io.h"
+#include "tpaint_io.h"
+
+#include <math.h>  // fabs, fabsf
+#include <png.h>  // png_create_read_struct, png_read_image
+
+/* Returns the largest difference between a sample of 'loaded' and the same
+sample of 'source' (clamped, as every saver does), and checks the two copies
+of the pixels in 'loaded' agree. Alpha is left out unless 'withAlpha'. */
+double max_error(PixelBuffer *source, PixelBuffer *loaded, int withAlpha) {
+    TEST_CHECK(loaded->width == source->width && loaded->height == source->height);
+
+    double worst = 0.0;
+    for (int i = 0; i < 4 * source->width * source->height; i++) {
+        float value = source->rgbadata[i] < 0.0f ? 0.0f : (source->rgbadata[i] > 1.0f ? 1.0f : source->rgbadata[i]);
+        double error = fabsf(loaded->rgbadata[i] - value);
+        if ((withAlpha || i % 4 != 3) && error > worst) {
+            worst = error;
+        }
+
+        double mirrored = ((double *)loaded->data)[i];
+        TEST_CHECK(fabs(mirrored - loaded->rgbadata[i]) < 1e-6);
+    }
+    return worst;
+}
+
+/* Saves 'source' as 'name' and loads it back. */
+PixelBuffer round_trip(const char *dir, const char *name, PixelBuffer *source, int bitDepth) {
+    const char *path = test_path(dir, name);
+    TEST_CHECK(image_io_save(source, path, IMAGE_COMPRESSION_FAST, bitDepth, NULL));
+    PixelBuffer loaded;
+    TEST_CHECK(image_io_load(path, &loaded));
+    return loaded;
+}
+
+/* Saves 'source' as 'name' and checks it loads back to within 'tolerance'. */
+void check_round_trip(const char *dir, const char *name, PixelBuffer *source, int bitDepth, int withAlpha, double tolerance) {
+    PixelBuffer loaded = round_trip(dir, name, source, bitDepth);
+    double error = max_error(source, &loaded, withAlpha);
+    if (error > tolerance) {
+        printf("%s: off by up to %g, more than %g\n", name, error, tolerance);
+        exit(1);
+    }
+    pixelbuffer_destroy(&loaded);
+}
+
+/* Saves 'source' as the png 'name', with 'level' and 'bitDepth', and reads
+it back with libpng itself (which checks every chunk's crc and the zlib
+stream's adler32), checking it holds exactly the samples the saver rounds
+'source' to. */
+void check_png_exactly(const char *dir, const char *name, PixelBuffer *source, int level, int bitDepth) {
+    const char *path = test_path(dir, name);
+    TEST_CHECK(image_io_save(source, path, level, bitDepth, NULL));
+
+    FILE *file = fopen(path, "rb");
+    TEST_CHECK(file != NULL);
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png_create_info_struct(png);
+    TEST_CHECK(png != NULL && info != NULL && setjmp(png_jmpbuf(png)) == 0);
+
+    png_init_io(png, file);
+    png_read_info(png, info);
+    TEST_CHECK((int)png_get_image_width(png, info) == source->width);
+    TEST_CHECK((int)png_get_image_height(png, info) == source->height);
+    TEST_CHECK(png_get_bit_depth(png, info) == bitDepth);
+    TEST_CHECK(png_get_color_type(png, info) == PNG_COLOR_TYPE_RGBA);
+
+    int numSamples = 4 * source->width;
+    size_t rowBytes = (size_t)numSamples * (bitDepth / 8);
+    unsigned char *pixels = malloc(rowBytes * source->height);
+    png_bytep *rows = malloc(sizeof(png_bytep) * source->height);
+    for (int y = 0; y < source->height; y++) {
+        rows[y] = pixels + rowBytes * y;
+    }
+    png_read_image(png, rows);
+    png_read_end(png, NULL);
+    png_destroy_read_struct(&png, &info, NULL);
+    fclose(file);
+
+    float scale = bitDepth == 16 ? 65535.0f : 255.0f;
+    for (int i = 0; i < numSamples * source->height; i++) {
+        float value = source->rgbadata[i] < 0.0f ? 0.0f : (source->rgbadata[i] > 1.0f ? 1.0f : source->rgbadata[i]);
+        unsigned int expected = (unsigned int)(value * scale + 0.5f);
+        unsigned int stored = bitDepth == 16 ? (unsigned int)pixels[2*i] << 8 | pixels[2*i + 1] : pixels[i];
+        if (stored != expected) {
+            printf("%s: sample %d is %u, not %u\n", name, i, stored, expected);
+            exit(1);
+        }
+    }
+    free(pixels);
+    free(rows);
+}
+
+/* Returns how many of the tiles the .tpaint at 'filepath' points at are raw,
+and checks each of those starts on a float. */
+int count_raw_tiles(const char *filepath) {
+    FILE *file = fopen(filepath, "rb");
+    TEST_CHECK(file != NULL);
+    TPaintHeader header;
+    TEST_CHECK(fread(&header, sizeof(header), 1, file) == 1);
+    int numTiles = ((header.width + TPAINT_TILE_SIZE - 1) / TPAINT_TILE_SIZE)
+        * ((header.height + TPAINT_TILE_SIZE - 1) / TPAINT_TILE_SIZE);
+    TPaintTile *index = malloc(sizeof(TPaintTile) * numTiles);
+    TEST_CHECK(fseek(file, header.indexOffset, SEEK_SET) == 0);
+    TEST_CHECK(fread(index, sizeof(TPaintTile), numTiles, file) == (size_t)numTiles);
+    fclose(file);
+
+    int numRaw = 0;
+    for (int i = 0; i < numTiles; i++) {
+        if (index[i].compression == TPAINT_TILE_RAW) {
+            TEST_CHECK(index[i].offset % sizeof(float) == 0);
+            numRaw++;
+        }
+    }
+    free(index);
+    return numRaw;
+}
+
+/* Takes an image of any size. */
+int format_sink_begin(void *data, int width, int height) {
+    (void)data;
+    return width > 0 && height > 0;
+}
+
+/* Remembers the format rows are handed on in. */
+int format_sink_row(void *data, int y, const void *rgba, ImageRowFormat format) {
+    (void)y;
+    (void)rgba;
+    *(ImageRowFormat *)data = format;
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    const char *dir = argc > 1 ? argv[1] : ".";
+    PixelBuffer image = test_make_image(301, 157);
+
+    // half a step of each format, and a little for float rounding
+    double step8 = 0.5 / 255.0 + 1e-6;
+    double step16 = 0.5 / 65535.0 + 1e-6;
+    check_round_trip(dir, "eight.png", &image, IMAGE_DEPTH_8, 1, step8);
+    check_round_trip(dir, "sixteen.png", &image, IMAGE_DEPTH_16, 1, step16);
+    check_round_trip(dir, "plain.qoi", &image, IMAGE_DEPTH_8, 1, step8);
+    check_round_trip(dir, "plain.pam", &image, IMAGE_DEPTH_8, 1, step8);
+    check_round_trip(dir, "plain.bmp", &image, IMAGE_DEPTH_8, 1, step8);
+    check_round_trip(dir, "opaque.ppm", &image, IMAGE_DEPTH_8, 0, step8);
+    check_round_trip(dir, "exact.tpaint", &image, IMAGE_DEPTH_8, 1, 0.0);
+
+    // a ppm has no alpha, so it loads opaque
+    PixelBuffer opaque;
+    TEST_CHECK(image_io_load(test_path(dir, "opaque.ppm"), &opaque));
+    TEST_CHECK(opaque.rgbadata[3] == 1.0f && opaque.rgbadata[4 * 301 * 157 - 1] == 1.0f);
+    pixelbuffer_destroy(&opaque);
+
+    // a 16-bit png is handed on in 16 bits, and is closer than any 8-bit format could be
+    ImageRowFormat format = IMAGE_ROW_UNORM8;
+    ImageRowSink sink = {format_sink_begin, format_sink_row, &format, NULL};
+    TEST_CHECK(image_io_load_rows(test_path(dir, "sixteen.png"), &sink));
+    TEST_CHECK(format == IMAGE_ROW_UNORM16);
+    PixelBuffer deep = round_trip(dir, "sixteen.png", &image, IMAGE_DEPTH_16);
+    TEST_CHECK(max_error(&image, &deep, 1) < 0.5 / 255.0 / 16.0);
+
+    // and saving what was loaded gives the same samples again
+    PixelBuffer again = round_trip(dir, "again.png", &deep, IMAGE_DEPTH_16);
+    TEST_CHECK(memcmp(deep.rgbadata, again.rgbadata, sizeof(float) * 4 * 301 * 157) == 0);
+    pixelbuffer_destroy(&deep);
+    pixelbuffer_destroy(&again);
+
+    // big enough to be filtered and deflated in strips on several threads,
+    // quickly and as small as it goes
+    PixelBuffer large = test_make_image(611, 389);
+    check_png_exactly(dir, "threaded_fast.png", &large, IMAGE_COMPRESSION_FAST, IMAGE_DEPTH_8);
+    check_png_exactly(dir, "threaded_smallest.png", &large, IMAGE_COMPRESSION_SMALLEST, IMAGE_DEPTH_8);
+    check_png_exactly(dir, "threaded_fast16.png", &large, IMAGE_COMPRESSION_FAST, IMAGE_DEPTH_16);
+    check_png_exactly(dir, "threaded_smallest16.png", &large, IMAGE_COMPRESSION_SMALLEST, IMAGE_DEPTH_16);
+
+    // a raw tile appended after deflated ones of any length still loads exactly
+    char mixed[4096];
+    snprintf(mixed, sizeof(mixed), "%s", test_path(dir, "mixed.tpaint"));
+    remove(mixed);
+    TEST_CHECK(image_io_save(&large, mixed, IMAGE_COMPRESSION_FAST, IMAGE_DEPTH_8, NULL));
+    TEST_CHECK(count_raw_tiles(mixed) == 0);
+    Color blue = {0.0, 0.0, 1.0, 1.0};
+    pixelbuffer_set_pixel(&large, 300, 300, blue);
+    TEST_CHECK(image_io_save(&large, mixed, 0, IMAGE_DEPTH_8, NULL));
+    TEST_CHECK(count_raw_tiles(mixed) == 1);
+    PixelBuffer appended;
+    TEST_CHECK(image_io_load(mixed, &appended));
+    TEST_CHECK(max_error(&large, &appended, 1) == 0.0);
+    pixelbuffer_destroy(&appended);
+    pixelbuffer_destroy(&large);
+
+    // saving over a .tpaint only appends the tiles that changed, and still loads exactly
+    for (int y = 20; y < 40; y++) {
+        for (int x = 270; x < 301; x++) {
+            Color red = {1.0, 0.0, 0.0, 1.0};
+            pixelbuffer_set_pixel(&image, x, y, red);
+        }
+    }
+    check_round_trip(dir, "exact.tpaint", &image, IMAGE_DEPTH_8, 1, 0.0);
+
+    pixelbuffer_destroy(&image);
+    printf("codec_test: ok\n");
+    return 0;
+}
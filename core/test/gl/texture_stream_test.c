@@ -0,0 +1,141 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+// Checks that rects uploaded through a texturestream end up in the texture
+// exactly as they were written, through the pixel buffer objects, through the
+// synchronous path (TINYPAINT_SYNC_UPLOAD=1), and when a rect does not fit in
+// what the frame was begun with. Needs no display: it runs in a surfaceless
+// EGL context, which Mesa's llvmpipe provides without a gpu.
+
+#include "../test.h"
+
+#include "texture_stream.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#define TEXTURE_WIDTH 517
+#define TEXTURE_HEIGHT 389
+#define NUM_FRAMES 300
+
+/* Makes a core 3.2 context current without any surface. Returns false if
+there is no EGL display to make one on. */
+int make_context() {
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay == NULL) {
+        return 0;
+    }
+    EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL) || !eglBindAPI(EGL_OPENGL_API)) {
+        return 0;
+    }
+
+    EGLint attributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 2,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext context = eglCreateContext(display, NULL, EGL_NO_CONTEXT, attributes);
+    return context != EGL_NO_CONTEXT && eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context);
+}
+
+/* Uploads NUM_FRAMES random rects of random bytes to a new texture, one per
+frame, and checks the texture holds the last bytes written to every pixel.
+Every 'squeeze'th frame is begun with one byte too few for its rect. Returns
+the stream's counts of uploads through each path. */
+void check_uploads(int squeeze, int *numAsync, int *numSync) {
+    int w = TEXTURE_WIDTH;
+    int h = TEXTURE_HEIGHT;
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    TextureStream stream = texture_stream_new();
+    unsigned char *expected = calloc((size_t)4 * w * h, 1);
+    unsigned char *rect = malloc((size_t)4 * w * h);
+    unsigned int state = 1;
+
+    for (int i = 0; i < NUM_FRAMES; i++) {
+        int x0 = 0;
+        int y0 = 0;
+        int x1 = w;
+        int y1 = h;
+        if (i > 0) {
+            x0 = rand_r(&state) % w;
+            y0 = rand_r(&state) % h;
+            x1 = x0 + 1 + rand_r(&state) % (w - x0);
+            y1 = y0 + 1 + rand_r(&state) % (h - y0);
+        }
+        int rw = x1 - x0;
+        int rh = y1 - y0;
+        for (int j = 0; j < 4 * rw * rh; j++) {
+            rect[j] = rand_r(&state) & 0xff;
+        }
+        for (int y = 0; y < rh; y++) {
+            memcpy(expected + 4 * ((size_t)(y0 + y) * w + x0), rect + (size_t)4 * rw * y, (size_t)4 * rw);
+        }
+
+        size_t numBytes = (size_t)4 * rw * rh;
+        int tooSmall = squeeze > 0 && i % squeeze == squeeze - 1;
+        texture_stream_begin(&stream, tooSmall ? numBytes - 1 : numBytes);
+        unsigned char *dst = texture_stream_add(&stream, texture, x0, y0, rw, rh);
+        TEST_CHECK((dst == NULL) == tooSmall);
+        if (dst != NULL) {
+            memcpy(dst, rect, numBytes);
+        }
+        else {
+            texture_stream_upload(&stream, texture, x0, y0, rw, rh, rect);
+        }
+        TEST_CHECK(texture_stream_end(&stream));
+    }
+
+    unsigned char *uploaded = malloc((size_t)4 * w * h);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, uploaded);
+    TEST_CHECK(glGetError() == GL_NO_ERROR);
+    TEST_CHECK(memcmp(expected, uploaded, (size_t)4 * w * h) == 0);
+
+    *numAsync = stream.numAsyncUploads;
+    *numSync = stream.numSyncUploads;
+    texture_stream_destroy(&stream);
+    glDeleteTextures(1, &texture);
+    free(expected);
+    free(rect);
+    free(uploaded);
+}
+
+int main(int argc, char *argv[]) {
+    (void)argc;
+    (void)argv;
+    if (!make_context()) {
+        printf("texture_stream_test: skipped, no surfaceless EGL context\n");
+        return 0;
+    }
+
+    int numAsync;
+    int numSync;
+
+    // through the pixel buffer objects (unless they are all busy)
+    setenv("TINYPAINT_SYNC_UPLOAD", "0", 1);
+    check_uploads(0, &numAsync, &numSync);
+    TEST_CHECK(numAsync > 0 && numAsync + numSync == NUM_FRAMES);
+
+    // and with rects that do not fit
+    check_uploads(7, &numAsync, &numSync);
+    TEST_CHECK(numSync >= NUM_FRAMES / 7 && numAsync + numSync == NUM_FRAMES);
+
+    // always synchronously
+    setenv("TINYPAINT_SYNC_UPLOAD", "1", 1);
+    check_uploads(7, &numAsync, &numSync);
+    TEST_CHECK(numAsync == 0 && numSync == NUM_FRAMES);
+
+    printf("texture_stream_test: ok (%s)\n", (const char *)glGetString(GL_RENDERER));
+    return 0;
+}
@@ -0,0 +1,43 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+// Checks that recipe_parse() takes every value in range, and refuses the
+// ones that are not, including the ones strtod() reads but no comparison
+// with a range can be true of.
+
+#include "test.h"
+
+#include "recipe.h"
+
+/* Returns whether recipe_parse() takes 'text', freeing the recipe if it does. */
+int parses(const char *text) {
+    Recipe recipe;
+    if (!recipe_parse(text, &recipe)) {
+        return 0;
+    }
+    recipe_destroy(&recipe);
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    (void)argc;
+    (void)argv;
+
+    TEST_CHECK(parses("motion:angle=0,threshold:cutoff=1,saturation:scale=10"));
+    TEST_CHECK(parses("gaussian:radius=8,posterize:bins=2"));
+
+    TEST_CHECK(!parses("threshold:cutoff=1.5"));
+    TEST_CHECK(!parses("gaussian:radius=2.5"));
+    TEST_CHECK(!parses("motion:angle=nan"));
+    TEST_CHECK(!parses("threshold:cutoff=-nan"));
+    TEST_CHECK(!parses("saturation:scale=NAN"));
+    TEST_CHECK(!parses("gaussian:radius=nan"));
+    TEST_CHECK(!parses("saturation:scale=inf"));
+    TEST_CHECK(!parses("brightness-contrast:contrast=-infinity"));
+
+    printf("recipe_test: ok\n");
+    return 0;
+}
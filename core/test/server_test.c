@@ -0,0 +1,90 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+// Checks that the daemon answers requests it can't make sense of with an
+// error, and keeps serving the connection that sent them, rather than going
+// down with every client it has.
+
+#include "test.h"
+
+#include "server.h"
+
+#include <signal.h>  // kill, SIGTERM
+#include <sys/socket.h>  // socket, connect, send, recv
+#include <sys/un.h>  // sockaddr_un
+#include <sys/wait.h>  // waitpid
+#include <unistd.h>  // fork, usleep, close
+
+/* Connects to the daemon listening on 'socketPath', waiting up to a few
+seconds for it to start. */
+int connect_to_daemon(const char *socketPath) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    TEST_CHECK(strlen(socketPath) < sizeof(address.sun_path));
+    strcpy(address.sun_path, socketPath);
+
+    for (int i = 0; i < 500; i++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        TEST_CHECK(fd >= 0);
+        if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0) {
+            return fd;
+        }
+        close(fd);
+        usleep(10000);
+    }
+    printf("server_test: the daemon never started listening\n");
+    exit(1);
+}
+
+/* Sends the 'length' bytes of 'request' and returns the first line of the
+answer, as a string that stays valid until the next call. */
+const char* ask(int fd, const char *request, size_t length) {
+    static char answer[1024];
+    TEST_CHECK(send(fd, request, length, MSG_NOSIGNAL) == (ssize_t)length);
+    size_t received = 0;
+    while (received < sizeof(answer) - 1 && memchr(answer, '\n', received) == NULL) {
+        ssize_t more = recv(fd, answer + received, sizeof(answer) - 1 - received, 0);
+        TEST_CHECK(more > 0);
+        received += more;
+    }
+    answer[received] = '\0';
+    *strchr(answer, '\n') = '\0';
+    return answer;
+}
+
+int main(int argc, char *argv[]) {
+    const char *dir = argc > 1 ? argv[1] : ".";
+    char socketPath[4096];
+    snprintf(socketPath, sizeof(socketPath), "%s", test_path(dir, "server_test.sock"));
+
+    pid_t daemon = fork();
+    TEST_CHECK(daemon >= 0);
+    if (daemon == 0) {
+        char *daemonArgv[] = {SERVER_FLAG, "--socket", socketPath, "--jobs", "1", "--quiet", NULL};
+        exit(server_main(6, daemonArgv));
+    }
+    int fd = connect_to_daemon(socketPath);
+
+    // a NUL inside a line, so the line has no newline of its own
+    static const char nul[] = "recipe x\0y\n\n";
+    TEST_CHECK(strcmp(ask(fd, nul, sizeof(nul) - 1), "error malformed request") == 0);
+    static const char unknown[] = "colour red\n\n";
+    TEST_CHECK(strcmp(ask(fd, unknown, sizeof(unknown) - 1), "error unknown key") == 0);
+
+    // and the same connection is still served
+    static const char stats[] = "stats\n\n";
+    TEST_CHECK(strcmp(ask(fd, stats, sizeof(stats) - 1), "requests 0") == 0);
+    close(fd);
+
+    int status;
+    TEST_CHECK(kill(daemon, SIGTERM) == 0);
+    TEST_CHECK(waitpid(daemon, &status, 0) == daemon);
+    TEST_CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    printf("server_test: ok\n");
+    return 0;
+}
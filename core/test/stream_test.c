@@ -0,0 +1,136 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+// Checks that filter_stream_file() gives exactly what loading the image,
+// applying the filters to the pixelbuffer and saving it does, for every kind
+// of source, including the ones with more than 8 bits per sample.
+
+#include "test.h"
+
+#include "filter_stream.h"
+#include "image_io.h"
+#include "recipe.h"
+
+#include <png.h>  // png_create_write_struct, png_write_image
+#include <stdint.h>  // uint16_t
+
+/* Writes 'source' to 'filepath' as an Adam7 interlaced png with 'bitDepth'
+bits per sample, which png_save() never writes. */
+void write_interlaced_png(PixelBuffer *source, const char *filepath, int bitDepth) {
+    FILE *file = fopen(filepath, "wb");
+    TEST_CHECK(file != NULL);
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png_create_info_struct(png);
+    TEST_CHECK(png != NULL && info != NULL && setjmp(png_jmpbuf(png)) == 0);
+
+    png_init_io(png, file);
+    png_set_IHDR(png, info, source->width, source->height, bitDepth, PNG_COLOR_TYPE_RGBA,
+        PNG_INTERLACE_ADAM7, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+
+    int rowBytes = 4 * source->width * (bitDepth / 8);
+    unsigned char *pixels = malloc((size_t)rowBytes * source->height);
+    png_bytep *rows = malloc(sizeof(png_bytep) * source->height);
+    for (int i = 0; i < 4 * source->width * source->height; i++) {
+        float value = source->rgbadata[i] < 0.0f ? 0.0f : (source->rgbadata[i] > 1.0f ? 1.0f : source->rgbadata[i]);
+        if (bitDepth == 16) {
+            int sample = value * 65535.0f + 0.5f;
+            pixels[2*i + 0] = sample >> 8;
+            pixels[2*i + 1] = sample & 0xff;
+        }
+        else {
+            pixels[i] = value * 255.0f + 0.5f;
+        }
+    }
+    for (int y = 0; y < source->height; y++) {
+        rows[y] = pixels + (size_t)rowBytes * y;
+    }
+    png_write_image(png, rows);
+    png_write_end(png, NULL);
+
+    png_destroy_write_struct(&png, &info);
+    fclose(file);
+    free(pixels);
+    free(rows);
+}
+
+/* Writes 'source' to 'filepath' as a PAM with 16-bit samples, which
+pnm_save() never writes. */
+void write_pam16(PixelBuffer *source, const char *filepath) {
+    FILE *file = fopen(filepath, "wb");
+    TEST_CHECK(file != NULL);
+    fprintf(file, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 65535\nTUPLTYPE RGB_ALPHA\nENDHDR\n",
+        source->width, source->height);
+    for (int i = 0; i < 4 * source->width * source->height; i++) {
+        float value = source->rgbadata[i] < 0.0f ? 0.0f : (source->rgbadata[i] > 1.0f ? 1.0f : source->rgbadata[i]);
+        int sample = value * 65535.0f + 0.5f;
+        fputc(sample >> 8, file);
+        fputc(sample & 0xff, file);
+    }
+    fclose(file);
+}
+
+/* Filters 'source' both ways into 'output' and checks they decode the same. */
+void check_stream_matches_buffer(const char *dir, const char *source, const char *output, int bitDepth) {
+    Recipe recipe;
+    TEST_CHECK(recipe_parse("gaussian:radius=3,sharpen:radius=2,saturation:scale=1.3", &recipe));
+
+    // strips much shorter than the image, so rows cross from one to the next
+    char streamed[4096];
+    snprintf(streamed, sizeof(streamed), "%s/streamed%s", dir, output);
+    TEST_CHECK(filter_stream_file(source, streamed, recipe.steps, recipe.numSteps, 7, IMAGE_COMPRESSION_FAST, bitDepth));
+
+    char whole[4096];
+    snprintf(whole, sizeof(whole), "%s/whole%s", dir, output);
+    PixelBuffer buffer;
+    TEST_CHECK(image_io_load(source, &buffer));
+    recipe_apply_to_pixelbuffer(&recipe, &buffer);
+    TEST_CHECK(image_io_save(&buffer, whole, IMAGE_COMPRESSION_FAST, bitDepth, NULL));
+
+    PixelBuffer a;
+    PixelBuffer b;
+    TEST_CHECK(image_io_load(streamed, &a));
+    TEST_CHECK(image_io_load(whole, &b));
+    if (!test_same_pixels(&a, &b)) {
+        printf("%s streamed to %s differs from filtering it whole\n", source, output);
+        exit(1);
+    }
+
+    pixelbuffer_destroy(&a);
+    pixelbuffer_destroy(&b);
+    pixelbuffer_destroy(&buffer);
+    recipe_destroy(&recipe);
+}
+
+int main(int argc, char *argv[]) {
+    const char *dir = argc > 1 ? argv[1] : ".";
+
+    // odd sizes, so the last interlace pass and the last tile row are partial
+    PixelBuffer image = test_make_image(301, 157);
+    char sources[6][4096];
+    snprintf(sources[0], 4096, "%s", test_path(dir, "interlaced8.png"));
+    write_interlaced_png(&image, sources[0], 8);
+    snprintf(sources[1], 4096, "%s", test_path(dir, "interlaced16.png"));
+    write_interlaced_png(&image, sources[1], 16);
+    snprintf(sources[2], 4096, "%s", test_path(dir, "deep.png"));
+    TEST_CHECK(image_io_save(&image, sources[2], IMAGE_COMPRESSION_FAST, IMAGE_DEPTH_16, NULL));
+    snprintf(sources[3], 4096, "%s", test_path(dir, "floats.tpaint"));
+    TEST_CHECK(image_io_save(&image, sources[3], IMAGE_COMPRESSION_FAST, IMAGE_DEPTH_8, NULL));
+    snprintf(sources[4], 4096, "%s", test_path(dir, "deep.pam"));
+    write_pam16(&image, sources[4]);
+    snprintf(sources[5], 4096, "%s", test_path(dir, "plain.qoi"));
+    TEST_CHECK(image_io_save(&image, sources[5], IMAGE_COMPRESSION_FAST, IMAGE_DEPTH_8, NULL));
+
+    for (int i = 0; i < 6; i++) {
+        check_stream_matches_buffer(dir, sources[i], ".png", IMAGE_DEPTH_16);
+        check_stream_matches_buffer(dir, sources[i], ".png", IMAGE_DEPTH_8);
+        check_stream_matches_buffer(dir, sources[i], ".pam", IMAGE_DEPTH_8);
+    }
+
+    pixelbuffer_destroy(&image);
+    printf("stream_test: ok\n");
+    return 0;
+}
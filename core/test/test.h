@@ -0,0 +1,62 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef TEST_H_
+#define TEST_H_
+
+#include "pixel_buffer.h"  // PixelBuffer
+
+#include <stdio.h>  // printf, snprintf
+#include <stdlib.h>  // exit
+#include <string.h>  // memcmp
+
+/* Stops the test (with a non-zero exit status) if 'condition' is false. */
+#define TEST_CHECK(condition) test_check((condition), #condition, __FILE__, __LINE__)
+
+static inline void test_check(int ok, const char *condition, const char *file, int line) {
+    if (!ok) {
+        printf("%s:%d: failed: %s\n", file, line, condition);
+        exit(1);
+    }
+}
+
+/* Returns the path of 'name' in the directory the test was given to work in,
+as a string that stays valid until the next call. */
+static inline const char* test_path(const char *dir, const char *name) {
+    static char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    return path;
+}
+
+/* Returns a width x height image of smooth gradients with noise on top, and
+alpha that varies too, with values that are not on any 8 or 16-bit step. */
+static inline PixelBuffer test_make_image(int width, int height) {
+    PixelBuffer buffer = pixelbuffer_new(width, height);
+    unsigned int state = 12345;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            state = state * 1103515245 + 12345;
+            double noise = (state >> 16 & 0xffff) / 65535.0 * 0.2;
+            Color color = {
+                0.8 * x / width + noise,
+                0.8 * y / height + 0.1,
+                0.8 * (x + y) / (width + height) + noise / 2.0,
+                0.5 + 0.5 * (state >> 8 & 0xff) / 255.0
+            };
+            pixelbuffer_set_pixel(&buffer, x, y, color);
+        }
+    }
+    return buffer;
+}
+
+/* Returns true if 'a' and 'b' are the same size and hold exactly the same pixels. */
+static inline int test_same_pixels(PixelBuffer *a, PixelBuffer *b) {
+    return a->width == b->width && a->height == b->height
+        && memcmp(a->rgbadata, b->rgbadata, sizeof(float) * 4 * a->width * a->height) == 0
+        && memcmp(a->data, b->data, sizeof(Color) * a->width * a->height) == 0;
+}
+
+#endif  // TEST_H_